@@ -0,0 +1,305 @@
+// Parser throughput: the arena-backed single-pass lexer against the previous
+// strtok_r parser, which strdup'd the line and then every token, and against
+// the parse cache the interactive loop goes through, where every line after
+// the first round is a hit.
+//
+// Usage: bench/bench_parser.bench [iterations]
+#include <nutshell/core.h>
+#include <nutshell/utils.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LEGACY_MAX_ARGS 64
+#define LEGACY_DEBUG(fmt, ...) \
+    do { if (getenv("NUT_DEBUG_PARSER")) fprintf(stderr, "PARSER: " fmt "\n", ##__VA_ARGS__); } while(0)
+
+// ---- Previous implementation, kept verbatim for comparison ----
+
+static void legacy_free_command(ParsedCommand *cmd);
+
+// The old parser kept one strdup'd file name per direction; the same
+// allocations as a redirection list
+static void legacy_set_redirection(ParsedCommand *stage, RedirType type, int fd, const char *file) {
+    Redirection *redir = calloc(1, sizeof(Redirection));
+    if (!redir) return;
+    redir->type = type;
+    redir->fd = fd;
+    redir->target = strdup(file);
+    redir->next = stage->redirs;
+    stage->redirs = redir;
+}
+
+char* trim_whitespace(char* str);
+
+// Allocate an empty command with a NULL-initialized argument array
+static ParsedCommand *legacy_new_command() {
+    ParsedCommand *cmd = calloc(1, sizeof(ParsedCommand));
+    if (!cmd) return NULL;
+    
+    // Use calloc to ensure all entries are initialized to NULL
+    cmd->args = calloc(LEGACY_MAX_ARGS, sizeof(char *));
+    if (!cmd->args) {
+        LEGACY_DEBUG("Failed to allocate args array");
+        free(cmd);
+        return NULL;
+    }
+    return cmd;
+}
+
+static ParsedCommand *legacy_parse_command(const char *input) {
+    if (!input) return NULL;
+    
+    LEGACY_DEBUG("Parsing command: '%s'", input);
+    
+    // Make a copy of the input to avoid modifying the original
+    char *input_copy = strdup(input);
+    if (!input_copy) return NULL;
+    
+    char *original_input_copy = input_copy;
+    input_copy = trim_whitespace(input_copy);
+    if (strlen(input_copy) == 0) {
+        LEGACY_DEBUG("Empty command after trimming");
+        free(original_input_copy);
+        original_input_copy = NULL;
+        return NULL;
+    }
+    
+    ParsedCommand *cmd = legacy_new_command();
+    if (!cmd) {
+        LEGACY_DEBUG("Failed to allocate ParsedCommand");
+        free(original_input_copy);
+        original_input_copy = NULL;
+        return NULL;
+    }
+    
+    // Pipeline of the command list being filled, and its current stage
+    ParsedCommand *pipeline = cmd;
+    ParsedCommand *stage = cmd;
+    int arg_count = 0;
+    // Set after `;` or `&` until the next command starts
+    bool list_ended = false;
+    char *token, *saveptr = NULL;
+    // Tokenize and process input
+    token = strtok_r(input_copy, " \t", &saveptr);
+    while (token != NULL) {
+        // `cmd;` is common enough to accept without a space before the `;`
+        size_t token_len = strlen(token);
+        bool trailing_semicolon = token_len > 1 && token[token_len - 1] == ';';
+        if (trailing_semicolon) token[token_len - 1] = '\0';
+        
+        // Check if token is a special character
+        if (strcmp(token, "<") == 0) {
+            token = strtok_r(NULL, " \t", &saveptr);
+            if (token) {
+                token_len = strlen(token);
+                trailing_semicolon = token_len > 1 && token[token_len - 1] == ';';
+                if (trailing_semicolon) token[token_len - 1] = '\0';
+                legacy_set_redirection(stage, REDIR_INPUT, 0, token);
+                LEGACY_DEBUG("Input file: %s", token);
+            } else {
+                LEGACY_DEBUG("Missing input file after <");
+            }
+        } else if (strcmp(token, ">") == 0) {
+            token = strtok_r(NULL, " \t", &saveptr);
+            if (token) {
+                token_len = strlen(token);
+                trailing_semicolon = token_len > 1 && token[token_len - 1] == ';';
+                if (trailing_semicolon) token[token_len - 1] = '\0';
+                legacy_set_redirection(stage, REDIR_OUTPUT, 1, token);
+                LEGACY_DEBUG("Output file: %s", token);
+            } else {
+                LEGACY_DEBUG("Missing output file after >");
+            }
+        } else if (strcmp(token, "|") == 0 || strcmp(token, "&&") == 0 ||
+                   strcmp(token, "||") == 0 || strcmp(token, ";") == 0 ||
+                   strcmp(token, "&") == 0) {
+            if (arg_count == 0) {
+                LEGACY_DEBUG("Syntax error: missing command before %s", token);
+                legacy_free_command(cmd);
+                free(original_input_copy);
+                return NULL;
+            }
+            stage->args[arg_count] = NULL;
+            
+            ParsedCommand *next = legacy_new_command();
+            if (!next) {
+                legacy_free_command(cmd);
+                free(original_input_copy);
+                return NULL;
+            }
+            if (strcmp(token, "|") == 0) {
+                stage->pipe_next = next;
+                LEGACY_DEBUG("Pipe to next stage");
+            } else {
+                // Background applies to the pipeline as a whole
+                if (strcmp(token, "&") == 0) {
+                    pipeline->background = true;
+                    LEGACY_DEBUG("Background process");
+                }
+                pipeline->connector = strcmp(token, "&&") == 0 ? CONNECT_AND :
+                                      strcmp(token, "||") == 0 ? CONNECT_OR : CONNECT_SEQ;
+                pipeline->next = next;
+                list_ended = pipeline->connector == CONNECT_SEQ;
+                pipeline = next;
+                LEGACY_DEBUG("List continues after %s", token);
+            }
+            stage = next;
+            arg_count = 0;
+        } else if (arg_count < LEGACY_MAX_ARGS - 1) {
+            // Regular argument
+            stage->args[arg_count] = strdup(token);
+            LEGACY_DEBUG("Arg[%d] = '%s'", arg_count, stage->args[arg_count]);
+            arg_count++;
+            list_ended = false;
+        }
+        
+        if (trailing_semicolon) {
+            if (arg_count == 0) {
+                LEGACY_DEBUG("Syntax error: missing command before ;");
+                legacy_free_command(cmd);
+                free(original_input_copy);
+                return NULL;
+            }
+            stage->args[arg_count] = NULL;
+            ParsedCommand *next = legacy_new_command();
+            if (!next) {
+                legacy_free_command(cmd);
+                free(original_input_copy);
+                return NULL;
+            }
+            pipeline->connector = CONNECT_SEQ;
+            pipeline->next = next;
+            pipeline = stage = next;
+            arg_count = 0;
+            list_ended = true;
+        }
+        
+        // Get next token
+        token = strtok_r(NULL, " \t", &saveptr);
+    }
+    // Ensure NULL termination
+    stage->args[arg_count] = NULL;
+    
+    if (arg_count == 0 && stage != cmd) {
+        if (!list_ended) {
+            // A trailing `|`, `&&` or `||` leaves an empty last command
+            LEGACY_DEBUG("Syntax error: missing command at end of line");
+            legacy_free_command(cmd);
+            free(original_input_copy);
+            return NULL;
+        }
+        // A trailing `;` or `&` just ends the list
+        ParsedCommand *prev = cmd;
+        while (prev->next != stage) prev = prev->next;
+        prev->next = NULL;
+        legacy_free_command(stage);
+    }
+    
+    LEGACY_DEBUG("Command parsed with %d arguments", arg_count);
+
+    if(original_input_copy){
+        free(original_input_copy);
+        original_input_copy = NULL;
+    }
+
+
+    return cmd;
+}
+
+static void legacy_free_command(ParsedCommand *cmd) {
+    if (!cmd) return;
+    
+    if (cmd->args) {
+        for (int i = 0; cmd->args[i]; i++) 
+            free(cmd->args[i]);
+        free(cmd->args);
+    }
+    
+    while (cmd->redirs) {
+        Redirection *next = cmd->redirs->next;
+        free((char *)cmd->redirs->target);
+        free(cmd->redirs);
+        cmd->redirs = next;
+    }
+    legacy_free_command(cmd->pipe_next);
+    legacy_free_command(cmd->next);
+    free(cmd);
+}
+
+// ---- Benchmark ----
+
+// Lines both parsers handle the same way (no quotes)
+static const char *lines[] = {
+    "ls -la",
+    "git status --short",
+    "cd /usr/local/src",
+    "grep -rn TODO src include | sort | uniq -c | sort -rn | head -20",
+    "make -j8 && make test || echo failed; echo done",
+    "find . -name *.c -newer Makefile -exec wc -l {} +",
+    "cat access.log | awk {print} | cut -d ' ' -f 1 > ips.txt",
+    "gcc -O2 -Wall -Wextra -Iinclude -c -o build/parser.o src/core/parser.c",
+};
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static double time_parser(ParsedCommand *(*parse)(const char *), void (*release)(ParsedCommand *),
+                          char **inputs, size_t count, int iterations) {
+    double start = now_us();
+    for (int i = 0; i < iterations; i++) {
+        for (size_t j = 0; j < count; j++) {
+            ParsedCommand *cmd = parse(inputs[j]);
+            if (!cmd) {
+                fprintf(stderr, "failed to parse: %s\n", inputs[j]);
+                exit(1);
+            }
+            release(cmd);
+        }
+    }
+    return now_us() - start;
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+    size_t count = sizeof(lines) / sizeof(lines[0]);
+    if (iterations < 1) iterations = 1;
+
+    // Both parsers get writable copies, as the shell passes readline's buffer
+    char **inputs = malloc(count * sizeof(char *));
+    size_t bytes = 0;
+    for (size_t i = 0; i < count; i++) {
+        inputs[i] = strdup(lines[i]);
+        bytes += strlen(lines[i]);
+    }
+
+    printf("Parsing %zu command lines %d times\n", count, iterations);
+    // Cached lines are resolved against the registry
+    init_registry_core();
+
+    // Warm up caches and the allocator
+    time_parser(legacy_parse_command, legacy_free_command, inputs, count, iterations / 10 + 1);
+    time_parser(parse_command, free_parsed_command, inputs, count, iterations / 10 + 1);
+    time_parser(parse_cache_acquire, parse_cache_release, inputs, count, iterations / 10 + 1);
+
+    double legacy_us = time_parser(legacy_parse_command, legacy_free_command, inputs, count, iterations);
+    double arena_us = time_parser(parse_command, free_parsed_command, inputs, count, iterations);
+    double cached_us = time_parser(parse_cache_acquire, parse_cache_release, inputs, count, iterations);
+
+    double parses = (double)count * iterations;
+    double megabytes = (double)bytes * iterations / 1e6;
+    printf("  %-10s %8.1f ns/line %8.1f MB/s\n", "strtok_r", legacy_us * 1e3 / parses, megabytes / (legacy_us / 1e6));
+    printf("  %-10s %8.1f ns/line %8.1f MB/s\n", "arena", arena_us * 1e3 / parses, megabytes / (arena_us / 1e6));
+    printf("  %-10s %8.1f ns/line %8.1f MB/s\n", "cached", cached_us * 1e3 / parses, megabytes / (cached_us / 1e6));
+    printf("  speedup    %8.2fx (arena), %.2fx (cached)\n", legacy_us / arena_us, legacy_us / cached_us);
+
+    for (size_t i = 0; i < count; i++) free(inputs[i]);
+    free(inputs);
+    parse_cache_free();
+    free_registry();
+    return 0;
+}
@@ -0,0 +1,268 @@
+// Prompt rendering: formats compiled into op programs at load time and
+// rendered in one pass, against the previous renderer, which copied the
+// format and every segment's through one str_replace per color, command and
+// segment for each prompt. Segment outputs are filled in by hand so only the
+// rendering is timed. Run from the repository root, where ./themes is.
+//
+// Usage: bench/bench_prompt.bench [iterations]
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+#include <nutshell/theme.h>
+#include <nutshell/utils.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define THEME_DEBUG(fmt, ...) \
+    do { if (getenv("NUT_DEBUG_THEME")) fprintf(stderr, "THEME: " fmt "\n", ##__VA_ARGS__); } while(0)
+
+// ---- Previous implementation, kept verbatim for comparison ----
+
+// Build the prompt from the segment outputs as they are
+static char *legacy_render_prompt(Theme *theme) {
+    if (!theme) return NULL;
+    
+    THEME_DEBUG("Generating prompt from template: %s", theme->left_prompt->format);
+    
+    // First process the left prompt
+    char *left_prompt = strdup(theme->left_prompt->format);
+    if (!left_prompt) return NULL;
+    
+    // Replace basic placeholders like colors and icon
+    // Replace icon if present
+    if (theme->left_prompt->icon) {
+        char *temp = left_prompt;
+        left_prompt = str_replace(temp, "{icon}", theme->left_prompt->icon);
+        free(temp);
+    }
+    
+    // Replace prompt symbol
+    char *temp = left_prompt;
+    left_prompt = str_replace(temp, "{prompt_symbol}", theme->prompt_symbol);
+    free(temp);
+    
+    // Replace color codes
+    temp = left_prompt;
+    left_prompt = str_replace(temp, "{reset}", theme->colors->reset);
+    free(temp);
+    
+    temp = left_prompt;
+    left_prompt = str_replace(temp, "{primary}", theme->colors->primary);
+    free(temp);
+    
+    temp = left_prompt;
+    left_prompt = str_replace(temp, "{secondary}", theme->colors->secondary);
+    free(temp);
+    
+    temp = left_prompt;
+    left_prompt = str_replace(temp, "{error}", theme->colors->error);
+    free(temp);
+    
+    temp = left_prompt;
+    left_prompt = str_replace(temp, "{warning}", theme->colors->warning);
+    free(temp);
+    
+    temp = left_prompt;
+    left_prompt = str_replace(temp, "{info}", theme->colors->info);
+    free(temp);
+    
+    temp = left_prompt;
+    left_prompt = str_replace(temp, "{success}", theme->colors->success);
+    free(temp);
+    
+    // Extract all segment placeholders from the prompt format
+    THEME_DEBUG("Extracting segments from prompt format");
+    
+    // Process all segments in the theme definition
+    for (int i = 0; i < theme->segment_count; i++) {
+        ThemeSegment *segment = theme->segments[i];
+        if (!segment || !segment->enabled || !segment->key) continue;
+        
+        // Create the placeholder from the segment key that was stored during load
+        char placeholder[256];
+        snprintf(placeholder, sizeof(placeholder), "{%s}", segment->key);
+        THEME_DEBUG("Checking for placeholder: %s", placeholder);
+        
+        // Only process if the placeholder exists in the prompt
+        if (strstr(left_prompt, placeholder)) {
+            THEME_DEBUG("Processing segment: %s", segment->key);
+            
+            // Create formatted segment with all replaced values
+            char *formatted_segment = strdup(segment->format);
+            if (!formatted_segment) continue;
+            
+            // Replace color codes first
+            char *temp;
+            temp = formatted_segment;
+            formatted_segment = str_replace(temp, "{primary}", theme->colors->primary);
+            free(temp);
+            
+            temp = formatted_segment;
+            formatted_segment = str_replace(temp, "{secondary}", theme->colors->secondary);
+            free(temp);
+            
+            temp = formatted_segment;
+            formatted_segment = str_replace(temp, "{reset}", theme->colors->reset);
+            free(temp);
+            
+            temp = formatted_segment;
+            formatted_segment = str_replace(temp, "{info}", theme->colors->info);
+            free(temp);
+            
+            temp = formatted_segment;
+            formatted_segment = str_replace(temp, "{warning}", theme->colors->warning);
+            free(temp);
+            
+            temp = formatted_segment;
+            formatted_segment = str_replace(temp, "{error}", theme->colors->error);
+            free(temp);
+            
+            temp = formatted_segment;
+            formatted_segment = str_replace(temp, "{success}", theme->colors->success);
+            free(temp);
+            
+            // Replace command outputs in the segment format
+            bool has_output = false;
+            for (int j = 0; j < segment->command_count; j++) {
+                ThemeCommand *cmd = segment->commands[j];
+                if (!cmd || !cmd->name) continue;
+                
+                // Replace {command_name} with its output
+                char cmd_placeholder[256];
+                snprintf(cmd_placeholder, sizeof(cmd_placeholder), "{%s}", cmd->name);
+                
+                // A command with nothing to show leaves nothing behind
+                if (!cmd->output) {
+                    temp = formatted_segment;
+                    formatted_segment = str_replace(temp, cmd_placeholder, "");
+                    free(temp);
+                    continue;
+                }
+                
+                THEME_DEBUG("Command %s output: %s", cmd->name, cmd->output);
+                
+                temp = formatted_segment;
+                formatted_segment = str_replace(temp, cmd_placeholder, cmd->output);
+                free(temp);
+                
+                has_output = true;
+            }
+            
+            // Only replace in the prompt if there's actual content
+            if (has_output) {
+                THEME_DEBUG("Replacing placeholder %s with: %s", placeholder, formatted_segment);
+                
+                temp = left_prompt;
+                left_prompt = str_replace(temp, placeholder, formatted_segment);
+                free(temp);
+            } else {
+                // Otherwise remove the placeholder
+                temp = left_prompt;
+                left_prompt = str_replace(temp, placeholder, "");
+                free(temp);
+            }
+            
+            free(formatted_segment);
+        }
+    }
+
+    // Append the prompt symbol if it's not already in the format
+    if (!strstr(theme->left_prompt->format, "{prompt_symbol}")) {
+        char *prompt_color = NULL;
+        
+        // Get the color for the prompt symbol
+        if (strcmp(theme->prompt_symbol_color, "primary") == 0) {
+            prompt_color = theme->colors->primary;
+        } else if (strcmp(theme->prompt_symbol_color, "secondary") == 0) {
+            prompt_color = theme->colors->secondary;
+        } else if (strcmp(theme->prompt_symbol_color, "error") == 0) {
+            prompt_color = theme->colors->error;
+        } else if (strcmp(theme->prompt_symbol_color, "warning") == 0) {
+            prompt_color = theme->colors->warning;
+        } else if (strcmp(theme->prompt_symbol_color, "info") == 0) {
+            prompt_color = theme->colors->info;
+        } else if (strcmp(theme->prompt_symbol_color, "success") == 0) {
+            prompt_color = theme->colors->success;
+        } else {
+            prompt_color = theme->colors->reset;
+        }
+        
+        // Create colored prompt symbol
+        char colored_symbol[256];
+        snprintf(colored_symbol, sizeof(colored_symbol), "%s%s%s ", 
+                prompt_color, theme->prompt_symbol, theme->colors->reset);
+        
+        // Append to the prompt
+        char *final_prompt = malloc(strlen(left_prompt) + strlen(colored_symbol) + 1);
+        if (final_prompt) {
+            sprintf(final_prompt, "%s%s", left_prompt, colored_symbol);
+            free(left_prompt);
+            left_prompt = final_prompt;
+        }
+    }
+    
+    THEME_DEBUG("Final prompt: %s", left_prompt);
+    return left_prompt;
+}
+
+// ---- Benchmark ----
+
+static const char *themes[] = { "default", "minimal", "developer", "cyberpunk" };
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static double time_render(char *(*render)(Theme *), Theme *theme, int iterations) {
+    double start = now_us();
+    for (int i = 0; i < iterations; i++) {
+        free(render(theme));
+    }
+    return now_us() - start;
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+    if (iterations < 1) iterations = 1;
+
+    printf("Rendering each theme's prompt %d times\n", iterations);
+    for (size_t t = 0; t < sizeof(themes) / sizeof(themes[0]); t++) {
+        Theme *theme = load_theme(themes[t]);
+        if (!theme) {
+            fprintf(stderr, "failed to load theme: %s\n", themes[t]);
+            return 1;
+        }
+
+        // Every command has printed something, as in a repository
+        for (int i = 0; i < theme->segment_count; i++) {
+            for (int j = 0; j < theme->segments[i]->command_count; j++) {
+                ThemeCommand *cmd = theme->segments[i]->commands[j];
+                if (cmd) cmd->output = strdup(cmd->name);
+            }
+        }
+
+        // Both must build the same prompt
+        char *legacy = legacy_render_prompt(theme);
+        char *compiled = render_theme_prompt(theme);
+        if (!legacy || !compiled || strcmp(legacy, compiled) != 0) {
+            fprintf(stderr, "%s: prompts differ:\n  %s\n  %s\n", themes[t], legacy, compiled);
+            return 1;
+        }
+        free(legacy);
+        free(compiled);
+
+        // Warm up caches and the allocator
+        time_render(legacy_render_prompt, theme, iterations / 10 + 1);
+        time_render(render_theme_prompt, theme, iterations / 10 + 1);
+
+        double legacy_us = time_render(legacy_render_prompt, theme, iterations);
+        double compiled_us = time_render(render_theme_prompt, theme, iterations);
+        printf("  %-10s %8.1f ns/prompt (str_replace) %8.1f ns/prompt (compiled) %6.2fx\n", themes[t],
+               legacy_us * 1e3 / iterations, compiled_us * 1e3 / iterations, legacy_us / compiled_us);
+        free_theme(theme);
+    }
+    return 0;
+}
@@ -0,0 +1,156 @@
+// Command registry cost with many packages installed: registering 10k
+// commands and looking them up, with the hash-indexed registry against the
+// previous one, which grew its array one entry per registration and scanned
+// it with strcmp on both names for every lookup.
+//
+// Usage: bench/bench_registry.bench [commands] [lookups]
+#define _GNU_SOURCE
+#include <nutshell/core.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LEGACY_DEBUG(fmt, ...) \
+    do { if (getenv("NUT_DEBUG_REGISTRY")) fprintf(stderr, "REGISTRY: " fmt "\n", ##__VA_ARGS__); } while(0)
+
+// ---- Previous implementation, kept verbatim for comparison ----
+
+static CommandRegistry *legacy_registry = NULL;
+
+static void legacy_register_command(const char *unix_cmd, const char *nut_cmd, bool is_builtin) {
+    legacy_registry->count++;
+    legacy_registry->commands = realloc(legacy_registry->commands, 
+                               legacy_registry->count * sizeof(CommandMapping));
+    
+    CommandMapping *cmd = &legacy_registry->commands[legacy_registry->count - 1];
+    cmd->unix_cmd = strdup(unix_cmd);
+    cmd->nut_cmd = strdup(nut_cmd);
+    cmd->is_builtin = is_builtin;
+    cmd->args = NULL;
+    
+    LEGACY_DEBUG("Registered command: %s -> %s (builtin: %s)", 
+            nut_cmd, unix_cmd, is_builtin ? "yes" : "no");
+}
+
+static const CommandMapping *legacy_find_command(const char *input_cmd) {
+    LEGACY_DEBUG("Looking for command: %s", input_cmd);
+    
+    for (size_t i = 0; i < legacy_registry->count; i++) {
+        if (strcmp(legacy_registry->commands[i].nut_cmd, input_cmd) == 0 ||
+            strcmp(legacy_registry->commands[i].unix_cmd, input_cmd) == 0) {
+            
+            LEGACY_DEBUG("Found command: %s -> %s (builtin: %s)", 
+                    input_cmd, legacy_registry->commands[i].unix_cmd, 
+                    legacy_registry->commands[i].is_builtin ? "yes" : "no");
+            return &legacy_registry->commands[i];
+        }
+    }
+    
+    LEGACY_DEBUG("Command not found: %s", input_cmd);
+    return NULL;
+}
+
+static void legacy_free_registry() {
+    for (size_t i = 0; i < legacy_registry->count; i++) {
+        free(legacy_registry->commands[i].unix_cmd);
+        free(legacy_registry->commands[i].nut_cmd);
+    }
+    free(legacy_registry->commands);
+    free(legacy_registry);
+    legacy_registry = NULL;
+}
+
+// ---- Benchmark ----
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+typedef struct {
+    double register_us;
+    double hit_us;
+    double miss_us;
+} Timings;
+
+static Timings time_registry(void (*reg)(const char *, const char *, bool),
+                             const CommandMapping *(*find)(const char *),
+                             char **unix_names, char **nut_names, size_t count, size_t lookups) {
+    Timings t;
+    double start = now_us();
+    for (size_t i = 0; i < count; i++) {
+        reg(unix_names[i], nut_names[i], false);
+    }
+    t.register_us = now_us() - start;
+
+    // Spread over the whole registry, by both names, as packages are used
+    start = now_us();
+    for (size_t i = 0; i < lookups; i++) {
+        size_t j = (i * 7919) % count;
+        const char *name = (i & 1) ? unix_names[j] : nut_names[j];
+        if (!find(name)) {
+            fprintf(stderr, "lookup failed: %s\n", name);
+            exit(1);
+        }
+    }
+    t.hit_us = now_us() - start;
+
+    // Misses are what every external command such as `git` or `make` costs
+    start = now_us();
+    for (size_t i = 0; i < lookups; i++) {
+        if (find("nutshell-bench-miss")) exit(1);
+    }
+    t.miss_us = now_us() - start;
+    return t;
+}
+
+static void hashed_register(const char *unix_cmd, const char *nut_cmd, bool is_builtin) {
+    register_command(unix_cmd, nut_cmd, is_builtin);
+}
+
+int main(int argc, char **argv) {
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000;
+    size_t lookups = argc > 2 ? strtoul(argv[2], NULL, 10) : 20000;
+    if (count < 1) count = 1;
+
+    char **unix_names = malloc(count * sizeof(char *));
+    char **nut_names = malloc(count * sizeof(char *));
+    for (size_t i = 0; i < count; i++) {
+        if (asprintf(&unix_names[i], "/home/user/.nutshell/packages/pkg%zu/pkg%zu.sh", i, i) < 0 ||
+            asprintf(&nut_names[i], "pkg%zu", i) < 0) {
+            return 1;
+        }
+    }
+
+    printf("Registering %zu commands, %zu lookups\n", count, lookups);
+
+    legacy_registry = calloc(1, sizeof(CommandRegistry));
+    Timings legacy = time_registry(legacy_register_command, legacy_find_command,
+                                   unix_names, nut_names, count, lookups);
+    legacy_free_registry();
+
+    // Package directories are scanned on the first miss; do that now
+    init_registry_core();
+    find_command("nutshell-bench-miss");
+    Timings hashed = time_registry(hashed_register, find_command,
+                                   unix_names, nut_names, count, lookups);
+    free_registry();
+
+    printf("  %-8s %10s %12s %12s\n", "", "register", "hit", "miss");
+    printf("  %-8s %8.1f ms %9.1f ns %9.1f ns\n", "linear",
+           legacy.register_us / 1e3, legacy.hit_us * 1e3 / lookups, legacy.miss_us * 1e3 / lookups);
+    printf("  %-8s %8.1f ms %9.1f ns %9.1f ns\n", "hashed",
+           hashed.register_us / 1e3, hashed.hit_us * 1e3 / lookups, hashed.miss_us * 1e3 / lookups);
+    printf("  speedup  %8.1fx %11.1fx %11.1fx\n", legacy.register_us / hashed.register_us,
+           legacy.hit_us / hashed.hit_us, legacy.miss_us / hashed.miss_us);
+
+    for (size_t i = 0; i < count; i++) {
+        free(unix_names[i]);
+        free(nut_names[i]);
+    }
+    free(unix_names);
+    free(nut_names);
+    return 0;
+}
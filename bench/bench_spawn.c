@@ -0,0 +1,69 @@
+// Compare the fork and posix_spawn launch backends.
+//
+// The shell's resident set is inflated first (readline history, Jansson trees
+// and curl/OpenSSL state make a long-running session large), since the cost of
+// fork() grows with the page tables it has to copy.
+//
+// Usage: bench/bench_spawn.bench [iterations] [rss_mb]
+#include <nutshell/core.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static double time_backend(SpawnBackend backend, int iterations) {
+    char *argv[] = { "true", NULL };
+    LaunchSpec spec = {
+        .argv = argv,
+        .use_path = true,
+        .stdin_fd = -1,
+        .stdout_fd = -1,
+        .pgid = -1,
+    };
+    
+    double start = now_us();
+    for (int i = 0; i < iterations; i++) {
+        pid_t pid = launch_process(&spec, backend, NULL);
+        if (pid < 0) {
+            fprintf(stderr, "launch failed\n");
+            exit(1);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return (now_us() - start) / iterations;
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 500;
+    size_t rss_mb = argc > 2 ? strtoul(argv[2], NULL, 10) : 256;
+    
+    // Touch every page so it is really resident
+    char *ballast = malloc(rss_mb << 20);
+    if (!ballast) {
+        fprintf(stderr, "Could not allocate %zu MB of ballast\n", rss_mb);
+        return 1;
+    }
+    memset(ballast, 1, rss_mb << 20);
+    
+    printf("Launching 'true' %d times with %zu MB resident\n", iterations, rss_mb);
+    
+    // Warm up the dynamic loader and page cache
+    time_backend(SPAWN_BACKEND_SPAWN, 10);
+    
+    double fork_us = time_backend(SPAWN_BACKEND_FORK, iterations);
+    double spawn_us = time_backend(SPAWN_BACKEND_SPAWN, iterations);
+    
+    printf("  %-12s %8.1f us/launch\n", spawn_backend_name(SPAWN_BACKEND_FORK), fork_us);
+    printf("  %-12s %8.1f us/launch\n", spawn_backend_name(SPAWN_BACKEND_SPAWN), spawn_us);
+    printf("  speedup      %8.2fx\n", fork_us / spawn_us);
+    
+    free(ballast);
+    return 0;
+}
@@ -0,0 +1,138 @@
+// Measure how long the shell takes to start.
+//
+// Time to first prompt: the shell is started with its input and output on
+// pipes and timed until the prompt follows the startup banner. The `-c`
+// fast path is timed from launch until `nutshell -c true` has exited.
+//
+// Usage: bench/bench_startup.bench [iterations] [path/to/nutshell]
+#include <nutshell/core.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Start the shell with pipes for stdin and stdout
+static pid_t start_shell(const char *exe, char **argv, int *in_fd, int *out_fd) {
+    int in[2], out[2];
+    if (pipe(in) != 0 || pipe(out) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        close(in[0]); close(in[1]);
+        close(out[0]); close(out[1]);
+        execv(exe, argv);
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+    *in_fd = in[1];
+    *out_fd = out[0];
+    return pid;
+}
+
+static double time_first_prompt(const char *exe) {
+    char *argv[] = { (char *)exe, NULL };
+    int in_fd, out_fd;
+
+    double start = now_us();
+    pid_t pid = start_shell(exe, argv, &in_fd, &out_fd);
+
+    // The prompt is whatever the shell writes after the banner line
+    char buf[4096];
+    bool banner = false;
+    double elapsed = -1;
+    ssize_t n;
+    while ((n = read(out_fd, buf, sizeof(buf))) > 0) {
+        if (!banner) {
+            char *nl = memchr(buf, '\n', n);
+            if (!nl) continue;
+            banner = true;
+            n -= nl + 1 - buf;
+        }
+        if (n > 0) {
+            elapsed = now_us() - start;
+            break;
+        }
+    }
+
+    // EOF on stdin ends the session
+    close(in_fd);
+    while (read(out_fd, buf, sizeof(buf)) > 0) {}
+    close(out_fd);
+    waitpid(pid, NULL, 0);
+    return elapsed;
+}
+
+static double time_batch(const char *exe) {
+    char *argv[] = { (char *)exe, "-c", "true", NULL };
+    int in_fd, out_fd;
+
+    double start = now_us();
+    pid_t pid = start_shell(exe, argv, &in_fd, &out_fd);
+    int status;
+    waitpid(pid, &status, 0);
+    double elapsed = now_us() - start;
+
+    close(in_fd);
+    close(out_fd);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? elapsed : -1;
+}
+
+static void report(const char *label, double (*measure)(const char *), const char *exe, int iterations) {
+    double *samples = malloc(iterations * sizeof(double));
+    if (!samples) exit(1);
+
+    double total = 0;
+    for (int i = 0; i < iterations; i++) {
+        samples[i] = measure(exe);
+        if (samples[i] < 0) {
+            fprintf(stderr, "%s: %s did not start properly\n", label, exe);
+            exit(1);
+        }
+        total += samples[i];
+    }
+    qsort(samples, iterations, sizeof(double), compare_double);
+
+    printf("  %-14s min %7.2f ms   median %7.2f ms   mean %7.2f ms\n", label,
+           samples[0] / 1e3, samples[iterations / 2] / 1e3, total / iterations / 1e3);
+    free(samples);
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 50;
+    const char *exe = argc > 2 ? argv[2] : "./nutshell";
+    if (iterations < 1) iterations = 1;
+
+    if (access(exe, X_OK) != 0) {
+        fprintf(stderr, "%s not found; run from the source tree after building it\n", exe);
+        return 1;
+    }
+
+    printf("Starting %s %d times\n", exe, iterations);
+
+    // Warm up the dynamic loader and page cache
+    time_batch(exe);
+    time_first_prompt(exe);
+
+    report("first prompt", time_first_prompt, exe, iterations);
+    report("-c true", time_batch, exe, iterations);
+    return 0;
+}
@@ -22,6 +22,9 @@ char *suggest_fix(const char *command, const char *error, int exit_status);
 // Handle AI commands in the shell
 bool handle_ai_command(ParsedCommand *cmd);
 
+// Check whether a command name is one of the AI commands
+bool is_ai_command(const char *name);
+
 // Initialize AI shell integration
 void init_ai_shell();
 
@@ -34,6 +34,7 @@ bool add_config_package(const char *package_name);
 bool remove_config_package(const char *package_name);
 bool add_config_alias(const char *alias_name, const char *command);
 bool remove_config_alias(const char *alias_name);
+unsigned long config_alias_generation();  // Changes whenever the aliases do
 bool add_config_script(const char *script_path);
 bool remove_config_script(const char *script_path);
 
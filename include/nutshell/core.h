@@ -10,54 +10,267 @@
 #include <stdbool.h>
 #include <readline/readline.h>
 
-#define MAX_ARGS 64
 #define MAX_CMD_LEN 1024
 #define PROMPT_MAX 256
+#define OUTPUT_TAIL_DEFAULT (64 * 1024)
 
 typedef struct CommandMapping {
     char *unix_cmd;
     char *nut_cmd;
     bool is_builtin;
+    char **args;  // Command template from a package manifest, NULL-terminated, or NULL
 } CommandMapping;
 
+// Commands in registration order, with an open-addressing index on each
+// name. Index slots hold a position in `commands` plus one, 0 when empty.
 typedef struct CommandRegistry {
     CommandMapping *commands;
     size_t count;
+    size_t capacity;
+    size_t *nut_index;
+    size_t *unix_index;
+    size_t index_size;   // Slots in each index, a power of two
 } CommandRegistry;
 
+// What register_command() did with a mapping
+typedef enum {
+    REGISTER_ADDED,      // New command, reachable under both names
+    REGISTER_DUPLICATE,  // Exactly the same mapping is already registered
+    REGISTER_SHADOWED,   // Added, but an earlier command keeps one of its names
+    REGISTER_UPDATED,    // Already registered, with a different command template
+    REGISTER_FAILED      // Out of memory
+} RegisterResult;
+
+// How a pipeline in a command list is joined to the one after it
+typedef enum {
+    CONNECT_SEQ,   // `a ; b` or `a & b`: always run b
+    CONNECT_AND,   // `a && b`: run b if a succeeded
+    CONNECT_OR     // `a || b`: run b if a failed
+} CommandConnector;
+
+// Owns the memory of a parsed command (nodes, argument arrays and words)
+typedef struct ParseArena ParseArena;
+
+typedef enum {
+    REDIR_INPUT,    // n<file
+    REDIR_OUTPUT,   // n>file
+    REDIR_APPEND,   // n>>file
+    REDIR_DUP,      // n>&m, n<&m: make n a copy of m
+    REDIR_CLOSE,    // n>&-, n<&-
+    REDIR_HERE      // n<<TAG here-document or n<<<word here-string
+} RedirType;
+
+// One redirection of a command. They are applied in the order written, so
+// `>log 2>&1` and `2>&1 >log` differ as they do in other shells.
+typedef struct Redirection {
+    RedirType type;
+    int fd;                    // Descriptor being redirected
+    int source_fd;             // REDIR_DUP: descriptor copied onto fd
+    const char *target;        // File name, or the text of a here-document
+    struct Redirection *next;
+} Redirection;
+
+// A `$(...)` or backtick command substitution, or an unquoted or
+// double-quoted `$?`. Its text is left out of the argument and the command's
+// output, or the last exit status, is spliced in at `offset` when the
+// command runs.
+typedef struct Substitution {
+    int arg;                   // Index into args
+    size_t offset;             // Byte offset into that argument
+    const char *command;       // Command text, backtick escapes already removed; NULL for `$?`
+    bool quoted;               // Inside "...": the output is not split into words
+    struct Substitution *next;
+} Substitution;
+
 typedef struct ParsedCommand {
     char **args;
-    char *input_file;
-    char *output_file;
-    bool background;
+    Redirection *redirs;              // In order, or NULL
+    Substitution *subs;               // Ordered by argument and offset, or NULL
+    bool background;                  // Set on the first stage for the whole pipeline
+    struct ParsedCommand *pipe_next;  // Next stage of a pipeline (`a | b`), or NULL
+    CommandConnector connector;       // Set on the first stage: how `next` is joined
+    struct ParsedCommand *next;       // Next pipeline of a command list, or NULL
+    ParseArena *arena;                // Set on the first node only
+    // Command lookup done ahead of time by resolve_command()
+    bool resolved;
+    unsigned long resolved_generation;  // registry_generation() it is valid for
+    const struct Builtin *builtin;
+    const CommandMapping *mapping;
 } ParsedCommand;
 
+// Outcome of a command: its exit status plus the resources it used
+typedef struct CommandResult {
+    int exit_code;       // Exit status, or 128 + signal number
+    int signal;          // Signal that killed or stopped it, or 0
+    bool stopped;
+    double wall_ms;      // From launch until the shell got control back
+    double user_ms;      // CPU time, summed over every stage
+    double sys_ms;
+    long max_rss_kb;     // Largest resident set of any stage
+    long minor_faults;
+    long major_faults;
+} CommandResult;
+
 // Command history tracking
 typedef struct CommandHistory {
     char *last_command;
     char *last_output;
     int exit_status;
     bool has_error;
+    CommandResult last_result;
 } CommandHistory;
 
 // Global command history for error fixing
 extern CommandHistory cmd_history;
+void capture_command_output(const char *command, const CommandResult *result, const char *output);
+
+// Subsystems started the first time something needs them
+typedef enum {
+    MODULE_CONFIG,   // User, system and directory config files
+    MODULE_THEME,    // Prompt theme; starts MODULE_CONFIG for the saved theme
+    MODULE_AI,       // AI commands and API key; curl starts on the first request
+    MODULE_COUNT
+} Module;
+
+void module_require(Module module);  // Idempotent
+bool module_ready(Module module);
+void modules_cleanup();              // Stops started modules in reverse order
 
 // Registry functions
 void init_registry();
-void register_command(const char *unix_cmd, const char *nut_cmd, bool is_builtin);
+void init_registry_core();  // Defers scanning package directories to the first miss
+RegisterResult register_command(const char *unix_cmd, const char *nut_cmd, bool is_builtin);
+RegisterResult register_template(const char *unix_cmd, const char *nut_cmd, char *const *args);
 const CommandMapping *find_command(const char *input_cmd);
+bool unregister_command(const char *unix_cmd);  // Drops the first command registered for unix_cmd
+const CommandMapping *registry_commands(size_t *count);  // In registration order
+void registry_watch_packages();  // Follow changes to the package directories from now on
+void registry_poll_packages();   // Apply the changes seen since the last call
+unsigned long registry_generation();  // Changes whenever the registry does
 void free_registry();
 
 // Parser functions
-ParsedCommand *parse_command(char *input);
+ParsedCommand *parse_command(const char *input);
 void free_parsed_command(ParsedCommand *cmd);
+void *parsed_command_alloc(ParsedCommand *cmd, size_t size);  // Zeroed, freed with cmd (the first node)
+// Replace every command word that names an alias with the alias's command,
+// in place. Aliases come from the config, once it is loaded. False, with an
+// error printed, if an alias cannot be expanded.
+bool expand_aliases(ParsedCommand *cmd);
+void alias_cache_free();  // Expanded aliases are kept until the aliases change
+// When the last parse_command() failed only because the input ended inside
+// a here-document, the delimiter line it is waiting for; otherwise NULL.
+// Read more lines and parse the whole text again once that line arrives.
+const char *parse_pending_heredoc();
+
+// Parsed command cache: an LRU map from input lines to resolved commands, so
+// repeated lines skip lexing and command lookup. Cached commands are shared
+// and must not be modified; every acquire is paired with a release.
+typedef struct ParseCacheStats {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long invalidations;  // Times the registry, aliases or PATH changed
+    size_t entries;
+    size_t capacity;
+} ParseCacheStats;
+
+ParsedCommand *parse_cache_acquire(const char *input);  // NULL on a syntax error
+void parse_cache_release(ParsedCommand *cmd);
+void parse_cache_clear();
+void parse_cache_set_capacity(size_t capacity);         // 0 turns caching off
+ParseCacheStats parse_cache_stats();
+void parse_cache_free();
 
 // Executor functions
-void execute_command(ParsedCommand *cmd);
+CommandResult execute_command(ParsedCommand *cmd);
+bool command_changes_shell(ParsedCommand *cmd);  // Any stage that must not run in-process
+// Run a `$(...)` command list with its stdout read into a new string,
+// trailing newlines removed, and its exit status stored. NULL if it could not
+// be run.
+char *run_substitution(const char *text, int *status);
+void resolve_command(ParsedCommand *cmd);       // Look up every stage's builtin/registry entry now
+const CommandResult *get_last_result();         // Backs `$?` and `last-stats`
+const int *get_pipeline_status(size_t *count);  // Per-stage exit statuses of the last command
+
+// Builtins: looked up in a sorted table and run in-process. Each gets its
+// arguments and the descriptors to use for stdin, stdout and stderr.
+typedef int (*BuiltinFunc)(int argc, char **argv, int in_fd, int out_fd, int err_fd);
+
+typedef struct Builtin {
+    const char *name;
+    BuiltinFunc run;
+    bool uses_stdio;     // Prints through stdio, so fds 0/1 are redirected around it
+    bool changes_shell;  // Changes the shell itself (cd, exit...): needs a subshell in $(...)
+} Builtin;
+
+const Builtin *find_builtin(const char *name);
+
+// Process launcher: posix_spawn fast path with a fork fallback
+typedef enum {
+    SPAWN_BACKEND_SPAWN,   // posix_spawn (vfork-style, no page table copy)
+    SPAWN_BACKEND_FORK     // fork + exec
+} SpawnBackend;
+
+typedef struct LaunchSpec {
+    char **argv;
+    bool use_path;            // Search PATH for argv[0] (execvp semantics)
+    const char *path;         // Already resolved executable to run, or NULL
+    const Redirection *redirs;  // Applied in order after the pipe ends, or NULL
+    int stdin_fd;             // Pipe end to install as stdin, or -1
+    int stdout_fd;            // Pipe end to install as stdout, or -1
+    pid_t pgid;               // -1 keeps the shell's group, 0 starts a new one
+    bool detach_output;       // Background job: write to the terminal, not the relay
+} LaunchSpec;
+
+pid_t launch_process(const LaunchSpec *spec, SpawnBackend backend, int *failure_status);
+void launch_setup_child(const LaunchSpec *spec);
+int open_here_doc(const char *text);  // Close-on-exec descriptor that reads back text
+SpawnBackend get_spawn_backend();
+void set_spawn_backend(SpawnBackend backend);
+const char *spawn_backend_name(SpawnBackend backend);
+
+// Job control: background and stopped commands, reaped through a SIGCHLD self-pipe
+typedef enum {
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE
+} JobState;
+
+void jobs_init();
+void jobs_init_batch();      // Reaping only, for -c and scripts: no terminal or job control
+void jobs_enter_subshell();  // In a forked subshell: no job control and no inherited jobs
+// pgid 0 means the processes stayed in the shell's own process group
+int jobs_add(pid_t pgid, const pid_t *pids, size_t count, const char *command, JobState state);
+void jobs_reap();
+void jobs_notify();          // Report finished and stopped jobs before the prompt
+size_t jobs_active_count();
+int jobs_getc(FILE *stream); // readline input hook that reaps while idle
+// Descriptors jobs_getc also waits on, and what to call when one is ready
+void jobs_watch_idle(size_t (*fds)(int *fds, size_t max), void (*ready)());
+void jobs_free();
+bool job_control_enabled();
+void give_terminal_to(pid_t pgid);
+
+// PATH lookup cache: remembers where commands were found, like bash's `hash`
+const char *path_cache_lookup(const char *name);  // Valid until the next lookup
+void path_cache_clear();
+void path_cache_free();
+
+// Output relay: streams command output to the terminal as it arrives while
+// keeping a bounded tail for the command history
+bool output_relay_start();
+char *output_relay_stop();  // Returns the captured tail (caller frees)
+void output_relay_keep_running();  // A stopped job still writes into the relay
+void output_relay_detach_child();
+bool output_relay_terminal_fds(int *out_fd, int *err_fd);
+void output_relay_set_tail_size(size_t size);
+size_t output_relay_get_tail_size();
 
 // Shell core
 void shell_loop();
+int shell_run_string(const char *text);  // `nutshell -c`: returns the last exit status
+int shell_run_file(const char *path);    // `nutshell script.nut`
 char *get_prompt();
 void handle_sigint(int sig);
 
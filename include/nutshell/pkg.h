@@ -2,6 +2,9 @@
 #define NUTSHELL_PKG_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <nutshell/core.h>
 
 #define NUTPKG_REGISTRY "https://registry.nutshell.sh/v1"
 #define MAX_DEPENDENCIES 32
@@ -39,4 +42,37 @@ bool install_package_from_path(const char *path);
 bool install_package_from_name(const char *name);
 bool register_package_commands(const char *pkg_dir, const char *pkg_name);
 
+// A command an installed package provides: its `<pkg>.sh` script, or a
+// command template from the `commands` map of its manifest
+typedef struct {
+    char *unix_cmd;   // Script path, or `<pkg dir>/<name>` for a template
+    char *nut_cmd;
+    char **args;      // Template words, NULL-terminated, or NULL for the script
+} PackageCommand;
+
+// Manifest command templates, split into words at install time (manifest.c)
+bool compile_package_commands(const char *pkg_dir);  // Writes <pkg_dir>/.commands
+size_t package_commands(const char *pkg_dir, const char *pkg_name, PackageCommand **commands);
+void free_package_commands(PackageCommand *commands, size_t count);
+
+// What package_commands() depends on: the directory's mtime changes when a
+// script or manifest is added or replaced, but the manifest and .commands
+// can be edited in place. Zero for a file that is missing.
+typedef struct {
+    struct timespec dir;
+    struct timespec manifest;
+    struct timespec compiled;
+} PackageStamp;
+bool package_stamp(const char *pkg_dir, bool files, PackageStamp *stamp);  // false unless a directory
+RegisterResult register_package_command(const PackageCommand *command);
+
+// On-disk index of the commands in each package root (~/.nutshell/package-index)
+void package_index_load(const char **roots, size_t count);  // Register every root's commands
+void package_index_invalidate();                            // Rescan all roots next time
+
+// Live reload of the package roots through inotify (Linux only)
+void package_watch_roots(const char **roots, size_t count);  // Watch roots and registered packages
+int package_watch_poll();                                    // Apply pending changes, returns how many
+void package_watch_free();
+
 #endif // NUTSHELL_PKG_H
\ No newline at end of file
@@ -2,12 +2,54 @@
 #define NUTSHELL_THEME_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// A format string compiled into the pieces it is rendered from, so a
+// prompt is one pass over them instead of a string replace per placeholder
+typedef enum {
+    THEME_OP_TEXT,     // Literal text
+    THEME_OP_COLOR,    // One of the theme's colors
+    THEME_OP_ICON,
+    THEME_OP_SYMBOL,   // The prompt symbol
+    THEME_OP_SEGMENT,  // A segment, rendered from its own format
+    THEME_OP_OUTPUT    // A segment command's output
+} ThemeOpType;
+
+typedef struct {
+    ThemeOpType type;
+    int index;         // Color, segment or command
+    size_t offset;     // THEME_OP_TEXT: where in the program's text
+    size_t length;
+} ThemeOp;
+
+typedef struct {
+    ThemeOp *ops;
+    size_t count;
+    char *text;        // The literal text of all THEME_OP_TEXT ops
+} ThemeProgram;
+
+// A segment value the shell works out itself: malloc'd, or NULL for none
+typedef char *(*SegmentProvider)();
 
 // Command with its output
 typedef struct {
     char *name;      // Name of the command (key)
     char *command;   // Command to execute
+    SegmentProvider provider;  // Used instead of command when set
     char *output;    // Cached output
+    // Output caching, from the theme: with neither set it runs for every prompt
+    int ttl_ms;      // How long an output stays good, 0 for as long as its keys hold
+    char **keys;     // What the output depends on: "cwd", "file:<path>", "env:<name>"
+    int key_count;
+    unsigned long long key_hash;  // Of the keys when the command was started
+    long long made_ms;            // When the output was made, 0 for not cached
+    // While the command runs
+    pid_t pid;       // 0 when not running
+    int fd;          // Read end of its stdout, while pid is set
+    char *buffer;    // Output read so far
+    size_t length;
+    long long deadline_ms;  // When the prompt stops waiting for it, or -1
 } ThemeCommand;
 
 // Theme segment structure
@@ -17,6 +59,8 @@ typedef struct {
     char *format;
     int command_count;
     ThemeCommand **commands;  // Array of commands for this segment
+    int timeout_ms;           // How long the prompt waits for its commands, 0 for the default
+    ThemeProgram program;     // format, compiled
 } ThemeSegment;
 
 // Theme color mapping
@@ -34,6 +78,7 @@ typedef struct {
 typedef struct {
     char *format;
     char *icon;
+    ThemeProgram program;  // format, compiled
 } PromptConfig;
 
 // Overall theme structure
@@ -48,6 +93,10 @@ typedef struct {
     char *prompt_symbol_color;
     ThemeSegment **segments;
     int segment_count;
+    // Set by compile_theme()
+    bool compiled;
+    bool appends_symbol;      // The format has no {prompt_symbol}, so it goes at the end
+    int symbol_color;         // prompt_symbol_color as a color index
 } Theme;
 
 // Theme management functions
@@ -55,11 +104,45 @@ void init_theme_system();
 void cleanup_theme_system();
 Theme *load_theme(const char *theme_name);
 void free_theme(Theme *theme);
-char *get_theme_prompt(Theme *theme);
+char *get_theme_prompt(Theme *theme);     // Runs the segment commands first
+char *render_theme_prompt(Theme *theme);  // With the outputs the commands last gave
+bool compile_theme(Theme *theme);         // Compile the formats; done on load, or before the first render
+void free_theme_program(ThemeProgram *program);
 char *expand_theme_format(Theme *theme, const char *format);
 char *get_segment_output(Theme *theme, const char *segment_name);
 void execute_segment_commands(ThemeSegment *segment);  // Added this function declaration
 
+// Segment commands run concurrently in the background. The prompt waits for
+// each until its segment's deadline; one still running then keeps its last
+// output and is collected while readline waits for input.
+#define SEGMENT_TIMEOUT_DEFAULT 100  // Milliseconds, NUT_PROMPT_TIMEOUT overrides
+void segment_command_start(ThemeCommand *cmd, int timeout_ms);  // 0 for the default, -1 waits for it to finish
+void segment_command_refresh(ThemeCommand *cmd, int timeout_ms);  // Start it unless its cached output holds
+void segment_command_cancel(ThemeCommand *cmd);
+void segment_commands_wait();       // Until every running command finished or passed its deadline
+size_t segment_commands_fds(int *fds, size_t max);  // Descriptors of the commands still running
+bool segment_commands_collect();    // Read without blocking; true if any command finished
+
+// Built-in providers a theme names with "provider" instead of a "command"
+SegmentProvider find_segment_provider(const char *name);
+
+// A work tree's status as its git status helper last saw it. The helper is a
+// long-lived process per repository, started on the first query, that runs
+// `git status` again only when inotify reports a change.
+#define GIT_STATUS_TIMEOUT_DEFAULT 50  // Milliseconds, NUT_GIT_STATUS_TIMEOUT overrides
+typedef struct {
+    char branch[256];
+    int ahead;
+    int behind;
+    int staged;
+    int unstaged;
+    int untracked;
+    int conflicted;
+} GitStatus;
+
+bool git_status_query(const char *top, const char *git_dir, GitStatus *status);  // false while nothing is known
+void git_status_stop();  // Stop every helper
+
 // Builtin theme command
 int theme_command(int argc, char **argv);
 
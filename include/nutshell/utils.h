@@ -1,6 +1,7 @@
 #ifndef NUTSHELL_UTILS_H
 #define NUTSHELL_UTILS_H
 
+#include <stdint.h>
 #include <sys/stat.h>
 #include "core.h"
 
@@ -17,6 +18,12 @@ char **split_string(const char *input, const char *delim, int *count);
 char *trim_whitespace(char *str);
 char *str_replace(const char *str, const char *find, const char *replace);
 
+// FNV-1a, for the open-addressing tables and cache keys. The tables grow
+// before they fill up, so a linear probe always reaches an empty slot.
+#define HASH_INIT 1469598103934665603ULL
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t len);  // Continues `hash`
+size_t hash_string(const char *s);
+
 // Security utilities
 bool sanitize_command(const char *cmd);
 bool is_safe_path(const char *path);
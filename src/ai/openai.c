@@ -22,6 +22,9 @@
 // API Key storage
 static char *api_key = NULL;
 
+// curl (and the TLS library behind it) is only started for the first request
+static bool curl_ready = false;
+
 // Memory structure for CURL responses
 struct MemoryStruct {
     char *memory;
@@ -130,9 +133,6 @@ void set_api_key(const char *key) {
 bool init_ai_integration() {
     AI_DEBUG("Initializing AI integration");
     
-    // Initialize CURL
-    curl_global_init(CURL_GLOBAL_DEFAULT);
-    
     // Check if we have API key
     if (!has_api_key()) {
         AI_DEBUG("OpenAI API key not found. Please set OPENAI_API_KEY environment variable");
@@ -152,7 +152,10 @@ void cleanup_ai_integration() {
         free(api_key);
         api_key = NULL;
     }
-    curl_global_cleanup();
+    if (curl_ready) {
+        curl_global_cleanup();
+        curl_ready = false;
+    }
     
     AI_DEBUG("AI resources cleaned up");
 }
@@ -168,6 +171,11 @@ static char *request_completion(const char *system_prompt, const char *user_prom
     AI_DEBUG("System prompt: %.40s...", system_prompt);
     AI_DEBUG("User prompt: %.40s...", user_prompt);
     
+    if (!curl_ready) {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        curl_ready = true;
+    }
+    
     CURL *curl = curl_easy_init();
     if (!curl) {
         print_error("Failed to initialize CURL");
@@ -30,7 +30,8 @@ void register_ai_commands() {
     AI_SHELL_DEBUG("AI commands registered successfully");
 }
 
-// Initialize AI integration for the shell
+// Initialize AI integration for the shell. Started through module_require(),
+// which makes sure it runs once until modules_cleanup().
 void init_ai_shell() {
     AI_SHELL_DEBUG("Initializing AI shell integration");
     
@@ -47,6 +48,12 @@ void init_ai_shell() {
     }
 }
 
+bool is_ai_command(const char *name) {
+    if (!name) return false;
+    return strcmp(name, "set-api-key") == 0 || strcmp(name, "ask") == 0 ||
+           strcmp(name, "explain") == 0 || strcmp(name, "fix") == 0;
+}
+
 // Update the shell loop function to handle AI commands
 bool handle_ai_command(ParsedCommand *cmd) {
     if (!cmd || !cmd->args[0]) return false;
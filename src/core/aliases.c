@@ -0,0 +1,297 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+#include <nutshell/core.h>
+#include <nutshell/config.h>
+#include <nutshell/utils.h>
+#include <stdint.h>
+#include <string.h>
+
+// Alias debug macro, shares the parser's switch
+#define ALIAS_DEBUG(fmt, ...) \
+    do { if (getenv("NUT_DEBUG_PARSER")) fprintf(stderr, "ALIAS: " fmt "\n", ##__VA_ARGS__); } while(0)
+
+// Aliases are expanded on the parsed command, not its text. An alias's
+// command is parsed once, the aliases in it expanded, and the result kept
+// until the aliases change; using the alias copies that command in place of
+// the stage that named it. As in other shells a word naming an alias that is
+// already being expanded is left as it is, so `ls` can stand for
+// `ls --color` and a cycle stops where it comes back round.
+
+#define ALIAS_DEPTH_MAX 16
+
+typedef struct {
+    char *name;          // NULL for an empty slot
+    size_t hash;
+    ParsedCommand *cmd;  // Fully expanded
+} MemoEntry;
+
+// Expanded aliases, in an open-addressing table at most half full
+static struct {
+    MemoEntry *entries;
+    size_t size;               // Slots, a power of two, or 0
+    size_t count;
+    unsigned long generation;  // config_alias_generation() they belong to
+} memo = { 0 };
+
+// Aliases being expanded, outermost first
+typedef struct {
+    const char *names[ALIAS_DEPTH_MAX];
+    int depth;
+} AliasStack;
+
+static MemoEntry *memo_slot(MemoEntry *entries, size_t size, const char *name, size_t hash) {
+    size_t mask = size - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        if (!entries[i].name || (entries[i].hash == hash && strcmp(entries[i].name, name) == 0)) {
+            return &entries[i];
+        }
+    }
+}
+
+static void memo_clear() {
+    for (size_t i = 0; i < memo.size; i++) {
+        if (!memo.entries[i].name) continue;
+        free(memo.entries[i].name);
+        free_parsed_command(memo.entries[i].cmd);
+        memo.entries[i].name = NULL;
+    }
+    memo.count = 0;
+}
+
+// Takes ownership of cmd on success
+static bool memo_store(const char *name, size_t hash, ParsedCommand *cmd) {
+    if ((memo.count + 1) * 2 > memo.size) {
+        size_t size = memo.size ? memo.size * 2 : 16;
+        MemoEntry *entries = calloc(size, sizeof(MemoEntry));
+        if (!entries) return false;
+        for (size_t i = 0; i < memo.size; i++) {
+            if (memo.entries[i].name) {
+                *memo_slot(entries, size, memo.entries[i].name, memo.entries[i].hash) = memo.entries[i];
+            }
+        }
+        free(memo.entries);
+        memo.entries = entries;
+        memo.size = size;
+    }
+    char *copy = strdup(name);
+    if (!copy) return false;
+    MemoEntry *entry = memo_slot(memo.entries, memo.size, name, hash);
+    entry->name = copy;
+    entry->hash = hash;
+    entry->cmd = cmd;
+    memo.count++;
+    return true;
+}
+
+static char *copy_word(ParsedCommand *root, const char *word) {
+    size_t len = strlen(word) + 1;
+    char *copy = parsed_command_alloc(root, len);
+    if (copy) memcpy(copy, word, len);
+    return copy;
+}
+
+// Copy one stage of an alias's command into root's arena. The last stage
+// also gets what was typed after the alias name: its arguments, then its
+// redirections and substitutions.
+static bool copy_stage(ParsedCommand *root, ParsedCommand *to, const ParsedCommand *from,
+                       const ParsedCommand *typed) {
+    size_t own = 0, extra = 0;
+    while (from->args[own]) own++;
+    if (typed) {
+        while (typed->args[extra + 1]) extra++;
+    }
+
+    char **args = parsed_command_alloc(root, (own + extra + 1) * sizeof(char *));
+    if (!args) return false;
+    for (size_t i = 0; i < own; i++) {
+        if (!(args[i] = copy_word(root, from->args[i]))) return false;
+    }
+    for (size_t i = 0; i < extra; i++) {
+        args[own + i] = typed->args[i + 1];
+    }
+
+    Redirection **redir_link = &to->redirs;
+    *redir_link = NULL;
+    for (const Redirection *r = from->redirs; r; r = r->next) {
+        Redirection *copy = parsed_command_alloc(root, sizeof(Redirection));
+        if (!copy) return false;
+        *copy = *r;
+        copy->next = NULL;
+        if (r->target && !(copy->target = copy_word(root, r->target))) return false;
+        *redir_link = copy;
+        redir_link = &copy->next;
+    }
+
+    Substitution **sub_link = &to->subs;
+    *sub_link = NULL;
+    for (const Substitution *s = from->subs; s; s = s->next) {
+        Substitution *copy = parsed_command_alloc(root, sizeof(Substitution));
+        if (!copy) return false;
+        *copy = *s;
+        copy->next = NULL;
+        if (s->command && !(copy->command = copy_word(root, s->command))) return false;
+        *sub_link = copy;
+        sub_link = &copy->next;
+    }
+
+    if (typed) {
+        // The typed words move from just after the alias name to just after
+        // the alias's own words
+        *redir_link = typed->redirs;
+        for (Substitution *s = typed->subs; s; s = s->next) s->arg += (int)own - 1;
+        *sub_link = typed->subs;
+    }
+    to->args = args;
+    to->resolved = false;
+    return true;
+}
+
+// Put a copy of an alias's command in place of `stage`, which is part of the
+// pipeline starting at `pipeline`. Returns the last stage copied, and the
+// first stage of the last pipeline copied through last_pipeline.
+static ParsedCommand *splice(ParsedCommand *root, ParsedCommand *pipeline, ParsedCommand *stage,
+                             const ParsedCommand *alias, ParsedCommand **last_pipeline) {
+    ParsedCommand typed = *stage;
+    ParsedCommand *to = stage, *prev = NULL, *head = NULL;
+
+    for (const ParsedCommand *alias_pipeline = alias; alias_pipeline; alias_pipeline = alias_pipeline->next) {
+        for (const ParsedCommand *from = alias_pipeline; from; from = from->pipe_next) {
+            if (!to && !(to = parsed_command_alloc(root, sizeof(ParsedCommand)))) return NULL;
+            bool last = !alias_pipeline->next && !from->pipe_next;
+            if (!copy_stage(root, to, from, last ? &typed : NULL)) return NULL;
+            to->pipe_next = NULL;
+            if (from == alias_pipeline) {
+                if (head) head->next = to;
+                head = to;
+                to->background = from->background;
+                to->connector = from->connector;
+                to->next = NULL;
+            } else {
+                prev->pipe_next = to;
+            }
+            prev = to;
+            to = NULL;
+        }
+    }
+    prev->pipe_next = typed.pipe_next;
+
+    // The alias's last pipeline is joined to whatever followed the stage
+    if (alias->next || stage == pipeline) {
+        head->background = head->background || typed.background;
+        head->connector = typed.connector;
+        head->next = typed.next;
+    } else {
+        stage->background = false;
+        stage->connector = CONNECT_SEQ;
+        stage->next = NULL;
+        pipeline->background = pipeline->background || alias->background;
+        head = pipeline;
+    }
+    *last_pipeline = head;
+    return prev;
+}
+
+static bool expand_list(ParsedCommand *root, AliasStack *stack);
+
+// The expanded command of the alias a stage starts with, or NULL if it does
+// not start with one. Returns false after printing an error. Only the
+// aliases expanded from the top are kept: further in, the result depends on
+// the aliases being expanded around it, and the caller frees it (owned).
+static bool lookup_alias(const ParsedCommand *stage, AliasStack *stack,
+                         ParsedCommand **alias, bool *owned) {
+    *alias = NULL;
+    *owned = false;
+    const char *name = stage->args[0];
+    // A word partly made by a substitution names nothing yet
+    if (stage->subs && stage->subs->arg == 0) return true;
+    for (int i = 0; i < stack->depth; i++) {
+        if (strcmp(stack->names[i], name) == 0) {
+            ALIAS_DEBUG("'%s' is already being expanded, left as is", name);
+            return true;
+        }
+    }
+
+    size_t hash = 0;
+    if (stack->depth == 0) {
+        if (memo.generation != config_alias_generation()) {
+            if (memo.count > 0) ALIAS_DEBUG("Aliases changed, dropping %zu expansions", memo.count);
+            memo_clear();
+            memo.generation = config_alias_generation();
+        }
+        hash = hash_string(name);
+        if (memo.size > 0) {
+            MemoEntry *entry = memo_slot(memo.entries, memo.size, name, hash);
+            if (entry->name) {
+                *alias = entry->cmd;
+                return true;
+            }
+        }
+    }
+
+    const char *text = get_alias_command(name);
+    if (!text) return true;
+    if (stack->depth == ALIAS_DEPTH_MAX) {
+        fprintf(stderr, "nutshell: alias '%s': nested more than %d deep\n", stack->names[0], ALIAS_DEPTH_MAX);
+        return false;
+    }
+    ParsedCommand *cmd = parse_command(text);
+    if (!cmd) {
+        fprintf(stderr, "nutshell: alias '%s': syntax error in '%s'\n", name, text);
+        return false;
+    }
+    ALIAS_DEBUG("Expanding '%s' to '%s'", name, text);
+
+    stack->names[stack->depth++] = name;
+    bool ok = expand_list(cmd, stack);
+    stack->depth--;
+    if (!ok) {
+        free_parsed_command(cmd);
+        return false;
+    }
+
+    *alias = cmd;
+    *owned = stack->depth > 0 || !memo_store(name, hash, cmd);
+    return true;
+}
+
+static bool expand_list(ParsedCommand *root, AliasStack *stack) {
+    for (ParsedCommand *pipeline = root; pipeline; pipeline = pipeline->next) {
+        for (ParsedCommand *stage = pipeline; stage; stage = stage->pipe_next) {
+            ParsedCommand *alias;
+            bool owned;
+            if (!lookup_alias(stage, stack, &alias, &owned)) return false;
+            if (!alias) continue;
+
+            if (alias->next && (stage != pipeline || stage->pipe_next)) {
+                fprintf(stderr, "nutshell: alias '%s': a command list cannot be part of a pipeline\n",
+                        stage->args[0]);
+                if (owned) free_parsed_command(alias);
+                return false;
+            }
+            ParsedCommand *last_pipeline;
+            ParsedCommand *last = splice(root, pipeline, stage, alias, &last_pipeline);
+            if (owned) free_parsed_command(alias);
+            if (!last) return false;
+            // What was copied is expanded already
+            pipeline = last_pipeline;
+            stage = last;
+        }
+    }
+    return true;
+}
+
+bool expand_aliases(ParsedCommand *cmd) {
+    if (!cmd || !module_ready(MODULE_CONFIG) || !global_config || global_config->alias_count == 0) {
+        return true;
+    }
+    AliasStack stack = { .depth = 0 };
+    return expand_list(cmd, &stack);
+}
+
+void alias_cache_free() {
+    memo_clear();
+    free(memo.entries);
+    memo.entries = NULL;
+    memo.size = 0;
+}
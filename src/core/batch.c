@@ -0,0 +1,165 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+#include <nutshell/core.h>
+#include <nutshell/utils.h>
+#include <errno.h>
+#include <string.h>
+
+// Batch mode debug macro
+#define BATCH_DEBUG(fmt, ...) \
+    do { if (getenv("NUT_DEBUG_BATCH")) fprintf(stderr, "BATCH: " fmt "\n", ##__VA_ARGS__); } while(0)
+
+// Non-interactive mode (`nutshell -c` and scripts): no readline, no prompt,
+// no theme and no output relay. Packages are scanned on the first command
+// the registry does not know and other modules start on first use.
+
+static void batch_init() {
+    init_registry_core();
+    jobs_init_batch();
+}
+
+static void batch_cleanup() {
+    jobs_free();
+    free(cmd_history.last_command);
+    free(cmd_history.last_output);
+    cmd_history.last_command = cmd_history.last_output = NULL;
+    free_registry();
+    path_cache_free();
+    modules_cleanup();
+}
+
+// Input read so far for a command that continues over several lines
+// (one with here-documents)
+typedef struct {
+    char *text;
+    size_t length;
+    size_t first_line;
+    char *delimiter;    // Line the parser is waiting for
+} PendingInput;
+
+static void pending_reset(PendingInput *pending) {
+    free(pending->text);
+    free(pending->delimiter);
+    pending->text = pending->delimiter = NULL;
+    pending->length = 0;
+}
+
+static bool pending_append(PendingInput *pending, const char *line, size_t line_no) {
+    size_t len = strlen(line);
+    char *text = realloc(pending->text, pending->length + len + 2);
+    if (!text) return false;
+    if (pending->length == 0) {
+        pending->first_line = line_no;
+    } else {
+        text[pending->length++] = '\n';
+    }
+    memcpy(text + pending->length, line, len + 1);
+    pending->text = text;
+    pending->length += len;
+    return true;
+}
+
+// Run one line of input, or hold on to it until the command it belongs to
+// is complete. Blank lines and comments keep the previous status.
+static int run_line(PendingInput *pending, char *line, const char *source, size_t line_no, int status) {
+    if (pending->length == 0) {
+        line += strspn(line, " \t");
+        if (*line == '\0' || *line == '#') return status;
+    }
+    if (!pending_append(pending, line, line_no)) {
+        perror("nutshell");
+        pending_reset(pending);
+        return EXIT_FAILURE;
+    }
+    // Body lines cannot finish the command; only parse again at the delimiter
+    if (pending->delimiter && strcmp(line + strspn(line, "\t"), pending->delimiter) != 0) {
+        return status;
+    }
+
+    ParsedCommand *cmd = parse_command(pending->text);
+    if (!cmd) {
+        const char *delimiter = parse_pending_heredoc();
+        if (delimiter) {
+            BATCH_DEBUG("Line %zu continues until '%s'", line_no, delimiter);
+            free(pending->delimiter);
+            pending->delimiter = strdup(delimiter);
+            return status;
+        }
+        fprintf(stderr, "nutshell: %s: line %zu: syntax error\n", source, pending->first_line);
+        pending_reset(pending);
+        return 2;
+    }
+
+    CommandResult result = execute_command(cmd);
+    capture_command_output(pending->text, &result, NULL);
+    free_parsed_command(cmd);
+    pending_reset(pending);
+    return result.exit_code;
+}
+
+// Input ended; a command still waiting for lines is an error
+static int finish_input(PendingInput *pending, const char *source, int status) {
+    if (pending->length == 0) return status;
+    fprintf(stderr, "nutshell: %s: line %zu: here-document not terminated\n",
+            source, pending->first_line);
+    pending_reset(pending);
+    return 2;
+}
+
+int shell_run_string(const char *text) {
+    batch_init();
+
+    char *copy = strdup(text);
+    if (!copy) {
+        perror("nutshell");
+        batch_cleanup();
+        return EXIT_FAILURE;
+    }
+
+    // Split by hand: strtok_r would drop the empty lines of here-documents
+    int status = 0;
+    size_t line_no = 0;
+    PendingInput pending = { 0 };
+    for (char *line = copy; line; ) {
+        char *newline = strchr(line, '\n');
+        if (newline) *newline = '\0';
+        status = run_line(&pending, line, "-c", ++line_no, status);
+        line = newline ? newline + 1 : NULL;
+    }
+    status = finish_input(&pending, "-c", status);
+    free(copy);
+
+    BATCH_DEBUG("-c finished with status %d", status);
+    batch_cleanup();
+    return status;
+}
+
+int shell_run_file(const char *path) {
+    FILE *input = strcmp(path, "-") == 0 ? stdin : fopen(path, "re");
+    if (!input) {
+        fprintf(stderr, "nutshell: %s: %s\n", path, strerror(errno));
+        return 127;
+    }
+
+    batch_init();
+
+    int status = 0;
+    size_t line_no = 0, capacity = 0;
+    char *line = NULL;
+    ssize_t len;
+    PendingInput pending = { 0 };
+    while ((len = getline(&line, &capacity, input)) != -1) {
+        line_no++;
+        if (len > 0 && line[len - 1] == '\n') line[len - 1] = '\0';
+        // The #! line is skipped like any other comment
+        status = run_line(&pending, line, path, line_no, status);
+    }
+    status = finish_input(&pending, path, status);
+    free(line);
+    if (input != stdin) fclose(input);
+
+    BATCH_DEBUG("%s finished with status %d", path, status);
+    batch_cleanup();
+    return status;
+}
@@ -0,0 +1,667 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+#include <nutshell/core.h>
+#include <nutshell/utils.h>
+#include <nutshell/ai.h>
+#include <nutshell/config.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Builtin debug macro, shares the executor's switch
+#define BUILTIN_DEBUG(fmt, ...) \
+    do { if (getenv("NUT_DEBUG_EXEC")) fprintf(stderr, "BUILTIN: " fmt "\n", ##__VA_ARGS__); } while(0)
+
+extern char **environ;
+
+// Commands implemented elsewhere that still print through stdio
+extern int install_pkg_command(int argc, char **argv);
+extern int theme_command(int argc, char **argv);
+extern int hash_command(int argc, char **argv);
+extern int jobs_command(int argc, char **argv);
+extern int fg_command(int argc, char **argv);
+extern int bg_command(int argc, char **argv);
+extern int wait_command(int argc, char **argv);
+
+// Growable output buffer so each builtin finishes with a single write()
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} OutBuf;
+
+static void buf_append(OutBuf *buf, const char *text, size_t len) {
+    if (buf->length + len + 1 > buf->capacity) {
+        size_t capacity = buf->capacity ? buf->capacity : 256;
+        while (buf->length + len + 1 > capacity) capacity *= 2;
+        char *grown = realloc(buf->data, capacity);
+        if (!grown) return;
+        buf->data = grown;
+        buf->capacity = capacity;
+    }
+    memcpy(buf->data + buf->length, text, len);
+    buf->length += len;
+    buf->data[buf->length] = '\0';
+}
+
+static void buf_puts(OutBuf *buf, const char *text) {
+    buf_append(buf, text, strlen(text));
+}
+
+static void buf_putc(OutBuf *buf, char c) {
+    buf_append(buf, &c, 1);
+}
+
+// Write the buffer out and release it. Returns false if the write failed.
+static bool buf_flush(OutBuf *buf, int fd) {
+    bool ok = true;
+    const char *p = buf->data;
+    size_t left = buf->length;
+    while (left > 0) {
+        ssize_t n = write(fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ok = false;
+            break;
+        }
+        p += n;
+        left -= (size_t)n;
+    }
+    free(buf->data);
+    buf->data = NULL;
+    buf->length = buf->capacity = 0;
+    return ok;
+}
+
+// Handle one backslash escape at *p (just past the backslash) for echo -e and
+// printf. Returns false on `\c`, which ends all output.
+static bool append_escape(OutBuf *buf, const char **p) {
+    char c = **p;
+    (*p)++;
+    switch (c) {
+    case 'n': buf_putc(buf, '\n'); break;
+    case 't': buf_putc(buf, '\t'); break;
+    case 'r': buf_putc(buf, '\r'); break;
+    case 'a': buf_putc(buf, '\a'); break;
+    case 'b': buf_putc(buf, '\b'); break;
+    case 'f': buf_putc(buf, '\f'); break;
+    case 'v': buf_putc(buf, '\v'); break;
+    case 'e': buf_putc(buf, '\033'); break;
+    case '\\': buf_putc(buf, '\\'); break;
+    case 'c': return false;
+    case '0': {
+        // \0nnn: up to three octal digits
+        int value = 0;
+        for (int i = 0; i < 3 && **p >= '0' && **p <= '7'; i++, (*p)++) {
+            value = value * 8 + (**p - '0');
+        }
+        buf_putc(buf, (char)value);
+        break;
+    }
+    case '\0':
+        (*p)--;
+        buf_putc(buf, '\\');
+        break;
+    default:
+        buf_putc(buf, '\\');
+        buf_putc(buf, c);
+        break;
+    }
+    return true;
+}
+
+static int builtin_true(int argc, char **argv, int in_fd, int out_fd, int err_fd) {
+    (void)argc; (void)argv; (void)in_fd; (void)out_fd; (void)err_fd;
+    return 0;
+}
+
+static int builtin_false(int argc, char **argv, int in_fd, int out_fd, int err_fd) {
+    (void)argc; (void)argv; (void)in_fd; (void)out_fd; (void)err_fd;
+    return 1;
+}
+
+// echo [-neE] [args...]
+static int builtin_echo(int argc, char **argv, int in_fd, int out_fd, int err_fd) {
+    (void)in_fd; (void)err_fd;
+    bool newline = true, escapes = false;
+    int i = 1;
+
+    // Only arguments made up entirely of known flags are options
+    for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strspn(argv[i] + 1, "neE") != strlen(argv[i] + 1)) break;
+        for (const char *f = argv[i] + 1; *f; f++) {
+            if (*f == 'n') newline = false;
+            else if (*f == 'e') escapes = true;
+            else escapes = false;
+        }
+    }
+
+    OutBuf buf = { 0 };
+    bool more = true;
+    for (int first = i; i < argc && more; i++) {
+        if (i > first) buf_putc(&buf, ' ');
+        if (!escapes) {
+            buf_puts(&buf, argv[i]);
+            continue;
+        }
+        for (const char *p = argv[i]; *p && more; ) {
+            if (*p == '\\') {
+                p++;
+                more = append_escape(&buf, &p);
+            } else {
+                buf_putc(&buf, *p++);
+            }
+        }
+    }
+    if (newline && more) buf_putc(&buf, '\n');
+    return buf_flush(&buf, out_fd) ? 0 : 1;
+}
+
+static int builtin_pwd(int argc, char **argv, int in_fd, int out_fd, int err_fd) {
+    (void)argc; (void)argv; (void)in_fd;
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        dprintf(err_fd, "pwd: %s\n", strerror(errno));
+        return 1;
+    }
+    OutBuf buf = { 0 };
+    buf_puts(&buf, cwd);
+    buf_putc(&buf, '\n');
+    return buf_flush(&buf, out_fd) ? 0 : 1;
+}
+
+// Format one printf conversion. `spec` holds the flags/width/precision and
+// the conversion character, e.g. "-10s".
+static void format_conversion(OutBuf *buf, const char *spec, size_t spec_len,
+                              const char *arg, int err_fd, bool *failed) {
+    char conversion = spec[spec_len - 1];
+    char format[64];
+    char out[512];
+
+    if (spec_len + 3 > sizeof(format)) return;
+
+    if (conversion == 'b') {
+        // %b: the argument with its escapes expanded
+        for (const char *p = arg; *p; ) {
+            if (*p == '\\') {
+                p++;
+                if (!append_escape(buf, &p)) break;
+            } else {
+                buf_putc(buf, *p++);
+            }
+        }
+        return;
+    }
+
+    format[0] = '%';
+    memcpy(format + 1, spec, spec_len - 1);
+    size_t n = spec_len;
+
+    if (strchr("diouxXc", conversion)) {
+        long long value = 0;
+        if (conversion == 'c') {
+            value = (unsigned char)arg[0];
+        } else if (arg[0] == '\'' || arg[0] == '"') {
+            // 'c yields the character's value, as in POSIX printf
+            value = (unsigned char)arg[1];
+        } else if (*arg) {
+            char *end;
+            errno = 0;
+            value = strtoll(arg, &end, 0);
+            if (*end || errno) {
+                dprintf(err_fd, "printf: %s: invalid number\n", arg);
+                *failed = true;
+            }
+        }
+        if (conversion != 'c') {
+            format[n++] = 'l';
+            format[n++] = 'l';
+        }
+        format[n++] = conversion;
+        format[n] = '\0';
+        int len = conversion == 'c' ? snprintf(out, sizeof(out), format, (int)value) :
+                                      snprintf(out, sizeof(out), format, value);
+        if (len > 0) buf_append(buf, out, (size_t)len < sizeof(out) ? (size_t)len : sizeof(out) - 1);
+    } else if (strchr("feEgG", conversion)) {
+        double value = *arg ? strtod(arg, NULL) : 0.0;
+        format[n++] = conversion;
+        format[n] = '\0';
+        int len = snprintf(out, sizeof(out), format, value);
+        if (len > 0) buf_append(buf, out, (size_t)len < sizeof(out) ? (size_t)len : sizeof(out) - 1);
+    } else {
+        // %s, with padding done by hand so long strings are not cut short
+        format[n++] = 's';
+        format[n] = '\0';
+        int len = snprintf(NULL, 0, format, arg);
+        if (len < 0) return;
+        char *text = malloc((size_t)len + 1);
+        if (!text) return;
+        snprintf(text, (size_t)len + 1, format, arg);
+        buf_append(buf, text, (size_t)len);
+        free(text);
+    }
+}
+
+// printf format [args...]: the format is reused until the arguments run out
+static int builtin_printf(int argc, char **argv, int in_fd, int out_fd, int err_fd) {
+    (void)in_fd;
+    if (argc < 2) {
+        dprintf(err_fd, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+
+    const char *format = argv[1];
+    int next_arg = 2;
+    bool failed = false;
+    OutBuf buf = { 0 };
+
+    do {
+        bool used_arg = false;
+        for (const char *p = format; *p; ) {
+            if (*p == '\\') {
+                p++;
+                if (!append_escape(&buf, &p)) {
+                    buf_flush(&buf, out_fd);
+                    return failed ? 1 : 0;
+                }
+                continue;
+            }
+            if (*p != '%') {
+                buf_putc(&buf, *p++);
+                continue;
+            }
+            if (p[1] == '%') {
+                buf_putc(&buf, '%');
+                p += 2;
+                continue;
+            }
+
+            const char *spec = ++p;
+            p += strspn(p, "-+ #0");
+            p += strspn(p, "0123456789");
+            if (*p == '.') {
+                p++;
+                p += strspn(p, "0123456789");
+            }
+            if (!*p || !strchr("diouxXcsbfeEgG", *p)) {
+                dprintf(err_fd, "printf: %%%c: invalid directive\n", *p ? *p : ' ');
+                buf_flush(&buf, out_fd);
+                return 1;
+            }
+            p++;
+
+            const char *arg = next_arg < argc ? argv[next_arg++] : "";
+            used_arg = true;
+            format_conversion(&buf, spec, (size_t)(p - spec), arg, err_fd, &failed);
+        }
+        // Stop once the format consumed nothing or the arguments are used up
+        if (!used_arg) break;
+    } while (next_arg < argc);
+
+    bool ok = buf_flush(&buf, out_fd);
+    return failed || !ok ? 1 : 0;
+}
+
+static bool is_integer(const char *s, long long *value) {
+    if (!*s) return false;
+    char *end;
+    errno = 0;
+    *value = strtoll(s, &end, 10);
+    return *end == '\0' && errno == 0;
+}
+
+static bool test_unary(const char *op, const char *arg, bool *result) {
+    struct stat st;
+    if (strcmp(op, "-n") == 0) { *result = arg[0] != '\0'; return true; }
+    if (strcmp(op, "-z") == 0) { *result = arg[0] == '\0'; return true; }
+    if (strcmp(op, "-L") == 0 || strcmp(op, "-h") == 0) {
+        *result = lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+        return true;
+    }
+    if (strcmp(op, "-r") == 0) { *result = access(arg, R_OK) == 0; return true; }
+    if (strcmp(op, "-w") == 0) { *result = access(arg, W_OK) == 0; return true; }
+    if (strcmp(op, "-x") == 0) { *result = access(arg, X_OK) == 0; return true; }
+
+    if (strlen(op) != 2 || op[0] != '-' || !strchr("efdsbcpS", op[1])) return false;
+    if (stat(arg, &st) != 0) {
+        *result = false;
+        return true;
+    }
+    switch (op[1]) {
+    case 'e': *result = true; break;
+    case 'f': *result = S_ISREG(st.st_mode); break;
+    case 'd': *result = S_ISDIR(st.st_mode); break;
+    case 's': *result = st.st_size > 0; break;
+    case 'b': *result = S_ISBLK(st.st_mode); break;
+    case 'c': *result = S_ISCHR(st.st_mode); break;
+    case 'p': *result = S_ISFIFO(st.st_mode); break;
+    case 'S': *result = S_ISSOCK(st.st_mode); break;
+    }
+    return true;
+}
+
+static bool test_binary(const char *left, const char *op, const char *right,
+                        bool *result, int err_fd) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) { *result = strcmp(left, right) == 0; return true; }
+    if (strcmp(op, "!=") == 0) { *result = strcmp(left, right) != 0; return true; }
+    if (strcmp(op, "<") == 0) { *result = strcmp(left, right) < 0; return true; }
+    if (strcmp(op, ">") == 0) { *result = strcmp(left, right) > 0; return true; }
+
+    static const char *numeric[] = { "-eq", "-ne", "-lt", "-le", "-gt", "-ge", NULL };
+    for (int i = 0; numeric[i]; i++) {
+        if (strcmp(op, numeric[i]) != 0) continue;
+        long long a, b;
+        if (!is_integer(left, &a) || !is_integer(right, &b)) {
+            dprintf(err_fd, "test: integer expression expected\n");
+            return false;
+        }
+        switch (i) {
+        case 0: *result = a == b; break;
+        case 1: *result = a != b; break;
+        case 2: *result = a < b; break;
+        case 3: *result = a <= b; break;
+        case 4: *result = a > b; break;
+        case 5: *result = a >= b; break;
+        }
+        return true;
+    }
+    dprintf(err_fd, "test: %s: binary operator expected\n", op);
+    return false;
+}
+
+// Evaluate 0-4 arguments following the POSIX rules for test
+static bool test_eval(int argc, char **argv, bool *result, int err_fd) {
+    switch (argc) {
+    case 0:
+        *result = false;
+        return true;
+    case 1:
+        *result = argv[0][0] != '\0';
+        return true;
+    case 2:
+        if (strcmp(argv[0], "!") == 0) {
+            *result = argv[1][0] == '\0';
+            return true;
+        }
+        if (!test_unary(argv[0], argv[1], result)) {
+            dprintf(err_fd, "test: %s: unary operator expected\n", argv[0]);
+            return false;
+        }
+        return true;
+    case 3:
+        if (strcmp(argv[0], "!") == 0) {
+            if (!test_eval(2, argv + 1, result, err_fd)) return false;
+            *result = !*result;
+            return true;
+        }
+        return test_binary(argv[0], argv[1], argv[2], result, err_fd);
+    case 4:
+        if (strcmp(argv[0], "!") == 0) {
+            if (!test_eval(3, argv + 1, result, err_fd)) return false;
+            *result = !*result;
+            return true;
+        }
+        __attribute__((fallthrough));  // to the -a/-o handling below
+    default:
+        // expr -a expr / expr -o expr, with -a binding tighter
+        for (int i = argc - 1; i > 0; i--) {
+            if (strcmp(argv[i], "-o") == 0) {
+                bool left, right;
+                if (!test_eval(i, argv, &left, err_fd) ||
+                    !test_eval(argc - i - 1, argv + i + 1, &right, err_fd)) return false;
+                *result = left || right;
+                return true;
+            }
+        }
+        for (int i = argc - 1; i > 0; i--) {
+            if (strcmp(argv[i], "-a") == 0) {
+                bool left, right;
+                if (!test_eval(i, argv, &left, err_fd) ||
+                    !test_eval(argc - i - 1, argv + i + 1, &right, err_fd)) return false;
+                *result = left && right;
+                return true;
+            }
+        }
+        dprintf(err_fd, "test: too many arguments\n");
+        return false;
+    }
+}
+
+// test expr / [ expr ]: 0 if true, 1 if false, 2 on a malformed expression
+static int builtin_test(int argc, char **argv, int in_fd, int out_fd, int err_fd) {
+    (void)in_fd; (void)out_fd;
+    if (strcmp(argv[0], "[") == 0) {
+        if (argc < 2 || strcmp(argv[argc - 1], "]") != 0) {
+            dprintf(err_fd, "[: missing `]'\n");
+            return 2;
+        }
+        argc--;
+    }
+
+    bool result;
+    if (!test_eval(argc - 1, argv + 1, &result, err_fd)) return 2;
+    return result ? 0 : 1;
+}
+
+static bool valid_name(const char *name, size_t len) {
+    if (len == 0 || !(name[0] == '_' || (name[0] >= 'A' && name[0] <= 'Z') ||
+                      (name[0] >= 'a' && name[0] <= 'z'))) return false;
+    for (size_t i = 1; i < len; i++) {
+        char c = name[i];
+        if (!(c == '_' || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+              (c >= '0' && c <= '9'))) return false;
+    }
+    return true;
+}
+
+// export [NAME[=value]...]: without arguments, list the environment
+static int builtin_export(int argc, char **argv, int in_fd, int out_fd, int err_fd) {
+    (void)in_fd;
+    int i = 1;
+    if (i < argc && strcmp(argv[i], "-p") == 0) i++;
+
+    if (i >= argc) {
+        OutBuf buf = { 0 };
+        for (char **env = environ; *env; env++) {
+            const char *eq = strchr(*env, '=');
+            if (!eq) continue;
+            buf_puts(&buf, "export ");
+            buf_append(&buf, *env, (size_t)(eq - *env));
+            buf_puts(&buf, "=\"");
+            for (const char *p = eq + 1; *p; p++) {
+                if (strchr("\"\\$`", *p)) buf_putc(&buf, '\\');
+                buf_putc(&buf, *p);
+            }
+            buf_puts(&buf, "\"\n");
+        }
+        return buf_flush(&buf, out_fd) ? 0 : 1;
+    }
+
+    int status = 0;
+    for (; i < argc; i++) {
+        const char *eq = strchr(argv[i], '=');
+        size_t name_len = eq ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+        if (!valid_name(argv[i], name_len)) {
+            dprintf(err_fd, "export: `%s': not a valid identifier\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        // Without a value there are no shell-only variables to promote
+        if (!eq) continue;
+
+        char *name = strndup(argv[i], name_len);
+        if (!name || setenv(name, eq + 1, 1) != 0) {
+            dprintf(err_fd, "export: %s: %s\n", argv[i], strerror(errno));
+            status = 1;
+        } else {
+            BUILTIN_DEBUG("Exported %s", name);
+        }
+        free(name);
+    }
+    return status;
+}
+
+// cd [dir]: without an argument, go home
+static int builtin_cd(int argc, char **argv, int in_fd, int out_fd, int err_fd) {
+    (void)in_fd; (void)out_fd;
+    const char *dir = argc > 1 ? argv[1] : getenv("HOME");
+    if (!dir) return 0;
+
+    if (chdir(dir) != 0) {
+        dprintf(err_fd, "cd: %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    // Successfully changed directory, reload directory-specific config. If
+    // the config is not loaded yet it will be read from here when needed.
+    if (module_ready(MODULE_CONFIG)) {
+        reload_directory_config();
+    }
+    return 0;
+}
+
+// exit [n]: leave with n, or with the status of the last command
+static int builtin_exit(int argc, char **argv, int in_fd, int out_fd, int err_fd) {
+    (void)in_fd; (void)out_fd; (void)err_fd;
+    int status = argc > 1 ? atoi(argv[1]) : get_last_result()->exit_code;
+    fflush(stdout);
+    exit(status & 0xff);
+}
+
+// last-stats: status and resource usage of the previous command
+static int builtin_last_stats(int argc, char **argv, int in_fd, int out_fd, int err_fd) {
+    (void)argc; (void)argv; (void)in_fd; (void)err_fd;
+    const CommandResult *r = get_last_result();
+    char line[128];
+    OutBuf buf = { 0 };
+
+    snprintf(line, sizeof(line), "exit status:  %d\n", r->exit_code);
+    buf_puts(&buf, line);
+    if (r->signal) {
+        snprintf(line, sizeof(line), "%-13s %d (%s)\n", r->stopped ? "stopped by:" : "killed by:",
+                 r->signal, strsignal(r->signal));
+        buf_puts(&buf, line);
+    }
+    snprintf(line, sizeof(line), "wall time:    %.3f ms\n", r->wall_ms);
+    buf_puts(&buf, line);
+    snprintf(line, sizeof(line), "user time:    %.3f ms\n", r->user_ms);
+    buf_puts(&buf, line);
+    snprintf(line, sizeof(line), "sys time:     %.3f ms\n", r->sys_ms);
+    buf_puts(&buf, line);
+    snprintf(line, sizeof(line), "max RSS:      %ld KB\n", r->max_rss_kb);
+    buf_puts(&buf, line);
+    snprintf(line, sizeof(line), "page faults:  %ld minor, %ld major\n",
+             r->minor_faults, r->major_faults);
+    buf_puts(&buf, line);
+
+    size_t count;
+    const int *statuses = get_pipeline_status(&count);
+    if (count > 1) {
+        buf_puts(&buf, "pipeline:    ");
+        for (size_t i = 0; i < count; i++) {
+            snprintf(line, sizeof(line), " %d", statuses[i]);
+            buf_puts(&buf, line);
+        }
+        buf_putc(&buf, '\n');
+    }
+    return buf_flush(&buf, out_fd) ? 0 : 1;
+}
+
+// parse-cache [-c]: show how well the parse cache is doing, or empty it
+static int builtin_parse_cache(int argc, char **argv, int in_fd, int out_fd, int err_fd) {
+    (void)in_fd;
+    if (argc > 1) {
+        if (strcmp(argv[1], "-c") != 0) {
+            dprintf(err_fd, "parse-cache: usage: parse-cache [-c]\n");
+            return 2;
+        }
+        parse_cache_clear();
+        return 0;
+    }
+
+    ParseCacheStats stats = parse_cache_stats();
+    unsigned long lookups = stats.hits + stats.misses;
+    char line[128];
+    OutBuf buf = { 0 };
+
+    snprintf(line, sizeof(line), "entries:        %zu of %zu\n", stats.entries, stats.capacity);
+    buf_puts(&buf, line);
+    snprintf(line, sizeof(line), "hits:           %lu (%.1f%%)\n", stats.hits,
+             lookups ? 100.0 * stats.hits / lookups : 0.0);
+    buf_puts(&buf, line);
+    snprintf(line, sizeof(line), "misses:         %lu\n", stats.misses);
+    buf_puts(&buf, line);
+    snprintf(line, sizeof(line), "evictions:      %lu\n", stats.evictions);
+    buf_puts(&buf, line);
+    snprintf(line, sizeof(line), "invalidations:  %lu\n", stats.invalidations);
+    buf_puts(&buf, line);
+    return buf_flush(&buf, out_fd) ? 0 : 1;
+}
+
+// Adapters for commands that take (argc, argv) and use stdio; the executor
+// points stdin/stdout/stderr at the right descriptors around these
+#define STDIO_BUILTIN(wrapper, func) \
+    static int wrapper(int argc, char **argv, int in_fd, int out_fd, int err_fd) { \
+        (void)in_fd; (void)out_fd; (void)err_fd; \
+        return func(argc, argv); \
+    }
+
+STDIO_BUILTIN(builtin_hash, hash_command)
+STDIO_BUILTIN(builtin_jobs, jobs_command)
+STDIO_BUILTIN(builtin_fg, fg_command)
+STDIO_BUILTIN(builtin_bg, bg_command)
+STDIO_BUILTIN(builtin_wait, wait_command)
+STDIO_BUILTIN(builtin_install_pkg, install_pkg_command)
+
+static int builtin_theme(int argc, char **argv, int in_fd, int out_fd, int err_fd) {
+    (void)in_fd; (void)out_fd; (void)err_fd;
+    module_require(MODULE_THEME);
+    return theme_command(argc, argv);
+}
+
+static int builtin_ai(int argc, char **argv, int in_fd, int out_fd, int err_fd) {
+    (void)argc; (void)in_fd; (void)out_fd; (void)err_fd;
+    module_require(MODULE_AI);
+    ParsedCommand cmd = { .args = argv };
+    return handle_ai_command(&cmd) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Sorted by name for bsearch. Builtins that change the shell itself run in a
+// subshell inside $(...), as they would in other shells.
+static const Builtin builtins[] = {
+    { "[",           builtin_test,        false, false },
+    { "ask",         builtin_ai,          true,  true  },
+    { "bg",          builtin_bg,          true,  true  },
+    { "cd",          builtin_cd,          false, true  },
+    { "echo",        builtin_echo,        false, false },
+    { "exit",        builtin_exit,        false, true  },
+    { "explain",     builtin_ai,          true,  true  },
+    { "export",      builtin_export,      false, true  },
+    { "false",       builtin_false,       false, false },
+    { "fg",          builtin_fg,          true,  true  },
+    { "fix",         builtin_ai,          true,  true  },
+    { "hash",        builtin_hash,        true,  false },
+    { "install-pkg", builtin_install_pkg, true,  true  },
+    { "jobs",        builtin_jobs,        true,  false },
+    { "last-stats",  builtin_last_stats,  false, false },
+    { "parse-cache", builtin_parse_cache, false, false },
+    { "printf",      builtin_printf,      false, false },
+    { "pwd",         builtin_pwd,         false, false },
+    { "set-api-key", builtin_ai,          true,  true  },
+    { "test",        builtin_test,        false, false },
+    { "theme",       builtin_theme,       true,  true  },
+    { "true",        builtin_true,        false, false },
+    { "wait",        builtin_wait,        true,  true  },
+};
+
+static int compare_builtin(const void *key, const void *entry) {
+    return strcmp((const char *)key, ((const Builtin *)entry)->name);
+}
+
+const Builtin *find_builtin(const char *name) {
+    if (!name) return NULL;
+    return bsearch(name, builtins, sizeof(builtins) / sizeof(builtins[0]),
+                   sizeof(Builtin), compare_builtin);
+}
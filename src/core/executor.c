@@ -5,7 +5,10 @@
 #include <nutshell/utils.h>
 #include <nutshell/config.h>  // Add this include for reload_directory_config
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <time.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <errno.h>
 #include <unistd.h>
 #include <string.h>
@@ -16,16 +19,16 @@
 #define EXEC_DEBUG(fmt, ...) \
     do { if (getenv("NUT_DEBUG_EXEC")) fprintf(stderr, "EXEC: " fmt "\n", ##__VA_ARGS__); } while(0)
 
-// Forward declarations
-extern int install_pkg_command(int argc, char **argv);
+static void execute_pipeline(ParsedCommand *cmd, CommandResult *result);
 
-// External declarations for AI commands
-extern int set_api_key_command(int argc, char **argv);
-extern int ask_ai_command(int argc, char **argv);
-extern int explain_command(int argc, char **argv);
-extern bool handle_ai_command(ParsedCommand *cmd);  // Add declaration for handle_ai_command
+// Exit statuses of every stage of the last foreground command
+static int *pipeline_status = NULL;
+static size_t pipeline_status_count = 0;
 
-static void handle_redirection(ParsedCommand *cmd);
+// Status and resource usage of the last command, for `$?` and `last-stats`
+static CommandResult last_result = { 0 };
+// Exit status of the last command substitution
+static int substitution_status = 0;
 
 // Add this function at the top of the file with other helper functions
 bool is_terminal_control_command(const char *cmd) {
@@ -54,108 +57,485 @@ static void debug_print_command(ParsedCommand *cmd) {
         EXEC_DEBUG("  Arg %d: '%s'", i, cmd->args[i]);
     }
     
-    if (cmd->input_file) {
-        EXEC_DEBUG("  Input from: %s", cmd->input_file);
-    }
-    if (cmd->output_file) {
-        EXEC_DEBUG("  Output to: %s", cmd->output_file);
+    static const char *redir_names[] = { "<", ">", ">>", ">&", ">&-", "<<" };
+    for (Redirection *redir = cmd->redirs; redir; redir = redir->next) {
+        if (redir->type == REDIR_DUP) {
+            EXEC_DEBUG("  Redirect: %d>&%d", redir->fd, redir->source_fd);
+        } else {
+            EXEC_DEBUG("  Redirect: %d%s %s", redir->fd, redir_names[redir->type],
+                       redir->type == REDIR_HERE ? "(here-document)" : redir->target ? redir->target : "");
+        }
     }
     if (cmd->background) {
         EXEC_DEBUG("  Running in background");
     }
 }
 
-void execute_command(ParsedCommand *cmd) {
-    if (!cmd || !cmd->args[0]) return;
+static void set_pipeline_status(const int *statuses, size_t count) {
+    int *copy = malloc(count * sizeof(int));
+    if (!copy) return;
+    memcpy(copy, statuses, count * sizeof(int));
     
-    debug_print_command(cmd);
+    free(pipeline_status);
+    pipeline_status = copy;
+    pipeline_status_count = count;
+}
 
-    // Handle builtin commands without forking
-    if (strcmp(cmd->args[0], "cd") == 0) {
-        if (cmd->args[1]) {
-            if (chdir(cmd->args[1]) == 0) {
-                // Successfully changed directory, reload directory-specific config
-                reload_directory_config();
+const int *get_pipeline_status(size_t *count) {
+    if (count) *count = pipeline_status_count;
+    return pipeline_status;
+}
+
+const CommandResult *get_last_result() {
+    return &last_result;
+}
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static double timeval_ms(struct timeval tv) {
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+// Fold the rusage of one reaped process (or of an in-process builtin, given as
+// a before/after pair) into the command's result
+static void add_rusage(CommandResult *result, const struct rusage *ru, const struct rusage *before) {
+    result->user_ms += timeval_ms(ru->ru_utime) - (before ? timeval_ms(before->ru_utime) : 0);
+    result->sys_ms += timeval_ms(ru->ru_stime) - (before ? timeval_ms(before->ru_stime) : 0);
+    result->minor_faults += ru->ru_minflt - (before ? before->ru_minflt : 0);
+    result->major_faults += ru->ru_majflt - (before ? before->ru_majflt : 0);
+    if (ru->ru_maxrss > result->max_rss_kb) {
+        result->max_rss_kb = ru->ru_maxrss;
+    }
+}
+
+// Convert a waitpid() status into a shell-style exit code
+static int status_to_exit_code(int status) {
+    if (WIFEXITED(status)) {
+        EXEC_DEBUG("Child exited with status %d", WEXITSTATUS(status));
+        return WEXITSTATUS(status);
+    }
+    if (WIFSIGNALED(status)) {
+        EXEC_DEBUG("Child killed by signal %d", WTERMSIG(status));
+        return 128 + WTERMSIG(status);
+    }
+    if (WIFSTOPPED(status)) {
+        EXEC_DEBUG("Child stopped by signal %d", WSTOPSIG(status));
+        return 128 + WSTOPSIG(status);
+    }
+    return EXIT_FAILURE;
+}
+
+// Record the final waitpid() status of the command (its last stage)
+static void set_result_status(CommandResult *result, int status) {
+    result->exit_code = status_to_exit_code(status);
+    result->stopped = WIFSTOPPED(status);
+    result->signal = WIFSIGNALED(status) ? WTERMSIG(status) :
+                     WIFSTOPPED(status) ? WSTOPSIG(status) : 0;
+}
+
+// Growable string and argument vector used while expanding arguments
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} ExpandBuf;
+
+typedef struct {
+    char **items;
+    size_t count;
+    size_t capacity;
+} ExpandArgs;
+
+static bool expand_append(ExpandBuf *buf, const char *text, size_t len) {
+    if (buf->length + len + 1 > buf->capacity) {
+        size_t capacity = buf->capacity ? buf->capacity : 64;
+        while (buf->length + len + 1 > capacity) capacity *= 2;
+        char *grown = realloc(buf->data, capacity);
+        if (!grown) return false;
+        buf->data = grown;
+        buf->capacity = capacity;
+    }
+    memcpy(buf->data + buf->length, text, len);
+    buf->length += len;
+    buf->data[buf->length] = '\0';
+    return true;
+}
+
+// Move the word being built into the argument vector
+static bool expand_push(ExpandArgs *args, ExpandBuf *buf) {
+    if (args->count + 2 > args->capacity) {
+        size_t capacity = args->capacity ? args->capacity * 2 : 8;
+        char **grown = realloc(args->items, capacity * sizeof(char *));
+        if (!grown) return false;
+        args->items = grown;
+        args->capacity = capacity;
+    }
+    args->items[args->count++] = buf->data ? buf->data : strdup("");
+    args->items[args->count] = NULL;
+    buf->data = NULL;
+    buf->length = buf->capacity = 0;
+    return args->items[args->count - 1] != NULL;
+}
+
+static bool is_field_separator(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+// Splice unquoted substitution output into the word being built, splitting
+// it into words on blanks and newlines. `*in_word` tracks whether a word has
+// been started, so output that is empty or all blanks adds no argument.
+static bool expand_fields(ExpandArgs *args, ExpandBuf *buf, bool *in_word, const char *output) {
+    const char *p = output;
+    while (*p) {
+        if (is_field_separator(*p)) {
+            while (is_field_separator(*p)) p++;
+            if (*in_word && !expand_push(args, buf)) return false;
+            *in_word = false;
+            continue;
+        }
+        size_t len = 0;
+        while (p[len] && !is_field_separator(p[len])) len++;
+        if (!expand_append(buf, p, len)) return false;
+        *in_word = true;
+        p += len;
+    }
+    return true;
+}
+
+// Expand `$?` and command substitutions. Returns a new argument array (which
+// may be empty), or NULL when nothing needs expanding.
+static char **expand_args(const ParsedCommand *cmd) {
+    if (!cmd->subs) return NULL;
+    
+    ExpandArgs args = { 0 };
+    ExpandBuf buf = { 0 };
+    const Substitution *sub = cmd->subs;
+    bool ok = true;
+    for (int i = 0; cmd->args[i] && ok; i++) {
+        const char *text = cmd->args[i];
+        if (!sub || sub->arg != i) {
+            ok = expand_append(&buf, text, strlen(text)) && expand_push(&args, &buf);
+            continue;
+        }
+        
+        // Substitutions run in order; their output is spliced between the
+        // pieces of literal text around them
+        size_t pos = 0;
+        bool in_word = false;
+        for (; ok && sub && sub->arg == i; sub = sub->next) {
+            if (sub->offset > pos) {
+                ok = expand_append(&buf, text + pos, sub->offset - pos);
+                in_word = true;
+                pos = sub->offset;
+            }
+            if (ok && !sub->command) {
+                // `$?`: digits, never split
+                char status[16];
+                int status_len = snprintf(status, sizeof(status), "%d", last_result.exit_code);
+                ok = expand_append(&buf, status, (size_t)status_len);
+                in_word = true;
+                continue;
+            }
+            char *output = ok ? run_substitution(sub->command, &substitution_status) : NULL;
+            if (!output) {
+                ok = false;
+            } else if (sub->quoted) {
+                ok = expand_append(&buf, output, strlen(output));
+                in_word = true;
+            } else {
+                ok = expand_fields(&args, &buf, &in_word, output);
             }
+            free(output);
         }
-        return;
+        if (ok && text[pos]) {
+            ok = expand_append(&buf, text + pos, strlen(text + pos));
+            in_word = true;
+        }
+        if (ok && in_word) ok = expand_push(&args, &buf);
+    }
+    free(buf.data);
+    
+    if (ok && !args.items) {
+        // Every argument expanded to nothing
+        args.items = calloc(1, sizeof(char *));
+    }
+    if (!ok) {
+        for (size_t i = 0; i < args.count; i++) free(args.items[i]);
+        free(args.items);
+        // Run nothing rather than the unexpanded command
+        return calloc(1, sizeof(char *));
     }
-     
-    if (strcmp(cmd->args[0], "exit") == 0) {
-        exit(EXIT_SUCCESS);
+    return args.items;
+}
+
+static void free_expanded_args(char **args) {
+    if (!args) return;
+    for (int i = 0; args[i]; i++) {
+        free(args[i]);
     }
+    free(args);
+}
+
+// Look a command up in the builtin table, following registry aliases such as
+// `hop` for `cd`
+static const Builtin *resolve_builtin(const char *name) {
+    const Builtin *builtin = find_builtin(name);
+    if (builtin) return builtin;
     
-    if (strcmp(cmd->args[0], "install-pkg") == 0) {
-        int argc = 0;
-        while (cmd->args[argc]) argc++;
-        install_pkg_command(argc, cmd->args);
-        return;
+    const CommandMapping *mapping = find_command(name);
+    if (mapping && mapping->is_builtin) {
+        return find_builtin(mapping->unix_cmd);
     }
+    return NULL;
+}
 
-    // Handle AI commands
-    if (strcmp(cmd->args[0], "set-api-key") == 0 ||
-        strcmp(cmd->args[0], "ask") == 0 ||
-        strcmp(cmd->args[0], "explain") == 0 ||
-        strcmp(cmd->args[0], "fix") == 0) {
-        handle_ai_command(cmd);
-        return;
+// Look up every stage ahead of time, so a command kept in the parse cache
+// skips the builtin and registry searches when it runs again. Stages whose
+// name is only known after expansion are left to run time.
+void resolve_command(ParsedCommand *cmd) {
+    for (ParsedCommand *node = cmd; node; node = node->next) {
+        for (ParsedCommand *stage = node; stage; stage = stage->pipe_next) {
+            if (!stage->args || !stage->args[0] || strchr(stage->args[0], '$') ||
+                (stage->subs && stage->subs->arg == 0)) continue;
+            stage->builtin = resolve_builtin(stage->args[0]);
+            stage->mapping = stage->builtin ? NULL : find_command(stage->args[0]);
+            stage->resolved = true;
+            stage->resolved_generation = registry_generation();
+        }
     }
+}
 
-    // Special handling for terminal control commands
-    if (is_terminal_control_command(cmd->args[0])) {
-        EXEC_DEBUG("Directly executing terminal command: %s", cmd->args[0]);
-        
-        // Create the full command with arguments
-        char full_cmd[1024] = {0};
-        for (int i = 0; cmd->args[i]; i++) {
-            if (i > 0) strcat(full_cmd, " ");
-            strcat(full_cmd, cmd->args[i]);
+// A stage's lookups from resolve_command(), as long as the registry has not
+// changed since
+static bool stage_resolved(const ParsedCommand *cmd) {
+    return cmd->resolved && cmd->resolved_generation == registry_generation();
+}
+
+static const Builtin *stage_builtin(const ParsedCommand *cmd) {
+    return stage_resolved(cmd) ? cmd->builtin : resolve_builtin(cmd->args[0]);
+}
+
+static const CommandMapping *stage_mapping(const ParsedCommand *cmd) {
+    return stage_resolved(cmd) ? cmd->mapping : find_command(cmd->args[0]);
+}
+
+bool command_changes_shell(ParsedCommand *cmd) {
+    for (ParsedCommand *node = cmd; node; node = node->next) {
+        for (ParsedCommand *stage = node; stage; stage = stage->pipe_next) {
+            // A name only known after expansion could be anything
+            if (strchr(stage->args[0], '$') || (stage->subs && stage->subs->arg == 0)) return true;
+            const Builtin *builtin = stage_builtin(stage);
+            if (builtin && builtin->changes_shell) return true;
+        }
+    }
+    return false;
+}
+
+// Descriptors a builtin's redirections can refer to; only the first three
+// are handed to the builtin, higher ones are used as they are
+#define BUILTIN_FD_SLOTS 10
+
+// Run a builtin with stdin, stdout and stderr pointed at other descriptors
+// (-1 closes one) for the duration
+static int run_stdio_builtin(const Builtin *builtin, int argc, char **argv, const int fds[3]) {
+    int saved[3] = { -1, -1, -1 }, source[3] = { -1, -1, -1 };
+    fflush(stdout);
+    fflush(stderr);
+    // Copy every source before replacing anything, since one may be another
+    // of the three
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] == i) continue;
+        saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+        if (fds[i] >= 0) source[i] = fcntl(fds[i], F_DUPFD_CLOEXEC, 3);
+    }
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] == i) continue;
+        if (source[i] >= 0) {
+            dup2(source[i], i);
+            close(source[i]);
+        } else {
+            close(i);
+        }
+    }
+    
+    int status = builtin->run(argc, argv, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO);
+    
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < 3; i++) {
+        if (fds[i] == i) continue;
+        if (saved[i] >= 0) {
+            dup2(saved[i], i);
+            close(saved[i]);
+        } else {
+            close(i);
+        }
+    }
+    return status;
+}
+
+// Work out the descriptors a builtin's redirections lead to, without
+// touching the shell's own. Files and here-documents opened on the way are
+// added to `opened` for the caller to close. Returns false after reporting
+// the first redirection that fails.
+static bool builtin_redirections(const Redirection *redir, int fds[BUILTIN_FD_SLOTS],
+                                 int *opened, size_t *opened_count) {
+    for (; redir; redir = redir->next) {
+        int fd;
+        switch (redir->type) {
+        case REDIR_INPUT:
+            fd = open(redir->target, O_RDONLY | O_CLOEXEC);
+            break;
+        case REDIR_OUTPUT:
+            fd = open(redir->target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            break;
+        case REDIR_APPEND:
+            fd = open(redir->target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            break;
+        case REDIR_HERE:
+            fd = open_here_doc(redir->target);
+            if (fd < 0) {
+                perror("here-document");
+                return false;
+            }
+            break;
+        case REDIR_DUP:
+            fd = redir->source_fd < BUILTIN_FD_SLOTS ? fds[redir->source_fd] : redir->source_fd;
+            if (fd < 0 || fcntl(fd, F_GETFD) == -1) {
+                fprintf(stderr, "%d: %s\n", redir->source_fd, strerror(EBADF));
+                return false;
+            }
+            if (redir->fd < BUILTIN_FD_SLOTS) fds[redir->fd] = fd;
+            continue;
+        case REDIR_CLOSE:
+            if (redir->fd < BUILTIN_FD_SLOTS) fds[redir->fd] = -1;
+            continue;
+        default:
+            continue;
         }
         
-        // Execute the command directly
-        system(full_cmd);
-        return;
+        if (fd < 0) {
+            perror(redir->target);
+            return false;
+        }
+        opened[(*opened_count)++] = fd;
+        if (redir->fd < BUILTIN_FD_SLOTS) fds[redir->fd] = fd;
+    }
+    return true;
+}
+
+// Run shell builtins in the current process, redirections included. Returns
+// false if the command is not a builtin; otherwise stores its status and
+// returns true.
+static bool run_builtin(ParsedCommand *cmd, int *status) {
+    const Builtin *builtin = stage_builtin(cmd);
+    if (!builtin) return false;
+    
+    int argc = 0;
+    while (cmd->args[argc]) argc++;
+    
+    int fds[BUILTIN_FD_SLOTS];
+    for (int i = 0; i < BUILTIN_FD_SLOTS; i++) fds[i] = i;
+    
+    size_t redir_count = 0, opened_count = 0;
+    for (const Redirection *r = cmd->redirs; r; r = r->next) redir_count++;
+    int *opened = redir_count ? malloc(redir_count * sizeof(int)) : NULL;
+    if (redir_count && (!opened || !builtin_redirections(cmd->redirs, fds, opened, &opened_count))) {
+        for (size_t i = 0; i < opened_count; i++) close(opened[i]);
+        free(opened);
+        *status = EXIT_FAILURE;
+        return true;
+    }
+    
+    EXEC_DEBUG("Running builtin %s in-process", builtin->name);
+    if (builtin->uses_stdio) {
+        *status = run_stdio_builtin(builtin, argc, cmd->args, fds);
+    } else {
+        // Anything printed before this point must reach the terminal first
+        fflush(stdout);
+        *status = builtin->run(argc, cmd->args, fds[0], fds[1], fds[2]);
+    }
+    
+    for (size_t i = 0; i < opened_count; i++) close(opened[i]);
+    free(opened);
+    return true;
+}
+
+// A package's command template with the arguments spliced in. Words that are
+// exactly `$1`..`$9` or `$@` take the arguments; without any, the arguments
+// follow the template.
+static char **splice_template(char *const *words, char *const *args) {
+    int argc = 0;
+    while (args[argc]) argc++;
+    size_t count = 0, all_count = 0;
+    for (; words[count]; count++) {
+        if (strcmp(words[count], "$@") == 0) all_count++;
     }
+    
+    char **spliced = calloc(count + (all_count + 1) * argc + 1, sizeof(char *));
+    if (!spliced) return NULL;
+    size_t n = 0;
+    bool placeholders = false;
+    for (size_t i = 0; i < count; i++) {
+        const char *word = words[i];
+        if (strcmp(word, "$@") == 0) {
+            placeholders = true;
+            for (int j = 1; j < argc; j++) spliced[n++] = strdup(args[j]);
+        } else if (word[0] == '$' && word[1] >= '1' && word[1] <= '9' && !word[2]) {
+            placeholders = true;
+            int j = word[1] - '0';
+            if (j < argc) spliced[n++] = strdup(args[j]);
+        } else {
+            spliced[n++] = strdup(word);
+        }
+    }
+    for (int j = 1; !placeholders && j < argc; j++) {
+        spliced[n++] = strdup(args[j]);
+    }
+    return spliced;
+}
 
-    // Look up the command in our registry
-    const CommandMapping *mapping = find_command(cmd->args[0]);
+// Resolve a command through the registry into the argument array handed to exec
+static char **build_exec_args(ParsedCommand *cmd, const CommandMapping **mapping_out) {
+    const CommandMapping *mapping = stage_mapping(cmd);
     if (getenv("NUT_DEBUG_EXEC") && mapping) {
         EXEC_DEBUG("Command '%s' found in registry as '%s' (builtin: %s)", 
                 cmd->args[0], mapping->unix_cmd, 
                 mapping->is_builtin ? "yes" : "no");
     }
     
-    // Create a clean array for arguments
-    char *clean_args[MAX_ARGS];
+    int argc = 0;
+    while (cmd->args[argc]) argc++;
+    
+    char **clean_args = NULL;
     int i = 0;
     
-    if (mapping) {
-        EXEC_DEBUG("Using mapped command %s (builtin: %s)", 
-                mapping->unix_cmd, mapping->is_builtin ? "yes" : "no");
-        
-        if (mapping->is_builtin) {
-            // For system commands (builtins), replace the command name but keep arg structure
-            clean_args[0] = strdup(mapping->unix_cmd);
-            for (i = 1; cmd->args[i] && i < MAX_ARGS - 1; i++) {
-                clean_args[i] = strdup(cmd->args[i]);
-                EXEC_DEBUG("  Arg %d: '%s'", i, clean_args[i]); // Debug: print each arg
-            }
-        } else {
-            // For custom scripts, use the script path as command and preserve original args
-            clean_args[0] = strdup(mapping->unix_cmd);
-            for (i = 1; cmd->args[i] && i < MAX_ARGS - 1; i++) {
-                clean_args[i] = strdup(cmd->args[i]);
-                EXEC_DEBUG("  Arg %d: '%s'", i, clean_args[i]); // Debug: print each arg
-            }
+    if (mapping && mapping->args) {
+        // Manifest commands run their template directly, no script involved
+        clean_args = splice_template(mapping->args, cmd->args);
+        if (!clean_args) return NULL;
+    } else if (!(clean_args = calloc(argc + 1, sizeof(char *)))) {
+        return NULL;
+    } else if (mapping) {
+        // Builtins keep their arguments under the mapped command name; custom
+        // scripts use the script path as the command and preserve the arguments
+        clean_args[0] = strdup(mapping->unix_cmd);
+        for (i = 1; cmd->args[i]; i++) {
+            clean_args[i] = strdup(cmd->args[i]);
+            EXEC_DEBUG("  Arg %d: '%s'", i, clean_args[i]);
         }
     } else {
         // Regular system command - keep all args unchanged
-        for (i = 0; cmd->args[i] && i < MAX_ARGS - 1; i++) {
+        for (i = 0; cmd->args[i]; i++) {
             clean_args[i] = strdup(cmd->args[i]);
-            EXEC_DEBUG("  Arg %d: '%s'", i, clean_args[i]); // Debug: print each arg
+            EXEC_DEBUG("  Arg %d: '%s'", i, clean_args[i]);
         }
+        clean_args[i] = NULL;  // Ensure NULL termination
     }
-    clean_args[i] = NULL;  // Ensure NULL termination
     
     if (getenv("NUT_DEBUG_EXEC")) {
         EXEC_DEBUG("Final command array:");
@@ -163,79 +543,365 @@ void execute_command(ParsedCommand *cmd) {
             EXEC_DEBUG("  clean_args[%d] = '%s'", j, clean_args[j]);
         }
     }
+    
+    *mapping_out = mapping;
+    return clean_args;
+}
+
+static void free_exec_args(char **clean_args) {
+    if (!clean_args) return;
+    for (int j = 0; clean_args[j]; j++) {
+        free(clean_args[j]);
+    }
+    free(clean_args);
+}
 
-    // Fork and execute
-    pid_t pid = fork();
+// Describe how to launch a resolved command: custom scripts are executed by
+// path, everything else (manifest templates included) through the PATH cache
+// so repeated commands skip the directory walk
+static LaunchSpec launch_spec_for(ParsedCommand *cmd, char **clean_args,
+                                  const CommandMapping *mapping) {
+    bool use_path = !(mapping && !mapping->is_builtin && !mapping->args);
+    LaunchSpec spec = {
+        .argv = clean_args,
+        .use_path = use_path,
+        .path = use_path ? path_cache_lookup(clean_args[0]) : NULL,
+        .redirs = cmd->redirs,
+        .stdin_fd = -1,
+        .stdout_fd = -1,
+        .pgid = -1,
+        .detach_output = false,
+    };
+    return spec;
+}
+
+// Command line as shown by `jobs`
+static char *describe_command(ParsedCommand *cmd) {
+    size_t len = 1;
+    for (ParsedCommand *stage = cmd; stage; stage = stage->pipe_next) {
+        for (int i = 0; stage->args[i]; i++) len += strlen(stage->args[i]) + 1;
+        len += 3;
+    }
+    
+    char *text = malloc(len);
+    if (!text) return NULL;
+    text[0] = '\0';
+    for (ParsedCommand *stage = cmd; stage; stage = stage->pipe_next) {
+        if (stage != cmd) strcat(text, " | ");
+        for (int i = 0; stage->args[i]; i++) {
+            if (i > 0) strcat(text, " ");
+            strcat(text, stage->args[i]);
+        }
+    }
+    return text;
+}
+
+// Put launched processes in the job table: background jobs when they start,
+// foreground ones once they are stopped
+static void add_job(ParsedCommand *cmd, pid_t pgid, const pid_t *pids, size_t count, JobState state) {
+    char *text = describe_command(cmd);
+    int id = jobs_add(pgid, pids, count, text, state);
+    free(text);
+    if (id < 0) return;
+    
+    if (state == JOB_STOPPED) {
+        // The stopped job keeps writing into the relay once it is resumed
+        output_relay_keep_running();
+        printf("\n");
+        jobs_notify();
+    } else if (job_control_enabled()) {
+        fprintf(stderr, "[%d] %d\n", id, pids[count - 1]);
+    }
+}
+
+// Run the command and everything it needs in the foreground. `cmd` is not
+// modified; `$?` and substitutions are expanded into a private copy.
+static void run_command(ParsedCommand *cmd, CommandResult *result) {
+    // Multi-stage pipelines run every stage concurrently; a builtin sent to
+    // the background takes the same route so it runs in its own child
+    if (cmd->pipe_next || (cmd->background && stage_builtin(cmd))) {
+        execute_pipeline(cmd, result);
+        return;
+    }
+
+    ParsedCommand view = *cmd;
+    char **expanded = expand_args(cmd);
+    if (expanded) view.args = expanded;
+    if (!view.args[0]) {
+        // Only substitutions that printed nothing: keep their status
+        result->exit_code = substitution_status;
+        set_pipeline_status(&result->exit_code, 1);
+        free_expanded_args(expanded);
+        return;
+    }
+
+    // Handle builtin commands without forking
+    int builtin_status;
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+    if (run_builtin(&view, &builtin_status)) {
+        getrusage(RUSAGE_SELF, &after);
+        add_rusage(result, &after, &before);
+        result->exit_code = builtin_status;
+        set_pipeline_status(&builtin_status, 1);
+        free_expanded_args(expanded);
+        return;
+    }
+
+    // Look up the command in our registry and build the exec arguments
+    const CommandMapping *mapping = NULL;
+    char **clean_args = build_exec_args(&view, &mapping);
+    free_expanded_args(expanded);
+    if (!clean_args) {
+        result->exit_code = EXIT_FAILURE;
+        return;
+    }
+
+    // Jobs get their own process group: background ones so terminal signals
+    // do not reach them, foreground ones so they can be handed the terminal
+    bool interactive = job_control_enabled();
+    LaunchSpec spec = launch_spec_for(cmd, clean_args, mapping);
+    spec.pgid = cmd->background || interactive ? 0 : -1;
+    // Background jobs outlive the output relay, so they write to the terminal
+    spec.detach_output = cmd->background;
+    
+    int exit_status;
+    pid_t pid = launch_process(&spec, get_spawn_backend(), &exit_status);
+    if (pid > 0 && spec.pgid == 0) {
+        // Set the group here too to avoid racing the child
+        setpgid(pid, pid);
+    }
     
     if (pid < 0) {
-        perror("fork");
-        goto cleanup;
+        result->exit_code = exit_status;
+    } else if (cmd->background) {
+        add_job(cmd, pid, &pid, 1, JOB_RUNNING);
+    } else {
+        int status;
+        struct rusage usage;
+        if (interactive) give_terminal_to(pid);
+        if (wait4(pid, &status, WUNTRACED, &usage) == pid) {
+            set_result_status(result, status);
+            if (!WIFSTOPPED(status)) add_rusage(result, &usage, NULL);
+        } else {
+            result->exit_code = EXIT_FAILURE;
+        }
+        if (interactive) give_terminal_to(getpgrp());
+        if (result->stopped) {
+            add_job(cmd, spec.pgid == 0 ? pid : 0, &pid, 1, JOB_STOPPED);
+        }
     }
+    set_pipeline_status(&result->exit_code, 1);
+
+    // Free the argument array in the parent
+    free_exec_args(clean_args);
+}
+
+// Run one pipeline of a command list and make it the last result
+static CommandResult execute_pipeline_node(ParsedCommand *cmd) {
+    CommandResult result = { 0 };
+    debug_print_command(cmd);
     
-    if (pid == 0) { // Child process
-        // Set up any redirections
-        handle_redirection(cmd);
+    double start = now_ms();
+    run_command(cmd, &result);
+    result.wall_ms = now_ms() - start;
+    
+    EXEC_DEBUG("Finished with status %d in %.3f ms (user %.3f ms, sys %.3f ms, max RSS %ld KB)",
+               result.exit_code, result.wall_ms, result.user_ms, result.sys_ms, result.max_rss_kb);
+    last_result = result;
+    return result;
+}
+
+// Run a command list. `&&` and `||` are decided from the real exit status of
+// the previous pipeline; a skipped pipeline leaves that status in place, so
+// `false && a || b` runs b. Returns the result of the last pipeline run.
+CommandResult execute_command(ParsedCommand *cmd) {
+    CommandResult result = { 0 };
+    if (!cmd || !cmd->args[0]) return result;
+    
+    result = execute_pipeline_node(cmd);
+    for (ParsedCommand *node = cmd; node->next; node = node->next) {
+        bool run = node->connector == CONNECT_SEQ ||
+                   (node->connector == CONNECT_AND && result.exit_code == 0) ||
+                   (node->connector == CONNECT_OR && result.exit_code != 0);
+        if (!run) {
+            EXEC_DEBUG("Skipping '%s' (status %d)", node->next->args[0], result.exit_code);
+            continue;
+        }
+        result = execute_pipeline_node(node->next);
+    }
+    return result;
+}
+
+// Run `a | b | c`: every stage starts at once, connected by close-on-exec
+// pipes, in one process group that owns the terminal while it runs
+static void execute_pipeline(ParsedCommand *cmd, CommandResult *result) {
+    size_t stage_count = 0;
+    for (ParsedCommand *stage = cmd; stage; stage = stage->pipe_next) {
+        stage_count++;
+    }
+    
+    pid_t *pids = calloc(stage_count, sizeof(pid_t));
+    int *statuses = calloc(stage_count, sizeof(int));
+    if (!pids || !statuses) {
+        free(pids);
+        free(statuses);
+        result->exit_code = EXIT_FAILURE;
+        return;
+    }
+    
+    bool interactive = job_control_enabled();
+    pid_t pgid = 0;
+    int prev_read = -1;
+    size_t launched = 0;
+    
+    EXEC_DEBUG("Starting pipeline with %zu stages", stage_count);
+    
+    ParsedCommand *stage = cmd;
+    for (size_t i = 0; i < stage_count; i++, stage = stage->pipe_next) {
+        ParsedCommand view = *stage;
+        char **expanded = expand_args(stage);
+        if (expanded) view.args = expanded;
+        bool empty = !view.args[0];
         
-        if (mapping && !mapping->is_builtin) {
-            // For custom scripts, use direct execution with path
-            EXEC_DEBUG("Executing script with execv: %s", clean_args[0]);
-            execv(clean_args[0], clean_args);
-        } else {
-            // For system commands and built-ins, use PATH lookup
-            EXEC_DEBUG("Executing command with execvp: %s", clean_args[0]);
-            execvp(clean_args[0], clean_args);
+        int fds[2] = { -1, -1 };
+        if (stage->pipe_next && pipe2(fds, O_CLOEXEC) != 0) {
+            perror("pipe2");
+            free_expanded_args(expanded);
+            break;
         }
         
-        // If we get here, execution failed
-        fprintf(stderr, "ERROR: Failed to execute '%s': %s\n", 
-                clean_args[0], strerror(errno));
+        LaunchSpec spec = {
+            .redirs = stage->redirs,
+            .stdin_fd = prev_read,
+            .stdout_fd = fds[1],
+            .pgid = pgid,
+            .detach_output = cmd->background,
+        };
         
-        // Free memory before exit
-        for (int j = 0; clean_args[j]; j++) {
-            free(clean_args[j]);
+        pid_t pid;
+        if (empty) {
+            // Only substitutions that printed nothing: nothing to start
+            statuses[i] = substitution_status;
+            pid = -1;
+        } else if (stage_builtin(&view)) {
+            // Builtins have to run in a forked child to take part in the pipe.
+            // Flush first so the child does not repeat our buffered output.
+            fflush(stdout);
+            pid = fork();
+            if (pid == 0) {
+                // Drop our copy of the read end so the stage sees SIGPIPE/EOF
+                // properly; builtins never exec, so O_CLOEXEC does not help
+                if (fds[0] != -1) close(fds[0]);
+                launch_setup_child(&spec);
+                
+                // launch_setup_child() already applied the redirections
+                view.redirs = NULL;
+                int status = EXIT_FAILURE;
+                run_builtin(&view, &status);
+                fflush(stdout);
+                fflush(stderr);
+                _exit(status);
+            }
+            if (pid < 0) perror("fork");
+        } else {
+            const CommandMapping *mapping = NULL;
+            char **clean_args = build_exec_args(&view, &mapping);
+            if (clean_args) {
+                LaunchSpec exec_spec = launch_spec_for(stage, clean_args, mapping);
+                exec_spec.stdin_fd = spec.stdin_fd;
+                exec_spec.stdout_fd = spec.stdout_fd;
+                exec_spec.pgid = spec.pgid;
+                exec_spec.detach_output = spec.detach_output;
+                pid = launch_process(&exec_spec, get_spawn_backend(), &statuses[i]);
+                free_exec_args(clean_args);
+            } else {
+                pid = -1;
+            }
         }
+        free_expanded_args(expanded);
         
-        exit(EXIT_FAILURE);
-    } else {
-        // Parent process
-        if (!cmd->background) {
-            int status;
-            waitpid(pid, &status, 0);
-            if (getenv("NUT_DEBUG_EXEC")) {
-                if (WIFEXITED(status)) {
-                    EXEC_DEBUG("Child exited with status %d", WEXITSTATUS(status));
-                } else if (WIFSIGNALED(status)) {
-                    EXEC_DEBUG("Child killed by signal %d", WTERMSIG(status));
-                }
+        if (pid < 0) {
+            // The stage never ran; keep going so the rest of the pipe drains
+            if (statuses[i] == 0 && !empty) statuses[i] = EXIT_FAILURE;
+            if (prev_read != -1) close(prev_read);
+            if (fds[1] != -1) close(fds[1]);
+            prev_read = fds[0];
+            pids[i] = -1;
+            continue;
+        }
+        
+        // Parent process: set the group here too to avoid racing the child
+        if (pgid == 0) pgid = pid;
+        setpgid(pid, pgid);
+        pids[i] = pid;
+        launched++;
+        EXEC_DEBUG("  Stage %zu '%s' started as pid %d (pgid %d)", i, stage->args[0], pid, pgid);
+        
+        if (prev_read != -1) close(prev_read);
+        if (fds[1] != -1) close(fds[1]);
+        prev_read = fds[0];
+    }
+    if (prev_read != -1) close(prev_read);
+    
+    if (cmd->background) {
+        EXEC_DEBUG("Pipeline running in background (pgid %d)", pgid);
+        if (launched > 0) {
+            pid_t *live = malloc(launched * sizeof(pid_t));
+            size_t n = 0;
+            for (size_t i = 0; live && i < stage_count; i++) {
+                if (pids[i] > 0) live[n++] = pids[i];
             }
+            if (live) add_job(cmd, pgid, live, n, JOB_RUNNING);
+            free(live);
         }
+        free(pids);
+        free(statuses);
+        return;
     }
-
-cleanup:
-    // Free the argument array in the parent
-    for (int j = 0; clean_args[j]; j++) {
-        free(clean_args[j]);
+    
+    if (interactive && launched > 0) {
+        give_terminal_to(pgid);
     }
-}
-
-static void handle_redirection(ParsedCommand *cmd) {
-    if (cmd->input_file) {
-        int fd = open(cmd->input_file, O_RDONLY);
-        if (fd == -1) {
-            perror("open");
-            exit(EXIT_FAILURE);
+    
+    bool stopped = false;
+    for (size_t i = 0; i < stage_count; i++) {
+        int status;
+        struct rusage usage;
+        if (pids[i] == 0) statuses[i] = EXIT_FAILURE;  // Never attempted
+        if (pids[i] <= 0) continue;
+        if (wait4(pids[i], &status, WUNTRACED, &usage) < 0) {
+            statuses[i] = EXIT_FAILURE;
+            continue;
         }
-        dup2(fd, STDIN_FILENO);
-        close(fd);
+        if (WIFSTOPPED(status)) {
+            stopped = true;
+        } else {
+            // Finished stages are not part of the job if the pipeline stops
+            add_rusage(result, &usage, NULL);
+            pids[i] = -1;
+        }
+        statuses[i] = status_to_exit_code(status);
+        // Like other shells, the pipeline's status is its last stage's
+        if (i == stage_count - 1) set_result_status(result, status);
+        EXEC_DEBUG("  Stage %zu exit status: %d", i, statuses[i]);
     }
+    result->exit_code = statuses[stage_count - 1];
     
-    if (cmd->output_file) {
-        int fd = open(cmd->output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-        if (fd == -1) {
-            perror("open");
-            exit(EXIT_FAILURE);
+    if (interactive && launched > 0) {
+        give_terminal_to(getpgrp());
+    }
+    if (stopped) {
+        // Whatever has not exited yet becomes a stopped job
+        size_t n = 0;
+        for (size_t i = 0; i < stage_count; i++) {
+            if (pids[i] > 0) pids[n++] = pids[i];
         }
-        dup2(fd, STDOUT_FILENO);
-        close(fd);
+        add_job(cmd, pgid, pids, n, JOB_STOPPED);
     }
-}
\ No newline at end of file
+    
+    set_pipeline_status(statuses, stage_count);
+    free(pids);
+    free(statuses);
+}
+
@@ -0,0 +1,545 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+#include <nutshell/core.h>
+#include <nutshell/utils.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// Job control debug macro
+#define JOBS_DEBUG(fmt, ...) \
+    do { if (getenv("NUT_DEBUG_JOBS")) fprintf(stderr, "JOBS: " fmt "\n", ##__VA_ARGS__); } while(0)
+
+typedef struct Job {
+    int id;
+    pid_t pgid;
+    pid_t *pids;
+    int *statuses;         // Last wait status of each process
+    bool *done;
+    size_t count;
+    char *command;
+    JobState state;
+    bool notified;         // The user has seen the current state
+    unsigned long touched; // Orders jobs for `%+` and `%-`
+    double started_ms;
+    double finished_ms;
+    CommandResult usage;   // Summed over the processes reaped so far
+} Job;
+
+static Job **jobs = NULL;
+static size_t job_count = 0;
+static size_t job_capacity = 0;
+static unsigned long touch_counter = 0;
+
+static bool job_control = false;
+static int sigchld_pipe[2] = { -1, -1 };
+
+#define IDLE_FDS_MAX 32
+
+// Other work readline's wait for input picks up
+static struct {
+    size_t (*fds)(int *fds, size_t max);
+    void (*ready)();
+} idle = { 0 };
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// SIGCHLD only pokes the self-pipe; the reaping itself happens outside the
+// handler, in jobs_reap()
+static void handle_sigchld(int sig) {
+    (void)sig;
+    int saved_errno = errno;
+    if (sigchld_pipe[1] >= 0) {
+        ssize_t ignored = write(sigchld_pipe[1], "c", 1);
+        (void)ignored;
+    }
+    errno = saved_errno;
+}
+
+bool job_control_enabled() {
+    return job_control && isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp();
+}
+
+// Make `pgid` the terminal's foreground process group. SIGTTOU is blocked so
+// the shell can take the terminal back while it sits in the background.
+void give_terminal_to(pid_t pgid) {
+    sigset_t block, old;
+    sigemptyset(&block);
+    sigaddset(&block, SIGTTOU);
+    sigprocmask(SIG_BLOCK, &block, &old);
+    tcsetpgrp(STDIN_FILENO, pgid);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+void jobs_init_batch() {
+    if (sigchld_pipe[0] < 0 && pipe2(sigchld_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        perror("pipe2");
+        sigchld_pipe[0] = sigchld_pipe[1] = -1;
+    }
+
+    struct sigaction sa;
+    sa.sa_handler = handle_sigchld;
+    sigemptyset(&sa.sa_mask);
+    // No SA_NOCLDSTOP: a background job stopping on terminal input matters too
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGCHLD, &sa, NULL);
+}
+
+void jobs_init() {
+    jobs_init_batch();
+    if (!isatty(STDIN_FILENO)) return;
+
+    // Wait until we are in the foreground, then take our own process group
+    // so jobs can be moved in and out of the foreground
+    pid_t pgrp;
+    while (tcgetpgrp(STDIN_FILENO) != (pgrp = getpgrp())) {
+        kill(-pgrp, SIGTTIN);
+    }
+
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    if (getpgrp() != getpid() && setpgid(0, 0) != 0) {
+        perror("setpgid");
+        return;
+    }
+    give_terminal_to(getpid());
+    job_control = true;
+    JOBS_DEBUG("Job control enabled (pgid %d)", getpid());
+}
+
+void jobs_enter_subshell() {
+    // Commands started from here stay in the subshell's process group,
+    // which is whatever the shell's was
+    job_control = false;
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    jobs_free();
+}
+
+static void free_job(Job *job) {
+    free(job->pids);
+    free(job->statuses);
+    free(job->done);
+    free(job->command);
+    free(job);
+}
+
+static void remove_job(Job *job) {
+    for (size_t i = 0; i < job_count; i++) {
+        if (jobs[i] == job) {
+            memmove(&jobs[i], &jobs[i + 1], (job_count - i - 1) * sizeof(Job *));
+            job_count--;
+            break;
+        }
+    }
+    free_job(job);
+}
+
+int jobs_add(pid_t pgid, const pid_t *pids, size_t count, const char *command, JobState state) {
+    if (job_count == job_capacity) {
+        size_t capacity = job_capacity ? job_capacity * 2 : 8;
+        Job **grown = realloc(jobs, capacity * sizeof(Job *));
+        if (!grown) return -1;
+        jobs = grown;
+        job_capacity = capacity;
+    }
+
+    Job *job = calloc(1, sizeof(Job));
+    if (!job) return -1;
+    job->pids = malloc(count * sizeof(pid_t));
+    job->statuses = calloc(count, sizeof(int));
+    job->done = calloc(count, sizeof(bool));
+    job->command = strdup(command ? command : "");
+    if (!job->pids || !job->statuses || !job->done || !job->command) {
+        free_job(job);
+        return -1;
+    }
+    memcpy(job->pids, pids, count * sizeof(pid_t));
+    job->count = count;
+    job->pgid = pgid;
+    job->state = state;
+    job->notified = state == JOB_RUNNING;
+    job->touched = ++touch_counter;
+    job->started_ms = now_ms();
+
+    // Like bash, a new job gets one more than the highest id in use
+    job->id = 1;
+    for (size_t i = 0; i < job_count; i++) {
+        if (jobs[i]->id >= job->id) job->id = jobs[i]->id + 1;
+    }
+    jobs[job_count++] = job;
+
+    JOBS_DEBUG("Added job %d (pgid %d, %zu processes): %s", job->id, pgid, count, job->command);
+    return job->id;
+}
+
+// Record a wait status for one process and update the job's state
+static void update_process(Job *job, size_t index, int status, const struct rusage *ru) {
+    job->statuses[index] = status;
+
+    if (WIFSTOPPED(status)) {
+        if (job->state != JOB_STOPPED) {
+            job->state = JOB_STOPPED;
+            job->notified = false;
+            job->touched = ++touch_counter;
+        }
+        return;
+    }
+    if (WIFCONTINUED(status)) {
+        job->state = JOB_RUNNING;
+        return;
+    }
+
+    job->done[index] = true;
+    if (ru) {
+        job->usage.user_ms += ru->ru_utime.tv_sec * 1000.0 + ru->ru_utime.tv_usec / 1000.0;
+        job->usage.sys_ms += ru->ru_stime.tv_sec * 1000.0 + ru->ru_stime.tv_usec / 1000.0;
+        if (ru->ru_maxrss > job->usage.max_rss_kb) job->usage.max_rss_kb = ru->ru_maxrss;
+    }
+
+    for (size_t i = 0; i < job->count; i++) {
+        if (!job->done[i]) return;
+    }
+    job->state = JOB_DONE;
+    job->notified = false;
+    job->finished_ms = now_ms();
+    JOBS_DEBUG("Job %d finished", job->id);
+}
+
+// Send a signal to the whole job. Without job control the processes share
+// the shell's process group, so they are signalled one by one.
+static int signal_job(Job *job, int sig) {
+    if (job->pgid > 0) return kill(-job->pgid, sig);
+
+    int result = 0;
+    for (size_t i = 0; i < job->count; i++) {
+        if (!job->done[i] && kill(job->pids[i], sig) != 0) result = -1;
+    }
+    return result;
+}
+
+// Exit code of a job: the status of its last process, as for pipelines
+static int job_exit_code(const Job *job) {
+    int status = job->statuses[job->count - 1];
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    if (WIFSTOPPED(status)) return 128 + WSTOPSIG(status);
+    return 0;
+}
+
+// Poll every process we launched as a job. Only known pids are waited for, so
+// foreground waits and popen()/system() callers never lose their children.
+void jobs_reap() {
+    if (sigchld_pipe[0] >= 0) {
+        char buf[64];
+        while (read(sigchld_pipe[0], buf, sizeof(buf)) > 0) {}
+    }
+
+    for (size_t j = 0; j < job_count; j++) {
+        Job *job = jobs[j];
+        for (size_t i = 0; i < job->count; i++) {
+            if (job->done[i]) continue;
+
+            int status;
+            struct rusage ru;
+            pid_t pid = wait4(job->pids[i], &status, WNOHANG | WUNTRACED | WCONTINUED, &ru);
+            if (pid == job->pids[i]) {
+                update_process(job, i, status, &ru);
+            } else if (pid < 0 && errno == ECHILD) {
+                // Someone else reaped it; treat it as finished
+                update_process(job, i, 0, NULL);
+            }
+        }
+    }
+}
+
+static const char *state_name(const Job *job) {
+    static char done[32];
+    switch (job->state) {
+    case JOB_RUNNING:
+        return "Running";
+    case JOB_STOPPED:
+        return "Stopped";
+    case JOB_DONE:
+    default:
+        if (job_exit_code(job) == 0) return "Done";
+        snprintf(done, sizeof(done), "Exit %d", job_exit_code(job));
+        return done;
+    }
+}
+
+// `+` marks the job fg/bg act on by default, `-` the one before it
+static Job *current_job(int which) {
+    Job *first = NULL, *second = NULL;
+    for (size_t i = 0; i < job_count; i++) {
+        Job *job = jobs[i];
+        if (job->state == JOB_DONE) continue;
+        if (!first || job->touched > first->touched) {
+            second = first;
+            first = job;
+        } else if (!second || job->touched > second->touched) {
+            second = job;
+        }
+    }
+    return which == 0 ? first : second;
+}
+
+static void print_job(const Job *job, bool long_format) {
+    char marker = job == current_job(0) ? '+' : job == current_job(1) ? '-' : ' ';
+    double end = job->state == JOB_DONE ? job->finished_ms : now_ms();
+
+    printf("[%d]%c  ", job->id, marker);
+    if (long_format) {
+        // Process group and CPU time of the processes that have exited so far
+        printf("%-7d cpu %6.2fs  ", job->pgid, (job->usage.user_ms + job->usage.sys_ms) / 1000.0);
+    }
+    printf("%-10s %8.1fs  %s%s\n", state_name(job), (end - job->started_ms) / 1000.0,
+           job->command, job->state == JOB_RUNNING ? " &" : "");
+}
+
+// Before each prompt: report jobs that stopped or finished since last time
+void jobs_notify() {
+    jobs_reap();
+    for (size_t i = 0; i < job_count; ) {
+        Job *job = jobs[i];
+        if (!job->notified && job->state != JOB_RUNNING) {
+            print_job(job, false);
+            job->notified = true;
+        }
+        if (job->state == JOB_DONE) {
+            remove_job(job);
+            continue;
+        }
+        i++;
+    }
+    fflush(stdout);
+}
+
+size_t jobs_active_count() {
+    return job_count;
+}
+
+// Parse a job spec: %n, %+, %%, %-, %prefix, or (for wait) a plain pid
+static Job *find_job(const char *spec, const char *builtin) {
+    Job *job = NULL;
+
+    if (!spec || strcmp(spec, "%+") == 0 || strcmp(spec, "%%") == 0 || strcmp(spec, "%") == 0) {
+        job = current_job(0);
+    } else if (strcmp(spec, "%-") == 0) {
+        job = current_job(1);
+    } else if (spec[0] == '%' && spec[1] >= '0' && spec[1] <= '9') {
+        int id = atoi(spec + 1);
+        for (size_t i = 0; i < job_count && !job; i++) {
+            if (jobs[i]->id == id) job = jobs[i];
+        }
+    } else if (spec[0] == '%') {
+        for (size_t i = 0; i < job_count && !job; i++) {
+            if (strncmp(jobs[i]->command, spec + 1, strlen(spec + 1)) == 0) job = jobs[i];
+        }
+    } else {
+        pid_t pid = atoi(spec);
+        for (size_t i = 0; i < job_count && !job; i++) {
+            for (size_t p = 0; p < jobs[i]->count; p++) {
+                if (jobs[i]->pids[p] == pid) job = jobs[i];
+            }
+        }
+    }
+
+    if (!job) {
+        fprintf(stderr, "%s: %s: no such job\n", builtin, spec ? spec : "current");
+    }
+    return job;
+}
+
+// Block until every process of the job has finished or one of them stopped
+static void wait_for_job(Job *job) {
+    for (size_t i = 0; i < job->count; i++) {
+        if (job->done[i]) continue;
+
+        int status;
+        struct rusage ru;
+        pid_t pid;
+        do {
+            pid = wait4(job->pids[i], &status, WUNTRACED, &ru);
+        } while (pid < 0 && errno == EINTR);
+
+        if (pid < 0) {
+            update_process(job, i, 0, NULL);
+            continue;
+        }
+        update_process(job, i, status, &ru);
+        if (job->state == JOB_STOPPED) return;
+    }
+}
+
+// Builtin: list jobs with their state and how long they have been running
+int jobs_command(int argc, char **argv) {
+    bool long_format = argc > 1 && strcmp(argv[1], "-l") == 0;
+
+    jobs_reap();
+    for (size_t i = 0; i < job_count; i++) {
+        print_job(jobs[i], long_format);
+        jobs[i]->notified = true;
+    }
+    // Finished jobs have now been reported
+    for (size_t i = 0; i < job_count; ) {
+        if (jobs[i]->state == JOB_DONE) {
+            remove_job(jobs[i]);
+        } else {
+            i++;
+        }
+    }
+    return 0;
+}
+
+// Builtin: continue a job in the foreground and wait for it
+int fg_command(int argc, char **argv) {
+    jobs_reap();
+    Job *job = find_job(argc > 1 ? argv[1] : NULL, "fg");
+    if (!job) return 1;
+
+    printf("%s\n", job->command);
+    fflush(stdout);
+
+    bool interactive = job_control_enabled();
+    job->state = JOB_RUNNING;
+    job->touched = ++touch_counter;
+    if (interactive && job->pgid > 0) give_terminal_to(job->pgid);
+    if (signal_job(job, SIGCONT) != 0) {
+        perror("fg");
+    }
+
+    wait_for_job(job);
+    if (interactive) give_terminal_to(getpgrp());
+
+    if (job->state == JOB_STOPPED) {
+        printf("\n");
+        print_job(job, false);
+        job->notified = true;
+        return 128 + SIGTSTP;
+    }
+
+    int status = job_exit_code(job);
+    remove_job(job);
+    return status;
+}
+
+// Builtin: continue a stopped job in the background
+int bg_command(int argc, char **argv) {
+    jobs_reap();
+    Job *job = find_job(argc > 1 ? argv[1] : NULL, "bg");
+    if (!job) return 1;
+
+    if (job->state != JOB_STOPPED) {
+        fprintf(stderr, "bg: job %d already in background\n", job->id);
+        return 0;
+    }
+    if (signal_job(job, SIGCONT) != 0) {
+        perror("bg");
+        return 1;
+    }
+    job->state = JOB_RUNNING;
+    job->notified = true;
+    job->touched = ++touch_counter;
+    printf("[%d]+ %s &\n", job->id, job->command);
+    return 0;
+}
+
+// Builtin: wait for the given jobs (or all running ones) to finish; the status
+// is that of the last job waited for
+int wait_command(int argc, char **argv) {
+    jobs_reap();
+    int status = 0;
+
+    if (argc <= 1) {
+        for (size_t i = 0; i < job_count; i++) {
+            if (jobs[i]->state == JOB_RUNNING) {
+                wait_for_job(jobs[i]);
+            }
+        }
+        for (size_t i = 0; i < job_count; ) {
+            if (jobs[i]->state == JOB_DONE) {
+                remove_job(jobs[i]);
+            } else {
+                i++;
+            }
+        }
+        return 0;
+    }
+
+    for (int a = 1; a < argc; a++) {
+        Job *job = find_job(argv[a], "wait");
+        if (!job) {
+            status = 127;
+            continue;
+        }
+        wait_for_job(job);
+        status = job_exit_code(job);
+        if (job->state == JOB_DONE) {
+            remove_job(job);
+        }
+    }
+    return status;
+}
+
+// readline input hook: sleep on the terminal and the SIGCHLD pipe together so
+// jobs are reaped while the shell waits at the prompt
+void jobs_watch_idle(size_t (*fds)(int *fds, size_t max), void (*ready)()) {
+    idle.fds = fds;
+    idle.ready = ready;
+}
+
+int jobs_getc(FILE *stream) {
+    int fd = fileno(stream);
+    while (sigchld_pipe[0] >= 0) {
+        struct pollfd fds[2 + IDLE_FDS_MAX] = {
+            { .fd = fd, .events = POLLIN },
+            { .fd = sigchld_pipe[0], .events = POLLIN },
+        };
+        int watched[IDLE_FDS_MAX];
+        size_t extra = idle.fds ? idle.fds(watched, IDLE_FDS_MAX) : 0;
+        for (size_t i = 0; i < extra; i++) {
+            fds[2 + i].fd = watched[i];
+            fds[2 + i].events = POLLIN;
+        }
+        if (poll(fds, 2 + extra, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            jobs_reap();
+        }
+        for (size_t i = 0; i < extra; i++) {
+            if (fds[2 + i].revents) {
+                idle.ready();
+                break;
+            }
+        }
+        if (fds[0].revents) break;
+    }
+    return rl_getc(stream);
+}
+
+void jobs_free() {
+    for (size_t i = 0; i < job_count; i++) {
+        free_job(jobs[i]);
+    }
+    free(jobs);
+    jobs = NULL;
+    job_count = job_capacity = 0;
+}
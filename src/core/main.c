@@ -13,9 +13,6 @@
 #define NUTSHELL_VERSION "0.0.4"
 #define NUTSHELL_RELEASE_DATE "March 2025"
 
-// External declaration for AI shell initialization
-extern void init_ai_shell();
-
 // Display version information
 void print_version() {
     printf("Nutshell Shell v%s (%s)\n", NUTSHELL_VERSION, NUTSHELL_RELEASE_DATE);
@@ -23,9 +20,12 @@ void print_version() {
 
 // Display help information
 void print_usage() {
-    printf("Usage: nutshell [OPTIONS]\n\n");
+    printf("Usage: nutshell [OPTIONS]\n");
+    printf("       nutshell -c COMMANDS\n");
+    printf("       nutshell SCRIPT\n\n");
     printf("An enhanced Unix shell with simplified command language, package management, and AI assistance.\n\n");
     printf("Options:\n");
+    printf("  -c COMMANDS   Run COMMANDS without a prompt and exit with their status\n");
     printf("  --help        Display this help message and exit\n");
     printf("  --version     Display version information and exit\n");
     printf("  --test        Run in test mode (for internal testing)\n\n");
@@ -33,7 +33,9 @@ void print_usage() {
     printf("  NUT_DEBUG=1                 Enable general debug output\n");
     printf("  OPENAI_API_KEY=<your_key>   Set API key for AI features\n");
     printf("  NUT_DEBUG_THEME=1           Enable theme system debugging\n");
-    printf("  NUT_DEBUG_CONFIG=1          Enable config system debugging\n\n");
+    printf("  NUT_DEBUG_CONFIG=1          Enable config system debugging\n");
+    printf("  NUT_OUTPUT_TAIL=<bytes>     Bytes of command output kept for 'fix' (default 65536)\n");
+    printf("  NUT_EXEC_BACKEND=fork       Launch commands with fork+exec instead of posix_spawn\n\n");
     printf("Documentation: https://github.com/chandralegend/nutshell\n");
 }
 
@@ -48,10 +50,21 @@ int main(int argc, char *argv[]) {
             print_usage();
             return 0;
         }
+        else if (strcmp(argv[1], "-c") == 0) {
+            if (argc < 3) {
+                fprintf(stderr, "nutshell: -c: option requires an argument\n");
+                return 2;
+            }
+            return shell_run_string(argv[2]);
+        }
         else if (strcmp(argv[1], "--test") == 0) {
             printf("Running in test mode\n");
             // Continue with initialization but don't start shell loop
         }
+        else if (argv[1][0] != '-' || strcmp(argv[1], "-") == 0) {
+            // Script file, or `-` for commands on stdin
+            return shell_run_file(argv[1]);
+        }
         else {
             printf("Unknown option: %s\n", argv[1]);
             print_usage();
@@ -59,11 +72,9 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    // Initialize the command registry
-    init_registry();
-    
-    // Initialize AI integration
-    init_ai_shell();
+    // Initialize the command registry. Config, theme and AI support start
+    // when first needed, and packages on the first command not registered.
+    init_registry_core();
     
     // Only start the shell loop in normal mode (not test mode)
     if (argc <= 1 || (argc > 1 && strcmp(argv[1], "--test") != 0)) {
@@ -72,7 +83,8 @@ int main(int argc, char *argv[]) {
     
     // Free resources before exit
     free_registry();
-    cleanup_ai_integration();
+    path_cache_free();
+    modules_cleanup();
     
     return 0;
 }
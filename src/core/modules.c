@@ -0,0 +1,85 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+#include <nutshell/core.h>
+#include <nutshell/utils.h>
+#include <nutshell/theme.h>
+#include <nutshell/config.h>
+#include <nutshell/ai.h>
+#include <string.h>
+#include <time.h>
+
+// Module debug macro
+#define MODULE_DEBUG(fmt, ...) \
+    do { if (getenv("NUT_DEBUG_MODULES")) fprintf(stderr, "MODULE: " fmt "\n", ##__VA_ARGS__); } while(0)
+
+extern void init_ai_shell();
+
+// Start the theme system and switch to the theme saved in the config
+static void init_theme_module() {
+    init_theme_system();
+
+    const char *saved_theme = get_config_theme();
+    if (saved_theme && current_theme && strcmp(current_theme->name, saved_theme) != 0) {
+        if (getenv("NUT_DEBUG")) {
+            DEBUG_LOG("Loading saved theme from config: %s", saved_theme);
+        }
+        Theme *theme = load_theme(saved_theme);
+        if (theme) {
+            free_theme(current_theme);
+            current_theme = theme;
+            if (getenv("NUT_DEBUG")) {
+                DEBUG_LOG("Successfully loaded saved theme: %s", theme->name);
+            }
+        } else if (getenv("NUT_DEBUG")) {
+            DEBUG_LOG("Failed to load saved theme: %s", saved_theme);
+        }
+    }
+}
+
+typedef struct {
+    const char *name;
+    void (*init)();
+    void (*cleanup)();
+    int depends;    // Module started first, or -1
+    bool ready;
+} ModuleEntry;
+
+// Indexed by Module
+static ModuleEntry modules[MODULE_COUNT] = {
+    [MODULE_CONFIG] = { "config", init_config_system, cleanup_config_system, -1, false },
+    [MODULE_THEME]  = { "theme", init_theme_module, cleanup_theme_system, MODULE_CONFIG, false },
+    [MODULE_AI]     = { "ai", init_ai_shell, cleanup_ai_integration, -1, false },
+};
+
+void module_require(Module module) {
+    ModuleEntry *entry = &modules[module];
+    if (entry->ready) return;
+
+    if (entry->depends >= 0) {
+        module_require((Module)entry->depends);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    // Mark first so a module that uses itself while starting does not recurse
+    entry->ready = true;
+    entry->init();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    MODULE_DEBUG("Started %s in %.3f ms", entry->name,
+                 (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+}
+
+bool module_ready(Module module) {
+    return modules[module].ready;
+}
+
+void modules_cleanup() {
+    for (int i = MODULE_COUNT - 1; i >= 0; i--) {
+        if (!modules[i].ready) continue;
+        MODULE_DEBUG("Stopping %s", modules[i].name);
+        modules[i].cleanup();
+        modules[i].ready = false;
+    }
+}
@@ -0,0 +1,253 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+#include <nutshell/core.h>
+#include <nutshell/config.h>
+#include <nutshell/utils.h>
+#include <string.h>
+
+// Parse cache debug macro
+#define PCACHE_DEBUG(fmt, ...) \
+    do { if (getenv("NUT_DEBUG_PARSER")) fprintf(stderr, "PCACHE: " fmt "\n", ##__VA_ARGS__); } while(0)
+
+#define PARSE_CACHE_DEFAULT 64
+
+// One cached line. The command is resolved once and never modified after
+// that, so a hit can be executed as is.
+typedef struct CacheEntry {
+    char *key;
+    size_t hash;
+    ParsedCommand *cmd;
+    unsigned refs;                  // Acquired and not yet released
+    struct CacheEntry *prev, *next; // LRU list, most recent first
+    struct CacheEntry *chain;       // Next entry in the same bucket
+} CacheEntry;
+
+static struct {
+    CacheEntry **buckets;
+    size_t bucket_count;
+    CacheEntry *head, *tail;
+    size_t count;
+    size_t capacity;
+    bool configured;
+    // Entries dropped while still in use, freed on release
+    CacheEntry *retired;
+    // What the cached lookups depend on
+    unsigned long registry_gen;
+    unsigned long alias_gen;
+    char *path_env;
+    ParseCacheStats stats;
+} cache = { 0 };
+
+static void free_entry(CacheEntry *entry) {
+    free_parsed_command(entry->cmd);
+    free(entry->key);
+    free(entry);
+}
+
+static void unlink_lru(CacheEntry *entry) {
+    if (entry->prev) entry->prev->next = entry->next;
+    else cache.head = entry->next;
+    if (entry->next) entry->next->prev = entry->prev;
+    else cache.tail = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void push_front(CacheEntry *entry) {
+    entry->prev = NULL;
+    entry->next = cache.head;
+    if (cache.head) cache.head->prev = entry;
+    cache.head = entry;
+    if (!cache.tail) cache.tail = entry;
+}
+
+// Take an entry out of the cache; one still in use is freed on release
+static void remove_entry(CacheEntry *entry) {
+    CacheEntry **link = &cache.buckets[entry->hash & (cache.bucket_count - 1)];
+    while (*link != entry) link = &(*link)->chain;
+    *link = entry->chain;
+    unlink_lru(entry);
+    cache.count--;
+
+    if (entry->refs > 0) {
+        entry->chain = cache.retired;
+        cache.retired = entry;
+    } else {
+        free_entry(entry);
+    }
+}
+
+static void configure() {
+    if (cache.configured) return;
+    cache.configured = true;
+    cache.capacity = PARSE_CACHE_DEFAULT;
+
+    const char *env = getenv("NUT_PARSE_CACHE");
+    if (env) cache.capacity = strtoul(env, NULL, 10);
+}
+
+void parse_cache_clear() {
+    while (cache.head) remove_entry(cache.head);
+    PCACHE_DEBUG("Cleared");
+}
+
+// Drop every entry if the registry, the aliases or PATH changed since they
+// were resolved
+static void check_dependencies() {
+    const char *path_env = getenv("PATH");
+    if (!path_env) path_env = "";
+    unsigned long registry_gen = registry_generation();
+    unsigned long alias_gen = config_alias_generation();
+
+    bool path_changed = !cache.path_env || strcmp(cache.path_env, path_env) != 0;
+    if (!path_changed && registry_gen == cache.registry_gen && alias_gen == cache.alias_gen) {
+        return;
+    }
+
+    if (cache.count > 0) {
+        PCACHE_DEBUG("Invalidated %zu entries (%s changed)", cache.count,
+                     path_changed ? "PATH" : registry_gen != cache.registry_gen ? "registry" : "aliases");
+        cache.stats.invalidations++;
+        parse_cache_clear();
+    }
+    if (path_changed) {
+        free(cache.path_env);
+        cache.path_env = strdup(path_env);
+    }
+    cache.registry_gen = registry_gen;
+    cache.alias_gen = alias_gen;
+}
+
+static CacheEntry *find_entry(const char *key, size_t hash) {
+    if (!cache.buckets) return NULL;
+    for (CacheEntry *entry = cache.buckets[hash & (cache.bucket_count - 1)]; entry; entry = entry->chain) {
+        if (entry->hash == hash && strcmp(entry->key, key) == 0) return entry;
+    }
+    return NULL;
+}
+
+static bool ensure_buckets() {
+    if (cache.buckets) return true;
+    // About two buckets per entry
+    size_t count = 16;
+    while (count < cache.capacity * 2) count *= 2;
+    cache.buckets = calloc(count, sizeof(CacheEntry *));
+    if (!cache.buckets) return false;
+    cache.bucket_count = count;
+    return true;
+}
+
+// Parse a line and expand its aliases
+static ParsedCommand *parse_aliased(const char *input) {
+    ParsedCommand *cmd = parse_command(input);
+    if (cmd && !expand_aliases(cmd)) {
+        free_parsed_command(cmd);
+        return NULL;
+    }
+    return cmd;
+}
+
+ParsedCommand *parse_cache_acquire(const char *input) {
+    if (!input) return NULL;
+    configure();
+    if (cache.capacity == 0) return parse_aliased(input);
+
+    check_dependencies();
+
+    size_t hash = hash_string(input);
+    CacheEntry *entry = find_entry(input, hash);
+    if (entry) {
+        cache.stats.hits++;
+        unlink_lru(entry);
+        push_front(entry);
+        entry->refs++;
+        return entry->cmd;
+    }
+    cache.stats.misses++;
+
+    ParsedCommand *cmd = parse_aliased(input);
+    if (!cmd) return NULL;
+
+    // Resolving can load packages, which changes the registry again
+    unsigned long gen;
+    do {
+        gen = registry_generation();
+        resolve_command(cmd);
+    } while (gen != registry_generation());
+    check_dependencies();
+
+    if (!ensure_buckets()) return cmd;
+    entry = calloc(1, sizeof(CacheEntry));
+    if (!entry || !(entry->key = strdup(input))) {
+        free(entry);
+        return cmd;
+    }
+    entry->hash = hash;
+    entry->cmd = cmd;
+    entry->refs = 1;
+
+    if (cache.count >= cache.capacity) {
+        PCACHE_DEBUG("Evicting '%s'", cache.tail->key);
+        cache.stats.evictions++;
+        remove_entry(cache.tail);
+    }
+    size_t bucket = hash & (cache.bucket_count - 1);
+    entry->chain = cache.buckets[bucket];
+    cache.buckets[bucket] = entry;
+    push_front(entry);
+    cache.count++;
+    return cmd;
+}
+
+void parse_cache_release(ParsedCommand *cmd) {
+    if (!cmd) return;
+
+    // The entry just acquired is normally at the front
+    for (CacheEntry *entry = cache.head; entry; entry = entry->next) {
+        if (entry->cmd == cmd) {
+            if (entry->refs > 0) entry->refs--;
+            return;
+        }
+    }
+    for (CacheEntry **link = &cache.retired; *link; link = &(*link)->chain) {
+        CacheEntry *entry = *link;
+        if (entry->cmd == cmd) {
+            if (--entry->refs == 0) {
+                *link = entry->chain;
+                free_entry(entry);
+            }
+            return;
+        }
+    }
+    // Not cached (cache disabled or out of memory)
+    free_parsed_command(cmd);
+}
+
+void parse_cache_set_capacity(size_t capacity) {
+    configure();
+    parse_cache_clear();
+    free(cache.buckets);
+    cache.buckets = NULL;
+    cache.bucket_count = 0;
+    cache.capacity = capacity;
+}
+
+ParseCacheStats parse_cache_stats() {
+    configure();
+    ParseCacheStats stats = cache.stats;
+    stats.entries = cache.count;
+    stats.capacity = cache.capacity;
+    return stats;
+}
+
+void parse_cache_free() {
+    parse_cache_clear();
+    while (cache.retired) {
+        CacheEntry *next = cache.retired->chain;
+        free_entry(cache.retired);
+        cache.retired = next;
+    }
+    free(cache.buckets);
+    free(cache.path_env);
+    memset(&cache, 0, sizeof(cache));
+}
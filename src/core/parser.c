@@ -2,111 +2,704 @@
 #define _GNU_SOURCE
 
 #include <nutshell/core.h>
-#include <ctype.h>
+#include <stddef.h>
 #include <string.h>
 #include <nutshell/utils.h>
 
-// Replace the debug flag with a macro that uses environment variable
+// Debug output is controlled by NUT_DEBUG_PARSER, looked up once per parse
+// rather than once per token since this runs for every command line
+static bool parser_debug = false;
+// Delimiter of the here-document the last parse stopped in
+static char *pending_delimiter = NULL;
 #define PARSER_DEBUG(fmt, ...) \
-    do { if (getenv("NUT_DEBUG_PARSER")) fprintf(stderr, "PARSER: " fmt "\n", ##__VA_ARGS__); } while(0)
+    do { if (parser_debug) fprintf(stderr, "PARSER: " fmt "\n", ##__VA_ARGS__); } while(0)
 
-// Function prototype
-char* trim_whitespace(char* str);
+#define ARENA_MIN_BLOCK 1024
+#define ARENA_ALIGN _Alignof(max_align_t)
 
-ParsedCommand *parse_command(char *input) {
-    if (!input) return NULL;
-    
-    PARSER_DEBUG("Parsing command: '%s'", input);
-    
-    // Make a copy of the input to avoid modifying the original
-    char *input_copy = strdup(input);
-    if (!input_copy) return NULL;
-    
-    char *original_input_copy = input_copy;
-    input_copy = trim_whitespace(input_copy);
-    if (strlen(input_copy) == 0) {
-        PARSER_DEBUG("Empty command after trimming");
-        free(original_input_copy);
-        original_input_copy = NULL;
-        return NULL;
+// Everything a parsed command points to lives in one arena: the nodes, the
+// argument arrays and a single buffer holding every word back to back.
+// free_parsed_command() releases it in one go.
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t used;
+    size_t size;
+    _Alignas(max_align_t) unsigned char data[];
+} ArenaBlock;
+
+struct ParseArena {
+    ArenaBlock *blocks;   // Newest first; this header lives in the oldest
+};
+
+static ArenaBlock *arena_block(size_t size) {
+    ArenaBlock *block = malloc(sizeof(ArenaBlock) + size);
+    if (!block) return NULL;
+    block->next = NULL;
+    block->used = 0;
+    block->size = size;
+    return block;
+}
+
+static size_t align_up(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+static ParseArena *arena_create(size_t size) {
+    size_t header = align_up(sizeof(ParseArena));
+    ArenaBlock *block = arena_block(header + (size > ARENA_MIN_BLOCK ? size : ARENA_MIN_BLOCK));
+    if (!block) return NULL;
+
+    ParseArena *arena = (ParseArena *)block->data;
+    block->used = header;
+    arena->blocks = block;
+    return arena;
+}
+
+static void *arena_alloc(ParseArena *arena, size_t size) {
+    size = align_up(size);
+    ArenaBlock *block = arena->blocks;
+    if (block->used + size > block->size) {
+        size_t grow = block->size * 2;
+        block = arena_block(size > grow ? size : grow);
+        if (!block) return NULL;
+        block->next = arena->blocks;
+        arena->blocks = block;
     }
-    
-    ParsedCommand *cmd = calloc(1, sizeof(ParsedCommand));
-    if (!cmd) {
-        PARSER_DEBUG("Failed to allocate ParsedCommand");
-        free(original_input_copy);
-        original_input_copy = NULL;
-        return NULL;
+    void *p = block->data + block->used;
+    block->used += size;
+    return p;
+}
+
+static void *arena_zalloc(ParseArena *arena, size_t size) {
+    void *p = arena_alloc(arena, size);
+    if (p) memset(p, 0, size);
+    return p;
+}
+
+static void arena_free(ParseArena *arena) {
+    if (!arena) return;
+    ArenaBlock *block = arena->blocks;
+    while (block) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+typedef enum {
+    TOKEN_END,
+    TOKEN_WORD,
+    TOKEN_PIPE,    // |
+    TOKEN_AND,     // &&
+    TOKEN_OR,      // ||
+    TOKEN_SEQ,     // ; or a newline
+    TOKEN_BG,      // &
+    TOKEN_REDIR,   // Any redirection operator, described in the lexer
+    TOKEN_ERROR
+} TokenType;
+
+static const char *token_names[] = {
+    "end of line", "word", "|", "&&", "||", ";", "&", "redirection", "error"
+};
+
+// Redirection operators, each followed by a word
+typedef enum {
+    OP_IN,            // <
+    OP_OUT,           // > and >|
+    OP_APPEND,        // >>
+    OP_DUP_IN,        // <&
+    OP_DUP_OUT,       // >&
+    OP_BOTH,          // &>
+    OP_BOTH_APPEND,   // &>>
+    OP_HEREDOC,       // <<
+    OP_HEREDOC_TABS,  // <<-
+    OP_HERESTRING     // <<<
+} RedirOp;
+
+// Here-document whose body starts on the line after the command
+typedef struct {
+    Redirection *redir;
+    const char *delimiter;
+    bool strip_tabs;
+} PendingHeredoc;
+
+// Single pass over the input. Words are unquoted into `out`, which has room
+// for the whole input, so each word is a NUL-terminated slice of one buffer.
+typedef struct {
+    const char *p;
+    char *out;
+    ParseArena *arena;
+    // Operator and descriptor of the last TOKEN_REDIR; fd is -1 unless
+    // written out, as in `2>`
+    RedirOp op;
+    int fd;
+    PendingHeredoc *heredocs;
+    size_t heredoc_count;
+    size_t heredoc_capacity;
+    const char *incomplete;  // Delimiter, if the input ended inside a here-document
+    // Substitutions in the word just lexed, with offsets into that word
+    Substitution *word_subs;
+    // Lexing the word after a redirection operator, which is not expanded
+    bool literal;
+} Lexer;
+
+static bool is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static bool is_operator(char c) {
+    return c == '|' || c == '&' || c == ';' || c == '<' || c == '>' || c == '\n';
+}
+
+// Skip a quoted string starting at its opening quote. Returns the closing
+// quote, or NULL if there is none.
+static const char *skip_quoted(const char *p) {
+    char quote = *p;
+    for (p++; *p && *p != quote; p++) {
+        if (*p == '\\' && quote != '\'' && p[1]) p++;
+    }
+    return *p ? p : NULL;
+}
+
+// Find the `)` closing a `$(` whose body starts at p. Quoted text and
+// nested parentheses are skipped. Returns NULL if there is none.
+static const char *find_paren_close(const char *p) {
+    int depth = 1;
+    for (; *p; p++) {
+        if (*p == '\\') {
+            if (p[1]) p++;
+        } else if (*p == '\'' || *p == '"' || *p == '`') {
+            p = skip_quoted(p);
+            if (!p) return NULL;
+        } else if (*p == '(') {
+            depth++;
+        } else if (*p == ')' && --depth == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Append a substitution found at `out` to those of the word being lexed
+static Substitution *new_word_substitution(Lexer *lx, const char *word, const char *out, bool quoted) {
+    Substitution *sub = arena_zalloc(lx->arena, sizeof(Substitution));
+    if (!sub) return NULL;
+    sub->arg = -1;
+    sub->offset = (size_t)(out - word);
+    sub->quoted = quoted;
+    Substitution **link = &lx->word_subs;
+    while (*link) link = &(*link)->next;
+    *link = sub;
+    return sub;
+}
+
+// Record a command substitution found at `out` in the word being lexed. The
+// command text runs from `text` for `len` bytes; inside backticks a backslash
+// before another backslash, a backtick or a $ is dropped.
+static bool add_word_substitution(Lexer *lx, const char *word, const char *out,
+                                  const char *text, size_t len, bool backtick, bool quoted) {
+    char *command = arena_alloc(lx->arena, len + 1);
+    if (!command) return false;
+
+    char *dst = command;
+    for (size_t i = 0; i < len; i++) {
+        if (backtick && text[i] == '\\' && i + 1 < len && strchr("\\`$", text[i + 1])) i++;
+        *dst++ = text[i];
+    }
+    *dst = '\0';
+
+    Substitution *sub = new_word_substitution(lx, word, out, quoted);
+    if (!sub) return false;
+    sub->command = command;
+    PARSER_DEBUG("Command substitution at offset %zu: '%s'", sub->offset, command);
+    return true;
+}
+
+// `$?` outside single quotes: the status is filled in when the command runs
+static bool starts_status(const Lexer *lx, const char *p) {
+    return !lx->literal && p[0] == '$' && p[1] == '?';
+}
+
+static bool add_word_status(Lexer *lx, const char *word, const char *out, bool quoted) {
+    if (!new_word_substitution(lx, word, out, quoted)) return false;
+    PARSER_DEBUG("Exit status at offset %zu", (size_t)(out - word));
+    return true;
+}
+
+// Lex a `$(...)` or backtick substitution at p. Returns the position after
+// it, or NULL on a syntax error.
+static const char *lex_substitution(Lexer *lx, const char *p, const char *word, const char *out,
+                                    bool quoted) {
+    if (*p == '`') {
+        const char *close = p + 1;
+        while (*close && *close != '`') {
+            if (*close == '\\' && close[1]) close++;
+            close++;
+        }
+        if (!*close) {
+            PARSER_DEBUG("Syntax error: unterminated backtick");
+            return NULL;
+        }
+        if (!add_word_substitution(lx, word, out, p + 1, close - p - 1, true, quoted)) return NULL;
+        return close + 1;
     }
-    
-    // Use calloc to ensure all entries are initialized to NULL
-    cmd->args = calloc(MAX_ARGS, sizeof(char *));
-    if (!cmd->args) {
-        PARSER_DEBUG("Failed to allocate args array");
-        free(original_input_copy);
-        original_input_copy = NULL;
-        free(cmd);
+
+    const char *close = find_paren_close(p + 2);
+    if (!close) {
+        PARSER_DEBUG("Syntax error: unterminated $(");
         return NULL;
     }
-    int arg_count = 0;
-    char *token, *saveptr = NULL;
-    // Tokenize and process input
-    token = strtok_r(input_copy, " \t", &saveptr);
-    while (token != NULL && arg_count < MAX_ARGS - 1) {
-        // Check if token is a special character
-        if (strcmp(token, "<") == 0) {
-            token = strtok_r(NULL, " \t", &saveptr);
-            if (token) {
-                cmd->input_file = strdup(token);
-                PARSER_DEBUG("Input file: %s", cmd->input_file);
+    if (!add_word_substitution(lx, word, out, p + 2, close - p - 2, false, quoted)) return NULL;
+    return close + 1;
+}
+
+static bool starts_substitution(const char *p) {
+    return *p == '`' || (p[0] == '$' && p[1] == '(');
+}
+
+static TokenType lex_word(Lexer *lx, char **word) {
+    *word = lx->out;
+    lx->word_subs = NULL;
+    const char *p = lx->p;
+    char *out = lx->out;
+
+    while (*p && !is_blank(*p) && !is_operator(*p)) {
+        if (starts_substitution(p)) {
+            p = lex_substitution(lx, p, *word, out, false);
+            if (!p) return TOKEN_ERROR;
+        } else if (starts_status(lx, p)) {
+            if (!add_word_status(lx, *word, out, false)) return TOKEN_ERROR;
+            p += 2;
+        } else if (*p == '\\') {
+            // Outside quotes a backslash keeps the next character literally
+            // and a backslash-newline disappears
+            if (p[1] == '\n') {
+                p += 2;
+            } else if (p[1]) {
+                *out++ = p[1];
+                p += 2;
             } else {
-                PARSER_DEBUG("Missing input file after <");
+                p++;
             }
-        } else if (strcmp(token, ">") == 0) {
-            token = strtok_r(NULL, " \t", &saveptr);
-            if (token) {
-                cmd->output_file = strdup(token);
-                PARSER_DEBUG("Output file: %s", cmd->output_file);
-            } else {
-                PARSER_DEBUG("Missing output file after >");
+        } else if (*p == '\'') {
+            const char *close = strchr(p + 1, '\'');
+            if (!close) {
+                PARSER_DEBUG("Syntax error: unterminated single quote");
+                return TOKEN_ERROR;
+            }
+            memcpy(out, p + 1, close - p - 1);
+            out += close - p - 1;
+            p = close + 1;
+        } else if (*p == '"') {
+            // Inside double quotes a backslash only escapes $ ` " \ and newline
+            for (p++; *p && *p != '"'; ) {
+                if (starts_substitution(p)) {
+                    p = lex_substitution(lx, p, *word, out, true);
+                    if (!p) return TOKEN_ERROR;
+                } else if (starts_status(lx, p)) {
+                    if (!add_word_status(lx, *word, out, true)) return TOKEN_ERROR;
+                    p += 2;
+                } else if (p[0] == '\\' && p[1] && strchr("$`\"\\\n", p[1])) {
+                    if (p[1] != '\n') *out++ = p[1];
+                    p += 2;
+                } else {
+                    *out++ = *p++;
+                }
             }
-        } else if (strcmp(token, "&") == 0) {
-            cmd->background = true;
-            PARSER_DEBUG("Background process");
+            if (!*p) {
+                PARSER_DEBUG("Syntax error: unterminated double quote");
+                return TOKEN_ERROR;
+            }
+            p++;
         } else {
-            // Regular argument
-            cmd->args[arg_count] = strdup(token);
-            PARSER_DEBUG("Arg[%d] = '%s'", arg_count, cmd->args[arg_count]);
-            arg_count++;
+            *out++ = *p++;
         }
-        
-        // Get next token
-        token = strtok_r(NULL, " \t", &saveptr);
     }
-    // Ensure NULL termination
-    cmd->args[arg_count] = NULL;
-    
-    PARSER_DEBUG("Command parsed with %d arguments", arg_count);
 
-    if(original_input_copy){
-        free(original_input_copy);
-        original_input_copy = NULL;
+    *out++ = '\0';
+    lx->p = p;
+    lx->out = out;
+    return TOKEN_WORD;
+}
+
+// Read the bodies of the here-documents started on the line just ended.
+// Each runs up to a line holding only its delimiter. The text is kept as
+// written, with no substitutions, whether or not the delimiter was quoted.
+static bool read_heredocs(Lexer *lx) {
+    for (size_t i = 0; i < lx->heredoc_count; i++) {
+        PendingHeredoc *doc = &lx->heredocs[i];
+        size_t delim_len = strlen(doc->delimiter);
+        char *text = arena_alloc(lx->arena, strlen(lx->p) + 1);
+        if (!text) return false;
+        char *out = text;
+
+        for (;;) {
+            const char *line = lx->p;
+            const char *end = line + strcspn(line, "\n");
+            if (doc->strip_tabs) {
+                while (*line == '\t') line++;
+            }
+            if ((size_t)(end - line) == delim_len && memcmp(line, doc->delimiter, delim_len) == 0) {
+                lx->p = *end ? end + 1 : end;
+                break;
+            }
+            if (!*end) {
+                // The delimiter line has not been read yet
+                PARSER_DEBUG("Here-document '%s' is not finished", doc->delimiter);
+                lx->incomplete = doc->delimiter;
+                return false;
+            }
+            memcpy(out, line, end - line);
+            out += end - line;
+            *out++ = '\n';
+            lx->p = end + 1;
+        }
+        *out = '\0';
+        doc->redir->target = text;
+        PARSER_DEBUG("Here-document '%s': %zu bytes", doc->delimiter, (size_t)(out - text));
     }
+    lx->heredoc_count = 0;
+    return true;
+}
+
+// Lex the redirection operator at p, where fd is -1 or the number written
+// in front of it
+static TokenType lex_redirection(Lexer *lx, const char *p, int fd) {
+    static const struct {
+        const char *text;
+        RedirOp op;
+    } operators[] = {
+        // Longest first
+        { "<<<", OP_HERESTRING }, { "<<-", OP_HEREDOC_TABS }, { "&>>", OP_BOTH_APPEND },
+        { "<<", OP_HEREDOC }, { "<&", OP_DUP_IN }, { ">>", OP_APPEND }, { ">&", OP_DUP_OUT },
+        { ">|", OP_OUT }, { "&>", OP_BOTH }, { "<", OP_IN }, { ">", OP_OUT },
+    };
+    for (size_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++) {
+        size_t len = strlen(operators[i].text);
+        if (strncmp(p, operators[i].text, len) == 0) {
+            lx->p = p + len;
+            lx->op = operators[i].op;
+            lx->fd = fd;
+            return TOKEN_REDIR;
+        }
+    }
+    return TOKEN_ERROR;
+}
+
+static TokenType next_token(Lexer *lx, char **word) {
+    while (is_blank(*lx->p)) lx->p++;
+
+    const char *p = lx->p;
+    if (is_digit(*p)) {
+        // A number right before < or > is the descriptor to redirect
+        size_t digits = strspn(p, "0123456789");
+        if ((p[digits] == '<' || p[digits] == '>') && digits <= 4) {
+            return lex_redirection(lx, p + digits, atoi(p));
+        }
+    }
+
+    switch (*p) {
+    case '\0':
+        return TOKEN_END;
+    case '#':
+        // A comment runs to the end of the line
+        p += strcspn(p, "\n");
+        lx->p = p;
+        return *p ? next_token(lx, word) : TOKEN_END;
+    case '|':
+        lx->p += p[1] == '|' ? 2 : 1;
+        return p[1] == '|' ? TOKEN_OR : TOKEN_PIPE;
+    case '&':
+        if (p[1] == '>') return lex_redirection(lx, p, -1);
+        lx->p += p[1] == '&' ? 2 : 1;
+        return p[1] == '&' ? TOKEN_AND : TOKEN_BG;
+    case ';':
+        lx->p++;
+        return TOKEN_SEQ;
+    case '\n':
+        lx->p++;
+        if (lx->heredoc_count > 0 && !read_heredocs(lx)) return TOKEN_ERROR;
+        return TOKEN_SEQ;
+    case '<':
+    case '>':
+        return lex_redirection(lx, p, -1);
+    default:
+        return lex_word(lx, word);
+    }
+}
+
+// Arguments of the stage being parsed. Most commands fit in the inline
+// array; longer ones spill to the heap, so there is no argument limit.
+typedef struct {
+    char **items;
+    size_t count;
+    size_t capacity;
+    char *inline_items[32];
+} ArgList;
+
+static bool args_push(ArgList *list, char *word) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity * 2;
+        char **items = list->items == list->inline_items ? malloc(capacity * sizeof(char *)) :
+                       realloc(list->items, capacity * sizeof(char *));
+        if (!items) return false;
+        if (list->items == list->inline_items) {
+            memcpy(items, list->inline_items, list->count * sizeof(char *));
+        }
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = word;
+    return true;
+}
 
+static Redirection *add_redirection(ParseArena *arena, ParsedCommand *stage,
+                                    RedirType type, int fd, const char *target) {
+    Redirection *redir = arena_zalloc(arena, sizeof(Redirection));
+    if (!redir) return NULL;
+    redir->type = type;
+    redir->fd = fd;
+    redir->target = target;
+
+    Redirection **link = &stage->redirs;
+    while (*link) link = &(*link)->next;
+    *link = redir;
+    return redir;
+}
+
+static bool all_digits(const char *word) {
+    if (!*word) return false;
+    for (; *word; word++) {
+        if (!is_digit(*word)) return false;
+    }
+    return true;
+}
+
+// Attach the redirection lexed before `word` to the stage
+static bool finish_redirection(Lexer *lx, ParsedCommand *stage, char *word) {
+    ParseArena *arena = lx->arena;
+    RedirOp op = lx->op;
+    bool input = op == OP_IN || op == OP_DUP_IN || op == OP_HEREDOC ||
+                 op == OP_HEREDOC_TABS || op == OP_HERESTRING;
+    int fd = lx->fd >= 0 ? lx->fd : input ? 0 : 1;
+    PARSER_DEBUG("Redirection of fd %d: '%s'", fd, word);
+
+    switch (op) {
+    case OP_IN:
+        return add_redirection(arena, stage, REDIR_INPUT, fd, word) != NULL;
+    case OP_OUT:
+        return add_redirection(arena, stage, REDIR_OUTPUT, fd, word) != NULL;
+    case OP_APPEND:
+        return add_redirection(arena, stage, REDIR_APPEND, fd, word) != NULL;
+    case OP_DUP_IN:
+    case OP_DUP_OUT:
+        if (strcmp(word, "-") == 0) {
+            return add_redirection(arena, stage, REDIR_CLOSE, fd, NULL) != NULL;
+        }
+        if (all_digits(word)) {
+            Redirection *redir = add_redirection(arena, stage, REDIR_DUP, fd, NULL);
+            if (redir) redir->source_fd = atoi(word);
+            return redir != NULL;
+        }
+        if (op == OP_DUP_IN || lx->fd >= 0) {
+            PARSER_DEBUG("Syntax error: %s is not a file descriptor", word);
+            return false;
+        }
+        // `>&file` is an old spelling of `&>file`
+        op = OP_BOTH;
+        __attribute__((fallthrough));
+    case OP_BOTH:
+    case OP_BOTH_APPEND: {
+        if (!add_redirection(arena, stage, op == OP_BOTH ? REDIR_OUTPUT : REDIR_APPEND, 1, word)) {
+            return false;
+        }
+        Redirection *redir = add_redirection(arena, stage, REDIR_DUP, 2, NULL);
+        if (redir) redir->source_fd = 1;
+        return redir != NULL;
+    }
+    case OP_HERESTRING: {
+        size_t len = strlen(word);
+        char *text = arena_alloc(arena, len + 2);
+        if (!text) return false;
+        memcpy(text, word, len);
+        memcpy(text + len, "\n", 2);
+        return add_redirection(arena, stage, REDIR_HERE, fd, text) != NULL;
+    }
+    case OP_HEREDOC:
+    case OP_HEREDOC_TABS: {
+        // The body is filled in once the end of the line is reached
+        Redirection *redir = add_redirection(arena, stage, REDIR_HERE, fd, "");
+        if (!redir) return false;
+        if (lx->heredoc_count == lx->heredoc_capacity) {
+            size_t capacity = lx->heredoc_capacity ? lx->heredoc_capacity * 2 : 4;
+            PendingHeredoc *grown = arena_alloc(arena, capacity * sizeof(PendingHeredoc));
+            if (!grown) return false;
+            if (lx->heredoc_count) memcpy(grown, lx->heredocs, lx->heredoc_count * sizeof(PendingHeredoc));
+            lx->heredocs = grown;
+            lx->heredoc_capacity = capacity;
+        }
+        lx->heredocs[lx->heredoc_count++] = (PendingHeredoc){
+            .redir = redir, .delimiter = word, .strip_tabs = op == OP_HEREDOC_TABS
+        };
+        return true;
+    }
+    }
+    return false;
+}
 
+// Move the collected arguments into the stage as a NULL-terminated array
+static bool finish_stage(ParseArena *arena, ParsedCommand *stage, ArgList *list) {
+    stage->args = arena_alloc(arena, (list->count + 1) * sizeof(char *));
+    if (!stage->args) return false;
+    memcpy(stage->args, list->items, list->count * sizeof(char *));
+    stage->args[list->count] = NULL;
+    PARSER_DEBUG("Stage parsed with %zu arguments", list->count);
+    list->count = 0;
+    return true;
+}
+
+ParsedCommand *parse_command(const char *input) {
+    if (!input) return NULL;
+
+    parser_debug = getenv("NUT_DEBUG_PARSER") != NULL;
+    free(pending_delimiter);
+    pending_delimiter = NULL;
+    PARSER_DEBUG("Parsing command: '%s'", input);
+
+    // The word buffer never needs more than the input itself: quotes and
+    // escapes only shrink a word, and every NUL replaces a separator
+    size_t len = strlen(input);
+    ParseArena *arena = arena_create(len + 1 + 2 * sizeof(ParsedCommand) + 16 * sizeof(char *));
+    if (!arena) return NULL;
+
+    Lexer lx = { .p = input, .out = arena_alloc(arena, len + 1), .arena = arena };
+    ParsedCommand *cmd = arena_zalloc(arena, sizeof(ParsedCommand));
+    if (!lx.out || !cmd) {
+        PARSER_DEBUG("Failed to allocate ParsedCommand");
+        arena_free(arena);
+        return NULL;
+    }
+    cmd->arena = arena;
+
+    ArgList args = { .capacity = 32 };
+    args.items = args.inline_items;
+    // Pipeline of the command list being filled, its current stage, and the
+    // pipeline before it
+    ParsedCommand *pipeline = cmd, *stage = cmd, *prev_pipeline = NULL;
+    // Set after a redirection operator until its word is read
+    bool pending = false;
+    // Set after `;` or `&` until the next command starts
+    bool list_ended = false;
+    bool ok = true;
+
+    while (ok) {
+        char *word = NULL;
+        // Redirection targets and here-document delimiters keep `$?` as text
+        lx.literal = pending;
+        TokenType token = next_token(&lx, &word);
+
+        if (token == TOKEN_ERROR) {
+            ok = false;
+        } else if (token == TOKEN_WORD) {
+            if (pending && lx.word_subs) {
+                PARSER_DEBUG("Syntax error: command substitution in a redirection");
+                ok = false;
+            } else if (pending) {
+                ok = finish_redirection(&lx, stage, word);
+            } else {
+                PARSER_DEBUG("Arg[%zu] = '%s'", args.count, word);
+                if (lx.word_subs) {
+                    Substitution **link = &stage->subs;
+                    while (*link) link = &(*link)->next;
+                    *link = lx.word_subs;
+                    for (Substitution *sub = lx.word_subs; sub; sub = sub->next) {
+                        sub->arg = (int)args.count;
+                    }
+                }
+                ok = args_push(&args, word);
+                list_ended = false;
+            }
+            pending = false;
+        } else if (pending) {
+            PARSER_DEBUG("Syntax error: missing word after redirection");
+            ok = false;
+        } else if (token == TOKEN_REDIR) {
+            pending = true;
+        } else if (token == TOKEN_END) {
+            if (lx.heredoc_count > 0) {
+                PARSER_DEBUG("Here-document body has not been read yet");
+                lx.incomplete = lx.heredocs[0].delimiter;
+                ok = false;
+            }
+            break;
+        } else if (args.count == 0) {
+            PARSER_DEBUG("Syntax error: missing command before %s", token_names[token]);
+            ok = false;
+        } else {
+            ParsedCommand *next = arena_zalloc(arena, sizeof(ParsedCommand));
+            ok = next && finish_stage(arena, stage, &args);
+            if (!ok) break;
+
+            if (token == TOKEN_PIPE) {
+                stage->pipe_next = next;
+                PARSER_DEBUG("Pipe to next stage");
+            } else {
+                // Background applies to the pipeline as a whole
+                if (token == TOKEN_BG) {
+                    pipeline->background = true;
+                    PARSER_DEBUG("Background process");
+                }
+                pipeline->connector = token == TOKEN_AND ? CONNECT_AND :
+                                      token == TOKEN_OR ? CONNECT_OR : CONNECT_SEQ;
+                pipeline->next = next;
+                list_ended = pipeline->connector == CONNECT_SEQ;
+                prev_pipeline = pipeline;
+                pipeline = next;
+                PARSER_DEBUG("List continues after %s", token_names[token]);
+            }
+            stage = next;
+        }
+    }
+
+    if (ok && args.count == 0) {
+        if (stage == cmd) {
+            PARSER_DEBUG("Empty command");
+            ok = false;
+        } else if (!list_ended) {
+            // A trailing `|`, `&&` or `||` leaves an empty last command
+            PARSER_DEBUG("Syntax error: missing command at end of line");
+            ok = false;
+        } else {
+            // A trailing `;` or `&` just ends the list
+            prev_pipeline->next = NULL;
+        }
+    } else if (ok) {
+        ok = finish_stage(arena, stage, &args);
+    }
+
+    if (args.items != args.inline_items) free(args.items);
+    if (lx.incomplete) pending_delimiter = strdup(lx.incomplete);
+    if (!ok) {
+        arena_free(arena);
+        return NULL;
+    }
     return cmd;
 }
 
+const char *parse_pending_heredoc() {
+    return pending_delimiter;
+}
+
 void free_parsed_command(ParsedCommand *cmd) {
     if (!cmd) return;
-    
-    if (cmd->args) {
-        for (int i = 0; cmd->args[i]; i++) 
-            free(cmd->args[i]);
-        free(cmd->args);
-    }
-    
-    free(cmd->input_file);
-    free(cmd->output_file);
-    free(cmd);
+    // Every node, argument array and string is in the arena
+    arena_free(cmd->arena);
+}
+
+void *parsed_command_alloc(ParsedCommand *cmd, size_t size) {
+    return arena_zalloc(cmd->arena, size);
 }
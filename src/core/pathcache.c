@@ -0,0 +1,275 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+#include <nutshell/core.h>
+#include <nutshell/utils.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Path cache debug macro
+#define HASH_DEBUG(fmt, ...) \
+    do { if (getenv("NUT_DEBUG_EXEC")) fprintf(stderr, "HASH: " fmt "\n", ##__VA_ARGS__); } while(0)
+
+#define PATH_CACHE_MIN_SLOTS 64
+
+// A directory from $PATH with the mtime it had when we last looked
+typedef struct {
+    char *dir;
+    struct timespec mtime;
+    bool exists;
+} PathDir;
+
+// One remembered command, like an entry in bash's `hash` table
+typedef struct {
+    char *name;
+    char *path;
+    size_t dir_index;   // Position in $PATH where it was found
+    unsigned long hits;
+} PathEntry;
+
+static struct {
+    char *path_env;     // $PATH the table was built for
+    PathDir *dirs;
+    size_t dir_count;
+    PathEntry *slots;   // Open addressing, linear probing
+    size_t slot_count;
+    size_t used;
+} cache = { 0 };
+
+static void free_entries() {
+    for (size_t i = 0; i < cache.slot_count; i++) {
+        free(cache.slots[i].name);
+        free(cache.slots[i].path);
+    }
+    free(cache.slots);
+    cache.slots = NULL;
+    cache.slot_count = 0;
+    cache.used = 0;
+}
+
+static void free_dirs() {
+    for (size_t i = 0; i < cache.dir_count; i++) {
+        free(cache.dirs[i].dir);
+    }
+    free(cache.dirs);
+    cache.dirs = NULL;
+    cache.dir_count = 0;
+    free(cache.path_env);
+    cache.path_env = NULL;
+}
+
+static void snapshot_dir(PathDir *dir) {
+    struct stat st;
+    dir->exists = stat(dir->dir, &st) == 0;
+    if (dir->exists) {
+        dir->mtime = st.st_mtim;
+    }
+}
+
+static bool dir_changed(PathDir *dir) {
+    struct stat st;
+    bool exists = stat(dir->dir, &st) == 0;
+    if (exists != dir->exists) return true;
+    return exists && (st.st_mtim.tv_sec != dir->mtime.tv_sec ||
+                      st.st_mtim.tv_nsec != dir->mtime.tv_nsec);
+}
+
+// Rebuild the directory list for a new $PATH; the table starts over
+static void load_path(const char *path_env) {
+    free_entries();
+    free_dirs();
+
+    cache.path_env = strdup(path_env);
+    if (!cache.path_env) return;
+
+    size_t count = 1;
+    for (const char *p = path_env; *p; p++) {
+        if (*p == ':') count++;
+    }
+    cache.dirs = calloc(count, sizeof(PathDir));
+    if (!cache.dirs) return;
+
+    const char *start = path_env;
+    while (1) {
+        const char *end = strchr(start, ':');
+        size_t len = end ? (size_t)(end - start) : strlen(start);
+
+        // An empty PATH element means the current directory
+        PathDir *dir = &cache.dirs[cache.dir_count++];
+        dir->dir = len ? strndup(start, len) : strdup(".");
+        snapshot_dir(dir);
+
+        if (!end) break;
+        start = end + 1;
+    }
+    HASH_DEBUG("PATH changed, tracking %zu directories", cache.dir_count);
+}
+
+static PathEntry *find_slot(const char *name) {
+    if (cache.slot_count == 0) return NULL;
+    size_t mask = cache.slot_count - 1;
+    for (size_t i = hash_string(name) & mask; ; i = (i + 1) & mask) {
+        PathEntry *entry = &cache.slots[i];
+        if (!entry->name || strcmp(entry->name, name) == 0) {
+            return entry;
+        }
+    }
+}
+
+static bool grow_table() {
+    size_t new_count = cache.slot_count ? cache.slot_count * 2 : PATH_CACHE_MIN_SLOTS;
+    PathEntry *old = cache.slots;
+    size_t old_count = cache.slot_count;
+
+    cache.slots = calloc(new_count, sizeof(PathEntry));
+    if (!cache.slots) {
+        cache.slots = old;
+        return false;
+    }
+    cache.slot_count = new_count;
+
+    for (size_t i = 0; i < old_count; i++) {
+        if (old[i].name) {
+            *find_slot(old[i].name) = old[i];
+        }
+    }
+    free(old);
+    return true;
+}
+
+// Walk $PATH once, the way execvp would, but without exec'ing anything
+static bool search_path(const char *name, char **path_out, size_t *index_out) {
+    char candidate[PATH_MAX];
+    for (size_t i = 0; i < cache.dir_count; i++) {
+        snprintf(candidate, sizeof(candidate), "%s/%s", cache.dirs[i].dir, name);
+
+        struct stat st;
+        if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) &&
+            access(candidate, X_OK) == 0) {
+            *path_out = strdup(candidate);
+            *index_out = i;
+            return *path_out != NULL;
+        }
+    }
+    return false;
+}
+
+// An entry found in directory k is only stale if directory k lost it or an
+// earlier directory gained a shadowing executable, so only those are checked
+static bool entry_is_current(const PathEntry *entry) {
+    for (size_t i = 0; i <= entry->dir_index && i < cache.dir_count; i++) {
+        if (dir_changed(&cache.dirs[i])) {
+            HASH_DEBUG("%s changed, forgetting remembered locations", cache.dirs[i].dir);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void refresh_dir_snapshots() {
+    for (size_t i = 0; i < cache.dir_count; i++) {
+        snapshot_dir(&cache.dirs[i]);
+    }
+}
+
+// Keep the table in step with $PATH; returns false if there is no PATH
+static bool sync_path() {
+    const char *path_env = getenv("PATH");
+    if (!path_env) path_env = "/usr/local/bin:/usr/bin:/bin";
+
+    if (!cache.path_env || strcmp(cache.path_env, path_env) != 0) {
+        load_path(path_env);
+    }
+    return cache.dirs != NULL;
+}
+
+// Insert name after a fresh PATH search. Returns the entry or NULL.
+static PathEntry *remember(const char *name) {
+    char *path;
+    size_t index;
+    if (!search_path(name, &path, &index)) return NULL;
+
+    if ((cache.used + 1) * 10 > cache.slot_count * 7 && !grow_table()) {
+        free(path);
+        return NULL;
+    }
+
+    PathEntry *entry = find_slot(name);
+    entry->name = strdup(name);
+    entry->path = path;
+    entry->dir_index = index;
+    entry->hits = 0;
+    cache.used++;
+
+    HASH_DEBUG("Remembered %s -> %s", name, path);
+    return entry;
+}
+
+const char *path_cache_lookup(const char *name) {
+    if (!name || !*name || strchr(name, '/')) return NULL;
+    if (!sync_path()) return NULL;
+
+    PathEntry *entry = find_slot(name);
+    if (entry && entry->name) {
+        if (entry_is_current(entry)) {
+            entry->hits++;
+            return entry->path;
+        }
+        // A directory changed under us: start over from the new contents
+        free_entries();
+        refresh_dir_snapshots();
+    }
+
+    entry = remember(name);
+    if (!entry) return NULL;
+    entry->hits++;
+    return entry->path;
+}
+
+void path_cache_clear() {
+    free_entries();
+    refresh_dir_snapshots();
+    HASH_DEBUG("Table cleared");
+}
+
+void path_cache_free() {
+    free_entries();
+    free_dirs();
+}
+
+// Builtin: `hash` lists remembered commands, `hash -r` forgets them all and
+// `hash name...` looks names up and remembers them
+int hash_command(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "-r") == 0) {
+        path_cache_clear();
+        return 0;
+    }
+
+    if (argc > 1) {
+        int status = 0;
+        sync_path();
+        for (int i = 1; i < argc; i++) {
+            PathEntry *entry = find_slot(argv[i]);
+            if ((!entry || !entry->name) && !remember(argv[i])) {
+                fprintf(stderr, "hash: %s: not found\n", argv[i]);
+                status = 1;
+            }
+        }
+        return status;
+    }
+
+    if (cache.used == 0) {
+        printf("hash: hash table empty\n");
+        return 0;
+    }
+
+    printf("hits\tcommand\n");
+    for (size_t i = 0; i < cache.slot_count; i++) {
+        if (cache.slots[i].name) {
+            printf("%4lu\t%s\n", cache.slots[i].hits, cache.slots[i].path);
+        }
+    }
+    return 0;
+}
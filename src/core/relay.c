@@ -0,0 +1,331 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+#include <nutshell/core.h>
+#include <nutshell/utils.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <termios.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+// Relay debug macro, enabled through the environment like the other subsystems
+#define RELAY_DEBUG(fmt, ...) \
+    do { if (getenv("NUT_DEBUG_RELAY")) fprintf(stderr, "RELAY: " fmt "\n", ##__VA_ARGS__); } while(0)
+
+// How long to keep draining after the command finished before giving up on
+// stray writers (e.g. a daemon that inherited the relay as its stdout)
+#define RELAY_DRAIN_MS 100
+
+// Bounded ring buffer holding the most recent bytes of command output
+typedef struct {
+    char *data;
+    size_t capacity;
+    size_t start;
+    size_t length;
+} OutputRing;
+
+// State of one relay. Only one command runs in the foreground at a time, but
+// a relay outlives its command when that command is stopped and becomes a job.
+typedef struct {
+    bool is_pty;
+    int read_fd;        // pty master or pipe read end, drained by the thread
+    int write_fd;       // pty slave or pipe write end, installed on fd 1 and 2
+    int saved_stdout;   // the real terminal, restored when the relay stops
+    int saved_stderr;
+    int wake_pipe[2];   // tells the thread the command has finished
+    pthread_t thread;
+    pthread_mutex_t ring_lock;
+    OutputRing ring;
+    bool keep_running;          // Set while active: a stopped job still writes here
+    atomic_bool detached;       // The thread cleans up after itself on EOF
+} OutputRelay;
+
+// The relay installed on fd 1 and 2, or NULL
+static OutputRelay *relay = NULL;
+
+static size_t tail_size = OUTPUT_TAIL_DEFAULT;
+
+void output_relay_set_tail_size(size_t size) {
+    tail_size = size > 0 ? size : OUTPUT_TAIL_DEFAULT;
+    RELAY_DEBUG("Tail size set to %zu bytes", tail_size);
+}
+
+size_t output_relay_get_tail_size() {
+    return tail_size;
+}
+
+static void ring_append(OutputRing *ring, const char *buf, size_t len) {
+    if (!ring->data || ring->capacity == 0) return;
+
+    // Only the last `capacity` bytes of a large chunk can survive anyway
+    if (len >= ring->capacity) {
+        memcpy(ring->data, buf + len - ring->capacity, ring->capacity);
+        ring->start = 0;
+        ring->length = ring->capacity;
+        return;
+    }
+
+    size_t end = (ring->start + ring->length) % ring->capacity;
+    size_t first = ring->capacity - end < len ? ring->capacity - end : len;
+    memcpy(ring->data + end, buf, first);
+    memcpy(ring->data, buf + first, len - first);
+
+    ring->length += len;
+    if (ring->length > ring->capacity) {
+        ring->start = (ring->start + ring->length - ring->capacity) % ring->capacity;
+        ring->length = ring->capacity;
+    }
+}
+
+// Copy the ring into a linear, NUL terminated string
+static char *ring_contents(const OutputRing *ring) {
+    char *out = malloc(ring->length + 1);
+    if (!out) return NULL;
+
+    size_t first = ring->capacity - ring->start < ring->length ?
+                   ring->capacity - ring->start : ring->length;
+    if (ring->length > 0) {
+        memcpy(out, ring->data + ring->start, first);
+        memcpy(out + first, ring->data, ring->length - first);
+    }
+    out[ring->length] = '\0';
+    return out;
+}
+
+static void write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+static void free_relay(OutputRelay *r) {
+    if (r->read_fd >= 0) close(r->read_fd);
+    if (r->wake_pipe[0] >= 0) close(r->wake_pipe[0]);
+    if (r->wake_pipe[1] >= 0) close(r->wake_pipe[1]);
+    if (r->saved_stdout >= 0) close(r->saved_stdout);
+    if (r->saved_stderr >= 0) close(r->saved_stderr);
+    pthread_mutex_destroy(&r->ring_lock);
+    free(r->ring.data);
+    free(r);
+}
+
+// Reader thread: copy everything to the terminal as it arrives and keep the tail
+static void *relay_thread(void *arg) {
+    OutputRelay *r = arg;
+    char buf[8192];
+    bool draining = false;
+    struct pollfd fds[2] = {
+        { .fd = r->read_fd, .events = POLLIN },
+        { .fd = r->wake_pipe[0], .events = POLLIN },
+    };
+
+    while (1) {
+        int ready = poll(fds, draining ? 1 : 2, draining ? RELAY_DRAIN_MS : -1);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (ready == 0) {
+            RELAY_DEBUG("Stopped draining: output side still held open");
+            break;
+        }
+
+        if (!draining && (fds[1].revents & POLLIN)) {
+            draining = true;
+        }
+
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t n = read(r->read_fd, buf, sizeof(buf));
+            if (n > 0) {
+                write_all(r->saved_stdout, buf, (size_t)n);
+                pthread_mutex_lock(&r->ring_lock);
+                ring_append(&r->ring, buf, (size_t)n);
+                pthread_mutex_unlock(&r->ring_lock);
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else {
+                // EOF on a pipe, or EIO on a pty master once every slave is closed
+                break;
+            }
+        }
+    }
+
+    if (atomic_load(&r->detached)) {
+        RELAY_DEBUG("Detached relay finished");
+        free_relay(r);
+    }
+    return NULL;
+}
+
+static int set_cloexec(int fd) {
+    int flags = fcntl(fd, F_GETFD);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+}
+
+// Open a pty pair whose slave mirrors the terminal, so commands keep seeing a tty
+static bool open_pty_pair(int *master_out, int *slave_out) {
+    if (!isatty(STDOUT_FILENO)) return false;
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0) return false;
+
+    if (grantpt(master) != 0 || unlockpt(master) != 0) {
+        close(master);
+        return false;
+    }
+
+    const char *slave_name = ptsname(master);
+    int slave = slave_name ? open(slave_name, O_RDWR | O_NOCTTY) : -1;
+    if (slave < 0) {
+        close(master);
+        return false;
+    }
+
+    // Mirror the terminal settings but pass bytes through untouched; the real
+    // terminal does its own output processing when we copy them across.
+    struct termios tio;
+    if (tcgetattr(STDOUT_FILENO, &tio) == 0) {
+        tio.c_oflag &= ~OPOST;
+        tcsetattr(slave, TCSANOW, &tio);
+    }
+
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0) {
+        ioctl(slave, TIOCSWINSZ, &ws);
+    }
+
+    set_cloexec(master);
+    set_cloexec(slave);
+    *master_out = master;
+    *slave_out = slave;
+    return true;
+}
+
+bool output_relay_start() {
+    if (relay) return false;
+
+    OutputRelay *r = calloc(1, sizeof(OutputRelay));
+    if (!r) return false;
+    r->read_fd = r->write_fd = r->saved_stdout = r->saved_stderr = -1;
+    r->wake_pipe[0] = r->wake_pipe[1] = -1;
+    pthread_mutex_init(&r->ring_lock, NULL);
+    atomic_init(&r->detached, false);
+
+    r->is_pty = open_pty_pair(&r->read_fd, &r->write_fd);
+    if (!r->is_pty) {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            RELAY_DEBUG("pipe failed: %s", strerror(errno));
+            free_relay(r);
+            return false;
+        }
+        set_cloexec(fds[0]);
+        set_cloexec(fds[1]);
+        r->read_fd = fds[0];
+        r->write_fd = fds[1];
+    }
+
+    if (pipe(r->wake_pipe) != 0) {
+        r->wake_pipe[0] = r->wake_pipe[1] = -1;
+        close(r->write_fd);
+        free_relay(r);
+        return false;
+    }
+    set_cloexec(r->wake_pipe[0]);
+    set_cloexec(r->wake_pipe[1]);
+
+    r->ring.data = malloc(tail_size);
+    r->ring.capacity = r->ring.data ? tail_size : 0;
+
+    fflush(stdout);
+    fflush(stderr);
+    r->saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+    r->saved_stderr = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 3);
+
+    if (r->saved_stdout < 0 || r->saved_stderr < 0 ||
+        pthread_create(&r->thread, NULL, relay_thread, r) != 0) {
+        RELAY_DEBUG("Failed to start relay");
+        close(r->write_fd);
+        free_relay(r);
+        return false;
+    }
+
+    // Commands (and in-process builtins) now write into the relay
+    dup2(r->write_fd, STDOUT_FILENO);
+    dup2(r->write_fd, STDERR_FILENO);
+    relay = r;
+
+    RELAY_DEBUG("Relay started over a %s", r->is_pty ? "pty" : "pipe");
+    return true;
+}
+
+char *output_relay_stop() {
+    if (!relay) return NULL;
+    OutputRelay *r = relay;
+    relay = NULL;
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(r->saved_stdout, STDOUT_FILENO);
+    dup2(r->saved_stderr, STDERR_FILENO);
+
+    if (r->keep_running) {
+        // A stopped job still holds the write side: leave the thread copying
+        // its output to the terminal until the job exits, then it frees itself.
+        // It cannot see EOF before write_fd is closed, so this does not race.
+        pthread_mutex_lock(&r->ring_lock);
+        char *tail = ring_contents(&r->ring);
+        pthread_mutex_unlock(&r->ring_lock);
+
+        atomic_store(&r->detached, true);
+        close(r->write_fd);
+        pthread_detach(r->thread);
+        RELAY_DEBUG("Relay left running for a stopped job");
+        return tail;
+    }
+
+    // Dropping our last reference to the write side lets the thread see EOF
+    // once the command's own copies are gone
+    close(r->write_fd);
+    write_all(r->wake_pipe[1], "x", 1);
+    pthread_join(r->thread, NULL);
+
+    char *tail = ring_contents(&r->ring);
+    RELAY_DEBUG("Relay stopped, kept %zu bytes of output", r->ring.length);
+    free_relay(r);
+    return tail;
+}
+
+// The command writing into the relay was stopped and is now a job: keep
+// forwarding its output after output_relay_stop()
+void output_relay_keep_running() {
+    if (relay) relay->keep_running = true;
+}
+
+// Called in a forked child that must outlive the relay (background jobs):
+// point its output straight at the terminal instead of the relay.
+void output_relay_detach_child() {
+    if (!relay) return;
+    dup2(relay->saved_stdout, STDOUT_FILENO);
+    dup2(relay->saved_stderr, STDERR_FILENO);
+}
+
+// The terminal descriptors saved while the relay is active, for launchers
+// that set up a child's descriptors without running code in it
+bool output_relay_terminal_fds(int *out_fd, int *err_fd) {
+    if (!relay) return false;
+    *out_fd = relay->saved_stdout;
+    *err_fd = relay->saved_stderr;
+    return true;
+}
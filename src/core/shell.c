@@ -30,14 +30,24 @@ void handle_sigint(int sig) {
     rl_redisplay();
 }
 
+// A prompt segment that outlived its deadline has finished: show it
+static void redraw_prompt() {
+    if (!segment_commands_collect() || !current_theme) return;
+    char *prompt = render_theme_prompt(current_theme);
+    if (!prompt) return;
+    rl_set_prompt(prompt);
+    rl_forced_update_display();
+    free(prompt);
+}
+
 extern int install_pkg_command(int argc, char **argv);
 extern int theme_command(int argc, char **argv);
 
 // Initialize command history
-CommandHistory cmd_history = {NULL, NULL, 0, false};
+CommandHistory cmd_history = {NULL, NULL, 0, false, {0}};
 
 // Function to store command output
-void capture_command_output(const char *command, int exit_status, const char *output) {
+void capture_command_output(const char *command, const CommandResult *result, const char *output) {
     // Free previous entries
     free(cmd_history.last_command);
     free(cmd_history.last_output);
@@ -45,12 +55,13 @@ void capture_command_output(const char *command, int exit_status, const char *ou
     // Store new entries
     cmd_history.last_command = strdup(command);
     cmd_history.last_output = output ? strdup(output) : NULL;
-    cmd_history.exit_status = exit_status;
-    cmd_history.has_error = (exit_status != 0);
+    cmd_history.last_result = *result;
+    cmd_history.exit_status = result->exit_code;
+    cmd_history.has_error = (result->exit_code != 0);
     
     if (getenv("NUT_DEBUG")) {
         DEBUG_LOG("Stored command: %s", cmd_history.last_command);
-        DEBUG_LOG("Exit status: %d", cmd_history.exit_status);
+        DEBUG_LOG("Exit status: %d (%.3f ms)", cmd_history.exit_status, result->wall_ms);
         DEBUG_LOG("Output: %.40s%s", cmd_history.last_output ? cmd_history.last_output : "(none)",
                   cmd_history.last_output && strlen(cmd_history.last_output) > 40 ? "..." : "");
     }
@@ -60,40 +71,11 @@ void shell_loop() {
     char *input;
     struct sigaction sa;
     
-    // Initialize the configuration system first
-    if (getenv("NUT_DEBUG")) {
-        DEBUG_LOG("Initializing configuration system");
+    // Size of the output tail kept for `fix`
+    const char *tail_env = getenv("NUT_OUTPUT_TAIL");
+    if (tail_env) {
+        output_relay_set_tail_size(strtoul(tail_env, NULL, 10));
     }
-    init_config_system();
-    
-    // Initialize the theme system
-    if (getenv("NUT_DEBUG")) {
-        DEBUG_LOG("Initializing theme system");
-    }
-    init_theme_system();
-    
-    // Load saved theme from config if available
-    const char *saved_theme = get_config_theme();
-    if (saved_theme && current_theme && strcmp(current_theme->name, saved_theme) != 0) {
-        if (getenv("NUT_DEBUG")) {
-            DEBUG_LOG("Loading saved theme from config: %s", saved_theme);
-        }
-        Theme *theme = load_theme(saved_theme);
-        if (theme) {
-            if (current_theme) {
-                free_theme(current_theme);
-            }
-            current_theme = theme;
-            if (getenv("NUT_DEBUG")) {
-                DEBUG_LOG("Successfully loaded saved theme: %s", theme->name);
-            }
-        } else if (getenv("NUT_DEBUG")) {
-            DEBUG_LOG("Failed to load saved theme: %s", saved_theme);
-        }
-    }
-    
-    // Initialize the AI shell integration
-    init_ai_shell();
     
     sa.sa_handler = handle_sigint;
     sigemptyset(&sa.sa_mask);
@@ -103,11 +85,20 @@ void shell_loop() {
         perror("sigaction");
         exit(EXIT_FAILURE);
     }
+    
+    // Job control, with background jobs reaped while we wait for input
+    jobs_init();
+    rl_getc_function = jobs_getc;
+    jobs_watch_idle(segment_commands_fds, redraw_prompt);
+    
+    // Packages installed or removed while the shell runs show up in it
+    registry_watch_packages();
 
     printf("Nutshell initialized. Type commands or 'exit' to quit.\n");
 
     while (1) {
         sigint_received = 0;
+        jobs_notify();
         char *prompt = get_prompt();
         input = readline(prompt);
         free(prompt);
@@ -115,172 +106,68 @@ void shell_loop() {
         if (!input) break;  // EOF
         
         if (strlen(input) > 0) {
+            registry_poll_packages();
+            
+            // Lines typed again come straight from the cache, already resolved
+            ParsedCommand *cmd = parse_cache_acquire(input);
+            // A here-document carries on over the following lines
+            while (!cmd && parse_pending_heredoc()) {
+                char *more = readline("> ");
+                char *joined = NULL;
+                if (!more || asprintf(&joined, "%s\n%s", input, more) < 0) {
+                    free(more);
+                    break;
+                }
+                free(more);
+                free(input);
+                input = joined;
+                cmd = parse_cache_acquire(input);
+            }
             add_history(input);
-            ParsedCommand *cmd = parse_command(input);
             if (cmd) {
                 // Save the original command string for history regardless of how we process it
-                char full_cmd[1024] = {0};
-                for (int i = 0; cmd->args[i]; i++) {
-                    if (i > 0) strcat(full_cmd, " ");
-                    strcat(full_cmd, cmd->args[i]);
-                }
+                const char *full_cmd = input;
                 
-                // Special handling for theme command
-                if (cmd->args[0] && strcmp(cmd->args[0], "theme") == 0) {
-                    // Count arguments
-                    int argc = 0;
-                    while (cmd->args[argc]) argc++;
-                    
-                    // Capture theme command output
-                    char output_file[] = "/tmp/nutshell_output_XXXXXX";
-                    int output_fd = mkstemp(output_file);
-                    if (output_fd != -1) {
-                        int stdout_bak = dup(STDOUT_FILENO);
-                        int stderr_bak = dup(STDERR_FILENO);
-                        
-                        // Redirect stdout and stderr to temp file
-                        dup2(output_fd, STDOUT_FILENO);
-                        dup2(output_fd, STDERR_FILENO);
-                        
-                        int status = theme_command(argc, cmd->args);
-                        
-                        // Restore stdout and stderr
-                        fflush(stdout);
-                        fflush(stderr);
-                        dup2(stdout_bak, STDOUT_FILENO);
-                        dup2(stderr_bak, STDERR_FILENO);
-                        close(stdout_bak);
-                        close(stderr_bak);
-                        
-                        // Read the captured output
-                        lseek(output_fd, 0, SEEK_SET);
-                        char output_buf[4096] = {0};
-                        read(output_fd, output_buf, sizeof(output_buf) - 1);
-                        close(output_fd);
-                        unlink(output_file);
-                        
-                        // Display the output
-                        printf("%s", output_buf);
-                        
-                        // Store command history
-                        capture_command_output(full_cmd, status, output_buf);
-                    } else {
-                        int status = theme_command(argc, cmd->args);
-                        capture_command_output(full_cmd, status, NULL);
-                    }
-                } else if (handle_ai_command(cmd)) {
-                    // For AI commands, just store the command without output capture
-                    capture_command_output(full_cmd, 0, NULL);
-                    
-                    // We can still capture stderr if needed in the future
-                    // by uncommenting and implementing this code:
-                    /*
-                    char output_file[] = "/tmp/nutshell_output_XXXXXX";
-                    int output_fd = mkstemp(output_file);
-                    if (output_fd != -1) {
-                        // Implementation would go here
-                        close(output_fd);
-                        unlink(output_file);
-                    }
-                    */
-                } else if (cmd->args[0] && is_terminal_control_command(cmd->args[0])) {
-                    // For terminal control commands, execute directly but capture output where possible
-                    FILE *fp = NULL;
+                if (is_ai_command(cmd->args[0]) || is_terminal_control_command(cmd->args[0])) {
+                    // AI commands talk to the user and terminal control commands
+                    // need the real terminal, so they bypass the relay and only
+                    // the command and its status are stored
+                    CommandResult result = execute_command(cmd);
+                    capture_command_output(full_cmd, &result, NULL);
+                } else {
+                    // For regular commands (and the theme builtin), stream output
+                    // live while the relay keeps the most recent bytes for `fix`
+                    bool relayed = output_relay_start();
                     
-                    // Create the full command with arguments
-                    char full_terminal_cmd[1024] = {0};
-                    for (int i = 0; cmd->args[i]; i++) {
-                        if (i > 0) strcat(full_terminal_cmd, " ");
-                        strcat(full_terminal_cmd, cmd->args[i]);
-                    }
+                    // Execute the command
+                    CommandResult result = execute_command(cmd);
                     
-                    // Try to capture any error output
-                    fp = popen(full_terminal_cmd, "r");
-                    if (fp) {
-                        // Execute the command directly for terminal interaction
-                        system(full_terminal_cmd);
-                        
-                        // Read any output that might have been captured
-                        char output_buf[4096] = {0};
-                        if (fread(output_buf, 1, sizeof(output_buf) - 1, fp) > 0) {
-                            capture_command_output(full_cmd, 0, output_buf);
-                        } else {
-                            capture_command_output(full_cmd, 0, NULL);
-                        }
-                        int status = pclose(fp);
-                        if (status != 0) {
-                            capture_command_output(full_cmd, WEXITSTATUS(status), NULL);
-                        }
-                    } else {
-                        // Fall back to direct execution
-                        execute_command(cmd);
-                        capture_command_output(full_cmd, 0, NULL);
-                    }
-                } else {
-                    // For regular commands, track execution and capture output
+                    char *output = relayed ? output_relay_stop() : NULL;
                     
-                    // Capture stdout and stderr for error tracking
-                    char output_file[] = "/tmp/nutshell_output_XXXXXX";
-                    int output_fd = mkstemp(output_file);
-                    if (output_fd != -1) {
-                        int stdout_bak = dup(STDOUT_FILENO);
-                        int stderr_bak = dup(STDERR_FILENO);
-                        
-                        // Redirect stdout and stderr to temp file
-                        dup2(output_fd, STDOUT_FILENO);
-                        dup2(output_fd, STDERR_FILENO);
-                        
-                        // Execute the command
-                        execute_command(cmd);
-                        int exit_status = WEXITSTATUS(0); // Get last command status
-                        
-                        // Restore stdout and stderr
-                        fflush(stdout);
-                        fflush(stderr);
-                        dup2(stdout_bak, STDOUT_FILENO);
-                        dup2(stderr_bak, STDERR_FILENO);
-                        close(stdout_bak);
-                        close(stderr_bak);
-                        
-                        // Read the captured output
-                        lseek(output_fd, 0, SEEK_SET);
-                        char output_buf[4096] = {0};
-                        read(output_fd, output_buf, sizeof(output_buf) - 1);
-                        close(output_fd);
-                        unlink(output_file);
-                        
-                        // IMPORTANT: Display the output to the user
-                        printf("%s", output_buf);
-                        
-                        // Store command history
-                        capture_command_output(full_cmd, exit_status, output_buf);
-                    } else {
-                        // Couldn't create temp file, execute normally
-                        execute_command(cmd);
-                        
-                        // Still store command but without output
-                        capture_command_output(full_cmd, 0, NULL);
-                    }
+                    // Store command history
+                    capture_command_output(full_cmd, &result, output);
+                    free(output);
                 }
-                free_parsed_command(cmd);
+                parse_cache_release(cmd);
             }
         }
         
         free(input);
     }
     
+    jobs_free();
+    parse_cache_free();
+    alias_cache_free();
+    
     // Clean up command history
     free(cmd_history.last_command);
     free(cmd_history.last_output);
-    
-    // Clean up theme system
-    cleanup_theme_system();
-    
-    // Clean up configuration system
-    cleanup_config_system();
 }
 
 char *get_prompt() {
+    // The theme is loaded for the first prompt
+    module_require(MODULE_THEME);
+    
     // Use the theme system if available
     if (current_theme) {
         return get_theme_prompt(current_theme);
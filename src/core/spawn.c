@@ -0,0 +1,375 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+#include <nutshell/core.h>
+#include <nutshell/utils.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+// Launcher debug macro, shares the executor's switch
+#define SPAWN_DEBUG(fmt, ...) \
+    do { if (getenv("NUT_DEBUG_EXEC")) fprintf(stderr, "SPAWN: " fmt "\n", ##__VA_ARGS__); } while(0)
+
+extern char **environ;
+
+static bool backend_initialized = false;
+static SpawnBackend backend = SPAWN_BACKEND_SPAWN;
+
+SpawnBackend get_spawn_backend() {
+    if (!backend_initialized) {
+        const char *env = getenv("NUT_EXEC_BACKEND");
+        backend = env && strcmp(env, "fork") == 0 ? SPAWN_BACKEND_FORK : SPAWN_BACKEND_SPAWN;
+        backend_initialized = true;
+    }
+    return backend;
+}
+
+void set_spawn_backend(SpawnBackend new_backend) {
+    backend = new_backend;
+    backend_initialized = true;
+}
+
+const char *spawn_backend_name(SpawnBackend which) {
+    return which == SPAWN_BACKEND_FORK ? "fork" : "posix_spawn";
+}
+
+// Here-document descriptors are moved up here, clear of the low descriptors
+// a command redirects
+#define HERE_DOC_FD_MIN 10
+
+static bool write_all(int fd, const char *text, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, text, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        text += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+// Hand back a descriptor that reads `text` from the start. On Linux this is
+// a memfd; elsewhere a pipe, with a short-lived process writing whatever
+// does not fit in the pipe buffer. Returns -1 with errno set on failure.
+int open_here_doc(const char *text) {
+    size_t len = strlen(text);
+    int fd = -1;
+
+#ifdef MFD_CLOEXEC
+    fd = memfd_create("nutshell-heredoc", MFD_CLOEXEC);
+    if (fd >= 0) {
+        if (!write_all(fd, text, len) || lseek(fd, 0, SEEK_SET) != 0) {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return -1;
+        }
+    }
+#endif
+
+    if (fd < 0) {
+        int fds[2];
+        if (pipe(fds) != 0) return -1;
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+        // Fill the pipe without blocking, then leave the rest to a writer
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        ssize_t n = write(fds[1], text, len);
+        size_t written = n > 0 ? (size_t)n : 0;
+        if (written < len) {
+            // Double fork so the writer is never left for us to reap
+            pid_t pid = fork();
+            if (pid == 0) {
+                if (fork() == 0) {
+                    close(fds[0]);
+                    fcntl(fds[1], F_SETFL, 0);
+                    write_all(fds[1], text + written, len - written);
+                    _exit(0);
+                }
+                _exit(0);
+            }
+            if (pid > 0) waitpid(pid, NULL, 0);
+        }
+        close(fds[1]);
+        fd = fds[0];
+    }
+
+    if (fd < HERE_DOC_FD_MIN) {
+        int moved = fcntl(fd, F_DUPFD_CLOEXEC, HERE_DOC_FD_MIN);
+        if (moved >= 0) {
+            close(fd);
+            fd = moved;
+        }
+    }
+    SPAWN_DEBUG("Here-document of %zu bytes on fd %d", len, fd);
+    return fd;
+}
+
+// Apply redirections in order in a forked child. Returns false after
+// reporting the first one that fails.
+static bool apply_redirections(const Redirection *redir) {
+    for (; redir; redir = redir->next) {
+        int fd;
+        switch (redir->type) {
+        case REDIR_INPUT:
+            fd = open(redir->target, O_RDONLY);
+            break;
+        case REDIR_OUTPUT:
+            fd = open(redir->target, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            break;
+        case REDIR_APPEND:
+            fd = open(redir->target, O_WRONLY | O_CREAT | O_APPEND, 0644);
+            break;
+        case REDIR_HERE:
+            fd = open_here_doc(redir->target);
+            if (fd < 0) {
+                perror("here-document");
+                return false;
+            }
+            break;
+        case REDIR_DUP:
+            if (redir->source_fd != redir->fd && dup2(redir->source_fd, redir->fd) < 0) {
+                fprintf(stderr, "%d: %s\n", redir->source_fd, strerror(errno));
+                return false;
+            }
+            continue;
+        case REDIR_CLOSE:
+            close(redir->fd);
+            continue;
+        default:
+            continue;
+        }
+
+        if (fd < 0) {
+            perror(redir->target);
+            return false;
+        }
+        if (fd != redir->fd) {
+            dup2(fd, redir->fd);
+            close(fd);
+        }
+    }
+    return true;
+}
+
+// Prepare a freshly forked child according to the spec. Exits the child if a
+// redirection cannot be opened.
+void launch_setup_child(const LaunchSpec *spec) {
+    if (spec->pgid >= 0) {
+        setpgid(0, spec->pgid);
+    }
+    // Undo the shell's own signal handling (job control ignores these)
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+
+    if (spec->detach_output) {
+        output_relay_detach_child();
+    }
+
+    if (spec->stdin_fd >= 0 && spec->stdin_fd != STDIN_FILENO) {
+        dup2(spec->stdin_fd, STDIN_FILENO);
+        close(spec->stdin_fd);
+    }
+    if (spec->stdout_fd >= 0 && spec->stdout_fd != STDOUT_FILENO) {
+        dup2(spec->stdout_fd, STDOUT_FILENO);
+        close(spec->stdout_fd);
+    }
+
+    // Redirections take precedence over pipes. On failure leave without
+    // flushing the copy of the shell's stdio buffers.
+    if (!apply_redirections(spec->redirs)) {
+        _exit(EXIT_FAILURE);
+    }
+}
+
+// Classic backend: fork, set up the child by hand, exec
+static pid_t launch_with_fork(const LaunchSpec *spec) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    launch_setup_child(spec);
+    if (spec->path) {
+        execv(spec->path, spec->argv);
+    } else if (spec->use_path) {
+        execvp(spec->argv[0], spec->argv);
+    } else {
+        execv(spec->argv[0], spec->argv);
+    }
+
+    int exec_errno = errno;
+    fprintf(stderr, "ERROR: Failed to execute '%s': %s\n", spec->argv[0], strerror(exec_errno));
+    _exit(exec_errno == ENOENT ? 127 : 126);
+}
+
+// Turn redirections into file actions. Here-documents are opened here, in
+// the shell, and their descriptors stored in here_fds for closing after the
+// spawn. Returns false if one cannot be opened.
+static bool add_redirection_actions(posix_spawn_file_actions_t *actions, const Redirection *redir,
+                                    int *here_fds, size_t *here_count) {
+    for (; redir; redir = redir->next) {
+        switch (redir->type) {
+        case REDIR_INPUT:
+            posix_spawn_file_actions_addopen(actions, redir->fd, redir->target, O_RDONLY, 0);
+            break;
+        case REDIR_OUTPUT:
+            posix_spawn_file_actions_addopen(actions, redir->fd, redir->target,
+                                             O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            break;
+        case REDIR_APPEND:
+            posix_spawn_file_actions_addopen(actions, redir->fd, redir->target,
+                                             O_WRONLY | O_CREAT | O_APPEND, 0644);
+            break;
+        case REDIR_DUP:
+            if (redir->source_fd != redir->fd) {
+                posix_spawn_file_actions_adddup2(actions, redir->source_fd, redir->fd);
+            }
+            break;
+        case REDIR_CLOSE:
+            posix_spawn_file_actions_addclose(actions, redir->fd);
+            break;
+        case REDIR_HERE: {
+            int fd = open_here_doc(redir->target);
+            if (fd < 0) {
+                perror("here-document");
+                return false;
+            }
+            here_fds[(*here_count)++] = fd;
+            posix_spawn_file_actions_adddup2(actions, fd, redir->fd);
+            break;
+        }
+        }
+    }
+    return true;
+}
+
+// posix_spawn reports file action and exec failures the same way. Find the
+// redirection that failed, if any, and report it.
+static bool report_redirection_error(const Redirection *redir) {
+    for (; redir; redir = redir->next) {
+        int fd = -1;
+        if (redir->type == REDIR_INPUT) {
+            fd = open(redir->target, O_RDONLY | O_CLOEXEC);
+        } else if (redir->type == REDIR_OUTPUT || redir->type == REDIR_APPEND) {
+            // The failed spawn already created the file if it could
+            fd = open(redir->target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        } else if (redir->type == REDIR_DUP && fcntl(redir->source_fd, F_GETFD) == -1) {
+            fprintf(stderr, "%d: %s\n", redir->source_fd, strerror(errno));
+            return true;
+        } else {
+            continue;
+        }
+        if (fd < 0) {
+            perror(redir->target);
+            return true;
+        }
+        close(fd);
+    }
+    return false;
+}
+
+// Fast backend: posix_spawn lets libc use vfork/clone(CLONE_VM), so the
+// shell's page tables are never copied no matter how large it has grown
+static pid_t launch_with_spawn(const LaunchSpec *spec, int *failure_status) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+    sigset_t empty, defaults;
+    sigemptyset(&empty);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGTSTP);
+    sigaddset(&defaults, SIGTTIN);
+    sigaddset(&defaults, SIGTTOU);
+    posix_spawnattr_setsigmask(&attr, &empty);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+
+    if (spec->pgid >= 0) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, spec->pgid);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    if (spec->detach_output) {
+        int term_out, term_err;
+        if (output_relay_terminal_fds(&term_out, &term_err)) {
+            posix_spawn_file_actions_adddup2(&actions, term_out, STDOUT_FILENO);
+            posix_spawn_file_actions_adddup2(&actions, term_err, STDERR_FILENO);
+        }
+    }
+    if (spec->stdin_fd >= 0 && spec->stdin_fd != STDIN_FILENO) {
+        posix_spawn_file_actions_adddup2(&actions, spec->stdin_fd, STDIN_FILENO);
+    }
+    if (spec->stdout_fd >= 0 && spec->stdout_fd != STDOUT_FILENO) {
+        posix_spawn_file_actions_adddup2(&actions, spec->stdout_fd, STDOUT_FILENO);
+    }
+
+    size_t redir_count = 0, here_count = 0;
+    for (const Redirection *r = spec->redirs; r; r = r->next) redir_count++;
+    int *here_fds = redir_count ? malloc(redir_count * sizeof(int)) : NULL;
+    if (redir_count && (!here_fds ||
+        !add_redirection_actions(&actions, spec->redirs, here_fds, &here_count))) {
+        for (size_t i = 0; i < here_count; i++) close(here_fds[i]);
+        free(here_fds);
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+        *failure_status = EXIT_FAILURE;
+        return -1;
+    }
+
+    pid_t pid;
+    int err = spec->path ?
+              posix_spawn(&pid, spec->path, &actions, &attr, spec->argv, environ) :
+              spec->use_path ?
+              posix_spawnp(&pid, spec->argv[0], &actions, &attr, spec->argv, environ) :
+              posix_spawn(&pid, spec->argv[0], &actions, &attr, spec->argv, environ);
+
+    // The child has its own copies of the here-documents by now
+    for (size_t i = 0; i < here_count; i++) close(here_fds[i]);
+    free(here_fds);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (err != 0) {
+        // Blame the redirection if that is what failed
+        if (report_redirection_error(spec->redirs)) {
+            *failure_status = EXIT_FAILURE;
+        } else {
+            fprintf(stderr, "ERROR: Failed to execute '%s': %s\n", spec->argv[0], strerror(err));
+            *failure_status = err == ENOENT ? 127 : 126;
+        }
+        return -1;
+    }
+    return pid;
+}
+
+// Start the command described by spec. Returns the child's pid, or -1 with
+// the shell-style exit status stored in *failure_status.
+pid_t launch_process(const LaunchSpec *spec, SpawnBackend which, int *failure_status) {
+    int ignored;
+    if (!failure_status) failure_status = &ignored;
+    *failure_status = EXIT_FAILURE;
+
+    SPAWN_DEBUG("Launching '%s' (%s) with %s", spec->argv[0],
+                spec->path ? spec->path : "unresolved", spawn_backend_name(which));
+    if (which == SPAWN_BACKEND_FORK) {
+        pid_t pid = launch_with_fork(spec);
+        if (pid < 0) perror("fork");
+        return pid;
+    }
+    return launch_with_spawn(spec, failure_status);
+}
@@ -0,0 +1,163 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+#include <nutshell/core.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// Substitution debug macro, shares the executor's switch
+#define SUBST_DEBUG(fmt, ...) \
+    do { if (getenv("NUT_DEBUG_EXEC")) fprintf(stderr, "SUBST: " fmt "\n", ##__VA_ARGS__); } while(0)
+
+// `$(...)` runs its command list in this process, with stdout pointed at a
+// pipe for the duration. Builtins write straight into the pipe and external
+// commands inherit it, so nothing forks a shell. A reader thread drains the
+// pipe while the command runs, so output larger than the pipe buffer cannot
+// stall a builtin that is writing from inside the shell. Only command lists
+// with builtins that change the shell (cd, exit...) get a forked subshell.
+
+typedef struct {
+    int fd;
+    char *data;
+    size_t length;
+    size_t capacity;
+    bool failed;
+} Capture;
+
+static void *drain_pipe(void *arg) {
+    Capture *capture = arg;
+    char chunk[4096];
+    for (;;) {
+        ssize_t n = read(capture->fd, chunk, sizeof(chunk));
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (capture->length + (size_t)n + 1 > capture->capacity) {
+            size_t capacity = capture->capacity ? capture->capacity : sizeof(chunk);
+            while (capture->length + (size_t)n + 1 > capacity) capacity *= 2;
+            char *grown = realloc(capture->data, capacity);
+            if (!grown) {
+                // Keep reading so the writers are not blocked forever
+                capture->failed = true;
+                continue;
+            }
+            capture->data = grown;
+            capture->capacity = capacity;
+        }
+        if (capture->failed) continue;
+        memcpy(capture->data + capture->length, chunk, (size_t)n);
+        capture->length += (size_t)n;
+    }
+    return NULL;
+}
+
+// Run the command in the shell itself with stdout pointed at the pipe
+static bool capture_in_process(ParsedCommand *cmd, int fds[2], Capture *capture, int *status) {
+    pthread_t reader;
+    if (pthread_create(&reader, NULL, drain_pipe, capture) != 0) {
+        fprintf(stderr, "nutshell: cannot start command substitution\n");
+        close(fds[1]);
+        return false;
+    }
+
+    fflush(stdout);
+    int saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[1]);
+
+    *status = execute_command(cmd).exit_code;
+
+    // Restoring stdout drops the shell's last write end; the reader sees
+    // EOF once every command that inherited the pipe has closed it too
+    fflush(stdout);
+    if (saved_stdout >= 0) {
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+    } else {
+        close(STDOUT_FILENO);
+    }
+    pthread_join(reader, NULL);
+    return true;
+}
+
+// Run the command in a forked subshell, so `cd`, `exit` and the like only
+// affect that
+static bool capture_in_subshell(ParsedCommand *cmd, int fds[2], Capture *capture, int *status) {
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[1]);
+        jobs_enter_subshell();
+        int code = execute_command(cmd).exit_code;
+        fflush(stdout);
+        fflush(stderr);
+        _exit(code);
+    }
+
+    close(fds[1]);
+    drain_pipe(capture);
+    int wait_status;
+    while (waitpid(pid, &wait_status, 0) < 0 && errno == EINTR) {}
+    *status = WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) :
+              WIFSIGNALED(wait_status) ? 128 + WTERMSIG(wait_status) : EXIT_FAILURE;
+    return true;
+}
+
+char *run_substitution(const char *text, int *status) {
+    *status = 0;
+    // Substitutions repeat as often as the lines around them
+    ParsedCommand *cmd = parse_cache_acquire(text);
+    if (!cmd) {
+        // Nothing to run, as for `$()`, is not an error
+        if (text[strspn(text, " \t\n")] == '\0') return strdup("");
+        fprintf(stderr, "nutshell: syntax error in command substitution: %s\n", text);
+        *status = 2;
+        return NULL;
+    }
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        perror("pipe2");
+        parse_cache_release(cmd);
+        *status = EXIT_FAILURE;
+        return NULL;
+    }
+
+    Capture capture = { .fd = fds[0] };
+    bool subshell = command_changes_shell(cmd);
+    SUBST_DEBUG("Running '%s' %s", text, subshell ? "in a subshell" : "in-process");
+    bool ran = subshell ? capture_in_subshell(cmd, fds, &capture, status) :
+                          capture_in_process(cmd, fds, &capture, status);
+    close(fds[0]);
+    parse_cache_release(cmd);
+
+    if (!ran || capture.failed) {
+        if (capture.failed) fprintf(stderr, "nutshell: command substitution output too large\n");
+        free(capture.data);
+        *status = EXIT_FAILURE;
+        return NULL;
+    }
+    if (!capture.data) return strdup("");
+
+    // Trailing newlines are dropped, as in every other shell
+    while (capture.length > 0 && capture.data[capture.length - 1] == '\n') {
+        capture.length--;
+    }
+    capture.data[capture.length] = '\0';
+    SUBST_DEBUG("'%s' produced %zu bytes, status %d", text, capture.length, *status);
+    return capture.data;
+}
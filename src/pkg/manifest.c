@@ -0,0 +1,298 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+#include <nutshell/core.h>
+#include <nutshell/pkg.h>
+#include <jansson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Manifest debug macro, shares the registry's switch
+#define MANIFEST_DEBUG(fmt, ...) \
+    do { if (getenv("NUT_DEBUG_REGISTRY")) fprintf(stderr, "MANIFEST: " fmt "\n", ##__VA_ARGS__); } while(0)
+
+// Besides its script, a package can name commands in the `commands` map of
+// its manifest: "acorn": "git commit -m". Templates are split into words with
+// the shell's own lexer once, when the package is installed, and kept in
+// <pkg>/.commands. Running one only splices the arguments into those words
+// and execs the result; no script interpreter is started.
+//
+// .commands is a header line followed by, for each command, its name, its
+// word count in decimal and its words, all NUL-terminated.
+
+static const char *MANIFEST_FILES[] = { "package.nut", "manifest.json" };
+static const char *COMPILED_FILE = ".commands";
+static const char COMPILED_MAGIC[] = "NUTCMDS1\n";
+
+typedef struct {
+    PackageCommand *items;
+    size_t count;
+    size_t capacity;
+} CommandList;
+
+static void free_words(char **words) {
+    if (!words) return;
+    for (size_t i = 0; words[i]; i++) free(words[i]);
+    free(words);
+}
+
+static void clear_commands(PackageCommand *commands, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(commands[i].unix_cmd);
+        free(commands[i].nut_cmd);
+        free_words(commands[i].args);
+    }
+}
+
+// Takes ownership of args
+static bool push_command(CommandList *list, const char *unix_cmd, const char *nut_cmd, char **args) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 8;
+        PackageCommand *items = realloc(list->items, capacity * sizeof(PackageCommand));
+        if (!items) {
+            free_words(args);
+            return false;
+        }
+        list->items = items;
+        list->capacity = capacity;
+    }
+    PackageCommand *command = &list->items[list->count];
+    command->unix_cmd = strdup(unix_cmd);
+    command->nut_cmd = strdup(nut_cmd);
+    command->args = args;
+    if (!command->unix_cmd || !command->nut_cmd) {
+        free(command->unix_cmd);
+        free(command->nut_cmd);
+        free_words(args);
+        return false;
+    }
+    list->count++;
+    return true;
+}
+
+static bool push_template(CommandList *list, const char *dir, const char *name, char **args) {
+    char unix_cmd[512];
+    snprintf(unix_cmd, sizeof(unix_cmd), "%s/%s", dir, name);
+    return push_command(list, unix_cmd, name, args);
+}
+
+// Split a template into words. Only a plain command qualifies: pipes, lists,
+// redirections and substitutions would need a shell to run them.
+static char **tokenize_template(const char *text) {
+    ParsedCommand *cmd = parse_command(text);
+    if (!cmd) return NULL;
+
+    char **words = NULL;
+    if (!cmd->pipe_next && !cmd->next && !cmd->redirs && !cmd->subs && !cmd->background) {
+        size_t count = 0;
+        while (cmd->args[count]) count++;
+        words = calloc(count + 1, sizeof(char *));
+        for (size_t i = 0; words && i < count; i++) {
+            words[i] = strdup(cmd->args[i]);
+            if (!words[i]) {
+                free_words(words);
+                words = NULL;
+            }
+        }
+    }
+    free_parsed_command(cmd);
+    return words;
+}
+
+// The package's manifest, if it has one
+static bool find_manifest(const char *dir, char *path, size_t size, struct stat *st) {
+    for (size_t i = 0; i < sizeof(MANIFEST_FILES) / sizeof(MANIFEST_FILES[0]); i++) {
+        snprintf(path, size, "%s/%s", dir, MANIFEST_FILES[i]);
+        if (stat(path, st) == 0 && S_ISREG(st->st_mode)) return true;
+    }
+    return false;
+}
+
+// Templates straight from the manifest, in the order it lists them
+static bool read_manifest(const char *dir, const char *path, CommandList *list) {
+    json_error_t error;
+    json_t *root = json_load_file(path, 0, &error);
+    if (!root) {
+        fprintf(stderr, "nutshell: %s:%d: %s\n", path, error.line, error.text);
+        return false;
+    }
+
+    bool valid = true;
+    json_t *commands = json_object_get(root, "commands");
+    const char *name;
+    json_t *value;
+    json_object_foreach(commands, name, value) {
+        char **words = json_is_string(value) ? tokenize_template(json_string_value(value)) : NULL;
+        if (!words || !words[0] || strchr(name, '/') || !name[0]) {
+            fprintf(stderr, "nutshell: %s: command '%s' is not a plain command\n", path, name);
+            free_words(words);
+            valid = false;
+            continue;
+        }
+        push_template(list, dir, name, words);
+    }
+    json_decref(root);
+    return valid;
+}
+
+static bool write_compiled(const char *dir, const CommandList *list, size_t first) {
+    char path[512], tmp_path[520];
+    snprintf(path, sizeof(path), "%s/%s", dir, COMPILED_FILE);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) return false;
+    FILE *fp = fdopen(fd, "w");
+    if (!fp) {
+        close(fd);
+        unlink(tmp_path);
+        return false;
+    }
+
+    fputs(COMPILED_MAGIC, fp);
+    for (size_t i = first; i < list->count; i++) {
+        const PackageCommand *command = &list->items[i];
+        size_t count = 0;
+        while (command->args[count]) count++;
+        fprintf(fp, "%s%c%zu%c", command->nut_cmd, '\0', count, '\0');
+        for (size_t j = 0; j < count; j++) {
+            fprintf(fp, "%s%c", command->args[j], '\0');
+        }
+    }
+    bool written = fflush(fp) == 0 && !ferror(fp);
+    fchmod(fileno(fp), 0644);
+    fclose(fp);
+    if (!written || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return false;
+    }
+    MANIFEST_DEBUG("Compiled %zu commands into %s", list->count - first, path);
+    return true;
+}
+
+// Next NUL-terminated string of the compiled file, or NULL at its end
+static const char *next_string(const char **p, const char *end) {
+    const char *s = *p;
+    const char *nul = s < end ? memchr(s, '\0', (size_t)(end - s)) : NULL;
+    if (!nul) return NULL;
+    *p = nul + 1;
+    return s;
+}
+
+static bool read_compiled(const char *dir, const char *path, CommandList *list) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return false;
+    char *data = NULL;
+    size_t size = 0;
+    struct stat st;
+    if (fstat(fileno(fp), &st) == 0 && st.st_size > 0 && (data = malloc((size_t)st.st_size))) {
+        size = fread(data, 1, (size_t)st.st_size, fp);
+    }
+    fclose(fp);
+
+    size_t magic_len = sizeof(COMPILED_MAGIC) - 1;
+    bool valid = data && size >= magic_len && memcmp(data, COMPILED_MAGIC, magic_len) == 0;
+    const char *p = data + (valid ? magic_len : 0);
+    const char *end = data + size;
+    while (valid && p < end) {
+        const char *name = next_string(&p, end);
+        const char *count_text = name ? next_string(&p, end) : NULL;
+        char *count_end;
+        unsigned long count = count_text ? strtoul(count_text, &count_end, 10) : 0;
+        if (!count_text || *count_end || count == 0 || count > size || !name[0] || strchr(name, '/')) {
+            valid = false;
+            break;
+        }
+        char **words = calloc(count + 1, sizeof(char *));
+        for (size_t i = 0; words && i < count; i++) {
+            const char *word = next_string(&p, end);
+            words[i] = word ? strdup(word) : NULL;
+            if (!words[i]) {
+                free_words(words);
+                words = NULL;
+            }
+        }
+        if (!words || !push_template(list, dir, name, words)) valid = false;
+    }
+    free(data);
+    return valid;
+}
+
+bool compile_package_commands(const char *pkg_dir) {
+    char path[512];
+    struct stat st;
+    if (!find_manifest(pkg_dir, path, sizeof(path), &st)) return true;
+
+    // The commands that are fine are kept even if others are not
+    CommandList list = {0};
+    bool valid = read_manifest(pkg_dir, path, &list);
+    valid = write_compiled(pkg_dir, &list, 0) && valid;
+    free_package_commands(list.items, list.count);
+    return valid;
+}
+
+// The package's script, then its templates. Templates come from .commands
+// unless the manifest is newer; packages copied in by hand are compiled on
+// the spot, and the result kept when the directory is writable.
+size_t package_commands(const char *pkg_dir, const char *pkg_name, PackageCommand **commands) {
+    CommandList list = {0};
+
+    char path[512];
+    struct stat st;
+    if ((size_t)snprintf(path, sizeof(path), "%s/%s.sh", pkg_dir, pkg_name) < sizeof(path) &&
+        stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+        push_command(&list, path, pkg_name, NULL);
+    }
+
+    struct stat manifest_st, compiled_st;
+    char compiled_path[512];
+    snprintf(compiled_path, sizeof(compiled_path), "%s/%s", pkg_dir, COMPILED_FILE);
+    if (find_manifest(pkg_dir, path, sizeof(path), &manifest_st)) {
+        size_t first = list.count;
+        bool fresh = stat(compiled_path, &compiled_st) == 0 &&
+            (compiled_st.st_mtim.tv_sec > manifest_st.st_mtim.tv_sec ||
+             (compiled_st.st_mtim.tv_sec == manifest_st.st_mtim.tv_sec &&
+              compiled_st.st_mtim.tv_nsec >= manifest_st.st_mtim.tv_nsec));
+        if (!fresh || !read_compiled(pkg_dir, compiled_path, &list)) {
+            // Whatever a damaged file gave is dropped
+            clear_commands(list.items + first, list.count - first);
+            list.count = first;
+            MANIFEST_DEBUG("Compiling commands of %s", pkg_dir);
+            // Kept even when parts of the manifest are wrong, so the errors
+            // are reported once rather than on every start
+            read_manifest(pkg_dir, path, &list);
+            write_compiled(pkg_dir, &list, first);
+        }
+    }
+
+    *commands = list.items;
+    return list.count;
+}
+
+// The manifest and .commands are only looked at with files set, as they
+// cannot appear without changing the directory's mtime
+bool package_stamp(const char *pkg_dir, bool files, PackageStamp *stamp) {
+    memset(stamp, 0, sizeof(*stamp));
+    struct stat st;
+    if (stat(pkg_dir, &st) != 0 || !S_ISDIR(st.st_mode)) return false;
+    stamp->dir = st.st_mtim;
+    if (!files) return true;
+
+    char path[512];
+    if (find_manifest(pkg_dir, path, sizeof(path), &st)) stamp->manifest = st.st_mtim;
+    snprintf(path, sizeof(path), "%s/%s", pkg_dir, COMPILED_FILE);
+    if (stat(path, &st) == 0) stamp->compiled = st.st_mtim;
+    return true;
+}
+
+void free_package_commands(PackageCommand *commands, size_t count) {
+    clear_commands(commands, count);
+    free(commands);
+}
+
+RegisterResult register_package_command(const PackageCommand *command) {
+    if (command->args) return register_template(command->unix_cmd, command->nut_cmd, command->args);
+    return register_command(command->unix_cmd, command->nut_cmd, false);
+}
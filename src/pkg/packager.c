@@ -78,13 +78,25 @@ bool install_package_from_path(const char *path) {
         return false;
     }
     
-    // Make script executable
-    snprintf(cmd, sizeof(cmd), "chmod +x %s/%s.sh", pkg_dir, pkg_name);
-    if (system(cmd) != 0) {
-        print_error("Failed to make script executable");
-        return false;
+    // Make script executable; packages may provide only manifest commands
+    snprintf(cmd, sizeof(cmd), "%s/%s.sh", pkg_dir, pkg_name);
+    if (access(cmd, F_OK) == 0) {
+        snprintf(cmd, sizeof(cmd), "chmod +x %s/%s.sh", pkg_dir, pkg_name);
+        if (system(cmd) != 0) {
+            print_error("Failed to make script executable");
+            return false;
+        }
     }
     
+    // Tokenize the manifest's command templates once, here, not on every start
+    if (!compile_package_commands(pkg_dir)) {
+        print_error("Some manifest commands were skipped");
+    }
+    
+    // Files copied into an existing package directory leave the packages
+    // directory's mtime alone, so the index cannot tell on its own
+    package_index_invalidate();
+    
     // Register the new command - fix the function call
     if (!register_package_commands(dest_dir, pkg_name)) {
         print_error("Failed to register package command");
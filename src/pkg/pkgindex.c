@@ -0,0 +1,532 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+#include <nutshell/core.h>
+#include <nutshell/pkg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Package index debug macro, shares the registry's switch
+#define PKGINDEX_DEBUG(fmt, ...) \
+    do { if (getenv("NUT_DEBUG_REGISTRY")) fprintf(stderr, "PKGINDEX: " fmt "\n", ##__VA_ARGS__); } while(0)
+
+// The commands found in each package root are kept in ~/.nutshell/package-index
+// along with the root's device, inode and mtime, and the mtime of every package
+// directory in it. Adding or removing a package changes the root's mtime, and
+// adding or replacing a package's script or manifest changes its directory's.
+// A package with a manifest also records the manifest's and .commands' mtimes,
+// since those files can be edited in place. As long as they all match, the
+// commands are registered straight from the mapped file. That is one stat per
+// package (three with a manifest) rather than one per root, but it still saves
+// the readdir and the script and manifest lookups, and no edit goes unnoticed.
+// Roots where anything changed are scanned again and the index is rewritten.
+//
+// Layout, all in host byte order (the file never leaves the machine):
+//   IndexHeader
+//   IndexRoot[root_count]
+//   IndexPackage[package_count]
+//   IndexEntry[entry_count]
+//   uint32_t[arg_count], string offsets of the command templates' words
+//   string table, NUL-terminated strings referenced by offset
+
+static const char *INDEX_FILE = "/.nutshell/package-index";
+static const char INDEX_MAGIC[8] = "NUTPIDX";
+#define INDEX_VERSION 3
+
+// A root or package modified this recently may change again within the same
+// mtime tick, so its scan is not trusted on the next start
+#define INDEX_RACY_SECONDS 2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t root_count;
+    uint32_t entry_count;
+    uint32_t arg_count;
+    uint32_t strings_size;
+    uint32_t package_count;
+} IndexHeader;
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t path;          // String offset
+    uint32_t first_entry;
+    uint32_t entry_count;
+    uint32_t trusted;       // 0 when the root was modified while it was scanned
+    uint32_t first_package;
+    uint32_t package_count;
+} IndexRoot;
+
+typedef struct {
+    uint32_t name;          // String offset of the directory's name in its root
+    uint32_t reserved;      // Keeps the mtimes 8-byte aligned
+    int64_t mtime_sec;      // The package directory
+    int64_t mtime_nsec;
+    int64_t manifest_sec;   // Zero without a manifest
+    int64_t manifest_nsec;
+    int64_t compiled_sec;   // .commands, zero when missing
+    int64_t compiled_nsec;
+} IndexPackage;
+
+typedef struct {
+    uint32_t unix_cmd;      // String offsets
+    uint32_t nut_cmd;
+    uint32_t first_arg;     // Template words; none for a script
+    uint32_t arg_count;
+} IndexEntry;
+
+typedef struct {
+    void *map;
+    size_t size;
+    const IndexHeader *header;
+    const IndexRoot *roots;
+    const IndexPackage *packages;
+    const IndexEntry *entries;
+    const uint32_t *args;
+    const char *strings;
+} MappedIndex;
+
+typedef struct {
+    char *name;
+    PackageStamp stamp;
+} ScannedPackage;
+
+// Commands of one root while the new index is put together: either still in
+// the mapped index, or found by scanning the directory
+typedef struct {
+    char *path;
+    struct stat st;
+    bool trusted;
+    const IndexRoot *indexed;
+    PackageCommand *commands;
+    size_t count;
+    size_t capacity;
+    ScannedPackage *packages;
+    size_t package_count;
+    size_t package_capacity;
+} RootScan;
+
+static bool index_path(char *path, size_t size) {
+    const char *home = getenv("HOME");
+    if (!home) return false;
+    return (size_t)snprintf(path, size, "%s%s", home, INDEX_FILE) < size;
+}
+
+static const char *index_string(const MappedIndex *index, uint32_t offset) {
+    return offset < index->header->strings_size ? index->strings + offset : NULL;
+}
+
+// Map the index and check that every offset in it stays inside the file
+static bool map_index(const char *path, MappedIndex *index) {
+    memset(index, 0, sizeof(*index));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(IndexHeader)) {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    index->map = map;
+    index->size = (size_t)st.st_size;
+    index->header = map;
+    const IndexHeader *header = index->header;
+    size_t tables = sizeof(IndexHeader) + (size_t)header->root_count * sizeof(IndexRoot) +
+                    (size_t)header->package_count * sizeof(IndexPackage) +
+                    (size_t)header->entry_count * sizeof(IndexEntry) +
+                    (size_t)header->arg_count * sizeof(uint32_t);
+    if (memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+        header->version != INDEX_VERSION ||
+        tables + header->strings_size != index->size ||
+        (header->strings_size > 0 && ((const char *)map)[index->size - 1] != '\0')) {
+        PKGINDEX_DEBUG("Ignoring invalid index %s", path);
+        munmap(map, index->size);
+        memset(index, 0, sizeof(*index));
+        return false;
+    }
+    index->roots = (const IndexRoot *)(header + 1);
+    index->packages = (const IndexPackage *)(index->roots + header->root_count);
+    index->entries = (const IndexEntry *)(index->packages + header->package_count);
+    index->args = (const uint32_t *)(index->entries + header->entry_count);
+    index->strings = (const char *)(index->args + header->arg_count);
+    return true;
+}
+
+static bool same_time(const struct timespec *time, int64_t sec, int64_t nsec) {
+    return (int64_t)time->tv_sec == sec && (int64_t)time->tv_nsec == nsec;
+}
+
+// Whether nothing package_commands() reads has changed since the scan
+static bool package_clean(const char *root_path, const char *name, const IndexPackage *package) {
+    char pkg_dir[512];
+    if ((size_t)snprintf(pkg_dir, sizeof(pkg_dir), "%s/%s", root_path, name) >= sizeof(pkg_dir)) {
+        return false;
+    }
+    bool files = package->manifest_sec != 0 || package->manifest_nsec != 0;
+    PackageStamp stamp;
+    if (!package_stamp(pkg_dir, files, &stamp)) return false;
+    return same_time(&stamp.dir, package->mtime_sec, package->mtime_nsec) &&
+           same_time(&stamp.manifest, package->manifest_sec, package->manifest_nsec) &&
+           same_time(&stamp.compiled, package->compiled_sec, package->compiled_nsec);
+}
+
+// The root's commands from the index, if neither it nor its packages have
+// changed since
+static const IndexRoot *find_clean_root(const MappedIndex *index, const char *path, const struct stat *st) {
+    if (!index->map) return NULL;
+    for (uint32_t i = 0; i < index->header->root_count; i++) {
+        const IndexRoot *root = &index->roots[i];
+        const char *root_path = index_string(index, root->path);
+        if (!root_path || strcmp(root_path, path) != 0) continue;
+
+        if (!root->trusted || root->dev != (uint64_t)st->st_dev || root->ino != (uint64_t)st->st_ino ||
+            root->mtime_sec != (int64_t)st->st_mtim.tv_sec ||
+            root->mtime_nsec != (int64_t)st->st_mtim.tv_nsec ||
+            (uint64_t)root->first_entry + root->entry_count > index->header->entry_count ||
+            (uint64_t)root->first_package + root->package_count > index->header->package_count) {
+            return NULL;
+        }
+        for (uint32_t j = 0; j < root->package_count; j++) {
+            const IndexPackage *package = &index->packages[root->first_package + j];
+            const char *name = index_string(index, package->name);
+            if (!name || !package_clean(path, name, package)) {
+                PKGINDEX_DEBUG("Package %s/%s changed", path, name ? name : "?");
+                return NULL;
+            }
+        }
+        for (uint32_t j = 0; j < root->entry_count; j++) {
+            const IndexEntry *entry = &index->entries[root->first_entry + j];
+            if (!index_string(index, entry->unix_cmd) || !index_string(index, entry->nut_cmd) ||
+                (uint64_t)entry->first_arg + entry->arg_count > index->header->arg_count) {
+                return NULL;
+            }
+            for (uint32_t k = 0; k < entry->arg_count; k++) {
+                if (!index_string(index, index->args[entry->first_arg + k])) return NULL;
+            }
+        }
+        return root;
+    }
+    return NULL;
+}
+
+// Takes over the contents of the commands
+static bool add_scanned(RootScan *scan, PackageCommand *commands, size_t count) {
+    if (scan->count + count > scan->capacity) {
+        size_t capacity = scan->capacity ? scan->capacity : 16;
+        while (scan->count + count > capacity) capacity *= 2;
+        PackageCommand *grown = realloc(scan->commands, capacity * sizeof(PackageCommand));
+        if (!grown) {
+            free_package_commands(commands, count);
+            return false;
+        }
+        scan->commands = grown;
+        scan->capacity = capacity;
+    }
+    memcpy(scan->commands + scan->count, commands, count * sizeof(PackageCommand));
+    scan->count += count;
+    free(commands);
+    return true;
+}
+
+static bool add_package(RootScan *scan, const char *name, const PackageStamp *stamp) {
+    if (scan->package_count == scan->package_capacity) {
+        size_t capacity = scan->package_capacity ? scan->package_capacity * 2 : 16;
+        ScannedPackage *grown = realloc(scan->packages, capacity * sizeof(ScannedPackage));
+        if (!grown) return false;
+        scan->packages = grown;
+        scan->package_capacity = capacity;
+    }
+    char *copy = strdup(name);
+    if (!copy) return false;
+    scan->packages[scan->package_count++] = (ScannedPackage){ .name = copy, .stamp = *stamp };
+    return true;
+}
+
+static bool same_stamp(const PackageStamp *a, const PackageStamp *b) {
+    return same_time(&a->dir, b->dir.tv_sec, b->dir.tv_nsec) &&
+           same_time(&a->manifest, b->manifest.tv_sec, b->manifest.tv_nsec) &&
+           same_time(&a->compiled, b->compiled.tv_sec, b->compiled.tv_nsec);
+}
+
+static bool recent(const struct timespec *time, time_t now) {
+    return now - time->tv_sec < INDEX_RACY_SECONDS;
+}
+
+// Every package directory's script and manifest commands, in directory order.
+// Each package is recorded, with or without commands, so that a script or
+// manifest added to it later is noticed.
+static void scan_root(RootScan *scan) {
+    DIR *dir = opendir(scan->path);
+    if (!dir) return;
+
+    // A package added in the same mtime tick as the scan would go unnoticed
+    time_t now = time(NULL);
+    bool settled = now - scan->st.st_mtim.tv_sec >= INDEX_RACY_SECONDS;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        char pkg_dir[512];
+        if ((size_t)snprintf(pkg_dir, sizeof(pkg_dir), "%s/%s", scan->path, entry->d_name) >= sizeof(pkg_dir)) {
+            continue;
+        }
+        PackageStamp before, after;
+        if (!package_stamp(pkg_dir, true, &before)) continue;
+        PackageCommand *commands;
+        size_t count = package_commands(pkg_dir, entry->d_name, &commands);
+        if (count > 0) {
+            add_scanned(scan, commands, count);
+        } else {
+            free(commands);
+        }
+        if (!add_package(scan, entry->d_name, &before)) settled = false;
+
+        // Compiling the manifest writes .commands, and anything else that
+        // changed while the package was read is picked up by the next scan
+        if (!package_stamp(pkg_dir, true, &after) || !same_stamp(&before, &after) ||
+            recent(&before.dir, now) || recent(&before.manifest, now) || recent(&before.compiled, now)) {
+            settled = false;
+        }
+    }
+    closedir(dir);
+
+    scan->trusted = settled;
+    PKGINDEX_DEBUG("Scanned %s: %zu packages, %zu commands%s", scan->path, scan->package_count, scan->count,
+                   scan->trusted ? "" : " (modified just now, will rescan)");
+}
+
+static void free_scan(RootScan *scan) {
+    free_package_commands(scan->commands, scan->count);
+    for (size_t i = 0; i < scan->package_count; i++) free(scan->packages[i].name);
+    free(scan->packages);
+    free(scan->path);
+}
+
+static size_t scan_packages(const RootScan *scan) {
+    return scan->indexed ? scan->indexed->package_count : scan->package_count;
+}
+
+// One package of a root as it goes into the new index, with the name's
+// offset left for the caller to fill in
+static IndexPackage view_package(const MappedIndex *index, const RootScan *scan, size_t i, const char **name) {
+    if (scan->indexed) {
+        IndexPackage package = index->packages[scan->indexed->first_package + i];
+        *name = index_string(index, package.name);
+        return package;
+    }
+    const PackageStamp *stamp = &scan->packages[i].stamp;
+    *name = scan->packages[i].name;
+    return (IndexPackage){
+        .mtime_sec = stamp->dir.tv_sec, .mtime_nsec = stamp->dir.tv_nsec,
+        .manifest_sec = stamp->manifest.tv_sec, .manifest_nsec = stamp->manifest.tv_nsec,
+        .compiled_sec = stamp->compiled.tv_sec, .compiled_nsec = stamp->compiled.tv_nsec,
+    };
+}
+
+static size_t scan_count(const RootScan *scan) {
+    return scan->indexed ? scan->indexed->entry_count : scan->count;
+}
+
+// One command of a root, from the scan or from the mapped index. An indexed
+// command's strings point into the map; release_command() frees the word
+// array built for it.
+static bool view_command(const MappedIndex *index, const RootScan *scan, size_t i, PackageCommand *view) {
+    if (!scan->indexed) {
+        *view = scan->commands[i];
+        return true;
+    }
+    const IndexEntry *entry = &index->entries[scan->indexed->first_entry + i];
+    view->unix_cmd = (char *)index_string(index, entry->unix_cmd);
+    view->nut_cmd = (char *)index_string(index, entry->nut_cmd);
+    view->args = NULL;
+    if (entry->arg_count == 0) return true;
+
+    view->args = calloc(entry->arg_count + 1, sizeof(char *));
+    if (!view->args) return false;
+    for (uint32_t j = 0; j < entry->arg_count; j++) {
+        view->args[j] = (char *)index_string(index, index->args[entry->first_arg + j]);
+    }
+    return true;
+}
+
+static void release_command(const RootScan *scan, PackageCommand *view) {
+    if (scan->indexed) free(view->args);
+}
+
+static size_t word_count(char *const *args) {
+    size_t count = 0;
+    while (args && args[count]) count++;
+    return count;
+}
+
+static uint32_t add_string(char *strings, size_t *offset, const char *s) {
+    size_t length = strlen(s) + 1;
+    memcpy(strings + *offset, s, length);
+    *offset += length;
+    return (uint32_t)(*offset - length);
+}
+
+// Write the index to a temporary file and rename it into place, so a shell
+// starting at the same time sees either the old index or the new one
+static void write_index(const char *path, const MappedIndex *index, RootScan *scans, size_t count) {
+    IndexHeader header = { .version = INDEX_VERSION, .root_count = (uint32_t)count };
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+
+    size_t strings_size = 0;
+    for (size_t i = 0; i < count; i++) {
+        strings_size += strlen(scans[i].path) + 1;
+        for (size_t j = 0; j < scan_packages(&scans[i]); j++) {
+            const char *name;
+            view_package(index, &scans[i], j, &name);
+            strings_size += strlen(name) + 1;
+        }
+        header.package_count += (uint32_t)scan_packages(&scans[i]);
+        for (size_t j = 0; j < scan_count(&scans[i]); j++) {
+            PackageCommand view;
+            if (!view_command(index, &scans[i], j, &view)) return;
+            strings_size += strlen(view.unix_cmd) + 1 + strlen(view.nut_cmd) + 1;
+            for (size_t k = 0; k < word_count(view.args); k++) {
+                strings_size += strlen(view.args[k]) + 1;
+            }
+            header.arg_count += (uint32_t)word_count(view.args);
+            release_command(&scans[i], &view);
+        }
+        header.entry_count += (uint32_t)scan_count(&scans[i]);
+    }
+    if (strings_size > UINT32_MAX) return;
+    header.strings_size = (uint32_t)strings_size;
+
+    size_t size = sizeof(IndexHeader) + count * sizeof(IndexRoot) +
+                  header.package_count * sizeof(IndexPackage) + header.entry_count * sizeof(IndexEntry) + header.arg_count * sizeof(uint32_t) +
+                  strings_size;
+    char *buffer = calloc(1, size);
+    if (!buffer) return;
+
+    IndexRoot *roots = (IndexRoot *)(buffer + sizeof(IndexHeader));
+    IndexPackage *packages = (IndexPackage *)(roots + count);
+    IndexEntry *entries = (IndexEntry *)(packages + header.package_count);
+    uint32_t *args = (uint32_t *)(entries + header.entry_count);
+    char *strings = (char *)(args + header.arg_count);
+    memcpy(buffer, &header, sizeof(header));
+
+    uint32_t next_package = 0, next_entry = 0, next_arg = 0;
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        roots[i].dev = (uint64_t)scans[i].st.st_dev;
+        roots[i].ino = (uint64_t)scans[i].st.st_ino;
+        roots[i].mtime_sec = (int64_t)scans[i].st.st_mtim.tv_sec;
+        roots[i].mtime_nsec = (int64_t)scans[i].st.st_mtim.tv_nsec;
+        roots[i].trusted = scans[i].trusted;
+        roots[i].path = add_string(strings, &offset, scans[i].path);
+        roots[i].first_package = next_package;
+        roots[i].package_count = (uint32_t)scan_packages(&scans[i]);
+        for (size_t j = 0; j < scan_packages(&scans[i]); j++, next_package++) {
+            const char *name;
+            packages[next_package] = view_package(index, &scans[i], j, &name);
+            packages[next_package].name = add_string(strings, &offset, name);
+        }
+        roots[i].first_entry = next_entry;
+        roots[i].entry_count = (uint32_t)scan_count(&scans[i]);
+        for (size_t j = 0; j < scan_count(&scans[i]); j++, next_entry++) {
+            PackageCommand view;
+            if (!view_command(index, &scans[i], j, &view)) {
+                free(buffer);
+                return;
+            }
+            IndexEntry *entry = &entries[next_entry];
+            entry->unix_cmd = add_string(strings, &offset, view.unix_cmd);
+            entry->nut_cmd = add_string(strings, &offset, view.nut_cmd);
+            entry->first_arg = next_arg;
+            entry->arg_count = (uint32_t)word_count(view.args);
+            for (size_t k = 0; k < entry->arg_count; k++) {
+                args[next_arg++] = add_string(strings, &offset, view.args[k]);
+            }
+            release_command(&scans[i], &view);
+        }
+    }
+
+    char tmp_path[600];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        PKGINDEX_DEBUG("Cannot write %s", tmp_path);
+        free(buffer);
+        return;
+    }
+    bool written = write(fd, buffer, size) == (ssize_t)size;
+    close(fd);
+    free(buffer);
+    if (!written || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return;
+    }
+    PKGINDEX_DEBUG("Wrote %s: %zu roots, %u packages, %u commands", path, count, header.package_count,
+                   header.entry_count);
+}
+
+void package_index_load(const char **roots, size_t count) {
+    char path[512];
+    bool have_path = index_path(path, sizeof(path));
+    MappedIndex index = {0};
+    if (have_path) map_index(path, &index);
+
+    RootScan *scans = calloc(count, sizeof(RootScan));
+    size_t scanned = 0;
+    bool changed = false;
+    for (size_t i = 0; scans && i < count; i++) {
+        RootScan *scan = &scans[scanned];
+        // With one per package, the only stats a root costs when nothing in
+        // it has changed
+        if (stat(roots[i], &scan->st) != 0 || !S_ISDIR(scan->st.st_mode)) continue;
+        scan->path = strdup(roots[i]);
+        if (!scan->path) continue;
+        scanned++;
+
+        // Commands are registered straight from the mapped file
+        scan->indexed = find_clean_root(&index, roots[i], &scan->st);
+        if (scan->indexed) {
+            PKGINDEX_DEBUG("Using index for %s: %u commands", roots[i], scan->indexed->entry_count);
+            scan->trusted = true;
+        } else {
+            scan_root(scan);
+            changed = true;
+        }
+
+        for (size_t j = 0; j < scan_count(scan); j++) {
+            PackageCommand view;
+            if (!view_command(&index, scan, j, &view)) continue;
+            register_package_command(&view);
+            release_command(scan, &view);
+        }
+    }
+    // A root that disappeared leaves a stale section behind
+    if (index.map && index.header->root_count != scanned) changed = true;
+
+    if (changed && have_path) write_index(path, &index, scans, scanned);
+    if (index.map) munmap(index.map, index.size);
+    for (size_t i = 0; i < scanned; i++) free_scan(&scans[i]);
+    free(scans);
+}
+
+void package_index_invalidate() {
+    char path[512];
+    if (index_path(path, sizeof(path)) && unlink(path) == 0) {
+        PKGINDEX_DEBUG("Removed %s", path);
+    }
+}
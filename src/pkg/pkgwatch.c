@@ -0,0 +1,345 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+#include <nutshell/core.h>
+#include <nutshell/pkg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Package watch debug macro, shares the registry's switch
+#define PKGWATCH_DEBUG(fmt, ...) \
+    do { if (getenv("NUT_DEBUG_REGISTRY")) fprintf(stderr, "PKGWATCH: " fmt "\n", ##__VA_ARGS__); } while(0)
+
+#ifdef __linux__
+#include <sys/inotify.h>
+
+// Each package root is watched for package directories coming and going, and
+// each directory in it, with or without commands so far, for its `<pkg>.sh`
+// script and manifest. That costs a readdir per root at startup. A root that
+// does not exist yet is waited for from its nearest existing parent.
+// Events are read without blocking between prompts and only the packages they
+// name are registered or unregistered; nothing is rescanned unless the
+// kernel's event queue overflowed.
+
+#define ROOT_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+#define PACKAGE_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_ONLYDIR)
+// Added to whatever else the directory is watched for
+#define PARENT_EVENTS (IN_CREATE | IN_MOVED_TO | IN_ONLYDIR | IN_MASK_ADD)
+
+typedef struct {
+    int wd;
+    char *path;
+    char *package;  // NULL for a package root or a parent
+    bool parent;    // Waiting for a missing root to be created in it
+} Watch;
+
+static int inotify_fd = -1;
+static Watch *watches = NULL;
+static size_t watch_count = 0;
+static size_t watch_capacity = 0;
+
+// Every root asked for, whether it exists or not
+static char **roots = NULL;
+static size_t root_count = 0;
+
+static Watch *find_watch(int wd) {
+    for (size_t i = 0; i < watch_count; i++) {
+        if (watches[i].wd == wd) return &watches[i];
+    }
+    return NULL;
+}
+
+static void drop_watch(Watch *watch) {
+    free(watch->path);
+    free(watch->package);
+    *watch = watches[--watch_count];
+}
+
+static bool add_watch(const char *path, const char *package, bool parent, uint32_t mask) {
+    int wd = inotify_add_watch(inotify_fd, path, mask);
+    if (wd < 0) {
+        PKGWATCH_DEBUG("Cannot watch %s: %s", path, strerror(errno));
+        return false;
+    }
+    // The same directory gives back the same descriptor
+    Watch *watch = find_watch(wd);
+    if (watch) {
+        // A parent that turns out to be a root gets the root's events
+        if (!parent) watch->parent = false;
+        return true;
+    }
+
+    if (watch_count == watch_capacity) {
+        size_t capacity = watch_capacity ? watch_capacity * 2 : 16;
+        Watch *grown = realloc(watches, capacity * sizeof(Watch));
+        if (!grown) {
+            inotify_rm_watch(inotify_fd, wd);
+            return false;
+        }
+        watches = grown;
+        watch_capacity = capacity;
+    }
+    watch = &watches[watch_count++];
+    watch->wd = wd;
+    watch->path = strdup(path);
+    watch->package = package ? strdup(package) : NULL;
+    watch->parent = parent;
+    PKGWATCH_DEBUG("Watching %s%s", path, parent ? " for a missing root" : "");
+    return true;
+}
+
+// Bring a package's registered commands in line with its script and
+// manifest. Returns how many commands were added, updated or removed.
+static int sync_package(const char *dir, const char *package) {
+    PackageCommand *commands;
+    size_t count = package_commands(dir, package, &commands);
+    int changes = 0;
+
+    // Commands the package no longer provides: everything registered from
+    // directly inside its directory. Going backwards, removals only move
+    // entries already looked at.
+    size_t dir_len = strlen(dir);
+    size_t registered_count;
+    const CommandMapping *registered = registry_commands(&registered_count);
+    for (size_t i = registered_count; i-- > 0; ) {
+        const char *unix_cmd = registered[i].unix_cmd;
+        if (registered[i].is_builtin || strncmp(unix_cmd, dir, dir_len) != 0 ||
+            unix_cmd[dir_len] != '/' || strchr(unix_cmd + dir_len + 1, '/')) {
+            continue;
+        }
+        bool kept = false;
+        for (size_t j = 0; j < count && !kept; j++) {
+            kept = strcmp(commands[j].unix_cmd, unix_cmd) == 0;
+        }
+        char *gone = kept ? NULL : strdup(unix_cmd);
+        if (gone && unregister_command(gone)) {
+            PKGWATCH_DEBUG("Removed %s", gone);
+            changes++;
+        }
+        free(gone);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        RegisterResult result = register_package_command(&commands[i]);
+        if (result == REGISTER_ADDED || result == REGISTER_SHADOWED || result == REGISTER_UPDATED) {
+            PKGWATCH_DEBUG("%s %s", result == REGISTER_UPDATED ? "Updated" : "Added", commands[i].nut_cmd);
+            changes++;
+        }
+    }
+    free_package_commands(commands, count);
+    return changes;
+}
+
+// Files in a package directory that decide its commands
+static bool package_file(const char *package, const char *name) {
+    size_t len = strlen(package);
+    if (strncmp(name, package, len) == 0 && strcmp(name + len, ".sh") == 0) return true;
+    return strcmp(name, "package.nut") == 0 || strcmp(name, "manifest.json") == 0 ||
+           strcmp(name, ".commands") == 0;
+}
+
+// A package directory in a watched root appeared or went away
+static int root_event(const Watch *root, const struct inotify_event *event) {
+    char dir[512];
+    if ((size_t)snprintf(dir, sizeof(dir), "%s/%s", root->path, event->name) >= sizeof(dir)) return 0;
+
+    if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+        // Watch first, so a script written right after mkdir is not missed
+        add_watch(dir, event->name, false, PACKAGE_EVENTS);
+        return sync_package(dir, event->name);
+    }
+
+    // A directory moved away keeps its watch, which would now follow it
+    for (size_t i = 0; i < watch_count; i++) {
+        if (watches[i].package && strcmp(watches[i].path, dir) == 0) {
+            inotify_rm_watch(inotify_fd, watches[i].wd);
+            drop_watch(&watches[i]);
+            break;
+        }
+    }
+    return sync_package(dir, event->name);
+}
+
+// Watch a root and every directory in it, registering what they provide when
+// `sync` is set. A missing root is waited for from its nearest existing
+// parent instead.
+static int watch_root(const char *root, bool sync) {
+    if (!add_watch(root, NULL, false, ROOT_EVENTS)) {
+        char parent[512];
+        snprintf(parent, sizeof(parent), "%s", root);
+        char *slash;
+        while ((slash = strrchr(parent, '/')) != NULL) {
+            slash[slash == parent ? 1 : 0] = '\0';
+            if (add_watch(parent, NULL, true, PARENT_EVENTS) || slash == parent) break;
+        }
+        return 0;
+    }
+
+    int changes = 0;
+    DIR *dir = opendir(root);
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' || (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN)) continue;
+        char path[512];
+        if ((size_t)snprintf(path, sizeof(path), "%s/%s", root, entry->d_name) >= sizeof(path)) continue;
+        if (!add_watch(path, entry->d_name, false, PACKAGE_EVENTS)) continue;
+        if (sync) changes += sync_package(path, entry->d_name);
+    }
+    if (dir) closedir(dir);
+    return changes;
+}
+
+static bool root_watched(const char *root) {
+    for (size_t i = 0; i < watch_count; i++) {
+        if (!watches[i].package && !watches[i].parent && strcmp(watches[i].path, root) == 0) return true;
+    }
+    return false;
+}
+
+// `path` appeared or went away: watch the missing roots at or below it, or
+// their nearest existing parents
+static int watch_missing_roots(const char *path) {
+    int changes = 0;
+    size_t len = strlen(path);
+    for (size_t i = 0; i < root_count; i++) {
+        if (strncmp(roots[i], path, len) != 0 || (roots[i][len] != '\0' && roots[i][len] != '/')) continue;
+        if (!root_watched(roots[i])) changes += watch_root(roots[i], true);
+    }
+    return changes;
+}
+
+// A directory was created in the parent of a missing root, possibly the root
+// itself or a directory on the way to it
+static int parent_event(const Watch *parent, const struct inotify_event *event) {
+    char path[512];
+    const char *separator = parent->path[strlen(parent->path) - 1] == '/' ? "" : "/";
+    if ((size_t)snprintf(path, sizeof(path), "%s%s%s", parent->path, separator, event->name) >= sizeof(path)) {
+        return 0;
+    }
+    return watch_missing_roots(path);
+}
+
+// Events were lost: bring every root back in step with the disk
+static int resync() {
+    PKGWATCH_DEBUG("Event queue overflowed, rescanning package directories");
+    int changes = 0;
+    for (size_t i = 0; i < root_count; i++) {
+        changes += watch_root(roots[i], true);
+    }
+    // Packages that disappeared
+    for (size_t i = 0; i < watch_count; i++) {
+        if (watches[i].package) changes += sync_package(watches[i].path, watches[i].package);
+    }
+    return changes;
+}
+
+void package_watch_roots(const char **paths, size_t count) {
+    if (inotify_fd < 0) {
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd < 0) {
+            PKGWATCH_DEBUG("inotify unavailable: %s", strerror(errno));
+            return;
+        }
+    }
+
+    // The commands are already registered, from the package index or a scan
+    for (size_t i = 0; i < count; i++) {
+        bool known = false;
+        for (size_t j = 0; j < root_count && !known; j++) known = strcmp(roots[j], paths[i]) == 0;
+        if (!known) {
+            char **grown = realloc(roots, (root_count + 1) * sizeof(char *));
+            if (!grown) continue;
+            roots = grown;
+            if (!(roots[root_count] = strdup(paths[i]))) continue;
+            root_count++;
+        }
+        watch_root(paths[i], false);
+    }
+}
+
+int package_watch_poll() {
+    if (inotify_fd < 0) return 0;
+
+    int changes = 0;
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t n = read(inotify_fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+
+        for (char *p = buffer; p < buffer + n; ) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                changes += resync();
+                continue;
+            }
+            Watch *watch = find_watch(event->wd);
+            if (!watch) continue;
+            if (event->mask & IN_IGNORED) {
+                // A root that was removed is waited for again
+                char *root = !watch->package && !watch->parent ? strdup(watch->path) : NULL;
+                drop_watch(watch);
+                if (root) changes += watch_missing_roots(root);
+                free(root);
+                continue;
+            }
+            if (event->len == 0) continue;
+
+            if (watch->parent) {
+                if (event->mask & IN_ISDIR) changes += parent_event(watch, event);
+            } else if (!watch->package) {
+                if (event->mask & IN_ISDIR) changes += root_event(watch, event);
+            } else if (package_file(watch->package, event->name)) {
+                changes += sync_package(watch->path, watch->package);
+            }
+        }
+    }
+
+    // The package index checks each package's files itself on the next start
+    if (changes) PKGWATCH_DEBUG("Applied %d package changes", changes);
+    return changes;
+}
+
+void package_watch_free() {
+    for (size_t i = 0; i < watch_count; i++) {
+        free(watches[i].path);
+        free(watches[i].package);
+    }
+    free(watches);
+    watches = NULL;
+    watch_count = watch_capacity = 0;
+    for (size_t i = 0; i < root_count; i++) free(roots[i]);
+    free(roots);
+    roots = NULL;
+    root_count = 0;
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+}
+
+#else
+
+// No live reload without inotify; new packages show up on the next start
+
+void package_watch_roots(const char **roots, size_t count) {
+    (void)roots;
+    (void)count;
+    PKGWATCH_DEBUG("Live package reload needs inotify");
+}
+
+int package_watch_poll() {
+    return 0;
+}
+
+void package_watch_free() {
+}
+
+#endif
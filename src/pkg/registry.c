@@ -2,10 +2,13 @@
 #define _GNU_SOURCE
 
 #include <nutshell/core.h>
+#include <nutshell/pkg.h>
+#include <nutshell/utils.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <dirent.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -16,14 +19,125 @@
 
 static CommandRegistry *registry = NULL;
 static const char* PACKAGES_DIR = "/.nutshell/packages";
+// Set by init_registry_core() until the package directories have been scanned
+static bool packages_pending = false;
+// Bumped on every change, so cached lookups know when to start over
+static unsigned long generation = 0;
+// Set by registry_watch_packages(): package directories are watched once loaded
+static bool watch_packages = false;
+
+// Room for the default commands before the first growth
+#define REGISTRY_MIN_CAPACITY 16
 
 // Function prototype for register_package_commands
 bool register_package_commands(const char *pkg_dir, const char *pkg_name);
 
+// The slot holding `name` in one of the indexes, or the empty slot where it
+// belongs. Both indexes use the same hash, so a name is only hashed once.
+static size_t *index_slot(size_t *index, bool by_unix, const char *name, size_t hash) {
+    size_t mask = registry->index_size - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        if (index[i] == 0) return &index[i];
+        const CommandMapping *cmd = &registry->commands[index[i] - 1];
+        if (strcmp(by_unix ? cmd->unix_cmd : cmd->nut_cmd, name) == 0) return &index[i];
+    }
+}
+
+// Index commands[i] under whichever of its names no earlier command has taken
+static void index_command(size_t i, size_t nut_hash, size_t unix_hash) {
+    const CommandMapping *cmd = &registry->commands[i];
+    size_t *nut_slot = index_slot(registry->nut_index, false, cmd->nut_cmd, nut_hash);
+    size_t *unix_slot = index_slot(registry->unix_index, true, cmd->unix_cmd, unix_hash);
+    if (*nut_slot == 0) *nut_slot = i + 1;
+    if (*unix_slot == 0) *unix_slot = i + 1;
+}
+
+// The command a name refers to, plus one, or 0. Either name can match and
+// the earlier registration wins, as with a scan in registration order.
+static size_t lookup_entry(const char *name, size_t hash) {
+    size_t nut_entry = *index_slot(registry->nut_index, false, name, hash);
+    size_t unix_entry = *index_slot(registry->unix_index, true, name, hash);
+    return nut_entry && (!unix_entry || nut_entry < unix_entry) ? nut_entry : unix_entry;
+}
+
+static void reindex_commands() {
+    memset(registry->nut_index, 0, registry->index_size * sizeof(size_t));
+    memset(registry->unix_index, 0, registry->index_size * sizeof(size_t));
+    for (size_t i = 0; i < registry->count; i++) {
+        const CommandMapping *cmd = &registry->commands[i];
+        index_command(i, hash_string(cmd->nut_cmd), hash_string(cmd->unix_cmd));
+    }
+}
+
+// Make room for one more command, doubling the array and rebuilding the
+// indexes at twice its size when it is full
+static bool reserve_command() {
+    if (registry->count < registry->capacity) return true;
+    
+    size_t capacity = registry->capacity ? registry->capacity * 2 : REGISTRY_MIN_CAPACITY;
+    size_t *nut_index = calloc(capacity * 2, sizeof(size_t));
+    size_t *unix_index = calloc(capacity * 2, sizeof(size_t));
+    CommandMapping *commands = nut_index && unix_index ?
+        realloc(registry->commands, capacity * sizeof(CommandMapping)) : NULL;
+    if (!commands) {
+        free(nut_index);
+        free(unix_index);
+        return false;
+    }
+    
+    free(registry->nut_index);
+    free(registry->unix_index);
+    registry->commands = commands;
+    registry->capacity = capacity;
+    registry->nut_index = nut_index;
+    registry->unix_index = unix_index;
+    registry->index_size = capacity * 2;
+    reindex_commands();
+    REGISTRY_DEBUG("Grew registry to %zu commands", capacity);
+    return true;
+}
+
+// The user and system package directories, user first
+static size_t package_roots(const char *roots[2], char *home_path, size_t size) {
+    size_t count = 0;
+    char *home = getenv("HOME");
+    if (home) {
+        snprintf(home_path, size, "%s%s", home, PACKAGES_DIR);
+        roots[count++] = home_path;
+    } else {
+        REGISTRY_DEBUG("HOME environment variable not set");
+    }
+    
+    // Also check system-wide packages if accessible
+    roots[count++] = "/usr/local/nutshell/packages";
+    return count;
+}
+
+// Register the user and system packages, from the package index when the
+// directories have not changed since they were last scanned
+static void load_installed_packages() {
+    packages_pending = false;
+    
+    const char *roots[2];
+    char home_path[256];
+    size_t count = package_roots(roots, home_path, sizeof(home_path));
+    for (size_t i = 0; i < count; i++) {
+        REGISTRY_DEBUG("Loading packages from %s", roots[i]);
+    }
+    package_index_load(roots, count);
+    if (watch_packages) package_watch_roots(roots, count);
+}
+
 void init_registry() {
-    registry = malloc(sizeof(CommandRegistry));
-    registry->commands = NULL;
-    registry->count = 0;
+    init_registry_core();
+    load_installed_packages();
+}
+
+// Default commands only; installed packages are scanned the first time a
+// lookup misses, so scripts that only use builtins never touch the disk
+void init_registry_core() {
+    registry = calloc(1, sizeof(CommandRegistry));
+    reserve_command();
     
     // Default commands
     register_command("exit", "roast", true);
@@ -37,21 +151,7 @@ void init_registry() {
     register_command("theme", "theme", true);
     
     REGISTRY_DEBUG("Initialized registry with default commands");
-    
-    // Load installed packages
-    char home_path[256];
-    char *home = getenv("HOME");
-    if (home) {
-        snprintf(home_path, sizeof(home_path), "%s%s", home, PACKAGES_DIR);
-        REGISTRY_DEBUG("Loading packages from user dir: %s", home_path);
-        load_packages_from_dir(home_path);
-    } else {
-        REGISTRY_DEBUG("HOME environment variable not set");
-    }
-    
-    // Also check system-wide packages if accessible
-    REGISTRY_DEBUG("Loading packages from system dir: /usr/local/nutshell/packages");
-    load_packages_from_dir("/usr/local/nutshell/packages");
+    packages_pending = true;
 }
 
 // New function to scan and load packages from directories
@@ -83,46 +183,150 @@ void load_packages_from_dir(const char *dir_path) {
 
 // Register commands from a specific package
 bool register_package_commands(const char *pkg_dir, const char *pkg_name) {
-    char script_path[512];
-    snprintf(script_path, sizeof(script_path), "%s/%s/%s.sh", pkg_dir, pkg_name, pkg_name);
+    char dir[512];
+    snprintf(dir, sizeof(dir), "%s/%s", pkg_dir, pkg_name);
     
-    // Check if the script exists
-    struct stat st;
-    if (stat(script_path, &st) == 0) {
-        // Register command with the package name
-        register_command(script_path, pkg_name, false);
-        return true;
+    // The script and every command from the manifest; reinstalling the same
+    // package finds them already there
+    PackageCommand *commands;
+    size_t count = package_commands(dir, pkg_name, &commands);
+    bool registered = count > 0;
+    for (size_t i = 0; i < count; i++) {
+        if (register_package_command(&commands[i]) == REGISTER_FAILED) registered = false;
     }
-    
-    return false;
+    free_package_commands(commands, count);
+    return registered;
 }
 
-void register_command(const char *unix_cmd, const char *nut_cmd, bool is_builtin) {
-    registry->count++;
-    registry->commands = realloc(registry->commands, 
-                               registry->count * sizeof(CommandMapping));
+static void free_args(char **args) {
+    if (!args) return;
+    for (size_t i = 0; args[i]; i++) free(args[i]);
+    free(args);
+}
+
+static char **copy_args(char *const *args) {
+    size_t count = 0;
+    while (args[count]) count++;
+    char **copy = calloc(count + 1, sizeof(char *));
+    if (!copy) return NULL;
+    for (size_t i = 0; i < count; i++) {
+        copy[i] = strdup(args[i]);
+        if (!copy[i]) {
+            free_args(copy);
+            return NULL;
+        }
+    }
+    return copy;
+}
+
+static bool args_equal(char *const *a, char *const *b) {
+    if (!a || !b) return a == b;
+    size_t i = 0;
+    for (; a[i] && b[i]; i++) {
+        if (strcmp(a[i], b[i]) != 0) return false;
+    }
+    return a[i] == b[i];
+}
+
+// Names keep their first registration, so user packages win over system
+// packages of the same name and no package replaces a default command
+static RegisterResult add_command(const char *unix_cmd, const char *nut_cmd, bool is_builtin,
+                                  char *const *args) {
+    if (!reserve_command()) return REGISTER_FAILED;
+    
+    size_t nut_hash = hash_string(nut_cmd);
+    size_t unix_hash = hash_string(unix_cmd);
+    size_t nut_entry = lookup_entry(nut_cmd, nut_hash);
+    size_t unix_entry = lookup_entry(unix_cmd, unix_hash);
+    if (nut_entry && nut_entry == unix_entry &&
+        strcmp(registry->commands[nut_entry - 1].nut_cmd, nut_cmd) == 0 &&
+        strcmp(registry->commands[nut_entry - 1].unix_cmd, unix_cmd) == 0) {
+        CommandMapping *existing = &registry->commands[nut_entry - 1];
+        if (args_equal(existing->args, args)) {
+            REGISTRY_DEBUG("Already registered: %s -> %s", nut_cmd, unix_cmd);
+            return REGISTER_DUPLICATE;
+        }
+        
+        // The manifest changed what the command runs
+        char **copy = args ? copy_args(args) : NULL;
+        if (args && !copy) return REGISTER_FAILED;
+        free_args(existing->args);
+        existing->args = copy;
+        generation++;
+        REGISTRY_DEBUG("Updated command: %s -> %s", nut_cmd, unix_cmd);
+        return REGISTER_UPDATED;
+    }
     
-    CommandMapping *cmd = &registry->commands[registry->count - 1];
+    CommandMapping *cmd = &registry->commands[registry->count];
     cmd->unix_cmd = strdup(unix_cmd);
     cmd->nut_cmd = strdup(nut_cmd);
     cmd->is_builtin = is_builtin;
+    cmd->args = args ? copy_args(args) : NULL;
+    if (!cmd->unix_cmd || !cmd->nut_cmd || (args && !cmd->args)) {
+        free(cmd->unix_cmd);
+        free(cmd->nut_cmd);
+        free_args(cmd->args);
+        return REGISTER_FAILED;
+    }
+    generation++;
+    registry->count++;
     
+    index_command(registry->count - 1, nut_hash, unix_hash);
+    if (nut_entry || unix_entry) {
+        REGISTRY_DEBUG("Registered command: %s -> %s (builtin: %s), shadowed by an earlier command",
+                nut_cmd, unix_cmd, is_builtin ? "yes" : "no");
+        return REGISTER_SHADOWED;
+    }
     REGISTRY_DEBUG("Registered command: %s -> %s (builtin: %s)", 
             nut_cmd, unix_cmd, is_builtin ? "yes" : "no");
+    return REGISTER_ADDED;
+}
+
+RegisterResult register_command(const char *unix_cmd, const char *nut_cmd, bool is_builtin) {
+    return add_command(unix_cmd, nut_cmd, is_builtin, NULL);
+}
+
+RegisterResult register_template(const char *unix_cmd, const char *nut_cmd, char *const *args) {
+    return add_command(unix_cmd, nut_cmd, false, args);
+}
+
+// Remove the first command registered for unix_cmd. Later commands move
+// down, and a command it shadowed gets the names back.
+bool unregister_command(const char *unix_cmd) {
+    size_t entry = *index_slot(registry->unix_index, true, unix_cmd, hash_string(unix_cmd));
+    if (!entry) return false;
+    
+    CommandMapping *cmd = &registry->commands[entry - 1];
+    REGISTRY_DEBUG("Unregistered command: %s -> %s", cmd->nut_cmd, cmd->unix_cmd);
+    free(cmd->unix_cmd);
+    free(cmd->nut_cmd);
+    free_args(cmd->args);
+    memmove(cmd, cmd + 1, (registry->count - entry) * sizeof(CommandMapping));
+    registry->count--;
+    reindex_commands();
+    generation++;
+    return true;
+}
+
+const CommandMapping *registry_commands(size_t *count) {
+    *count = registry ? registry->count : 0;
+    return registry ? registry->commands : NULL;
 }
 
 const CommandMapping *find_command(const char *input_cmd) {
     REGISTRY_DEBUG("Looking for command: %s", input_cmd);
     
-    for (size_t i = 0; i < registry->count; i++) {
-        if (strcmp(registry->commands[i].nut_cmd, input_cmd) == 0 ||
-            strcmp(registry->commands[i].unix_cmd, input_cmd) == 0) {
-            
-            REGISTRY_DEBUG("Found command: %s -> %s (builtin: %s)", 
-                    input_cmd, registry->commands[i].unix_cmd, 
-                    registry->commands[i].is_builtin ? "yes" : "no");
-            return &registry->commands[i];
-        }
+    size_t entry = lookup_entry(input_cmd, hash_string(input_cmd));
+    if (entry) {
+        const CommandMapping *cmd = &registry->commands[entry - 1];
+        REGISTRY_DEBUG("Found command: %s -> %s (builtin: %s)", 
+                input_cmd, cmd->unix_cmd, cmd->is_builtin ? "yes" : "no");
+        return cmd;
+    }
+    
+    if (packages_pending) {
+        load_installed_packages();
+        return find_command(input_cmd);
     }
     
     REGISTRY_DEBUG("Command not found: %s", input_cmd);
@@ -133,9 +337,38 @@ void free_registry() {
     for (size_t i = 0; i < registry->count; i++) {
         free(registry->commands[i].unix_cmd);
         free(registry->commands[i].nut_cmd);
+        free_args(registry->commands[i].args);
     }
     free(registry->commands);
+    free(registry->nut_index);
+    free(registry->unix_index);
     free(registry);
+    registry = NULL;
+    packages_pending = false;
+    watch_packages = false;
+    package_watch_free();
+    generation++;
+}
+
+// Interactive shells keep up with packages installed or removed while they
+// run. Until the packages are first loaded there is nothing to keep up with.
+void registry_watch_packages() {
+    if (watch_packages) return;
+    watch_packages = true;
+    if (registry && !packages_pending) {
+        const char *roots[2];
+        char home_path[256];
+        size_t count = package_roots(roots, home_path, sizeof(home_path));
+        package_watch_roots(roots, count);
+    }
+}
+
+void registry_poll_packages() {
+    if (watch_packages) package_watch_poll();
+}
+
+unsigned long registry_generation() {
+    return generation;
 }
 
 void print_command_registry() {
@@ -6,13 +6,14 @@
 #include <jansson.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <dirent.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <limits.h>  // For PATH_MAX constant
-#include <libgen.h>  // For dirname function
 #include <errno.h>   // Add this include for errno
+#include <time.h>
 
 // Configuration debug macro
 #define CONFIG_DEBUG(fmt, ...) \
@@ -21,14 +22,197 @@
 // Global configuration instance
 Config *global_config = NULL;
 
+// Bumped whenever the set of aliases may have changed
+static unsigned long alias_generation = 0;
+
+// Open-addressing index over global_config->aliases, rebuilt on the first
+// lookup after they change. Slots hold a position in the array plus one, 0
+// when empty.
+static size_t *alias_index = NULL;
+static size_t alias_index_size = 0;
+static unsigned long alias_index_generation = 0;
+
+// A config file as it was when it was read, or the fact that it was missing
+typedef struct {
+    char *path;
+    bool exists;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+} FileStamp;
+
+typedef struct {
+    FileStamp *items;
+    size_t count;
+    size_t capacity;
+} FileStamps;
+
+// The merged configuration of a working directory. It stays valid while
+// every file looked at to build it, found or not, is as it was, so changing
+// back to a directory costs a stat per file instead of reading any JSON.
+typedef struct {
+    char *dir;
+    char *home;           // $HOME it was resolved with
+    FileStamps files;
+    Config values;
+    bool loaded_any;
+    unsigned long last_used;
+} DirConfig;
+
+#define DIR_CACHE_MAX 32
+// A file changed this recently could change again without its mtime moving
+#define CONFIG_RACY_SECONDS 2
+
+static DirConfig dir_cache[DIR_CACHE_MAX];
+static size_t dir_cache_count = 0;
+static unsigned long dir_cache_clock = 0;
+
 // Configuration file names
 static const char *DIR_CONFIG_FILE = ".nutshell.json";
 static const char *USER_CONFIG_DIR = "/.nutshell";
 static const char *USER_CONFIG_FILE = "/.nutshell/config.json";
 static const char *SYSTEM_CONFIG_FILE = "/usr/local/nutshell/config.json";
 
+static char **copy_strings(char **strings, int count) {
+    if (count == 0) return NULL;
+    char **copy = calloc(count, sizeof(char *));
+    for (int i = 0; copy && i < count; i++) {
+        copy[i] = strings[i] ? strdup(strings[i]) : NULL;
+    }
+    return copy;
+}
+
+static void free_strings(char **strings, int count) {
+    for (int i = 0; i < count; i++) free(strings[i]);
+    free(strings);
+}
+
+// Copy every value of one configuration into an empty one
+static void copy_values(Config *to, const Config *from) {
+    to->theme = from->theme ? strdup(from->theme) : NULL;
+    to->enabled_packages = copy_strings(from->enabled_packages, from->package_count);
+    to->package_count = to->enabled_packages ? from->package_count : 0;
+    to->aliases = copy_strings(from->aliases, from->alias_count);
+    to->alias_commands = copy_strings(from->alias_commands, from->alias_count);
+    to->alias_count = to->aliases && to->alias_commands ? from->alias_count : 0;
+    to->scripts = copy_strings(from->scripts, from->script_count);
+    to->script_count = to->scripts ? from->script_count : 0;
+}
+
+static void free_values(Config *config) {
+    free(config->theme);
+    free_strings(config->enabled_packages, config->package_count);
+    free_strings(config->aliases, config->alias_count);
+    free_strings(config->alias_commands, config->alias_count);
+    free_strings(config->scripts, config->script_count);
+    memset(config, 0, sizeof(Config));
+}
+
+// Note what a config file looks like now; st is NULL when it is missing
+static void record_file(FileStamps *stamps, const char *path, const struct stat *st) {
+    if (!stamps) return;
+    if (stamps->count == stamps->capacity) {
+        size_t capacity = stamps->capacity ? stamps->capacity * 2 : 8;
+        FileStamp *items = realloc(stamps->items, capacity * sizeof(FileStamp));
+        if (!items) return;
+        stamps->items = items;
+        stamps->capacity = capacity;
+    }
+    FileStamp *stamp = &stamps->items[stamps->count];
+    memset(stamp, 0, sizeof(FileStamp));
+    if (!(stamp->path = strdup(path))) return;
+    if (st) {
+        stamp->exists = true;
+        stamp->dev = st->st_dev;
+        stamp->ino = st->st_ino;
+        stamp->mtime = st->st_mtim;
+        stamp->size = st->st_size;
+    }
+    stamps->count++;
+}
+
+static bool stamp_current(const FileStamp *stamp) {
+    struct stat st;
+    if (stat(stamp->path, &st) != 0) return !stamp->exists;
+    return stamp->exists && st.st_dev == stamp->dev && st.st_ino == stamp->ino &&
+           st.st_mtim.tv_sec == stamp->mtime.tv_sec && st.st_mtim.tv_nsec == stamp->mtime.tv_nsec &&
+           st.st_size == stamp->size;
+}
+
+static void free_stamps(FileStamps *stamps) {
+    for (size_t i = 0; i < stamps->count; i++) free(stamps->items[i].path);
+    free(stamps->items);
+    memset(stamps, 0, sizeof(FileStamps));
+}
+
+static void drop_dir_config(DirConfig *entry) {
+    free(entry->dir);
+    free(entry->home);
+    free_stamps(&entry->files);
+    free_values(&entry->values);
+    *entry = dir_cache[--dir_cache_count];
+}
+
+static void free_dir_cache() {
+    while (dir_cache_count > 0) drop_dir_config(&dir_cache[0]);
+}
+
+// The cached configuration of a directory, if none of its files changed
+static DirConfig *find_dir_config(const char *dir, const char *home) {
+    for (size_t i = 0; i < dir_cache_count; i++) {
+        DirConfig *entry = &dir_cache[i];
+        if (strcmp(entry->dir, dir) != 0 || strcmp(entry->home, home) != 0) continue;
+        for (size_t j = 0; j < entry->files.count; j++) {
+            if (!stamp_current(&entry->files.items[j])) {
+                CONFIG_DEBUG("%s changed, reloading config for %s", entry->files.items[j].path, dir);
+                drop_dir_config(entry);
+                return NULL;
+            }
+        }
+        return entry;
+    }
+    return NULL;
+}
+
+// Remember the configuration just loaded for a directory. Takes the stamps.
+static void store_dir_config(const char *dir, const char *home, FileStamps *stamps, bool loaded_any) {
+    time_t now = time(NULL);
+    for (size_t i = 0; i < stamps->count; i++) {
+        if (stamps->items[i].exists && stamps->items[i].mtime.tv_sec >= now - CONFIG_RACY_SECONDS) {
+            CONFIG_DEBUG("%s was just modified, not caching", stamps->items[i].path);
+            free_stamps(stamps);
+            return;
+        }
+    }
+    
+    if (dir_cache_count == DIR_CACHE_MAX) {
+        size_t oldest = 0;
+        for (size_t i = 1; i < dir_cache_count; i++) {
+            if (dir_cache[i].last_used < dir_cache[oldest].last_used) oldest = i;
+        }
+        drop_dir_config(&dir_cache[oldest]);
+    }
+    DirConfig *entry = &dir_cache[dir_cache_count];
+    memset(entry, 0, sizeof(DirConfig));
+    entry->dir = strdup(dir);
+    entry->home = strdup(home);
+    if (!entry->dir || !entry->home) {
+        free(entry->dir);
+        free(entry->home);
+        free_stamps(stamps);
+        return;
+    }
+    entry->files = *stamps;
+    copy_values(&entry->values, global_config);
+    entry->loaded_any = loaded_any;
+    entry->last_used = ++dir_cache_clock;
+    dir_cache_count++;
+}
+
 // Initialize configuration system
 void init_config_system() {
+    if (global_config) return;  // Already initialized
     CONFIG_DEBUG("Initializing configuration system");
     
     // Create empty configuration structure
@@ -59,6 +243,7 @@ void init_config_system() {
 // Clean up configuration resources
 void cleanup_config_system() {
     if (!global_config) return;
+    alias_generation++;
     
     free(global_config->theme);
     
@@ -81,18 +266,26 @@ void cleanup_config_system() {
     
     free(global_config);
     global_config = NULL;
+    
+    free(alias_index);
+    alias_index = NULL;
+    alias_index_size = 0;
+    
+    free_dir_cache();
 }
 
 // Load JSON file into configuration
-static bool load_config_from_file(const char *path) {
+static bool load_config_from_file(const char *path, FileStamps *stamps) {
     CONFIG_DEBUG("Attempting to load config from: %s", path);
     
     // Check if file exists
     struct stat st;
     if (stat(path, &st) != 0) {
         CONFIG_DEBUG("Config file not found: %s", path);
+        record_file(stamps, path, NULL);
         return false;
     }
+    record_file(stamps, path, &st);
     
     // Open file
     FILE *file = fopen(path, "r");
@@ -163,6 +356,7 @@ static bool load_config_from_file(const char *path) {
     // Extract aliases
     json_t *aliases_json = json_object_get(root, "aliases");
     if (json_is_object(aliases_json)) {
+        alias_generation++;
         // Free existing aliases
         for (int i = 0; i < global_config->alias_count; i++) {
             free(global_config->aliases[i]);
@@ -191,6 +385,8 @@ static bool load_config_from_file(const char *path) {
                 i++;
             }
         }
+        // Values that are not strings were skipped
+        global_config->alias_count = i;
     }
     
     // Extract scripts
@@ -222,95 +418,55 @@ static bool load_config_from_file(const char *path) {
     return true;
 }
 
-// Check up the directory tree for config files
-static bool find_directory_config(char *result_path, size_t max_size) {
-    char current_dir[PATH_MAX] = {0};
-    char config_path[PATH_MAX] = {0};
-    
-    // Get the absolute path of the current directory
-    if (!getcwd(current_dir, sizeof(current_dir))) {
-        CONFIG_DEBUG("Failed to get current directory");
-        return false;
-    }
-    
-    CONFIG_DEBUG("Searching for directory config starting from: %s", current_dir);
-    CONFIG_DEBUG("Looking for file named: %s", DIR_CONFIG_FILE);
-    
-    // Start from the current directory and go up until root
-    char *dir_path = strdup(current_dir);
-    if (!dir_path) {
-        CONFIG_DEBUG("Failed to allocate memory for dir_path");
-        return false;
-    }
-    
-    while (dir_path && strlen(dir_path) > 0) {
-        // Create the config file path
-        snprintf(config_path, sizeof(config_path), "%s/%s", dir_path, DIR_CONFIG_FILE);
-        CONFIG_DEBUG("Checking for config at: %s", config_path);
-        
-        // Check if config file exists
-        if (access(config_path, R_OK) == 0) {
-            CONFIG_DEBUG("Found directory config at: %s", config_path);
-            
-            // Check if we can actually open and read the file
-            FILE *check = fopen(config_path, "r");
-            if (check) {
-                char buffer[256];
-                size_t bytes_read = fread(buffer, 1, sizeof(buffer) - 1, check);
-                buffer[bytes_read] = '\0';
-                fclose(check);
-                CONFIG_DEBUG("First %zu bytes of config: %.100s...", bytes_read, buffer);
-            } else {
-                CONFIG_DEBUG("WARNING: Found config but cannot open for reading: %s", strerror(errno));
-            }
-            
-            strncpy(result_path, config_path, max_size);
-            free(dir_path);
-            return true;
-        } else {
-            CONFIG_DEBUG("Config file not found at: %s (%s)", config_path, strerror(errno));
-        }
-        
-        // Go up one directory level - completely rewritten to avoid memory issues
-        char *parent_dir = strdup(dir_path);
-        if (!parent_dir) {
-            CONFIG_DEBUG("Failed to allocate memory for parent_dir");
-            free(dir_path);
+// Check up the directory tree for config files. Each place looked at is
+// recorded, so a config created later closer to `dir` is noticed.
+static bool find_directory_config(const char *start, char *result_path, size_t max_size,
+                                  FileStamps *stamps) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", start);
+    CONFIG_DEBUG("Searching for directory config starting from: %s", dir);
+    
+    for (;;) {
+        char config_path[PATH_MAX];
+        if ((size_t)snprintf(config_path, sizeof(config_path), "%s/%s", dir, DIR_CONFIG_FILE) >= sizeof(config_path)) {
             return false;
         }
-        
-        // Use dirname() on the copy
-        char *dirname_result = dirname(parent_dir);
-        
-        // If we've reached the root directory
-        if (strcmp(dir_path, dirname_result) == 0 || 
-            strcmp(dirname_result, "/") == 0) {
-            CONFIG_DEBUG("Reached root directory or can't go up further");
-            free(parent_dir);
-            free(dir_path);
-            return false;
+        struct stat st;
+        if (stat(config_path, &st) == 0 && access(config_path, R_OK) == 0) {
+            CONFIG_DEBUG("Found directory config at: %s", config_path);
+            snprintf(result_path, max_size, "%s", config_path);
+            return true;
         }
+        record_file(stamps, config_path, NULL);
         
-        // Replace current path with parent
-        free(dir_path);
-        dir_path = strdup(dirname_result);
-        free(parent_dir);
-        
-        if (!dir_path) {
-            CONFIG_DEBUG("Failed to allocate memory for new dir_path");
-            return false;
-        }
+        // Go up one level; the root directory itself is not searched
+        char *slash = strrchr(dir, '/');
+        if (!slash || slash == dir) break;
+        *slash = '\0';
     }
     
     CONFIG_DEBUG("No directory config found in path");
-    if (dir_path) {
-        free(dir_path);
-    }
     return false;
 }
 
 // Load configuration from files with improved directory hierarchy search
 bool load_config_files() {
+    char cwd[PATH_MAX];
+    bool have_cwd = getcwd(cwd, sizeof(cwd)) != NULL;
+    char *home = getenv("HOME");
+    
+    // A directory seen before, with none of its files changed since
+    DirConfig *cached = have_cwd ? find_dir_config(cwd, home ? home : "") : NULL;
+    if (cached && global_config) {
+        CONFIG_DEBUG("Using cached config for %s", cwd);
+        free_values(global_config);
+        copy_values(global_config, &cached->values);
+        alias_generation++;
+        cached->last_used = ++dir_cache_clock;
+        return cached->loaded_any;
+    }
+    
+    FileStamps stamps = {0};
     bool loaded_any = false;
     
     // Track which configuration sources were loaded
@@ -321,7 +477,7 @@ bool load_config_files() {
     // Load in reverse precedence order: system (lowest) -> user -> directory (highest)
     
     // Check for system config first (lowest precedence)
-    if (load_config_from_file(SYSTEM_CONFIG_FILE)) {
+    if (load_config_from_file(SYSTEM_CONFIG_FILE, &stamps)) {
         CONFIG_DEBUG("Loaded system config from: %s", SYSTEM_CONFIG_FILE);
         system_loaded = true;
         loaded_any = true;
@@ -329,10 +485,9 @@ bool load_config_files() {
     
     // Check for user config next (medium precedence)
     char user_config[512];
-    char *home = getenv("HOME");
     if (home) {
         snprintf(user_config, sizeof(user_config), "%s%s", home, USER_CONFIG_FILE);
-        if (load_config_from_file(user_config)) {
+        if (load_config_from_file(user_config, &stamps)) {
             CONFIG_DEBUG("Loaded user config from: %s", user_config);
             user_loaded = true;
             loaded_any = true;
@@ -341,19 +496,11 @@ bool load_config_files() {
     
     // Finally, try to find directory-specific config (highest precedence)
     char dir_config_path[PATH_MAX] = {0};
-    if (find_directory_config(dir_config_path, sizeof(dir_config_path))) {
-        if (load_config_from_file(dir_config_path)) {
+    if (have_cwd && find_directory_config(cwd, dir_config_path, sizeof(dir_config_path), &stamps)) {
+        if (load_config_from_file(dir_config_path, &stamps)) {
             CONFIG_DEBUG("Loaded directory-specific config from: %s", dir_config_path);
             dir_loaded = true;
             loaded_any = true;
-            
-            // Store the directory where we found the config
-            if (global_config) {
-                char *dir_name = strdup(dirname(dir_config_path));
-                CONFIG_DEBUG("Setting active config directory to: %s", dir_name);
-                // Store this path for later reference
-                free(dir_name); // Free the temporary string
-            }
         }
     }
     
@@ -361,10 +508,27 @@ bool load_config_files() {
               dir_loaded ? "yes" : "no", 
               user_loaded ? "yes" : "no", 
               system_loaded ? "yes" : "no");
-              
+    
+    if (have_cwd && global_config) {
+        store_dir_config(cwd, home ? home : "", &stamps, loaded_any);
+    } else {
+        free_stamps(&stamps);
+    }
     return loaded_any;
 }
 
+// Same aliases, in the same order, as the ones given
+static bool aliases_unchanged(char **aliases, char **commands, int count) {
+    if (!global_config || global_config->alias_count != count) return false;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(global_config->aliases[i], aliases[i]) != 0 ||
+            strcmp(global_config->alias_commands[i], commands[i]) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
 // Force reload of configuration based on current directory
 bool reload_directory_config() {
     CONFIG_DEBUG("Reloading configuration for current directory");
@@ -373,12 +537,36 @@ bool reload_directory_config() {
     char *current_theme = global_config && global_config->theme ? 
                          strdup(global_config->theme) : NULL;
     
+    // Keep the aliases to compare: moving between directories that share
+    // them must not throw away the commands already expanded with them
+    unsigned long generation = alias_generation;
+    char **old_aliases = NULL, **old_commands = NULL;
+    int old_count = 0;
+    if (global_config) {
+        old_aliases = global_config->aliases;
+        old_commands = global_config->alias_commands;
+        old_count = global_config->alias_count;
+        global_config->aliases = NULL;
+        global_config->alias_commands = NULL;
+        global_config->alias_count = 0;
+    }
+    
     // Clear existing configuration but don't free the struct
     cleanup_config_values();
     
     // Reload configuration from files
     bool result = load_config_files();
     
+    if (aliases_unchanged(old_aliases, old_commands, old_count)) {
+        alias_generation = generation;
+    }
+    for (int i = 0; i < old_count; i++) {
+        free(old_aliases[i]);
+        free(old_commands[i]);
+    }
+    free(old_aliases);
+    free(old_commands);
+    
     // If we had a theme before and no new theme was loaded, restore it
     if (current_theme && global_config && !global_config->theme) {
         global_config->theme = current_theme;
@@ -392,33 +580,8 @@ bool reload_directory_config() {
 // Clean up only the values inside the configuration, not the struct itself
 void cleanup_config_values() {
     if (!global_config) return;
-    
-    free(global_config->theme);
-    global_config->theme = NULL;
-    
-    for (int i = 0; i < global_config->package_count; i++) {
-        free(global_config->enabled_packages[i]);
-    }
-    free(global_config->enabled_packages);
-    global_config->enabled_packages = NULL;
-    global_config->package_count = 0;
-    
-    for (int i = 0; i < global_config->alias_count; i++) {
-        free(global_config->aliases[i]);
-        free(global_config->alias_commands[i]);
-    }
-    free(global_config->aliases);
-    free(global_config->alias_commands);
-    global_config->aliases = NULL;
-    global_config->alias_commands = NULL;
-    global_config->alias_count = 0;
-    
-    for (int i = 0; i < global_config->script_count; i++) {
-        free(global_config->scripts[i]);
-    }
-    free(global_config->scripts);
-    global_config->scripts = NULL;
-    global_config->script_count = 0;
+    alias_generation++;
+    free_values(global_config);
 }
 
 // Save current configuration to user config file
@@ -568,6 +731,7 @@ bool remove_config_package(const char *package_name) {
 // Add alias to configuration
 bool add_config_alias(const char *alias_name, const char *command) {
     if (!global_config || !alias_name || !command) return false;
+    alias_generation++;
     
     // Check if alias already exists
     for (int i = 0; i < global_config->alias_count; i++) {
@@ -595,6 +759,7 @@ bool add_config_alias(const char *alias_name, const char *command) {
 // Remove alias from configuration
 bool remove_config_alias(const char *alias_name) {
     if (!global_config || !alias_name) return false;
+    alias_generation++;
     
     for (int i = 0; i < global_config->alias_count; i++) {
         if (strcmp(global_config->aliases[i], alias_name) == 0) {
@@ -616,6 +781,39 @@ bool remove_config_alias(const char *alias_name) {
     return false; // Alias not found
 }
 
+unsigned long config_alias_generation() {
+    return alias_generation;
+}
+
+// The slot holding `name`, or the empty slot where it belongs
+static size_t *alias_slot(const char *name, size_t hash) {
+    size_t mask = alias_index_size - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        if (alias_index[i] == 0 || strcmp(global_config->aliases[alias_index[i] - 1], name) == 0) {
+            return &alias_index[i];
+        }
+    }
+}
+
+static bool index_aliases() {
+    size_t size = 16;
+    while (size < (size_t)global_config->alias_count * 2) size *= 2;
+    if (size != alias_index_size) {
+        size_t *index = realloc(alias_index, size * sizeof(size_t));
+        if (!index) return false;
+        alias_index = index;
+        alias_index_size = size;
+    }
+    memset(alias_index, 0, alias_index_size * sizeof(size_t));
+    for (int i = 0; i < global_config->alias_count; i++) {
+        size_t *slot = alias_slot(global_config->aliases[i], hash_string(global_config->aliases[i]));
+        if (*slot == 0) *slot = (size_t)i + 1;
+    }
+    alias_index_generation = alias_generation;
+    CONFIG_DEBUG("Indexed %d aliases", global_config->alias_count);
+    return true;
+}
+
 // Add script to configuration
 bool add_config_script(const char *script_path) {
     if (!global_config || !script_path) return false;
@@ -678,13 +876,11 @@ bool is_package_enabled(const char *package_name) {
 
 // Get alias command
 const char *get_alias_command(const char *alias_name) {
-    if (!global_config || !alias_name) return NULL;
+    if (!global_config || !alias_name || global_config->alias_count == 0) return NULL;
     
-    for (int i = 0; i < global_config->alias_count; i++) {
-        if (strcmp(global_config->aliases[i], alias_name) == 0) {
-            return global_config->alias_commands[i];
-        }
+    if ((!alias_index || alias_index_generation != alias_generation) && !index_aliases()) {
+        return NULL;
     }
-    
-    return NULL;
+    size_t entry = *alias_slot(alias_name, hash_string(alias_name));
+    return entry ? global_config->alias_commands[entry - 1] : NULL;
 }
@@ -0,0 +1,705 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+#include <nutshell/theme.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// Git status debug macro, shares the theme's switch
+#define GITSTATUS_DEBUG(fmt, ...) \
+    do { if (getenv("NUT_DEBUG_THEME")) fprintf(stderr, "GITSTATUS: " fmt "\n", ##__VA_ARGS__); } while(0)
+
+// `git status` has to look at every file of the work tree, which takes
+// seconds in a big enough repository. Each repository the prompt asks about
+// gets a helper: a child of the shell in its own process group that watches
+// the work tree with inotify and runs `git status` only after something
+// changed, so asking it costs a round trip on a socket pair.
+//
+// Each query carries the time the shell is willing to wait. A helper that is
+// up to date answers at once. Otherwise it waits for the `git status` it has
+// running, up to that budget, and then answers with what it saw last; later
+// queries do not wait again until it has caught up. A helper exits when the
+// shell closes its end of the socket.
+//
+// The first `git status` starts right away, next to a `git ls-files` that
+// lists the directories git ignores. Once that is in, the work tree is
+// walked in chunks between queries, leaving out the ignored directories, so
+// `node_modules` or a build tree neither holds up the first answer nor uses
+// up the inotify watches. A change in a directory not watched yet would go
+// unseen, so the status counts as up to date only once the walk is done,
+// and `git status` runs once more then.
+
+#define GIT_HELPERS_MAX 8
+#define GIT_STATUS_SLACK 20          // Milliseconds on top of the budget for the reply itself
+#define GIT_STATUS_UNWATCHED_TTL 1000  // How long a status holds where inotify is not available
+#define GIT_REPLY_MAX 512
+#define GIT_WALK_CHUNK 256             // Directories watched between two looks at the socket
+
+extern char **environ;
+
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int status_timeout() {
+    const char *env = getenv("NUT_GIT_STATUS_TIMEOUT");
+    if (env && *env) {
+        char *end;
+        long value = strtol(env, &end, 10);
+        if (*end == '\0' && value > 0 && value <= 60000) return (int)value;
+    }
+    return GIT_STATUS_TIMEOUT_DEFAULT;
+}
+
+// ---- The helper process ----
+
+typedef struct {
+    int wd;
+    char *path;
+    bool git_dir;  // Inside the git directory, where lock files come and go
+} Watch;
+
+typedef struct {
+    char *path;
+    bool git_dir;
+} WalkDir;
+
+static struct {
+    int sock;
+    const char *top;
+    GitStatus status;
+    bool known;        // The last `git status` succeeded
+    bool computed;     // One has finished
+    bool stale;        // Something changed since the running or last one started
+    bool waited;       // A query ran out of time since the status was last up to date
+    long long computed_ms;
+    pid_t git;
+    int git_fd;
+    char *output;
+    size_t length;
+    int pending;       // Queries waiting for a fresh status
+    long long answer_by;
+    int inotify_fd;
+    bool watching;
+    Watch *watches;
+    size_t watch_count;
+    size_t watch_capacity;
+    WalkDir *walk;     // Directories still to be watched
+    size_t walk_count;
+    size_t walk_capacity;
+    bool walked;       // Everything is watched, or watching was given up
+    pid_t lister;      // `git ls-files` listing the ignored directories
+    int lister_fd;
+    char *listing;
+    size_t listing_length;
+    bool listed;
+    char **ignored;    // Relative to the top, sorted
+    size_t ignored_count;
+} helper = { 0 };
+
+// Run git with its output on a non-blocking pipe. Returns the read end, or
+// -1 if it could not be started.
+static int spawn_git(char *const argv[], pid_t *pid) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) return -1;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    int error = posix_spawnp(pid, "git", &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    if (error != 0) {
+        GITSTATUS_DEBUG("Cannot run git %s: %s", argv[1], strerror(error));
+        close(fds[0]);
+        return -1;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    return fds[0];
+}
+
+// Append what the pipe has to the buffer. True once it reached the end.
+static bool read_pipe(int fd, char **buffer, size_t *length) {
+    char chunk[4096];
+    ssize_t n;
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+        char *grown = realloc(*buffer, *length + (size_t)n + 1);
+        if (!grown) continue;
+        memcpy(grown + *length, chunk, (size_t)n);
+        *buffer = grown;
+        *length += (size_t)n;
+        (*buffer)[*length] = '\0';
+    }
+    return !(n < 0 && (errno == EAGAIN || errno == EINTR));
+}
+
+#ifdef __linux__
+#include <sys/inotify.h>
+
+#define TREE_EVENTS (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | \
+                     IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR)
+
+static const Watch *find_watch(int wd) {
+    for (size_t i = 0; i < helper.watch_count; i++) {
+        if (helper.watches[i].wd == wd) return &helper.watches[i];
+    }
+    return NULL;
+}
+
+static bool add_watch(const char *path, bool git_dir) {
+    int wd = inotify_add_watch(helper.inotify_fd, path, TREE_EVENTS);
+    if (wd < 0) {
+        // Out of watches: fall back to running git status on a timer
+        if (errno == ENOSPC) helper.watching = false;
+        GITSTATUS_DEBUG("Cannot watch %s: %s", path, strerror(errno));
+        return false;
+    }
+    if (find_watch(wd)) return true;
+
+    if (helper.watch_count == helper.watch_capacity) {
+        size_t capacity = helper.watch_capacity ? helper.watch_capacity * 2 : 64;
+        Watch *grown = realloc(helper.watches, capacity * sizeof(Watch));
+        if (!grown) return false;
+        helper.watches = grown;
+        helper.watch_capacity = capacity;
+    }
+    helper.watches[helper.watch_count++] = (Watch){ .wd = wd, .path = strdup(path), .git_dir = git_dir };
+    return true;
+}
+
+static void push_walk(const char *path, bool git_dir) {
+    if (helper.walk_count == helper.walk_capacity) {
+        size_t capacity = helper.walk_capacity ? helper.walk_capacity * 2 : 64;
+        WalkDir *grown = realloc(helper.walk, capacity * sizeof(WalkDir));
+        if (!grown) return;
+        helper.walk = grown;
+        helper.walk_capacity = capacity;
+    }
+    char *copy = strdup(path);
+    if (copy) helper.walk[helper.walk_count++] = (WalkDir){ .path = copy, .git_dir = git_dir };
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// The path relative to the top of the work tree, or NULL outside it
+static const char *relative_path(const char *path) {
+    size_t top_len = strlen(helper.top);
+    if (strncmp(path, helper.top, top_len) != 0 || path[top_len] != '/') return NULL;
+    return path + top_len + 1;
+}
+
+// A directory the listing named as ignored
+static bool listed_ignored(const char *path) {
+    const char *rel = relative_path(path);
+    return rel && bsearch(&rel, helper.ignored, helper.ignored_count, sizeof(char *), compare_paths);
+}
+
+// A directory created after the listing: git is asked about it alone
+static bool git_ignores(const char *path) {
+    const char *rel = relative_path(path);
+    if (!rel) return false;
+    if (listed_ignored(path)) return true;
+    char *argv[] = { "git", "check-ignore", "-q", "--", (char *)rel, NULL };
+    pid_t pid;
+    int fd = spawn_git(argv, &pid);
+    if (fd < 0) return false;
+    close(fd);
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Watching was given up: git status runs on a timer instead
+static void stop_watching() {
+    close(helper.inotify_fd);
+    helper.inotify_fd = -1;
+    for (size_t i = 0; i < helper.walk_count; i++) free(helper.walk[i].path);
+    helper.walk_count = 0;
+    helper.walked = true;
+}
+
+// Watch up to GIT_WALK_CHUNK more directories, leaving out the ignored ones
+// and nested `.git` directories
+static void walk_some() {
+    for (int done = 0; done < GIT_WALK_CHUNK && helper.walk_count > 0 && helper.watching; done++) {
+        WalkDir next = helper.walk[--helper.walk_count];
+        DIR *dir = add_watch(next.path, next.git_dir) ? opendir(next.path) : NULL;
+        struct dirent *ent;
+        while (dir && (ent = readdir(dir)) != NULL) {
+            if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0 ||
+                strcmp(ent->d_name, ".git") == 0) {
+                continue;
+            }
+            char child[PATH_MAX];
+            if ((size_t)snprintf(child, sizeof(child), "%s/%s", next.path, ent->d_name) >= sizeof(child)) continue;
+            struct stat st;
+            bool is_dir = ent->d_type == DT_DIR ||
+                          (ent->d_type == DT_UNKNOWN && lstat(child, &st) == 0 && S_ISDIR(st.st_mode));
+            if (is_dir && (next.git_dir || !listed_ignored(child))) push_walk(child, next.git_dir);
+        }
+        if (dir) closedir(dir);
+        free(next.path);
+    }
+
+    if (!helper.watching) {
+        stop_watching();
+        helper.stale = true;
+    } else if (helper.walk_count == 0 && helper.listed && !helper.walked) {
+        GITSTATUS_DEBUG("Watching %zu directories of %s, %zu ignored", helper.watch_count, helper.top,
+                        helper.ignored_count);
+        helper.walked = true;
+        helper.stale = true;
+    }
+}
+
+// The listing is in: the work tree can be walked
+static void read_listing() {
+    if (!read_pipe(helper.lister_fd, &helper.listing, &helper.listing_length)) return;
+    close(helper.lister_fd);
+    helper.lister_fd = -1;
+    int status = 0;
+    waitpid(helper.lister, &status, 0);
+    helper.lister = 0;
+
+    // Ignored directories end in a slash; ignored files are of no interest
+    const char *end = helper.listing + helper.listing_length;
+    for (char *entry = helper.listing; WIFEXITED(status) && WEXITSTATUS(status) == 0 && entry < end;
+         entry += strlen(entry) + 1) {
+        size_t len = strlen(entry);
+        if (len < 2 || entry[len - 1] != '/') continue;
+        char **grown = realloc(helper.ignored, (helper.ignored_count + 1) * sizeof(char *));
+        if (!grown) break;
+        helper.ignored = grown;
+        entry[len - 1] = '\0';
+        if ((helper.ignored[helper.ignored_count] = strdup(entry)) != NULL) helper.ignored_count++;
+    }
+    free(helper.listing);
+    helper.listing = NULL;
+    qsort(helper.ignored, helper.ignored_count, sizeof(char *), compare_paths);
+    helper.listed = true;
+    push_walk(helper.top, false);
+}
+
+// HEAD and the index at once, the refs and then the work tree in chunks
+static void start_watching(const char *top, const char *git_dir) {
+    helper.lister_fd = -1;
+    helper.inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (helper.inotify_fd < 0) {
+        helper.walked = true;
+        return;
+    }
+    helper.watching = true;
+
+    char refs[PATH_MAX];
+    add_watch(git_dir, true);
+    if ((size_t)snprintf(refs, sizeof(refs), "%s/refs", git_dir) < sizeof(refs)) push_walk(refs, true);
+
+    char *argv[] = { "git", "ls-files", "--directory", "-o", "-i", "--exclude-standard", "-z", NULL };
+    helper.lister_fd = spawn_git(argv, &helper.lister);
+    if (helper.lister_fd < 0) {
+        helper.listed = true;
+        push_walk(top, false);
+    }
+}
+
+static void read_events() {
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while ((n = read(helper.inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char *p = buffer; p < buffer + n; ) {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+
+            const Watch *watch = find_watch(event->wd);
+            const char *name = event->len ? event->name : "";
+            size_t name_len = strlen(name);
+            // git takes a lock file for everything it writes
+            if (watch && watch->git_dir && name_len > 5 && strcmp(name + name_len - 5, ".lock") == 0) continue;
+            if (event->mask & IN_IGNORED) continue;
+
+            if (watch && (event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)) &&
+                strcmp(name, ".git") != 0) {
+                char child[PATH_MAX];
+                if ((size_t)snprintf(child, sizeof(child), "%s/%s", watch->path, name) < sizeof(child) &&
+                    (watch->git_dir || !git_ignores(child))) {
+                    push_walk(child, watch->git_dir);
+                }
+            }
+            helper.stale = true;
+        }
+    }
+}
+#else
+static void start_watching(const char *top, const char *git_dir) {
+    (void)top;
+    (void)git_dir;
+    helper.inotify_fd = -1;
+    helper.lister_fd = -1;
+    helper.walked = true;
+}
+
+static void read_events() {
+}
+
+static void walk_some() {
+}
+
+static void read_listing() {
+}
+#endif
+
+// Porcelain v2 with -z: NUL-terminated records, headers first
+static void parse_status() {
+    GitStatus status = { 0 };
+    char oid[16] = "";
+    bool detached = false;
+
+    const char *end = helper.output + helper.length;
+    for (const char *record = helper.output; record < end; record += strlen(record) + 1) {
+        if (strncmp(record, "# branch.oid ", 13) == 0) {
+            snprintf(oid, sizeof(oid), "%.7s", record + 13);
+        } else if (strncmp(record, "# branch.head ", 14) == 0) {
+            detached = strcmp(record + 14, "(detached)") == 0;
+            snprintf(status.branch, sizeof(status.branch), "%s", record + 14);
+        } else if (strncmp(record, "# branch.ab ", 12) == 0) {
+            sscanf(record + 12, "+%d -%d", &status.ahead, &status.behind);
+        } else if ((record[0] == '1' || record[0] == '2') && record[1] == ' ' && strlen(record) > 4) {
+            if (record[2] != '.') status.staged++;
+            if (record[3] != '.') status.unstaged++;
+            // A rename is followed by the path it was renamed from
+            if (record[0] == '2' && record + strlen(record) + 1 < end) record += strlen(record) + 1;
+        } else if (record[0] == 'u' && record[1] == ' ') {
+            status.conflicted++;
+        } else if (record[0] == '?' && record[1] == ' ') {
+            status.untracked++;
+        }
+    }
+    if (detached && oid[0]) snprintf(status.branch, sizeof(status.branch), "%s", oid);
+    helper.status = status;
+}
+
+static void start_git() {
+    // Without optional locks git leaves the index alone, so the run does not
+    // set off the watches itself
+    char *argv[] = { "git", "--no-optional-locks", "status", "--porcelain=v2", "--branch", "-z", NULL };
+    pid_t pid;
+    int fd = spawn_git(argv, &pid);
+    if (fd < 0) {
+        helper.computed = true;
+        helper.known = false;
+        helper.stale = false;
+        helper.computed_ms = now_ms();
+        return;
+    }
+
+    GITSTATUS_DEBUG("Running git status (%d)", pid);
+    helper.git = pid;
+    helper.git_fd = fd;
+    helper.length = 0;
+    helper.stale = false;
+}
+
+static void read_git() {
+    if (!read_pipe(helper.git_fd, &helper.output, &helper.length)) return;
+
+    close(helper.git_fd);
+    helper.git_fd = -1;
+    int status = 0;
+    waitpid(helper.git, &status, 0);
+    helper.git = 0;
+
+    helper.known = WIFEXITED(status) && WEXITSTATUS(status) == 0 && helper.output;
+    if (helper.known) parse_status();
+    helper.computed = true;
+    helper.computed_ms = now_ms();
+}
+
+static bool fresh() {
+    return helper.computed && !helper.stale && helper.git == 0 && helper.walked;
+}
+
+static void reply() {
+    char line[GIT_REPLY_MAX];
+    const GitStatus *s = &helper.status;
+    if (helper.known) {
+        snprintf(line, sizeof(line), "%s\t%d\t%d\t%d\t%d\t%d\t%d\n", s->branch[0] ? s->branch : "-",
+                 s->ahead, s->behind, s->staged, s->unstaged, s->untracked, s->conflicted);
+    } else {
+        snprintf(line, sizeof(line), "-\n");
+    }
+    send(helper.sock, line, strlen(line), MSG_NOSIGNAL);
+}
+
+static void answer_pending() {
+    while (helper.pending > 0) {
+        reply();
+        helper.pending--;
+    }
+}
+
+// A query is the number of milliseconds the shell waits for the answer
+static bool read_queries() {
+    char buffer[256];
+    ssize_t n = recv(helper.sock, buffer, sizeof(buffer) - 1, MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) return false;
+    if (n < 0) return true;
+    buffer[n] = '\0';
+
+    for (char *line = buffer, *newline; (newline = strchr(line, '\n')) != NULL; line = newline + 1) {
+        *newline = '\0';
+        int budget = atoi(line);
+        if (!helper.watching && helper.computed && now_ms() - helper.computed_ms > GIT_STATUS_UNWATCHED_TTL) {
+            helper.stale = true;
+        }
+        if (fresh() || helper.waited) {
+            reply();
+            continue;
+        }
+        long long by = now_ms() + budget;
+        if (helper.pending == 0 || by < helper.answer_by) helper.answer_by = by;
+        helper.pending++;
+    }
+    return true;
+}
+
+static void helper_main(int sock, const char *top, const char *git_dir) {
+    helper.sock = sock;
+    helper.top = top;
+    helper.git_fd = -1;
+    helper.stale = true;
+    if (chdir(top) != 0) _exit(1);
+    start_watching(top, git_dir);
+
+    for (;;) {
+        if (helper.stale && helper.git == 0) start_git();
+
+        struct pollfd fds[4];
+        nfds_t count = 0;
+        fds[count++] = (struct pollfd){ .fd = helper.sock, .events = POLLIN };
+        if (helper.inotify_fd >= 0) fds[count++] = (struct pollfd){ .fd = helper.inotify_fd, .events = POLLIN };
+        if (helper.git_fd >= 0) fds[count++] = (struct pollfd){ .fd = helper.git_fd, .events = POLLIN };
+        if (helper.lister_fd >= 0) fds[count++] = (struct pollfd){ .fd = helper.lister_fd, .events = POLLIN };
+
+        int timeout = -1;
+        if (helper.pending > 0) {
+            long long left = helper.answer_by - now_ms();
+            timeout = left > 0 ? (int)left : 0;
+        }
+        // More of the tree to walk once the socket has been looked at
+        if (helper.walk_count > 0) timeout = 0;
+        if (poll(fds, count, timeout) < 0 && errno != EINTR) break;
+
+        // Changes first: a file written before the query was sent counts
+        if (helper.inotify_fd >= 0) read_events();
+        if (helper.git_fd >= 0) read_git();
+        if (helper.lister_fd >= 0) read_listing();
+        if (!read_queries()) break;
+        if (helper.walk_count > 0) walk_some();
+
+        if (fresh()) {
+            helper.waited = false;
+            answer_pending();
+        } else if (helper.pending > 0 && now_ms() >= helper.answer_by) {
+            helper.waited = true;
+            answer_pending();
+        }
+    }
+
+    if (helper.git > 0) kill(helper.git, SIGKILL);
+    if (helper.lister > 0) kill(helper.lister, SIGKILL);
+    _exit(0);
+}
+
+// ---- The shell's side ----
+
+typedef struct {
+    char *top;
+    pid_t pid;
+    int fd;
+    int outstanding;   // Queries sent and not answered yet
+    char reply[GIT_REPLY_MAX];
+    size_t length;
+    GitStatus status;
+    bool known;
+    long long used_ms;
+} GitHelper;
+
+static struct {
+    GitHelper list[GIT_HELPERS_MAX];
+    size_t count;
+} helpers = { 0 };
+
+static void stop_helper(GitHelper *h) {
+    GITSTATUS_DEBUG("Stopping the helper for %s", h->top);
+    close(h->fd);
+    kill(-h->pid, SIGKILL);
+    waitpid(h->pid, NULL, 0);
+    free(h->top);
+    *h = helpers.list[--helpers.count];
+}
+
+static GitHelper *start_helper(const char *top, const char *git_dir) {
+    if (helpers.count == GIT_HELPERS_MAX) {
+        // Make room by stopping the one asked least recently
+        GitHelper *oldest = &helpers.list[0];
+        for (size_t i = 1; i < helpers.count; i++) {
+            if (helpers.list[i].used_ms < oldest->used_ms) oldest = &helpers.list[i];
+        }
+        stop_helper(oldest);
+    }
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) != 0) return NULL;
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(sv[0]);
+        close(sv[1]);
+        return NULL;
+    }
+    if (pid == 0) {
+        // Out of the terminal's reach, and holding nothing of the shell's open
+        setpgid(0, 0);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+        signal(SIGCHLD, SIG_DFL);
+        long max = sysconf(_SC_OPEN_MAX);
+        if (max < 0 || max > 4096) max = 4096;
+        for (int fd = 3; fd < max; fd++) {
+            if (fd != sv[1]) close(fd);
+        }
+        int null = open("/dev/null", O_RDWR);
+        if (null >= 0) {
+            dup2(null, STDIN_FILENO);
+            dup2(null, STDOUT_FILENO);
+            if (!getenv("NUT_DEBUG_THEME")) dup2(null, STDERR_FILENO);
+            if (null > STDERR_FILENO) close(null);
+        }
+        helper_main(sv[1], top, git_dir);
+    }
+    setpgid(pid, pid);
+    close(sv[1]);
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+
+    GitHelper *h = &helpers.list[helpers.count++];
+    *h = (GitHelper){ .top = strdup(top), .pid = pid, .fd = sv[0] };
+    GITSTATUS_DEBUG("Started helper %d for %s", pid, top);
+    return h;
+}
+
+static void parse_reply(GitHelper *h, char *line) {
+    GitStatus status = { 0 };
+    char *fields[7];
+    int count = 0;
+    for (char *field = line; count < 7; count++) {
+        fields[count] = field;
+        char *tab = strchr(field, '\t');
+        if (!tab) {
+            count++;
+            break;
+        }
+        *tab = '\0';
+        field = tab + 1;
+    }
+    h->known = count == 7;
+    if (!h->known) return;
+
+    snprintf(status.branch, sizeof(status.branch), "%s", strcmp(fields[0], "-") == 0 ? "" : fields[0]);
+    status.ahead = atoi(fields[1]);
+    status.behind = atoi(fields[2]);
+    status.staged = atoi(fields[3]);
+    status.unstaged = atoi(fields[4]);
+    status.untracked = atoi(fields[5]);
+    status.conflicted = atoi(fields[6]);
+    h->status = status;
+}
+
+// Take in whatever replies have arrived. False once the helper is gone.
+static bool read_replies(GitHelper *h) {
+    for (;;) {
+        ssize_t n = read(h->fd, h->reply + h->length, sizeof(h->reply) - 1 - h->length);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+        if (n <= 0) return false;
+        h->length += (size_t)n;
+        h->reply[h->length] = '\0';
+
+        char *line = h->reply, *newline;
+        while ((newline = strchr(line, '\n')) != NULL) {
+            *newline = '\0';
+            parse_reply(h, line);
+            if (h->outstanding > 0) h->outstanding--;
+            line = newline + 1;
+        }
+        h->length -= (size_t)(line - h->reply);
+        memmove(h->reply, line, h->length);
+        // A reply never fills the buffer; if it did, start over
+        if (h->length == sizeof(h->reply) - 1) h->length = 0;
+    }
+}
+
+bool git_status_query(const char *top, const char *git_dir, GitStatus *status) {
+    if (!top || !git_dir) return false;
+
+    GitHelper *h = NULL;
+    for (size_t i = 0; i < helpers.count; i++) {
+        if (strcmp(helpers.list[i].top, top) == 0) h = &helpers.list[i];
+    }
+    if (!h && !(h = start_helper(top, git_dir))) return false;
+    h->used_ms = now_ms();
+
+    int budget = status_timeout();
+    char query[16];
+    int len = snprintf(query, sizeof(query), "%d\n", budget);
+    if (!read_replies(h) || send(h->fd, query, (size_t)len, MSG_NOSIGNAL) != len) {
+        stop_helper(h);
+        return false;
+    }
+    h->outstanding++;
+
+    // An answer from before a missed deadline still counts down on the way
+    long long deadline = now_ms() + budget + GIT_STATUS_SLACK;
+    while (h->outstanding > 0) {
+        long long left = deadline - now_ms();
+        if (left <= 0) {
+            GITSTATUS_DEBUG("No answer for %s in %d ms", top, budget);
+            break;
+        }
+        struct pollfd pfd = { .fd = h->fd, .events = POLLIN };
+        if (poll(&pfd, 1, (int)left) < 0 && errno != EINTR) break;
+        if (!read_replies(h)) {
+            stop_helper(h);
+            return false;
+        }
+    }
+
+    if (!h->known) return false;
+    *status = h->status;
+    return true;
+}
+
+void git_status_stop() {
+    while (helpers.count > 0) {
+        stop_helper(&helpers.list[0]);
+    }
+}
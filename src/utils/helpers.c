@@ -10,6 +10,19 @@
 #include <pwd.h>
 #include <unistd.h>
 
+// Hashing
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t len) {
+    for (const unsigned char *p = data; len-- > 0; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+size_t hash_string(const char *s) {
+    return (size_t)hash_bytes(HASH_INIT, s, strlen(s));
+}
+
 // String utilities
 char *trim_whitespace(char *str) {
     if (!str) return NULL;
@@ -0,0 +1,281 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+#include <nutshell/theme.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Prompt debug macro, shares the theme's switch
+#define PROMPT_DEBUG(fmt, ...) \
+    do { if (getenv("NUT_DEBUG_THEME")) fprintf(stderr, "PROMPT: " fmt "\n", ##__VA_ARGS__); } while(0)
+
+// Theme formats are compiled once into ops: runs of literal text, and
+// placeholders already resolved to the color, segment or command they name.
+// Rendering a prompt is then one pass over the ops into a buffer kept from
+// one prompt to the next. A placeholder that names nothing stays as text.
+
+static const struct {
+    const char *name;
+    size_t offset;
+} colors[] = {
+    { "reset", offsetof(ThemeColors, reset) },
+    { "primary", offsetof(ThemeColors, primary) },
+    { "secondary", offsetof(ThemeColors, secondary) },
+    { "error", offsetof(ThemeColors, error) },
+    { "warning", offsetof(ThemeColors, warning) },
+    { "info", offsetof(ThemeColors, info) },
+    { "success", offsetof(ThemeColors, success) },
+};
+
+#define COLOR_COUNT (int)(sizeof(colors) / sizeof(colors[0]))
+#define COLOR_RESET 0
+
+// The prompt being rendered
+static struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} out = { 0 };
+
+static const char *color_value(const Theme *theme, int index) {
+    return *(char *const *)((const char *)theme->colors + colors[index].offset);
+}
+
+// Whether `name` is the `length` bytes of a placeholder
+static bool names(const char *name, const char *placeholder, size_t length) {
+    return name && strncmp(name, placeholder, length) == 0 && name[length] == '\0';
+}
+
+static int find_color(const char *name, size_t length) {
+    for (int i = 0; i < COLOR_COUNT; i++) {
+        if (names(colors[i].name, name, length)) return i;
+    }
+    return -1;
+}
+
+// What a placeholder in the prompt's format, or in a segment's, stands for
+static bool resolve(const Theme *theme, const ThemeSegment *segment, const char *name, size_t length,
+                    ThemeOp *op) {
+    op->offset = op->length = 0;
+    if (!segment && theme->left_prompt->icon && names("icon", name, length)) {
+        op->type = THEME_OP_ICON;
+        return true;
+    }
+    if (!segment && names("prompt_symbol", name, length)) {
+        op->type = THEME_OP_SYMBOL;
+        return true;
+    }
+    if ((op->index = find_color(name, length)) >= 0) {
+        op->type = THEME_OP_COLOR;
+        return true;
+    }
+
+    if (!segment) {
+        for (int i = 0; i < theme->segment_count; i++) {
+            const ThemeSegment *candidate = theme->segments[i];
+            if (candidate && candidate->enabled && names(candidate->key, name, length)) {
+                op->type = THEME_OP_SEGMENT;
+                op->index = i;
+                return true;
+            }
+        }
+    } else {
+        for (int i = 0; i < segment->command_count; i++) {
+            const ThemeCommand *cmd = segment->commands[i];
+            if (cmd && names(cmd->name, name, length)) {
+                op->type = THEME_OP_OUTPUT;
+                op->index = i;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void add_text(ThemeProgram *program, size_t *used, const char *text, size_t length) {
+    if (length == 0) return;
+    memcpy(program->text + *used, text, length);
+    ThemeOp *last = program->count ? &program->ops[program->count - 1] : NULL;
+    if (last && last->type == THEME_OP_TEXT) {
+        last->length += length;
+    } else {
+        program->ops[program->count++] = (ThemeOp){ .type = THEME_OP_TEXT, .offset = *used, .length = length };
+    }
+    *used += length;
+}
+
+// Compile the prompt's format (segment NULL) or a segment's
+static bool compile_format(const Theme *theme, const ThemeSegment *segment, const char *format,
+                           ThemeProgram *program) {
+    free_theme_program(program);
+    if (!format) format = "";
+
+    // Each brace gives at most a placeholder and the text after it
+    size_t braces = 0;
+    for (const char *p = format; *p; p++) {
+        if (*p == '{') braces++;
+    }
+    program->ops = malloc((2 * braces + 1) * sizeof(ThemeOp));
+    program->text = malloc(strlen(format) + 1);
+    if (!program->ops || !program->text) {
+        free_theme_program(program);
+        return false;
+    }
+
+    size_t used = 0;
+    const char *p = format;
+    while (*p) {
+        const char *open = strchr(p, '{');
+        if (!open) {
+            add_text(program, &used, p, strlen(p));
+            break;
+        }
+        const char *close = strpbrk(open + 1, "{}");
+        if (!close || *close == '{') {
+            add_text(program, &used, p, (size_t)(open + 1 - p));
+            p = open + 1;
+            continue;
+        }
+
+        add_text(program, &used, p, (size_t)(open - p));
+        ThemeOp op;
+        if (resolve(theme, segment, open + 1, (size_t)(close - open - 1), &op)) {
+            program->ops[program->count++] = op;
+        } else {
+            add_text(program, &used, open, (size_t)(close + 1 - open));
+        }
+        p = close + 1;
+    }
+    return true;
+}
+
+void free_theme_program(ThemeProgram *program) {
+    free(program->ops);
+    free(program->text);
+    program->ops = NULL;
+    program->text = NULL;
+    program->count = 0;
+}
+
+bool compile_theme(Theme *theme) {
+    if (!theme) return false;
+    if (theme->compiled) return true;
+
+    for (int i = 0; i < theme->segment_count; i++) {
+        ThemeSegment *segment = theme->segments[i];
+        if (segment && !compile_format(theme, segment, segment->format, &segment->program)) return false;
+    }
+    const char *format = theme->left_prompt->format;
+    if (!compile_format(theme, NULL, format, &theme->left_prompt->program)) return false;
+
+    theme->appends_symbol = !format || !strstr(format, "{prompt_symbol}");
+    const char *symbol_color = theme->prompt_symbol_color;
+    theme->symbol_color = symbol_color ? find_color(symbol_color, strlen(symbol_color)) : -1;
+    if (theme->symbol_color < 0) theme->symbol_color = COLOR_RESET;
+
+    PROMPT_DEBUG("Compiled %s: %zu ops", theme->name ? theme->name : "theme", theme->left_prompt->program.count);
+    theme->compiled = true;
+    return true;
+}
+
+static void emit(const char *text, size_t length) {
+    if (out.length + length + 1 > out.capacity) {
+        size_t capacity = out.capacity ? out.capacity * 2 : 256;
+        while (capacity < out.length + length + 1) capacity *= 2;
+        char *grown = realloc(out.data, capacity);
+        if (!grown) return;
+        out.data = grown;
+        out.capacity = capacity;
+    }
+    memcpy(out.data + out.length, text, length);
+    out.length += length;
+}
+
+static void emit_string(const char *text) {
+    if (text) emit(text, strlen(text));
+}
+
+// A segment none of whose commands has output is left out altogether
+static bool has_output(const ThemeSegment *segment) {
+    for (int i = 0; i < segment->command_count; i++) {
+        if (segment->commands[i] && segment->commands[i]->output) return true;
+    }
+    return false;
+}
+
+static void run(const Theme *theme, const ThemeSegment *segment, const ThemeProgram *program) {
+    for (size_t i = 0; i < program->count; i++) {
+        const ThemeOp *op = &program->ops[i];
+        switch (op->type) {
+        case THEME_OP_TEXT:
+            emit(program->text + op->offset, op->length);
+            break;
+        case THEME_OP_COLOR:
+            emit_string(color_value(theme, op->index));
+            break;
+        case THEME_OP_ICON:
+            emit_string(theme->left_prompt->icon);
+            break;
+        case THEME_OP_SYMBOL:
+            emit_string(theme->prompt_symbol);
+            break;
+        case THEME_OP_SEGMENT: {
+            const ThemeSegment *shown = theme->segments[op->index];
+            if (shown && has_output(shown)) run(theme, shown, &shown->program);
+            break;
+        }
+        case THEME_OP_OUTPUT: {
+            const ThemeCommand *cmd = segment->commands[op->index];
+            if (cmd) emit_string(cmd->output);
+            break;
+        }
+        }
+    }
+}
+
+static char *finish_render() {
+    char *result = malloc(out.length + 1);
+    if (!result) return NULL;
+    if (out.length) memcpy(result, out.data, out.length);
+    result[out.length] = '\0';
+    return result;
+}
+
+// Build the prompt from the segment outputs as they are
+char *render_theme_prompt(Theme *theme) {
+    if (!theme || !compile_theme(theme)) return NULL;
+
+    out.length = 0;
+    run(theme, NULL, &theme->left_prompt->program);
+    if (theme->appends_symbol) {
+        emit_string(color_value(theme, theme->symbol_color));
+        emit_string(theme->prompt_symbol);
+        emit_string(theme->colors->reset);
+        emit(" ", 1);
+    }
+
+    char *prompt = finish_render();
+    PROMPT_DEBUG("Final prompt: %s", prompt ? prompt : "");
+    return prompt;
+}
+
+// Replace placeholders in format string, running the commands of the
+// segments it names
+char *expand_theme_format(Theme *theme, const char *format) {
+    if (!theme || !format || !compile_theme(theme)) return NULL;
+
+    ThemeProgram program = { 0 };
+    if (!compile_format(theme, NULL, format, &program)) return NULL;
+    for (size_t i = 0; i < program.count; i++) {
+        if (program.ops[i].type == THEME_OP_SEGMENT) {
+            execute_segment_commands(theme->segments[program.ops[i].index]);
+        }
+    }
+
+    out.length = 0;
+    run(theme, NULL, &program);
+    free_theme_program(&program);
+    return finish_render();
+}
@@ -0,0 +1,357 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+#include <nutshell/theme.h>
+#include <nutshell/core.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pwd.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Provider debug macro, shares the theme's switch
+#define PROVIDER_DEBUG(fmt, ...) \
+    do { if (getenv("NUT_DEBUG_THEME")) fprintf(stderr, "PROVIDER: " fmt "\n", ##__VA_ARGS__); } while(0)
+
+// Segment values the shell can work out itself. Each one replaces a
+// `/bin/sh -c` pipeline of small tools, so a prompt made only of these starts
+// no process at all. The git providers read the repository's files directly.
+
+static char *directory_provider() {
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) return NULL;
+
+    const char *home = getenv("HOME");
+    size_t home_len = home ? strlen(home) : 0;
+    if (home_len > 1 && strncmp(cwd, home, home_len) == 0 &&
+        (cwd[home_len] == '/' || cwd[home_len] == '\0')) {
+        char *result = malloc(strlen(cwd) - home_len + 2);
+        if (result) sprintf(result, "~%s", cwd + home_len);
+        return result;
+    }
+    return strdup(cwd);
+}
+
+// The repository the working directory is in: its git directory, and the
+// top of its work tree. `.git` is a directory, or in worktrees and
+// submodules a file naming one.
+static bool find_repository(char *git_dir, size_t git_size, char *top, size_t top_size) {
+    char dir[PATH_MAX];
+    if (!getcwd(dir, sizeof(dir))) return false;
+
+    for (;;) {
+        char path[PATH_MAX];
+        struct stat st;
+        if ((size_t)snprintf(path, sizeof(path), "%s/.git", strcmp(dir, "/") == 0 ? "" : dir) < sizeof(path) &&
+            stat(path, &st) == 0) {
+            snprintf(top, top_size, "%s", dir);
+            if (S_ISDIR(st.st_mode)) {
+                snprintf(git_dir, git_size, "%s", path);
+                return true;
+            }
+            char link[PATH_MAX];
+            FILE *fp = fopen(path, "r");
+            bool found = fp && fgets(link, sizeof(link), fp) && strncmp(link, "gitdir: ", 8) == 0;
+            if (fp) fclose(fp);
+            if (!found) return false;
+            link[strcspn(link, "\r\n")] = '\0';
+            if (link[8] == '/') {
+                snprintf(git_dir, git_size, "%s", link + 8);
+            } else {
+                snprintf(git_dir, git_size, "%s/%s", dir, link + 8);
+            }
+            return true;
+        }
+
+        char *slash = strrchr(dir, '/');
+        if (!slash || slash == dir) {
+            if (strcmp(dir, "/") == 0) return false;
+            strcpy(dir, "/");
+        } else {
+            *slash = '\0';
+        }
+    }
+}
+
+static char *git_branch_provider() {
+    char git_dir[PATH_MAX], top[PATH_MAX];
+    if (!find_repository(git_dir, sizeof(git_dir), top, sizeof(top))) return NULL;
+
+    char path[PATH_MAX + 8], head[256];
+    snprintf(path, sizeof(path), "%s/HEAD", git_dir);
+    FILE *fp = fopen(path, "r");
+    if (!fp) return NULL;
+    bool got = fgets(head, sizeof(head), fp) != NULL;
+    fclose(fp);
+    if (!got) return NULL;
+    head[strcspn(head, "\r\n")] = '\0';
+
+    // A branch, or the commit checked out on its own
+    if (strncmp(head, "ref: ", 5) == 0) {
+        const char *ref = head + 5;
+        if (strncmp(ref, "refs/heads/", 11) == 0) ref += 11;
+        return ref[0] ? strdup(ref) : NULL;
+    }
+    return strlen(head) >= 7 ? strndup(head, 7) : NULL;
+}
+
+// Index entries from version 2 and 3 files: the fixed part, then the path
+#define INDEX_ENTRY_FIXED 62
+#define INDEX_FLAG_EXTENDED 0x4000
+#define INDEX_FLAG_VALID 0x8000
+#define INDEX_SKIP_WORKTREE 0x4000
+#define INDEX_GITLINK 0160000
+
+static uint32_t index_word(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return ntohl(value);
+}
+
+static uint16_t index_half(const unsigned char *p) {
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+    return ntohs(value);
+}
+
+// Whether a tracked file changed, going by the stat data git keeps for
+// each entry of the index: its size and modification time, as `git status`
+// checks before it looks at contents. A file touched but not changed counts
+// as changed until git next refreshes the index, and untracked files are
+// not looked at. That is an lstat per tracked file on every prompt, which
+// the git_status helper avoids in large repositories.
+static char *git_dirty_provider() {
+    char git_dir[PATH_MAX], top[PATH_MAX];
+    if (!find_repository(git_dir, sizeof(git_dir), top, sizeof(top))) return NULL;
+
+    char path[PATH_MAX + 8];
+    snprintf(path, sizeof(path), "%s/index", git_dir);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 12) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    const unsigned char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+
+    bool dirty = false;
+    uint32_t version = index_word(data + 4);
+    if (memcmp(data, "DIRC", 4) != 0 || (version != 2 && version != 3)) {
+        // Version 4 compresses paths; leave those to git
+        PROVIDER_DEBUG("Index version %u not read", version);
+        munmap((void *)data, size);
+        return NULL;
+    }
+
+    uint32_t count = index_word(data + 8);
+    size_t offset = 12;
+    for (uint32_t i = 0; i < count && !dirty; i++) {
+        const unsigned char *entry = data + offset;
+        if (offset + INDEX_ENTRY_FIXED > size) break;
+        uint16_t flags = index_half(entry + 60);
+        size_t fixed = INDEX_ENTRY_FIXED;
+        bool skip = (flags & INDEX_FLAG_VALID) != 0;
+        if (flags & INDEX_FLAG_EXTENDED) {
+            if (offset + fixed + 2 > size) break;
+            skip = skip || (index_half(entry + fixed) & INDEX_SKIP_WORKTREE);
+            fixed += 2;
+        }
+        const char *name = (const char *)entry + fixed;
+        size_t name_len = strnlen(name, size - offset - fixed);
+        if (offset + fixed + name_len >= size) break;
+        offset += (fixed + name_len + 8) & ~(size_t)7;
+
+        uint32_t mode = index_word(entry + 24);
+        // A merge in progress
+        if ((flags >> 12) & 3) {
+            dirty = true;
+            break;
+        }
+        if (skip || (mode & 0170000) == INDEX_GITLINK) continue;
+
+        char file[PATH_MAX];
+        struct stat file_st;
+        if ((size_t)snprintf(file, sizeof(file), "%s/%s", top, name) >= sizeof(file)) continue;
+        if (lstat(file, &file_st) != 0) {
+            dirty = true;
+            break;
+        }
+        uint32_t mtime = index_word(entry + 8);
+        uint32_t mtime_ns = index_word(entry + 12);
+        uint32_t file_size = index_word(entry + 36);
+        // git keeps nanoseconds only where it was built to
+        dirty = (uint32_t)file_st.st_mtim.tv_sec != mtime ||
+                (mtime_ns && (uint32_t)file_st.st_mtim.tv_nsec != mtime_ns) ||
+                (uint32_t)file_st.st_size != file_size;
+        if (dirty) PROVIDER_DEBUG("%s changed", name);
+    }
+    munmap((void *)data, size);
+    return dirty ? strdup("*") : NULL;
+}
+
+// The counts come from the repository's git status helper
+static bool git_status(GitStatus *status) {
+    char git_dir[PATH_MAX], top[PATH_MAX];
+    return find_repository(git_dir, sizeof(git_dir), top, sizeof(top)) &&
+           git_status_query(top, git_dir, status);
+}
+
+// A count, only when there is something to count
+static char *count_output(int count) {
+    char *result;
+    if (count <= 0) return NULL;
+    return asprintf(&result, "%d", count) < 0 ? NULL : result;
+}
+
+static char *git_ahead_provider() {
+    GitStatus status;
+    return git_status(&status) ? count_output(status.ahead) : NULL;
+}
+
+static char *git_behind_provider() {
+    GitStatus status;
+    return git_status(&status) ? count_output(status.behind) : NULL;
+}
+
+static char *git_staged_provider() {
+    GitStatus status;
+    return git_status(&status) ? count_output(status.staged) : NULL;
+}
+
+static char *git_unstaged_provider() {
+    GitStatus status;
+    return git_status(&status) ? count_output(status.unstaged) : NULL;
+}
+
+static char *git_untracked_provider() {
+    GitStatus status;
+    return git_status(&status) ? count_output(status.untracked) : NULL;
+}
+
+static char *git_conflicted_provider() {
+    GitStatus status;
+    return git_status(&status) ? count_output(status.conflicted) : NULL;
+}
+
+// All of them at once, e.g. `↑1 ↓2 +3 !4 ?5`; nothing when clean and in sync
+static char *git_status_provider() {
+    GitStatus status;
+    if (!git_status(&status)) return NULL;
+
+    char buffer[128] = "";
+    size_t used = 0;
+    const struct {
+        const char *mark;
+        int count;
+    } parts[] = {
+        { "↑", status.ahead },
+        { "↓", status.behind },
+        { "=", status.conflicted },
+        { "+", status.staged },
+        { "!", status.unstaged },
+        { "?", status.untracked },
+    };
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+        if (parts[i].count <= 0) continue;
+        used += snprintf(buffer + used, sizeof(buffer) - used, "%s%s%d", used ? " " : "", parts[i].mark,
+                         parts[i].count);
+    }
+    return used ? strdup(buffer) : NULL;
+}
+
+static char *venv_provider() {
+    const char *venv = getenv("VIRTUAL_ENV");
+    if (venv && *venv) {
+        const char *slash = strrchr(venv, '/');
+        return strdup(slash && slash[1] ? slash + 1 : venv);
+    }
+    const char *conda = getenv("CONDA_DEFAULT_ENV");
+    return conda && *conda ? strdup(conda) : NULL;
+}
+
+// Shown only when the last command failed
+static char *exit_status_provider() {
+    if (!cmd_history.last_command || cmd_history.exit_status == 0) return NULL;
+    char *result;
+    return asprintf(&result, "%d", cmd_history.exit_status) < 0 ? NULL : result;
+}
+
+static char *duration_provider() {
+    if (!cmd_history.last_command) return NULL;
+    double ms = cmd_history.last_result.wall_ms;
+    char *result;
+    int written;
+    if (ms < 1000) {
+        written = asprintf(&result, "%dms", (int)ms);
+    } else if (ms < 60000) {
+        written = asprintf(&result, "%.1fs", ms / 1000);
+    } else {
+        long seconds = (long)(ms / 1000);
+        written = asprintf(&result, "%ldm%02lds", seconds / 60, seconds % 60);
+    }
+    return written < 0 ? NULL : result;
+}
+
+static char *username_provider() {
+    const char *user = getenv("USER");
+    if (user && *user) return strdup(user);
+    struct passwd *pw = getpwuid(geteuid());
+    return pw ? strdup(pw->pw_name) : NULL;
+}
+
+static char *hostname_provider() {
+    char host[256];
+    if (gethostname(host, sizeof(host)) != 0) return NULL;
+    host[sizeof(host) - 1] = '\0';
+    host[strcspn(host, ".")] = '\0';
+    return strdup(host);
+}
+
+static char *time_provider() {
+    char buffer[16];
+    time_t now = time(NULL);
+    struct tm tm;
+    if (!localtime_r(&now, &tm) || strftime(buffer, sizeof(buffer), "%H:%M:%S", &tm) == 0) return NULL;
+    return strdup(buffer);
+}
+
+static const struct {
+    const char *name;
+    SegmentProvider provide;
+} providers[] = {
+    { "directory", directory_provider },
+    { "git_branch", git_branch_provider },
+    { "git_dirty", git_dirty_provider },
+    { "git_status", git_status_provider },
+    { "git_ahead", git_ahead_provider },
+    { "git_behind", git_behind_provider },
+    { "git_staged", git_staged_provider },
+    { "git_unstaged", git_unstaged_provider },
+    { "git_untracked", git_untracked_provider },
+    { "git_conflicted", git_conflicted_provider },
+    { "venv", venv_provider },
+    { "exit_status", exit_status_provider },
+    { "duration", duration_provider },
+    { "username", username_provider },
+    { "hostname", hostname_provider },
+    { "time", time_provider },
+};
+
+SegmentProvider find_segment_provider(const char *name) {
+    if (!name) return NULL;
+    for (size_t i = 0; i < sizeof(providers) / sizeof(providers[0]); i++) {
+        if (strcmp(providers[i].name, name) == 0) return providers[i].provide;
+    }
+    return NULL;
+}
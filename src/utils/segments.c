@@ -0,0 +1,389 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+#include <nutshell/theme.h>
+#include <nutshell/core.h>
+#include <nutshell/utils.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// Segment debug macro, shares the theme's switch
+#define SEGMENT_DEBUG(fmt, ...) \
+    do { if (getenv("NUT_DEBUG_THEME")) fprintf(stderr, "SEGMENT: " fmt "\n", ##__VA_ARGS__); } while(0)
+
+// Every segment command of a prompt is started at once, each in a process
+// group of its own with its output on a non-blocking pipe, so the prompt
+// waits for the slowest of them instead of all of them in turn. A command
+// that misses its deadline is not killed: the prompt shows its last output
+// and the shell picks up the new one while readline waits for input. The
+// next prompt leaves it running too, rather than starting it over.
+//
+// A command that has to be stopped, because its cache key changed or its
+// theme is going away, gets SIGTERM and is only killed if it has not exited
+// after SEGMENT_STOP_GRACE_MS. git, for one, removes its index.lock on
+// SIGTERM but cannot on SIGKILL. A command that closes its output but keeps
+// running is neither stopped nor waited for: it is reaped once it exits.
+//
+// A command the theme gives a TTL or cache keys is not run again while its
+// output is younger than the TTL and none of its keys changed, so a prompt
+// whose outputs all hold starts no process at all. Commands with a built-in
+// provider are not run at all: the provider is called in their place.
+
+#define SEGMENT_OUTPUT_MAX 4096
+#define SEGMENT_STOP_GRACE_MS 200
+
+// Commands started and not yet collected
+static struct {
+    ThemeCommand **running;
+    size_t count;
+    size_t capacity;
+    pid_t *lingering;    // Done with their output but not exited yet
+    size_t lingering_count;
+    size_t lingering_capacity;
+} segments = { 0 };
+
+static long long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int default_timeout() {
+    const char *env = getenv("NUT_PROMPT_TIMEOUT");
+    if (env && *env) {
+        char *end;
+        long value = strtol(env, &end, 10);
+        if (*end == '\0' && value > 0 && value <= 60000) return (int)value;
+    }
+    return SEGMENT_TIMEOUT_DEFAULT;
+}
+
+static long long deadline_after(int timeout_ms) {
+    if (timeout_ms == 0) timeout_ms = default_timeout();
+    return timeout_ms < 0 ? -1 : now_ms() + timeout_ms;
+}
+
+static bool cacheable(const ThemeCommand *cmd) {
+    return cmd->ttl_ms > 0 || cmd->key_count > 0;
+}
+
+// A relative file key is looked for from the working directory up, the way
+// git finds .git, so `.git/HEAD` holds anywhere inside a repository
+static bool stat_key_file(const char *cwd, const char *file, char *path, size_t size, struct stat *st) {
+    if (file[0] == '/') {
+        snprintf(path, size, "%s", file);
+        return stat(path, st) == 0;
+    }
+    if (file[0] == '~' && file[1] == '/') {
+        const char *home = getenv("HOME");
+        snprintf(path, size, "%s%s", home ? home : "", file + 1);
+        return stat(path, st) == 0;
+    }
+    if (!cwd) return false;
+
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", cwd);
+    for (;;) {
+        if ((size_t)snprintf(path, size, "%s/%s", strcmp(dir, "/") == 0 ? "" : dir, file) < size &&
+            stat(path, st) == 0) {
+            return true;
+        }
+        char *slash = strrchr(dir, '/');
+        if (!slash || slash == dir) {
+            if (strcmp(dir, "/") == 0) return false;
+            strcpy(dir, "/");
+        } else {
+            *slash = '\0';
+        }
+    }
+}
+
+// Everything the command's output depends on, hashed
+static unsigned long long cache_key(const ThemeCommand *cmd) {
+    uint64_t hash = HASH_INIT;
+    char cwd_buffer[PATH_MAX];
+    const char *cwd = getcwd(cwd_buffer, sizeof(cwd_buffer));
+
+    for (int i = 0; i < cmd->key_count; i++) {
+        const char *key = cmd->keys[i];
+        hash = hash_bytes(hash, key, strlen(key) + 1);
+        const char *value = NULL;
+        if (strcmp(key, "cwd") == 0) {
+            value = cwd;
+        } else if (strncmp(key, "env:", 4) == 0) {
+            value = getenv(key + 4);
+        } else if (strncmp(key, "file:", 5) == 0) {
+            char path[PATH_MAX];
+            struct stat st;
+            if (stat_key_file(cwd, key + 5, path, sizeof(path), &st)) {
+                hash = hash_bytes(hash, path, strlen(path) + 1);
+                hash = hash_bytes(hash, &st.st_dev, sizeof(st.st_dev));
+                hash = hash_bytes(hash, &st.st_ino, sizeof(st.st_ino));
+                hash = hash_bytes(hash, &st.st_size, sizeof(st.st_size));
+                hash = hash_bytes(hash, &st.st_mtim, sizeof(st.st_mtim));
+                continue;
+            }
+        } else {
+            SEGMENT_DEBUG("Unknown cache key '%s' for '%s'", key, cmd->name);
+        }
+        // Unset and empty differ
+        if (value) hash = hash_bytes(hash, value, strlen(value) + 1);
+    }
+    return (unsigned long long)hash;
+}
+
+static void forget(ThemeCommand *cmd) {
+    for (size_t i = 0; i < segments.count; i++) {
+        if (segments.running[i] == cmd) {
+            segments.running[i] = segments.running[--segments.count];
+            break;
+        }
+    }
+    if (segments.count == 0) {
+        free(segments.running);
+        segments.running = NULL;
+        segments.capacity = 0;
+    }
+}
+
+// Reap the command, asking its process group to stop first if it is still
+// running
+static void stop(pid_t pid) {
+    if (waitpid(pid, NULL, WNOHANG) != 0) return;
+    kill(-pid, SIGTERM);
+    struct timespec pause = { 0, 10 * 1000000L };
+    for (int waited = 0; waited < SEGMENT_STOP_GRACE_MS; waited += 10) {
+        if (waitpid(pid, NULL, WNOHANG) != 0) return;
+        nanosleep(&pause, NULL);
+    }
+    SEGMENT_DEBUG("Killing pid %d, still running after SIGTERM", (int)pid);
+    kill(-pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+// Reap the commands that have exited since they closed their output
+static void reap_lingering() {
+    for (size_t i = segments.lingering_count; i-- > 0; ) {
+        if (waitpid(segments.lingering[i], NULL, WNOHANG) == 0) continue;
+        segments.lingering[i] = segments.lingering[--segments.lingering_count];
+    }
+}
+
+// The command is done with its output: reap it if it has exited and keep
+// its first line
+static void finish(ThemeCommand *cmd) {
+    close(cmd->fd);
+    cmd->fd = -1;
+    // Whatever it still does with the pipe closed does not hold up the prompt
+    if (waitpid(cmd->pid, NULL, WNOHANG) == 0) {
+        if (segments.lingering_count == segments.lingering_capacity) {
+            size_t capacity = segments.lingering_capacity ? segments.lingering_capacity * 2 : 4;
+            pid_t *grown = realloc(segments.lingering, capacity * sizeof(pid_t));
+            if (grown) {
+                segments.lingering = grown;
+                segments.lingering_capacity = capacity;
+            }
+        }
+        if (segments.lingering_count < segments.lingering_capacity) {
+            segments.lingering[segments.lingering_count++] = cmd->pid;
+        }
+        SEGMENT_DEBUG("'%s' closed its output but is still running", cmd->name);
+    }
+    cmd->pid = 0;
+    if (cacheable(cmd)) cmd->made_ms = now_ms();
+
+    free(cmd->output);
+    cmd->output = NULL;
+    if (cmd->buffer) {
+        cmd->buffer[strcspn(cmd->buffer, "\n")] = '\0';
+        if (cmd->buffer[0]) cmd->output = strdup(cmd->buffer);
+    }
+    free(cmd->buffer);
+    cmd->buffer = NULL;
+    cmd->length = 0;
+    SEGMENT_DEBUG("Command '%s' output: '%s'", cmd->name, cmd->output ? cmd->output : "");
+    forget(cmd);
+}
+
+// Read what the command has written so far. Returns true once it is finished.
+static bool drain(ThemeCommand *cmd) {
+    char chunk[1024];
+    for (;;) {
+        ssize_t n = read(cmd->fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return false;
+        if (n <= 0) break;
+
+        // Only the first line is shown; past the cap the rest is discarded
+        size_t keep = (size_t)n;
+        if (cmd->length + keep > SEGMENT_OUTPUT_MAX) keep = SEGMENT_OUTPUT_MAX - cmd->length;
+        if (keep == 0) continue;
+        char *grown = realloc(cmd->buffer, cmd->length + keep + 1);
+        if (!grown) continue;
+        memcpy(grown + cmd->length, chunk, keep);
+        cmd->buffer = grown;
+        cmd->length += keep;
+        cmd->buffer[cmd->length] = '\0';
+    }
+    finish(cmd);
+    return true;
+}
+
+static void start(ThemeCommand *cmd, int timeout_ms, unsigned long long key) {
+    // Still running from an earlier prompt: what it would print may be out of
+    // date after the command just run
+    segment_command_cancel(cmd);
+    cmd->key_hash = key;
+    cmd->made_ms = 0;
+
+    if (cmd->provider) {
+        free(cmd->output);
+        cmd->output = cmd->provider();
+        if (cacheable(cmd)) cmd->made_ms = now_ms();
+        SEGMENT_DEBUG("Provider '%s' output: '%s'", cmd->name, cmd->output ? cmd->output : "");
+        return;
+    }
+
+    if (segments.count == segments.capacity) {
+        size_t capacity = segments.capacity ? segments.capacity * 2 : 8;
+        ThemeCommand **grown = realloc(segments.running, capacity * sizeof(ThemeCommand *));
+        if (!grown) return;
+        segments.running = grown;
+        segments.capacity = capacity;
+    }
+
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) != 0) return;
+    fcntl(pipe_fds[0], F_SETFL, O_NONBLOCK);
+
+    // Nothing to read from the terminal or to write to it behind the prompt
+    Redirection err = { .type = REDIR_OUTPUT, .fd = STDERR_FILENO, .target = "/dev/null", .next = NULL };
+    Redirection in = { .type = REDIR_INPUT, .fd = STDIN_FILENO, .target = "/dev/null", .next = &err };
+    char *argv[] = { "/bin/sh", "-c", cmd->command, NULL };
+    LaunchSpec spec = {
+        .argv = argv,
+        .use_path = false,
+        .path = "/bin/sh",
+        .redirs = &in,
+        .stdin_fd = -1,
+        .stdout_fd = pipe_fds[1],
+        .pgid = 0,
+        .detach_output = false,
+    };
+    pid_t pid = launch_process(&spec, get_spawn_backend(), NULL);
+    close(pipe_fds[1]);
+    if (pid <= 0) {
+        close(pipe_fds[0]);
+        return;
+    }
+
+    cmd->pid = pid;
+    cmd->fd = pipe_fds[0];
+    cmd->deadline_ms = deadline_after(timeout_ms);
+    segments.running[segments.count++] = cmd;
+    SEGMENT_DEBUG("Started '%s' (pid %d)", cmd->name, (int)pid);
+}
+
+void segment_command_start(ThemeCommand *cmd, int timeout_ms) {
+    if (!cmd || (!cmd->command && !cmd->provider)) return;
+    start(cmd, timeout_ms, cacheable(cmd) ? cache_key(cmd) : 0);
+}
+
+void segment_command_refresh(ThemeCommand *cmd, int timeout_ms) {
+    if (!cmd || (!cmd->command && !cmd->provider)) return;
+    if (!cacheable(cmd)) {
+        // Still at it since an earlier prompt: its last output is shown until
+        // it finishes, instead of starting over and maybe never finishing
+        if (cmd->pid > 0) {
+            cmd->deadline_ms = deadline_after(timeout_ms);
+            return;
+        }
+        start(cmd, timeout_ms, 0);
+        return;
+    }
+
+    unsigned long long key = cache_key(cmd);
+    if (key == cmd->key_hash) {
+        // What it is working on still holds
+        if (cmd->pid > 0) {
+            cmd->deadline_ms = deadline_after(timeout_ms);
+            return;
+        }
+        if (cmd->made_ms && (cmd->ttl_ms <= 0 || now_ms() - cmd->made_ms < cmd->ttl_ms)) {
+            SEGMENT_DEBUG("Reusing the output of '%s'", cmd->name);
+            return;
+        }
+    }
+    start(cmd, timeout_ms, key);
+}
+
+void segment_command_cancel(ThemeCommand *cmd) {
+    if (!cmd || cmd->pid <= 0) return;
+    SEGMENT_DEBUG("Cancelling '%s' (pid %d)", cmd->name, (int)cmd->pid);
+    close(cmd->fd);
+    cmd->fd = -1;
+    stop(cmd->pid);
+    cmd->pid = 0;
+    free(cmd->buffer);
+    cmd->buffer = NULL;
+    cmd->length = 0;
+    forget(cmd);
+}
+
+void segment_commands_wait() {
+    reap_lingering();
+    for (;;) {
+        struct pollfd fds[segments.count ? segments.count : 1];
+        ThemeCommand *waiting[segments.count ? segments.count : 1];
+        size_t count = 0;
+        long long now = now_ms();
+        int timeout = -1;
+        for (size_t i = 0; i < segments.count; i++) {
+            ThemeCommand *cmd = segments.running[i];
+            if (cmd->deadline_ms >= 0) {
+                if (cmd->deadline_ms <= now) continue;
+                int left = (int)(cmd->deadline_ms - now);
+                if (timeout < 0 || left < timeout) timeout = left;
+            }
+            fds[count].fd = cmd->fd;
+            fds[count].events = POLLIN;
+            waiting[count++] = cmd;
+        }
+        if (count == 0) return;
+
+        int ready = poll(fds, count, timeout);
+        if (ready < 0 && errno != EINTR) return;
+        for (size_t i = 0; ready > 0 && i < count; i++) {
+            if (fds[i].revents) drain(waiting[i]);
+        }
+    }
+}
+
+size_t segment_commands_fds(int *fds, size_t max) {
+    size_t count = 0;
+    for (size_t i = 0; i < segments.count && count < max; i++) {
+        fds[count++] = segments.running[i]->fd;
+    }
+    return count;
+}
+
+bool segment_commands_collect() {
+    reap_lingering();
+    bool finished = false;
+    // Going backwards, a finished command only moves one already looked at
+    for (size_t i = segments.count; i-- > 0; ) {
+        if (i < segments.count && drain(segments.running[i])) finished = true;
+    }
+    return finished;
+}
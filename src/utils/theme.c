@@ -20,6 +20,8 @@ Theme *current_theme = NULL;
 
 // Initialize the theme system
 void init_theme_system() {
+    if (current_theme) return;  // Already initialized
+    
     // Try to load the default theme
     current_theme = load_theme("default");
     
@@ -126,6 +128,31 @@ char *str_replace(const char *str, const char *find, const char *replace) {
     return result;
 }
 
+// Read a command's "ttl" (seconds) and cache "keys"
+static void load_command_cache(ThemeCommand *cmd, json_t *cmd_json) {
+    json_t *ttl = json_object_get(cmd_json, "ttl");
+    json_t *keys = json_object_get(cmd_json, "keys");
+    
+    if (ttl && json_is_number(ttl) && json_number_value(ttl) > 0) {
+        double ms = json_number_value(ttl) * 1000;
+        cmd->ttl_ms = ms < 1 ? 1 : ms > 86400000 ? 86400000 : (int)ms;
+    }
+    
+    if (keys && json_is_array(keys) && json_array_size(keys) > 0) {
+        cmd->keys = calloc(json_array_size(keys), sizeof(char *));
+        if (!cmd->keys) return;
+    
+        size_t index;
+        json_t *key;
+        json_array_foreach(keys, index, key) {
+            if (!json_is_string(key)) continue;
+            char *copy = strdup(json_string_value(key));
+            if (copy) cmd->keys[cmd->key_count++] = copy;
+        }
+    }
+    THEME_DEBUG("Command '%s' cached for %d ms on %d keys", cmd->name, cmd->ttl_ms, cmd->key_count);
+}
+
 // Load theme from JSON file
 Theme *load_theme(const char *theme_name) {
     if (!theme_name) {
@@ -340,11 +367,15 @@ Theme *load_theme(const char *theme_name) {
                 
                 json_t *enabled = json_object_get(value, "enabled");
                 json_t *format = json_object_get(value, "format");
+                json_t *timeout = json_object_get(value, "timeout");
                 
                 segment->enabled = enabled ? json_is_true(enabled) : true;
                 segment->format = format && json_is_string(format) ? 
                                 strdup(json_string_value(format)) : 
                                 strdup("");
+                // Milliseconds the prompt waits for the segment's commands
+                segment->timeout_ms = timeout && json_is_integer(timeout) && json_integer_value(timeout) > 0 ?
+                                    (int)json_integer_value(timeout) : 0;
                 
                 // Handle both old and new command formats
                 json_t *command = json_object_get(value, "command");
@@ -360,13 +391,32 @@ Theme *load_theme(const char *theme_name) {
                     int j = 0;
                     
                     json_object_foreach(commands, cmd_key, cmd_value) {
-                        if (cmd_value && json_is_string(cmd_value) && j < segment->command_count) {
+                        // Either the command itself, or an object that also
+                        // says how long its output can be kept, or names a
+                        // built-in provider to use instead
+                        json_t *cmd_text = json_is_object(cmd_value) ?
+                                          json_object_get(cmd_value, "command") : cmd_value;
+                        json_t *provider_name = json_is_object(cmd_value) ?
+                                               json_object_get(cmd_value, "provider") : NULL;
+                        SegmentProvider provider = NULL;
+                        if (provider_name && json_is_string(provider_name)) {
+                            provider = find_segment_provider(json_string_value(provider_name));
+                            if (!provider) {
+                                fprintf(stderr, "Warning: Unknown segment provider '%s' in theme %s\n",
+                                        json_string_value(provider_name), theme_name);
+                            }
+                        }
+                        if ((provider || (cmd_text && json_is_string(cmd_text))) && j < segment->command_count) {
                             ThemeCommand *cmd = calloc(1, sizeof(ThemeCommand));
                             if (!cmd) continue;
                             
                             cmd->name = strdup(cmd_key);
-                            cmd->command = strdup(json_string_value(cmd_value));
+                            cmd->provider = provider;
+                            cmd->command = provider ? NULL : strdup(json_string_value(cmd_text));
                             cmd->output = NULL; // Will be filled when executed
+                            if (json_is_object(cmd_value)) {
+                                load_command_cache(cmd, cmd_value);
+                            }
                             
                             segment->commands[j++] = cmd;
                         }
@@ -418,6 +468,7 @@ Theme *load_theme(const char *theme_name) {
     
     THEME_DEBUG("Theme loaded successfully: %s", theme->name);
     json_decref(root);
+    compile_theme(theme);
     return theme;
 }
 
@@ -439,6 +490,7 @@ void free_theme(Theme *theme) {
     
     free(theme->left_prompt->format);
     free(theme->left_prompt->icon);
+    free_theme_program(&theme->left_prompt->program);
     free(theme->left_prompt);
     
     free(theme->right_prompt->format);
@@ -450,13 +502,19 @@ void free_theme(Theme *theme) {
     for (int i = 0; i < theme->segment_count; i++) {
         free(theme->segments[i]->key);  // Free the segment key
         free(theme->segments[i]->format);
+        free_theme_program(&theme->segments[i]->program);
         
         // Free all commands in the segment
         for (int j = 0; j < theme->segments[i]->command_count; j++) {
             if (theme->segments[i]->commands[j]) {
+                segment_command_cancel(theme->segments[i]->commands[j]);
                 free(theme->segments[i]->commands[j]->name);
                 free(theme->segments[i]->commands[j]->command);
                 free(theme->segments[i]->commands[j]->output);
+                for (int k = 0; k < theme->segments[i]->commands[j]->key_count; k++) {
+                    free(theme->segments[i]->commands[j]->keys[k]);
+                }
+                free(theme->segments[i]->commands[j]->keys);
                 free(theme->segments[i]->commands[j]);
             }
         }
@@ -472,211 +530,36 @@ void free_theme(Theme *theme) {
 void execute_segment_commands(ThemeSegment *segment) {
     if (!segment || !segment->commands) return;
     
+    // All at once, and every one of them waited for
     for (int i = 0; i < segment->command_count; i++) {
-        ThemeCommand *cmd = segment->commands[i];
-        if (!cmd || !cmd->command) continue;
-        
-        // Free any previous output
-        free(cmd->output);
-        cmd->output = NULL;
-        
-        // Execute the command
-        FILE *fp = popen(cmd->command, "r");
-        if (!fp) continue;
-        
-        char buffer[256] = {0};
-        if (fgets(buffer, sizeof(buffer), fp)) {
-            // Remove trailing newline
-            buffer[strcspn(buffer, "\n")] = 0;
-            if (strlen(buffer) > 0) {
-                cmd->output = strdup(buffer);
-                THEME_DEBUG("Command '%s' output: '%s'", cmd->name, cmd->output);
-            }
-        }
-        pclose(fp);
+        segment_command_start(segment->commands[i], -1);
     }
+    segment_commands_wait();
 }
 
 // Get theme prompt
 char *get_theme_prompt(Theme *theme) {
     if (!theme) return NULL;
     
-    THEME_DEBUG("Generating prompt from template: %s", theme->left_prompt->format);
-    
-    // First process the left prompt
-    char *left_prompt = strdup(theme->left_prompt->format);
-    if (!left_prompt) return NULL;
-    
-    // Replace basic placeholders like colors and icon
-    // Replace icon if present
-    if (theme->left_prompt->icon) {
-        char *temp = left_prompt;
-        left_prompt = str_replace(temp, "{icon}", theme->left_prompt->icon);
-        free(temp);
-    }
-    
-    // Replace prompt symbol
-    char *temp = left_prompt;
-    left_prompt = str_replace(temp, "{prompt_symbol}", theme->prompt_symbol);
-    free(temp);
-    
-    // Replace color codes
-    temp = left_prompt;
-    left_prompt = str_replace(temp, "{reset}", theme->colors->reset);
-    free(temp);
-    
-    temp = left_prompt;
-    left_prompt = str_replace(temp, "{primary}", theme->colors->primary);
-    free(temp);
-    
-    temp = left_prompt;
-    left_prompt = str_replace(temp, "{secondary}", theme->colors->secondary);
-    free(temp);
-    
-    temp = left_prompt;
-    left_prompt = str_replace(temp, "{error}", theme->colors->error);
-    free(temp);
-    
-    temp = left_prompt;
-    left_prompt = str_replace(temp, "{warning}", theme->colors->warning);
-    free(temp);
-    
-    temp = left_prompt;
-    left_prompt = str_replace(temp, "{info}", theme->colors->info);
-    free(temp);
+    if (!compile_theme(theme)) return NULL;
     
-    temp = left_prompt;
-    left_prompt = str_replace(temp, "{success}", theme->colors->success);
-    free(temp);
-    
-    // Extract all segment placeholders from the prompt format
-    THEME_DEBUG("Extracting segments from prompt format");
-    
-    // Process all segments in the theme definition
-    for (int i = 0; i < theme->segment_count; i++) {
-        ThemeSegment *segment = theme->segments[i];
-        if (!segment || !segment->enabled || !segment->key) continue;
-        
-        // Create the placeholder from the segment key that was stored during load
-        char placeholder[256];
-        snprintf(placeholder, sizeof(placeholder), "{%s}", segment->key);
-        THEME_DEBUG("Checking for placeholder: %s", placeholder);
-        
-        // Only process if the placeholder exists in the prompt
-        if (strstr(left_prompt, placeholder)) {
-            THEME_DEBUG("Processing segment: %s", segment->key);
-            
-            // Execute all commands for this segment to get live data
-            execute_segment_commands(segment);
-            
-            // Create formatted segment with all replaced values
-            char *formatted_segment = strdup(segment->format);
-            if (!formatted_segment) continue;
-            
-            // Replace color codes first
-            char *temp;
-            temp = formatted_segment;
-            formatted_segment = str_replace(temp, "{primary}", theme->colors->primary);
-            free(temp);
-            
-            temp = formatted_segment;
-            formatted_segment = str_replace(temp, "{secondary}", theme->colors->secondary);
-            free(temp);
-            
-            temp = formatted_segment;
-            formatted_segment = str_replace(temp, "{reset}", theme->colors->reset);
-            free(temp);
-            
-            temp = formatted_segment;
-            formatted_segment = str_replace(temp, "{info}", theme->colors->info);
-            free(temp);
-            
-            temp = formatted_segment;
-            formatted_segment = str_replace(temp, "{warning}", theme->colors->warning);
-            free(temp);
-            
-            temp = formatted_segment;
-            formatted_segment = str_replace(temp, "{error}", theme->colors->error);
-            free(temp);
-            
-            temp = formatted_segment;
-            formatted_segment = str_replace(temp, "{success}", theme->colors->success);
-            free(temp);
-            
-            // Replace command outputs in the segment format
-            bool has_output = false;
-            for (int j = 0; j < segment->command_count; j++) {
-                ThemeCommand *cmd = segment->commands[j];
-                if (!cmd || !cmd->name || !cmd->output) continue;
-                
-                THEME_DEBUG("Command %s output: %s", cmd->name, cmd->output);
-                
-                // Replace {command_name} with its output
-                char cmd_placeholder[256];
-                snprintf(cmd_placeholder, sizeof(cmd_placeholder), "{%s}", cmd->name);
-                
-                temp = formatted_segment;
-                formatted_segment = str_replace(temp, cmd_placeholder, cmd->output);
-                free(temp);
-                
-                has_output = true;
-            }
-            
-            // Only replace in the prompt if there's actual content
-            if (has_output) {
-                THEME_DEBUG("Replacing placeholder %s with: %s", placeholder, formatted_segment);
-                
-                temp = left_prompt;
-                left_prompt = str_replace(temp, placeholder, formatted_segment);
-                free(temp);
-            } else {
-                // Otherwise remove the placeholder
-                temp = left_prompt;
-                left_prompt = str_replace(temp, placeholder, "");
-                free(temp);
-            }
-            
-            free(formatted_segment);
-        }
-    }
-
-    // Append the prompt symbol if it's not already in the format
-    if (!strstr(theme->left_prompt->format, "{prompt_symbol}")) {
-        char *prompt_color = NULL;
-        
-        // Get the color for the prompt symbol
-        if (strcmp(theme->prompt_symbol_color, "primary") == 0) {
-            prompt_color = theme->colors->primary;
-        } else if (strcmp(theme->prompt_symbol_color, "secondary") == 0) {
-            prompt_color = theme->colors->secondary;
-        } else if (strcmp(theme->prompt_symbol_color, "error") == 0) {
-            prompt_color = theme->colors->error;
-        } else if (strcmp(theme->prompt_symbol_color, "warning") == 0) {
-            prompt_color = theme->colors->warning;
-        } else if (strcmp(theme->prompt_symbol_color, "info") == 0) {
-            prompt_color = theme->colors->info;
-        } else if (strcmp(theme->prompt_symbol_color, "success") == 0) {
-            prompt_color = theme->colors->success;
-        } else {
-            prompt_color = theme->colors->reset;
-        }
-        
-        // Create colored prompt symbol
-        char colored_symbol[256];
-        snprintf(colored_symbol, sizeof(colored_symbol), "%s%s%s ", 
-                prompt_color, theme->prompt_symbol, theme->colors->reset);
+    // Start the commands of every segment the prompt shows before waiting
+    // for any of them
+    bool started[theme->segment_count + 1];
+    memset(started, 0, sizeof(started));
+    const ThemeProgram *program = &theme->left_prompt->program;
+    for (size_t i = 0; i < program->count; i++) {
+        if (program->ops[i].type != THEME_OP_SEGMENT || started[program->ops[i].index]) continue;
+        started[program->ops[i].index] = true;
         
-        // Append to the prompt
-        char *final_prompt = malloc(strlen(left_prompt) + strlen(colored_symbol) + 1);
-        if (final_prompt) {
-            sprintf(final_prompt, "%s%s", left_prompt, colored_symbol);
-            free(left_prompt);
-            left_prompt = final_prompt;
+        ThemeSegment *segment = theme->segments[program->ops[i].index];
+        for (int j = 0; j < segment->command_count; j++) {
+            segment_command_refresh(segment->commands[j], segment->timeout_ms);
         }
     }
+    segment_commands_wait();
     
-    THEME_DEBUG("Final prompt: %s", left_prompt);
-    return left_prompt;
+    return render_theme_prompt(theme);
 }
 
 // Get segment output
@@ -687,7 +570,8 @@ char *get_segment_output(Theme *theme, const char *segment_name) {
         ThemeSegment *segment = theme->segments[i];
         // Search through all commands in the segment
         for (int j = 0; j < segment->command_count; j++) {
-            if (segment->commands[j] && strcmp(segment->commands[j]->command, segment_name) == 0) {
+            if (segment->commands[j] && segment->commands[j]->command &&
+                strcmp(segment->commands[j]->command, segment_name) == 0) {
                 FILE *fp = popen(segment->commands[j]->command, "r");
                 if (!fp) return NULL;
                 
@@ -706,129 +590,6 @@ char *get_segment_output(Theme *theme, const char *segment_name) {
     return NULL;
 }
 
-// Replace placeholders in format string
-char *expand_theme_format(Theme *theme, const char *format) {
-    if (!theme || !format) return NULL;
-    
-    char *result = strdup(format);
-    if (!result) return NULL;
-    
-    // Handle NULL parameters safely throughout the function
-    char *temp = NULL;
-    
-    // Replace color codes with safety checks
-    if (result && theme->colors) {
-        if (theme->colors->primary && strstr(result, "{primary}")) {
-            temp = result;
-            result = str_replace(temp, "{primary}", theme->colors->primary);
-            free(temp);
-        }
-        
-        if (theme->colors->secondary && strstr(result, "{secondary}")) {
-            temp = result;
-            result = str_replace(temp, "{secondary}", theme->colors->secondary);
-            free(temp);
-        }
-        
-        if (theme->colors->error && strstr(result, "{error}")) {
-            temp = result;
-            result = str_replace(temp, "{error}", theme->colors->error);
-            free(temp);
-        }
-        
-        if (theme->colors->warning && strstr(result, "{warning}")) {
-            temp = result;
-            result = str_replace(temp, "{warning}", theme->colors->warning);
-            free(temp);
-        }
-        
-        if (theme->colors->info && strstr(result, "{info}")) {
-            temp = result;
-            result = str_replace(temp, "{info}", theme->colors->info);
-            free(temp);
-        }
-        
-        if (theme->colors->success && strstr(result, "{success}")) {
-            temp = result;
-            result = str_replace(temp, "{success}", theme->colors->success);
-            free(temp);
-        }
-        
-        if (theme->colors->reset && strstr(result, "{reset}")) {
-            temp = result;
-            result = str_replace(temp, "{reset}", theme->colors->reset);
-            free(temp);
-        }
-    }
-    
-    // Replace icon placeholder
-    if (result && theme->left_prompt->icon && strstr(result, "{icon}")) {
-        temp = result;
-        result = str_replace(temp, "{icon}", theme->left_prompt->icon);
-        free(temp);
-    }
-    
-    // Replace segment placeholders
-    for (int i = 0; i < theme->segment_count; i++) {
-        ThemeSegment *segment = theme->segments[i];
-        if (!segment || !segment->enabled) continue;
-        
-        // Extract segment name from format
-        char segment_name[64] = {0};
-        
-        if (strncmp(segment->format, "{directory}", 11) == 0) {
-            strcpy(segment_name, "directory");
-        } else if (strncmp(segment->format, "{git_branch}", 12) == 0) {
-            strcpy(segment_name, "git_branch");
-        } else {
-            // Extract name between { and }
-            const char *start = strchr(segment->format, '{');
-            const char *end = strchr(segment->format, '}');
-            if (start && end && end > start) {
-                size_t name_len = end - start - 1;
-                strncpy(segment_name, start + 1, name_len);
-                segment_name[name_len] = '\0';
-            }
-        }
-        
-        // Check if this segment is referenced in the format
-        char placeholder[128];
-        snprintf(placeholder, sizeof(placeholder), "{%s}", segment_name);
-        
-        if (result && strstr(result, placeholder)) {
-            // Use first command as default for backward compatibility
-            char *segment_output = NULL;
-            if (segment->commands && segment->commands[0]) {
-                segment_output = get_segment_output(theme, segment->commands[0]->command);
-            }
-            
-            if (segment_output && strlen(segment_output) > 0) {
-                // Replace placeholders in segment output
-                char *output = strdup(segment->format);
-                temp = output;
-                
-                // Replace the segment value in the format
-                output = str_replace(temp, placeholder, segment_output);
-                free(temp);
-                
-                // Replace the placeholder in the result
-                temp = result;
-                result = str_replace(temp, placeholder, output);
-                free(temp);
-                free(output);
-                free(segment_output);
-            } else {
-                // If no output, remove the placeholder
-                temp = result;
-                result = str_replace(temp, placeholder, "");
-                free(temp);
-            }
-        }
-    }
-    
-    return result;
-}
-
 // Theme command implementation
 int theme_command(int argc, char **argv) {
     if (argc < 2) {
@@ -943,6 +704,7 @@ void cleanup_theme_system() {
         free_theme(current_theme);
         current_theme = NULL;
     }
+    git_status_stop();
 }
 
 // Helper function to convert \u escape sequences to proper ANSI sequences
@@ -42,6 +42,28 @@ void test_ai_command_registration() {
     printf("AI command registration test passed\n");
 }
 
+// The AI module starts again after modules_cleanup()
+void test_ai_module_restart() {
+    printf("Testing AI module restart...\n");
+    
+    init_registry();
+    module_require(MODULE_AI);
+    assert(find_command("ask") != NULL);
+    modules_cleanup();
+    assert(!module_ready(MODULE_AI));
+    
+    free_registry();
+    init_registry();
+    assert(find_command("ask") == NULL);
+    module_require(MODULE_AI);
+    assert(find_command("ask") != NULL);
+    
+    modules_cleanup();
+    free_registry();
+    
+    printf("AI module restart test passed\n");
+}
+
 // Test handling AI commands
 void test_ai_command_handling() {
     printf("Testing AI command handling...\n");
@@ -106,6 +128,7 @@ int main() {
     
     // Run tests
     test_ai_command_registration();
+    test_ai_module_restart();
     test_ai_command_handling();
     test_ai_integration_with_executor();
     
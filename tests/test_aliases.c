@@ -0,0 +1,203 @@
+#include <nutshell/core.h>
+#include <nutshell/config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static char home[] = "/tmp/nutshell_aliases_XXXXXX";
+
+static void write_config(const char *aliases) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/.nutshell/config.json", home);
+    FILE *fp = fopen(path, "w");
+    assert(fp != NULL);
+    fprintf(fp, "{\"aliases\": {%s}}\n", aliases);
+    fclose(fp);
+}
+
+static bool words_are(char **args, const char **expected) {
+    size_t i = 0;
+    for (; expected[i]; i++) {
+        if (!args[i] || strcmp(args[i], expected[i]) != 0) return false;
+    }
+    return args[i] == NULL;
+}
+
+#define WORDS(...) ((const char *[]){ __VA_ARGS__, NULL })
+
+void test_simple_aliases() {
+    printf("Testing simple aliases...\n");
+    
+    ParsedCommand *cmd = parse_cache_acquire("ll /tmp");
+    assert(cmd && words_are(cmd->args, WORDS("ls", "-la", "/tmp")));
+    parse_cache_release(cmd);
+    
+    // Aliases of aliases, and an alias naming itself
+    cmd = parse_cache_acquire("lh /tmp");
+    assert(cmd && words_are(cmd->args, WORDS("ls", "-la", "-h", "/tmp")));
+    parse_cache_release(cmd);
+    cmd = parse_cache_acquire("grep x");
+    assert(cmd && words_are(cmd->args, WORDS("grep", "--color=auto", "x")));
+    parse_cache_release(cmd);
+    
+    // Only command words are expanded, in every stage and list member
+    cmd = parse_cache_acquire("echo ll | ll && ll");
+    assert(cmd && words_are(cmd->args, WORDS("echo", "ll")));
+    assert(words_are(cmd->pipe_next->args, WORDS("ls", "-la")));
+    assert(cmd->connector == CONNECT_AND);
+    assert(words_are(cmd->next->args, WORDS("ls", "-la")));
+    parse_cache_release(cmd);
+    
+    // The typed arguments keep their substitutions and redirections
+    cmd = parse_cache_acquire("quiet $(echo a) 2>&1");
+    assert(cmd && words_are(cmd->args, WORDS("cat", "")));
+    assert(cmd->subs && cmd->subs->arg == 1 && strcmp(cmd->subs->command, "echo a") == 0);
+    assert(cmd->redirs && cmd->redirs->type == REDIR_OUTPUT);
+    assert(strcmp(cmd->redirs->target, "/dev/null") == 0);
+    assert(cmd->redirs->next && cmd->redirs->next->type == REDIR_DUP);
+    parse_cache_release(cmd);
+    
+    printf("Simple alias test passed!\n");
+}
+
+void test_pipeline_and_list_aliases() {
+    printf("Testing pipeline and list aliases...\n");
+    
+    // The typed arguments go to the alias's last stage
+    ParsedCommand *cmd = parse_cache_acquire("count -c | cat");
+    assert(cmd && words_are(cmd->args, WORDS("sort")));
+    assert(words_are(cmd->pipe_next->args, WORDS("uniq", "-c")));
+    assert(words_are(cmd->pipe_next->pipe_next->args, WORDS("cat")));
+    assert(cmd->pipe_next->pipe_next->pipe_next == NULL);
+    parse_cache_release(cmd);
+    
+    cmd = parse_cache_acquire("up /tmp || echo failed &");
+    assert(cmd && words_are(cmd->args, WORDS("cd", "..")));
+    assert(cmd->connector == CONNECT_AND);
+    ParsedCommand *last = cmd->next;
+    assert(words_are(last->args, WORDS("ls", "/tmp")));
+    assert(last->connector == CONNECT_OR);
+    assert(words_are(last->next->args, WORDS("echo", "failed")));
+    assert(last->next->background);
+    parse_cache_release(cmd);
+    
+    // A list cannot be spliced into a pipeline
+    assert(parse_cache_acquire("echo x | up") == NULL);
+    
+    // And the result runs like the line it stands for
+    cmd = parse_cache_acquire("shout hello | cat");
+    assert(cmd != NULL);
+    CommandResult result = execute_command(cmd);
+    assert(result.exit_code == 0);
+    parse_cache_release(cmd);
+    
+    printf("Pipeline and list alias test passed!\n");
+}
+
+void test_alias_cycles() {
+    printf("Testing alias cycles and depth...\n");
+    
+    // A cycle stops at the alias it comes back to
+    ParsedCommand *cmd = parse_cache_acquire("ping 1");
+    assert(cmd && words_are(cmd->args, WORDS("ping", "b", "a", "1")));
+    parse_cache_release(cmd);
+    
+    // A chain of distinct aliases has a depth limit
+    char aliases[4096] = "";
+    size_t len = 0;
+    for (int i = 0; i < 20; i++) {
+        len += snprintf(aliases + len, sizeof(aliases) - len, "%s\"d%d\": \"d%d\"", i ? ", " : "", i, i + 1);
+    }
+    write_config(aliases);
+    reload_directory_config();
+    assert(parse_cache_acquire("d0") == NULL);
+    cmd = parse_cache_acquire("d10");
+    assert(cmd && words_are(cmd->args, WORDS("d20")));
+    parse_cache_release(cmd);
+    
+    printf("Alias cycle test passed!\n");
+}
+
+void test_alias_changes() {
+    printf("Testing alias changes...\n");
+    
+    write_config("\"ll\": \"ls -la\", \"skip\": 5");
+    reload_directory_config();
+    assert(get_alias_command("skip") == NULL);
+    ParsedCommand *cmd = parse_cache_acquire("ll");
+    assert(cmd && words_are(cmd->args, WORDS("ls", "-la")));
+    parse_cache_release(cmd);
+    
+    // Reloading the same aliases keeps everything expanded with them
+    unsigned long generation = config_alias_generation();
+    reload_directory_config();
+    assert(config_alias_generation() == generation);
+    
+    // Changing one is seen by the next command
+    add_config_alias("ll", "ls -l");
+    assert(config_alias_generation() != generation);
+    cmd = parse_cache_acquire("ll");
+    assert(cmd && words_are(cmd->args, WORDS("ls", "-l")));
+    parse_cache_release(cmd);
+    remove_config_alias("ll");
+    cmd = parse_cache_acquire("ll");
+    assert(cmd && words_are(cmd->args, WORDS("ll")));
+    parse_cache_release(cmd);
+    
+    // Lookups stay hashed with many aliases
+    static char aliases[32768];
+    size_t len = 0;
+    for (int i = 0; i < 500; i++) {
+        len += snprintf(aliases + len, sizeof(aliases) - len, "%s\"a%d\": \"echo %d\"", i ? ", " : "", i, i);
+    }
+    write_config(aliases);
+    reload_directory_config();
+    assert(global_config->alias_count == 500);
+    assert(strcmp(get_alias_command("a0"), "echo 0") == 0);
+    assert(strcmp(get_alias_command("a499"), "echo 499") == 0);
+    assert(get_alias_command("a500") == NULL);
+    
+    printf("Alias change test passed!\n");
+}
+
+int main() {
+    printf("Running alias tests...\n");
+    
+    assert(mkdtemp(home) != NULL);
+    char *old_home = strdup(getenv("HOME"));
+    setenv("HOME", home, 1);
+    char dir[512];
+    snprintf(dir, sizeof(dir), "%s/.nutshell", home);
+    assert(mkdir(dir, 0755) == 0);
+    // The working directory could have a .nutshell.json of its own
+    assert(chdir(home) == 0);
+    
+    write_config("\"ll\": \"ls -la\", \"lh\": \"ll -h\", \"grep\": \"grep --color=auto\", "
+                 "\"quiet\": \"cat >/dev/null\", \"count\": \"sort | uniq\", "
+                 "\"up\": \"cd .. && ls\", \"shout\": \"echo\", "
+                 "\"ping\": \"pong a\", \"pong\": \"ping b\"");
+    init_registry_core();
+    module_require(MODULE_CONFIG);
+    
+    test_simple_aliases();
+    test_pipeline_and_list_aliases();
+    test_alias_cycles();
+    test_alias_changes();
+    
+    parse_cache_free();
+    alias_cache_free();
+    modules_cleanup();
+    free_registry();
+    
+    char command[600];
+    snprintf(command, sizeof(command), "rm -rf %s", home);
+    assert(system(command) == 0);
+    setenv("HOME", old_home, 1);
+    free(old_home);
+    
+    printf("All alias tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include <nutshell/core.h>
+#include <nutshell/utils.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+static char *read_file(const char *path) {
+    static char buf[256];
+    FILE *f = fopen(path, "r");
+    assert(f != NULL);
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    buf[n] = '\0';
+    fclose(f);
+    return buf;
+}
+
+void test_run_string() {
+    printf("Testing -c command strings...\n");
+
+    char out[] = "/tmp/nutshell_batch_out_XXXXXX";
+    int fd = mkstemp(out);
+    assert(fd != -1);
+    close(fd);
+
+    // The status is the one of the last command that ran
+    assert(shell_run_string("true") == 0);
+    assert(shell_run_string("false") == 1);
+    assert(shell_run_string("false; true") == 0);
+    assert(shell_run_string("true && false") == 1);
+
+    // Lines run in order; blank lines and comments are skipped
+    char text[256];
+    snprintf(text, sizeof(text), "echo one > %s\n\n# comment\ncat %s | wc -l > %s.n", out, out, out);
+    assert(shell_run_string(text) == 0);
+    char count_path[64];
+    snprintf(count_path, sizeof(count_path), "%s.n", out);
+    assert(atoi(read_file(count_path)) == 1);
+
+    // Syntax errors fail with 2
+    assert(shell_run_string("true &&") == 2);
+
+    unlink(count_path);
+    unlink(out);
+    printf("-c test passed!\n");
+}
+
+void test_run_file() {
+    printf("Testing script files...\n");
+
+    char script[] = "/tmp/nutshell_batch_script_XXXXXX";
+    int fd = mkstemp(script);
+    assert(fd != -1);
+    dprintf(fd, "#!/usr/bin/env nutshell\n"
+                "echo running\n"
+                "  # indented comment\n"
+                "test 1 -eq 2\n");
+    close(fd);
+
+    assert(shell_run_file(script) == 1);
+    assert(shell_run_file("/nonexistent/script.nut") == 127);
+    
+    // Here-documents keep their blank lines and # lines
+    char out[] = "/tmp/nutshell_batch_out_XXXXXX";
+    int out_fd = mkstemp(out);
+    assert(out_fd != -1);
+    close(out_fd);
+    fd = open(script, O_WRONLY | O_TRUNC);
+    assert(fd != -1);
+    dprintf(fd, "cat <<EOF >%s\n"
+                "# kept\n"
+                "\n"
+                "EOF\n"
+                "echo done >>%s\n", out, out);
+    close(fd);
+    assert(shell_run_file(script) == 0);
+    assert(strcmp(read_file(out), "# kept\n\ndone\n") == 0);
+    
+    // A missing delimiter is an error
+    assert(shell_run_string("cat <<EOF\nnever ends") == 2);
+    
+    unlink(out);
+
+    unlink(script);
+    printf("Script file test passed!\n");
+}
+
+int main() {
+    printf("Running batch mode tests...\n");
+
+    test_run_string();
+    test_run_file();
+
+    printf("All batch mode tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,190 @@
+#include <nutshell/core.h>
+#include <nutshell/utils.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+// Run a builtin with its output captured through a pipe; returns the status
+// and stores what it wrote in out
+static int run_captured(char **argv, char *out, size_t size) {
+    int argc = 0;
+    while (argv[argc]) argc++;
+
+    const Builtin *builtin = find_builtin(argv[0]);
+    assert(builtin != NULL);
+
+    int fds[2];
+    assert(pipe(fds) == 0);
+    int status = builtin->run(argc, argv, STDIN_FILENO, fds[1], fds[1]);
+    close(fds[1]);
+
+    ssize_t n = read(fds[0], out, size - 1);
+    out[n > 0 ? n : 0] = '\0';
+    close(fds[0]);
+    return status;
+}
+
+// Parse and run one command line
+static int run_line(const char *text) {
+    char line[256];
+    snprintf(line, sizeof(line), "%s", text);
+    ParsedCommand *cmd = parse_command(line);
+    assert(cmd != NULL);
+    CommandResult result = execute_command(cmd);
+    free_parsed_command(cmd);
+    return result.exit_code;
+}
+
+void test_lookup() {
+    printf("Testing builtin lookup...\n");
+
+    assert(find_builtin("echo") != NULL);
+    assert(find_builtin("[") != NULL);
+    assert(find_builtin("wait") != NULL);
+    assert(find_builtin("ls") == NULL);
+    assert(find_builtin("") == NULL);
+    assert(find_builtin(NULL) == NULL);
+    assert(!find_builtin("pwd")->uses_stdio);
+    assert(find_builtin("jobs")->uses_stdio);
+
+    printf("Builtin lookup test passed!\n");
+}
+
+void test_echo_and_printf() {
+    printf("Testing echo and printf...\n");
+    char out[256];
+
+    char *echo[] = { "echo", "hello", "world", NULL };
+    assert(run_captured(echo, out, sizeof(out)) == 0);
+    assert(strcmp(out, "hello world\n") == 0);
+
+    char *echo_n[] = { "echo", "-n", "a", NULL };
+    run_captured(echo_n, out, sizeof(out));
+    assert(strcmp(out, "a") == 0);
+
+    char *echo_e[] = { "echo", "-e", "a\\tb\\c", "ignored", NULL };
+    run_captured(echo_e, out, sizeof(out));
+    assert(strcmp(out, "a\tb") == 0);
+
+    // Unknown options are printed as arguments
+    char *echo_opt[] = { "echo", "-x", NULL };
+    run_captured(echo_opt, out, sizeof(out));
+    assert(strcmp(out, "-x\n") == 0);
+
+    char *fmt[] = { "printf", "%s=%d|%5s|%-3s|%x\\n", "n", "42", "ab", "c", "255", NULL };
+    assert(run_captured(fmt, out, sizeof(out)) == 0);
+    assert(strcmp(out, "n=42|   ab|c  |ff\n") == 0);
+
+    // The format is reused for leftover arguments
+    char *reuse[] = { "printf", "<%s>", "a", "b", "c", NULL };
+    run_captured(reuse, out, sizeof(out));
+    assert(strcmp(out, "<a><b><c>") == 0);
+
+    char *bad_number[] = { "printf", "%d", "x", NULL };
+    assert(run_captured(bad_number, out, sizeof(out)) == 1);
+
+    printf("echo/printf test passed!\n");
+}
+
+void test_test_builtin() {
+    printf("Testing test and [...\n");
+    char out[256];
+
+    char *lt[] = { "test", "3", "-lt", "10", NULL };
+    assert(run_captured(lt, out, sizeof(out)) == 0);
+    char *str_ne[] = { "[", "a", "!=", "a", "]", NULL };
+    assert(run_captured(str_ne, out, sizeof(out)) == 1);
+    char *dir[] = { "[", "-d", "/", "]", NULL };
+    assert(run_captured(dir, out, sizeof(out)) == 0);
+    char *not_file[] = { "test", "!", "-f", "/", NULL };
+    assert(run_captured(not_file, out, sizeof(out)) == 0);
+    char *empty[] = { "test", "-z", "", NULL };
+    assert(run_captured(empty, out, sizeof(out)) == 0);
+    char *and[] = { "test", "a", "=", "a", "-a", "-n", "x", NULL };
+    assert(run_captured(and, out, sizeof(out)) == 0);
+    char *none[] = { "test", NULL };
+    assert(run_captured(none, out, sizeof(out)) == 1);
+
+    // Malformed expressions return 2
+    char *bad_int[] = { "test", "1", "-eq", "x", NULL };
+    assert(run_captured(bad_int, out, sizeof(out)) == 2);
+    char *unclosed[] = { "[", "a", NULL };
+    assert(run_captured(unclosed, out, sizeof(out)) == 2);
+
+    printf("test/[ test passed!\n");
+}
+
+void test_environment_builtins() {
+    printf("Testing pwd, cd and export...\n");
+    char out[4096];
+    char cwd[4096];
+    assert(getcwd(cwd, sizeof(cwd)));
+
+    char *pwd[] = { "pwd", NULL };
+    assert(run_captured(pwd, out, sizeof(out)) == 0);
+    assert(strncmp(out, cwd, strlen(cwd)) == 0);
+
+    char *export[] = { "export", "NUT_TEST_EXPORT=value", NULL };
+    assert(run_captured(export, out, sizeof(out)) == 0);
+    assert(strcmp(getenv("NUT_TEST_EXPORT"), "value") == 0);
+    char *bad_export[] = { "export", "1bad=x", NULL };
+    assert(run_captured(bad_export, out, sizeof(out)) == 1);
+
+    assert(run_line("cd /") == 0);
+    assert(run_captured(pwd, out, sizeof(out)) == 0);
+    assert(strcmp(out, "/\n") == 0);
+    assert(run_line("cd /nonexistent-dir") == 1);
+    assert(chdir(cwd) == 0);
+
+    printf("Environment builtin test passed!\n");
+}
+
+void test_in_process_redirection() {
+    printf("Testing builtin redirection...\n");
+
+    char path[] = "/tmp/nutshell_builtin_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    close(fd);
+
+    char line[256];
+    snprintf(line, sizeof(line), "echo redirected > %s", path);
+    assert(run_line(line) == 0);
+
+    char buf[64] = { 0 };
+    FILE *f = fopen(path, "r");
+    assert(f != NULL);
+    assert(fgets(buf, sizeof(buf), f) != NULL);
+    fclose(f);
+    assert(strcmp(buf, "redirected\n") == 0);
+
+    // Builtins set the status seen by the rest of a command list
+    assert(run_line("false") == 1);
+    assert(run_line("true && false || true") == 0);
+
+    // An unwritable target fails the builtin without running it
+    assert(run_line("echo lost > /nonexistent-dir/out") == 1);
+
+    unlink(path);
+    printf("Builtin redirection test passed!\n");
+}
+
+int main() {
+    printf("Running builtin tests...\n");
+
+    init_registry();
+
+    test_lookup();
+    test_echo_and_printf();
+    test_test_builtin();
+    test_environment_builtins();
+    test_in_process_redirection();
+
+    free_registry();
+
+    printf("All builtin tests passed!\n");
+    return 0;
+}
@@ -80,6 +80,29 @@ static void test_init_cleanup() {
     printf("Config initialization and cleanup test passed!\n");
 }
 
+// Test on-demand startup through the module framework
+static void test_module_require() {
+    printf("Testing on-demand config module...\n");
+    
+    assert(!module_ready(MODULE_CONFIG));
+    module_require(MODULE_CONFIG);
+    assert(module_ready(MODULE_CONFIG));
+    Config *first = global_config;
+    assert(first != NULL);
+    
+    // Requiring it again does not reload anything
+    module_require(MODULE_CONFIG);
+    assert(global_config == first);
+    init_config_system();
+    assert(global_config == first);
+    
+    modules_cleanup();
+    assert(!module_ready(MODULE_CONFIG));
+    assert(global_config == NULL);
+    
+    printf("On-demand config module test passed!\n");
+}
+
 // Test loading configuration from a file
 static void test_load_config() {
     printf("Testing config loading...\n");
@@ -315,6 +338,7 @@ int main() {
     
     // Run tests
     test_init_cleanup();
+    test_module_require();
     test_load_config();
     test_save_config();
     
@@ -9,6 +9,7 @@
 #include <assert.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <libgen.h>
 
 // Helper function to create a test directory structure with configs
@@ -248,6 +249,73 @@ static void test_directory_config_loading() {
     printf("Directory config loading test passed!\n");
 }
 
+// Write a directory config with the given theme, last modified at `when`
+static void write_aged_config(const char *dir, const char *theme, time_t when) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/.nutshell.json", dir);
+    FILE *fp = fopen(path, "w");
+    assert(fp != NULL);
+    fprintf(fp, "{\"theme\": \"%s\"}\n", theme);
+    fclose(fp);
+    struct timespec times[2] = { { when, 0 }, { when, 0 } };
+    assert(utimensat(AT_FDCWD, path, times, 0) == 0);
+}
+
+// Test that directories already visited reuse their resolved config
+static void test_directory_config_cache() {
+    printf("Testing directory config cache...\n");
+    
+    char root[] = "/tmp/nutshell_dircache_XXXXXX";
+    assert(mkdtemp(root) != NULL);
+    char *old_home = strdup(getenv("HOME"));
+    setenv("HOME", root, 1);
+    char cwd[1024], outer[512], inner[512];
+    assert(getcwd(cwd, sizeof(cwd)) != NULL);
+    snprintf(outer, sizeof(outer), "%s/outer", root);
+    snprintf(inner, sizeof(inner), "%s/outer/inner", root);
+    assert(mkdir(outer, 0755) == 0);
+    assert(mkdir(inner, 0755) == 0);
+    write_aged_config(outer, "first", 1000000000);
+    
+    chdir(inner);
+    init_config_system();
+    assert(strcmp(global_config->theme, "first") == 0);
+    
+    // Unchanged files are not read again: an edit that keeps the size and
+    // modification time goes unnoticed
+    write_aged_config(outer, "other", 1000000000);
+    reload_directory_config();
+    assert(strcmp(global_config->theme, "first") == 0);
+    
+    // A new modification time is noticed
+    write_aged_config(outer, "other", 1000000100);
+    reload_directory_config();
+    assert(strcmp(global_config->theme, "other") == 0);
+    
+    // So is a config created closer to the directory
+    write_aged_config(inner, "inner", 1000000000);
+    reload_directory_config();
+    assert(strcmp(global_config->theme, "inner") == 0);
+    
+    // Moving between directories
+    chdir(outer);
+    reload_directory_config();
+    assert(strcmp(global_config->theme, "other") == 0);
+    chdir(inner);
+    reload_directory_config();
+    assert(strcmp(global_config->theme, "inner") == 0);
+    
+    cleanup_config_system();
+    chdir(cwd);
+    char command[600];
+    snprintf(command, sizeof(command), "rm -rf %s", root);
+    assert(system(command) == 0);
+    setenv("HOME", old_home, 1);
+    free(old_home);
+    
+    printf("Directory config cache test passed!\n");
+}
+
 int main() {
     printf("Running directory config tests...\n");
     
@@ -260,6 +328,7 @@ int main() {
     
     // Run tests
     test_directory_config_loading();
+    test_directory_config_cache();
     
     printf("All directory config tests passed!\n");
     return 0;
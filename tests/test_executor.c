@@ -0,0 +1,391 @@
+#include <nutshell/core.h>
+#include <nutshell/utils.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Read a whole (small) file into a static buffer
+static const char *read_file(const char *path) {
+    static char buffer[4096];
+    buffer[0] = '\0';
+    FILE *fp = fopen(path, "r");
+    if (!fp) return buffer;
+    size_t n = fread(buffer, 1, sizeof(buffer) - 1, fp);
+    buffer[n] = '\0';
+    fclose(fp);
+    return buffer;
+}
+
+void test_pipeline_execution() {
+    printf("Testing pipeline execution...\n");
+    
+    char output_path[] = "/tmp/nutshell_exec_test_XXXXXX";
+    int fd = mkstemp(output_path);
+    assert(fd != -1);
+    close(fd);
+    
+    char line[256];
+    snprintf(line, sizeof(line), "printf 'a\\nb\\nc\\n' | grep -v b | wc -l > %s", output_path);
+    ParsedCommand *cmd = parse_command(line);
+    assert(cmd != NULL);
+    execute_command(cmd);
+    free_parsed_command(cmd);
+    
+    assert(atoi(read_file(output_path)) == 2);
+    
+    size_t count = 0;
+    const int *statuses = get_pipeline_status(&count);
+    assert(count == 3);
+    assert(statuses[0] == 0 && statuses[1] == 0 && statuses[2] == 0);
+    
+    unlink(output_path);
+    printf("Pipeline execution test passed!\n");
+}
+
+void test_pipeline_stage_status() {
+    printf("Testing per-stage pipeline exit statuses...\n");
+    
+    char line[] = "false | nutshell_no_such_command | true";
+    ParsedCommand *cmd = parse_command(line);
+    assert(cmd != NULL);
+    execute_command(cmd);
+    free_parsed_command(cmd);
+    
+    size_t count = 0;
+    const int *statuses = get_pipeline_status(&count);
+    assert(count == 3);
+    assert(statuses[0] == 1);
+    assert(statuses[1] == 127);
+    assert(statuses[2] == 0);
+    
+    printf("Pipeline stage status test passed!\n");
+}
+
+// Parse and run one command line
+static CommandResult run_line(const char *text) {
+    char line[256];
+    snprintf(line, sizeof(line), "%s", text);
+    ParsedCommand *cmd = parse_command(line);
+    assert(cmd != NULL);
+    CommandResult result = execute_command(cmd);
+    free_parsed_command(cmd);
+    return result;
+}
+
+void test_command_result() {
+    printf("Testing command results and $? expansion...\n");
+    
+    CommandResult result = run_line("true");
+    assert(result.exit_code == 0 && result.signal == 0);
+    assert(result.wall_ms > 0);
+    assert(result.max_rss_kb > 0);
+    
+    result = run_line("false");
+    assert(result.exit_code == 1);
+    assert(get_last_result()->exit_code == 1);
+    
+    result = run_line("nutshell_no_such_command");
+    assert(result.exit_code == 127);
+    
+    // A child killed by a signal reports 128 + signo
+    char script[] = "/tmp/nutshell_signal_XXXXXX";
+    int fd = mkstemp(script);
+    assert(fd != -1);
+    dprintf(fd, "#!/bin/sh\nkill -9 $$\n");
+    close(fd);
+    chmod(script, 0755);
+    result = run_line(script);
+    assert(result.exit_code == 128 + 9);
+    assert(result.signal == 9);
+    unlink(script);
+    
+    // $? expands to the previous status at execution time
+    char output_path[] = "/tmp/nutshell_exec_test_XXXXXX";
+    fd = mkstemp(output_path);
+    assert(fd != -1);
+    close(fd);
+    run_line("false");
+    char line[256];
+    snprintf(line, sizeof(line), "echo status=$? > %s", output_path);
+    result = run_line(line);
+    assert(result.exit_code == 0);
+    assert(strcmp(read_file(output_path), "status=1\n") == 0);
+    
+    // Only outside single quotes
+    run_line("false");
+    snprintf(line, sizeof(line), "echo '$?' \"$?\" a$?b \\$? > %s", output_path);
+    result = run_line(line);
+    assert(strcmp(read_file(output_path), "$? 1 a1b $?\n") == 0);
+    unlink(output_path);
+    
+    // The status of a pipeline is the status of its last stage
+    result = run_line("true | false");
+    assert(result.exit_code == 1);
+    
+    printf("Command result test passed!\n");
+}
+
+void test_command_list() {
+    printf("Testing command lists...\n");
+    
+    char output_path[] = "/tmp/nutshell_exec_test_XXXXXX";
+    int fd = mkstemp(output_path);
+    assert(fd != -1);
+    close(fd);
+    
+    char line[512];
+    snprintf(line, sizeof(line),
+             "false && echo and > %1$s ; false || echo or > %1$s", output_path);
+    CommandResult result = run_line(line);
+    assert(result.exit_code == 0);
+    assert(strcmp(read_file(output_path), "or\n") == 0);
+    
+    // A skipped command keeps the previous status for the next connector
+    snprintf(line, sizeof(line), "false && echo skipped > %1$s || echo fallback=$? > %1$s",
+             output_path);
+    run_line(line);
+    assert(strcmp(read_file(output_path), "fallback=1\n") == 0);
+    
+    // The list's status is that of the last command that ran
+    result = run_line("true && false");
+    assert(result.exit_code == 1);
+    result = run_line("true || false");
+    assert(result.exit_code == 0);
+    
+    unlink(output_path);
+    printf("Command list test passed!\n");
+}
+
+// Write a tiny executable script that prints its own location
+static void write_script(const char *dir, const char *name) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *fp = fopen(path, "w");
+    assert(fp != NULL);
+    fprintf(fp, "#!/bin/sh\necho %s\n", dir);
+    fclose(fp);
+    chmod(path, 0755);
+}
+
+void test_path_cache() {
+    printf("Testing PATH lookup cache...\n");
+    
+    char first[] = "/tmp/nutshell_path_a_XXXXXX";
+    char second[] = "/tmp/nutshell_path_b_XXXXXX";
+    assert(mkdtemp(first) && mkdtemp(second));
+    
+    char *saved_path = strdup(getenv("PATH"));
+    char path_env[256];
+    snprintf(path_env, sizeof(path_env), "%s:%s", first, second);
+    setenv("PATH", path_env, 1);
+    
+    char expected[512];
+    write_script(second, "nutcmd");
+    snprintf(expected, sizeof(expected), "%s/nutcmd", second);
+    assert(strcmp(path_cache_lookup("nutcmd"), expected) == 0);
+    assert(strcmp(path_cache_lookup("nutcmd"), expected) == 0);
+    assert(path_cache_lookup("nutshell_no_such_command") == NULL);
+    assert(path_cache_lookup("./nutcmd") == NULL);
+    
+    // A new executable earlier in PATH changes that directory's mtime
+    write_script(first, "nutcmd");
+    snprintf(expected, sizeof(expected), "%s/nutcmd", first);
+    assert(strcmp(path_cache_lookup("nutcmd"), expected) == 0);
+    
+    // Commands run through the cached location
+    char output_path[] = "/tmp/nutshell_exec_test_XXXXXX";
+    int fd = mkstemp(output_path);
+    assert(fd != -1);
+    close(fd);
+    char line[256];
+    snprintf(line, sizeof(line), "nutcmd > %s", output_path);
+    ParsedCommand *cmd = parse_command(line);
+    execute_command(cmd);
+    free_parsed_command(cmd);
+    assert(strncmp(read_file(output_path), first, strlen(first)) == 0);
+    
+    // Changing PATH itself drops everything that was remembered
+    setenv("PATH", second, 1);
+    snprintf(expected, sizeof(expected), "%s/nutcmd", second);
+    assert(strcmp(path_cache_lookup("nutcmd"), expected) == 0);
+    
+    setenv("PATH", saved_path, 1);
+    free(saved_path);
+    path_cache_free();
+    
+    snprintf(expected, sizeof(expected), "%s/nutcmd", first);
+    unlink(expected);
+    snprintf(expected, sizeof(expected), "%s/nutcmd", second);
+    unlink(expected);
+    rmdir(first);
+    rmdir(second);
+    unlink(output_path);
+    printf("PATH lookup cache test passed!\n");
+}
+
+// Run a line built from a format that mentions the output file twice at most
+static CommandResult run_with_file(const char *format, const char *path) {
+    char line[512];
+    snprintf(line, sizeof(line), format, path, path);
+    ParsedCommand *cmd = parse_command(line);
+    assert(cmd != NULL);
+    CommandResult result = execute_command(cmd);
+    free_parsed_command(cmd);
+    return result;
+}
+
+void test_redirections() {
+    printf("Testing redirections...\n");
+    
+    char path[] = "/tmp/nutshell_redir_test_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    close(fd);
+    
+    // External commands with both launch backends, builtins in-process
+    SpawnBackend backends[] = { SPAWN_BACKEND_SPAWN, SPAWN_BACKEND_FORK };
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        set_spawn_backend(backends[i]);
+        
+        run_with_file("sh -c 'echo out; echo err >&2' >%s 2>&1", path);
+        assert(strcmp(read_file(path), "out\nerr\n") == 0);
+        run_with_file("sh -c 'echo more' >>%s", path);
+        assert(strcmp(read_file(path), "out\nerr\nmore\n") == 0);
+        
+        // Order matters: stderr still goes where stdout pointed before
+        run_with_file("sh -c 'echo err >&2' 2>&1 >%s 2>/dev/null", path);
+        assert(strcmp(read_file(path), "") == 0);
+        run_with_file("sh -c 'echo x; echo y >&2' &>%s", path);
+        assert(strcmp(read_file(path), "x\ny\n") == 0);
+        run_with_file("sh -c 'echo z >&3' 3>%s", path);
+        assert(strcmp(read_file(path), "z\n") == 0);
+        
+        run_with_file("tr a-z A-Z <<<'here string' >%s", path);
+        assert(strcmp(read_file(path), "HERE STRING\n") == 0);
+        run_with_file("cat <<EOF >%s\nfirst\n\nthird\nEOF", path);
+        assert(strcmp(read_file(path), "first\n\nthird\n") == 0);
+        // Bodies are literal, as with a quoted delimiter
+        run_with_file("cat <<EOF >%s\n$? $(echo no)\nEOF", path);
+        assert(strcmp(read_file(path), "$? $(echo no)\n") == 0);
+        run_with_file("cat <<<piped | tr a-z A-Z >%s", path);
+        assert(strcmp(read_file(path), "PIPED\n") == 0);
+        
+        CommandResult result = run_with_file("cat </nonexistent/nutshell >%s", path);
+        assert(result.exit_code == 1);
+    }
+    set_spawn_backend(SPAWN_BACKEND_SPAWN);
+    
+    // Builtins
+    run_with_file("echo one >%s; echo two 2>/dev/null >>%s", path);
+    assert(strcmp(read_file(path), "one\ntwo\n") == 0);
+    run_with_file("echo to-stderr 2>%s 1>&2", path);
+    assert(strcmp(read_file(path), "to-stderr\n") == 0);
+    run_with_file("test -z x 2>%s <<<ignored", path);
+    assert(strcmp(read_file(path), "") == 0);
+    CommandResult result = run_with_file("echo lost >&- 2>%s", path);
+    assert(result.exit_code != 0);
+    
+    // Terminal control commands get their own redirections and arguments
+    if (system("command -v tput >/dev/null 2>&1") == 0) {
+        run_with_file("tput -T dumb cols >%s", path);
+        assert(atoi(read_file(path)) > 0);
+        // One argument, never read again by a shell
+        result = run_with_file("tput -T dumb 'x y;echo injected' >%s 2>&1", path);
+        assert(result.exit_code != 0);
+        assert(strstr(read_file(path), "'x y;echo injected'") != NULL);
+    }
+    
+    unlink(path);
+    printf("Redirection test passed!\n");
+}
+
+void test_command_substitution() {
+    printf("Testing command substitution...\n");
+    
+    char path[] = "/tmp/nutshell_subst_test_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    close(fd);
+    
+    // Unquoted output is split into words, quoted output is kept whole
+    run_with_file("printf '[%%s]' $(printf 'a  b\\nc\\n\\n') \"$(echo 'x  y')\" >%s", path);
+    assert(strcmp(read_file(path), "[a][b][c][x  y]") == 0);
+    run_with_file("echo pre$(echo mid)post `echo tick` >%s", path);
+    assert(strcmp(read_file(path), "premidpost tick\n") == 0);
+    run_with_file("echo $(echo $(echo nested) | tr a-z A-Z) >%s", path);
+    assert(strcmp(read_file(path), "NESTED\n") == 0);
+    
+    // Nothing left to run: the status is the substitution's
+    CommandResult result = run_with_file("$(false) 2>%s", path);
+    assert(result.exit_code == 1);
+    run_with_file("echo [$(true)] >%s", path);
+    assert(strcmp(read_file(path), "[]\n") == 0);
+    
+    // Builtins that change the shell run in a subshell
+    char cwd[4096];
+    assert(getcwd(cwd, sizeof(cwd)) != NULL);
+    run_with_file("echo $(cd / && pwd) \"$(exit 7)\" >%s", path);
+    assert(strcmp(read_file(path), "/ \n") == 0);
+    char after[4096];
+    assert(getcwd(after, sizeof(after)) != NULL);
+    assert(strcmp(cwd, after) == 0);
+    result = run_with_file("$(exit 4) 2>%s", path);
+    assert(result.exit_code == 4);
+    
+    unlink(path);
+    printf("Command substitution test passed!\n");
+}
+
+void test_command_templates() {
+    printf("Testing manifest command templates...\n");
+    
+    char path[] = "/tmp/nutshell_template_test_XXXXXX";
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    close(fd);
+    
+    // Placeholders take the arguments they name, the rest are dropped
+    char *picked[] = { "printf", "[%s]", "$2", "$1", "$3", NULL };
+    assert(register_template("/tmp/tplpkg/picked", "picked", picked) == REGISTER_ADDED);
+    run_with_file("picked one two >%s", path);
+    assert(strcmp(read_file(path), "[two][one]") == 0);
+    
+    // $@ takes them all; without placeholders they follow the template
+    char *all[] = { "printf", "<%s>", "$@", "end", NULL };
+    char *plain[] = { "printf", "(%s)", NULL };
+    assert(register_template("/tmp/tplpkg/all", "all", all) == REGISTER_ADDED);
+    assert(register_template("/tmp/tplpkg/plain", "plain", plain) == REGISTER_ADDED);
+    run_with_file("all 'a b' c >%s", path);
+    assert(strcmp(read_file(path), "<a b><c><end>") == 0);
+    run_with_file("plain x y >%s", path);
+    assert(strcmp(read_file(path), "(x)(y)") == 0);
+    
+    assert(unregister_command("/tmp/tplpkg/picked"));
+    assert(unregister_command("/tmp/tplpkg/all"));
+    assert(unregister_command("/tmp/tplpkg/plain"));
+    unlink(path);
+    printf("Manifest command template test passed!\n");
+}
+
+int main() {
+    printf("Running executor tests...\n");
+    
+    init_registry();
+    
+    test_pipeline_execution();
+    test_pipeline_stage_status();
+    test_path_cache();
+    test_command_result();
+    test_command_list();
+    test_redirections();
+    test_command_substitution();
+    test_command_templates();
+    
+    free_registry();
+    
+    printf("All executor tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include <nutshell/core.h>
+#include <nutshell/utils.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+extern int wait_command(int argc, char **argv);
+extern int fg_command(int argc, char **argv);
+extern int bg_command(int argc, char **argv);
+extern int jobs_command(int argc, char **argv);
+
+// Parse and run one command line
+static void run_line(const char *text) {
+    char line[256];
+    snprintf(line, sizeof(line), "%s", text);
+    ParsedCommand *cmd = parse_command(line);
+    assert(cmd != NULL);
+    execute_command(cmd);
+    free_parsed_command(cmd);
+}
+
+// Script that stops itself and exits with 4 once continued
+static void write_stopping_script(char *path) {
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    dprintf(fd, "#!/bin/sh\nkill -STOP $$\nexit 4\n");
+    close(fd);
+    chmod(path, 0755);
+}
+
+void test_background_and_wait() {
+    printf("Testing background jobs and wait...\n");
+    
+    run_line("sleep 0.2 &");
+    assert(jobs_active_count() == 1);
+    assert(get_last_result()->exit_code == 0);
+    
+    char *wait_all[] = { "wait", NULL };
+    assert(wait_command(1, wait_all) == 0);
+    assert(jobs_active_count() == 0);
+    
+    // wait %n reports the job's own status
+    run_line("false &");
+    run_line("sleep 0.1 | true &");
+    assert(jobs_active_count() == 2);
+    char *wait_first[] = { "wait", "%1", NULL };
+    assert(wait_command(2, wait_first) == 1);
+    char *wait_second[] = { "wait", "%2", NULL };
+    assert(wait_command(2, wait_second) == 0);
+    assert(jobs_active_count() == 0);
+    
+    char *wait_missing[] = { "wait", "%7", NULL };
+    assert(wait_command(2, wait_missing) == 127);
+    
+    printf("Background job test passed!\n");
+}
+
+void test_reaping() {
+    printf("Testing job reaping...\n");
+    
+    run_line("true &");
+    usleep(200000);
+    jobs_reap();
+    // Finished jobs stay listed until they have been reported once
+    assert(jobs_active_count() == 1);
+    char *jobs_args[] = { "jobs", NULL };
+    assert(jobs_command(1, jobs_args) == 0);
+    assert(jobs_active_count() == 0);
+    
+    printf("Job reaping test passed!\n");
+}
+
+void test_fg_and_bg() {
+    printf("Testing fg and bg...\n");
+    
+    char script[] = "/tmp/nutshell_jobs_XXXXXX";
+    write_stopping_script(script);
+    
+    // bg continues the stopped job; wait then collects its status
+    run_line(script);
+    assert(get_last_result()->stopped);
+    assert(jobs_active_count() == 1);
+    char *bg_args[] = { "bg", NULL };
+    assert(bg_command(1, bg_args) == 0);
+    char *wait_args[] = { "wait", "%1", NULL };
+    assert(wait_command(2, wait_args) == 4);
+    assert(jobs_active_count() == 0);
+    
+    // fg continues it and waits in one step
+    run_line(script);
+    assert(jobs_active_count() == 1);
+    char *fg_args[] = { "fg", "%1", NULL };
+    assert(fg_command(2, fg_args) == 4);
+    assert(jobs_active_count() == 0);
+    
+    char *fg_none[] = { "fg", NULL };
+    assert(fg_command(1, fg_none) == 1);
+    
+    unlink(script);
+    printf("fg/bg test passed!\n");
+}
+
+int main() {
+    printf("Running job control tests...\n");
+    
+    init_registry();
+    jobs_init();
+    
+    test_background_and_wait();
+    test_reaping();
+    test_fg_and_bg();
+    
+    jobs_free();
+    free_registry();
+    
+    printf("All job control tests passed!\n");
+    return 0;
+}
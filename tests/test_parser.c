@@ -21,8 +21,7 @@ void test_basic_parsing() {
     assert(cmd->args[2] != NULL);
     assert(strcmp(cmd->args[2], "world") == 0);
     assert(cmd->args[3] == NULL);
-    assert(cmd->input_file == NULL);
-    assert(cmd->output_file == NULL);
+    assert(cmd->redirs == NULL);
     assert(cmd->background == 0);
     
     free_parsed_command(cmd);
@@ -42,13 +41,352 @@ void test_redirection() {
     assert(cmd->args[1] != NULL);
     assert(strcmp(cmd->args[1], "file.txt") == 0);
     assert(cmd->args[2] == NULL);
-    assert(cmd->output_file != NULL);
-    assert(strcmp(cmd->output_file, "output.txt") == 0);
+    assert(cmd->redirs != NULL);
+    assert(cmd->redirs->type == REDIR_OUTPUT && cmd->redirs->fd == 1);
+    assert(strcmp(cmd->redirs->target, "output.txt") == 0);
+    assert(cmd->redirs->next == NULL);
     
     free_parsed_command(cmd);
+    
+    // Redirections are kept in the order written
+    cmd = parse_command("make >>build.log 2>&1 <&- 3<in 4>| out 5>&-");
+    assert(cmd != NULL);
+    assert(strcmp(cmd->args[0], "make") == 0 && cmd->args[1] == NULL);
+    Redirection *r = cmd->redirs;
+    assert(r->type == REDIR_APPEND && r->fd == 1 && strcmp(r->target, "build.log") == 0);
+    r = r->next;
+    assert(r->type == REDIR_DUP && r->fd == 2 && r->source_fd == 1);
+    r = r->next;
+    assert(r->type == REDIR_CLOSE && r->fd == 0);
+    r = r->next;
+    assert(r->type == REDIR_INPUT && r->fd == 3 && strcmp(r->target, "in") == 0);
+    r = r->next;
+    assert(r->type == REDIR_OUTPUT && r->fd == 4 && strcmp(r->target, "out") == 0);
+    r = r->next;
+    assert(r->type == REDIR_CLOSE && r->fd == 5 && r->next == NULL);
+    free_parsed_command(cmd);
+    
+    // &> and >&file send both stdout and stderr to the file
+    cmd = parse_command("cc &>log; cc >&log2");
+    assert(cmd->redirs->type == REDIR_OUTPUT && cmd->redirs->fd == 1);
+    assert(cmd->redirs->next->type == REDIR_DUP && cmd->redirs->next->fd == 2);
+    assert(strcmp(cmd->next->redirs->target, "log2") == 0);
+    assert(cmd->next->redirs->next->source_fd == 1);
+    free_parsed_command(cmd);
+    
+    // A number only names a descriptor right before the operator
+    cmd = parse_command("echo 2 >x a2>y");
+    assert(strcmp(cmd->args[1], "2") == 0 && strcmp(cmd->args[2], "a2") == 0);
+    assert(cmd->redirs->fd == 1 && cmd->redirs->next->fd == 1);
+    free_parsed_command(cmd);
+    
+    assert(parse_command("cat <&file") == NULL);
+    assert(parse_command("cat 2>&") == NULL);
     printf("Redirection test passed!\n");
 }
 
+void test_here_documents() {
+    printf("Testing here-documents...\n");
+    
+    ParsedCommand *cmd = parse_command("tr a-z A-Z <<<'hello world'");
+    assert(cmd != NULL);
+    assert(cmd->redirs->type == REDIR_HERE && cmd->redirs->fd == 0);
+    assert(strcmp(cmd->redirs->target, "hello world\n") == 0);
+    free_parsed_command(cmd);
+    
+    // Bodies follow the command line, in the order the operators appear
+    cmd = parse_command("cat <<EOF 3<<-'END' | wc -l\none\n\n  two\nEOF\n\tthree\n\tEND\necho after");
+    assert(cmd != NULL);
+    assert(strcmp(cmd->redirs->target, "one\n\n  two\n") == 0);
+    assert(cmd->redirs->next->fd == 3);
+    assert(strcmp(cmd->redirs->next->target, "three\n") == 0);
+    assert(strcmp(cmd->pipe_next->args[0], "wc") == 0);
+    assert(strcmp(cmd->next->args[0], "echo") == 0);
+    assert(parse_pending_heredoc() == NULL);
+    free_parsed_command(cmd);
+    
+    // Until the delimiter arrives the input is incomplete, not wrong
+    assert(parse_command("cat <<EOF") == NULL);
+    assert(strcmp(parse_pending_heredoc(), "EOF") == 0);
+    assert(parse_command("cat <<EOF\nbody") == NULL);
+    assert(strcmp(parse_pending_heredoc(), "EOF") == 0);
+    assert(parse_command("cat <<") == NULL);
+    assert(parse_pending_heredoc() == NULL);
+    
+    cmd = parse_command("cat <<EOF\nEOF");
+    assert(cmd != NULL && strcmp(cmd->redirs->target, "") == 0);
+    free_parsed_command(cmd);
+    
+    printf("Here-document test passed!\n");
+}
+
+void test_command_substitution() {
+    printf("Testing command substitution parsing...\n");
+    
+    ParsedCommand *cmd = parse_command("echo pre$(date +%s)post \"$(echo \"a b\")\" `ls \\`pwd\\``");
+    assert(cmd != NULL);
+    // The command text is cut out of the word it sits in
+    assert(strcmp(cmd->args[1], "prepost") == 0);
+    assert(strcmp(cmd->args[2], "") == 0);
+    assert(strcmp(cmd->args[3], "") == 0);
+    
+    Substitution *sub = cmd->subs;
+    assert(sub->arg == 1 && sub->offset == 3 && !sub->quoted);
+    assert(strcmp(sub->command, "date +%s") == 0);
+    sub = sub->next;
+    assert(sub->arg == 2 && sub->offset == 0 && sub->quoted);
+    assert(strcmp(sub->command, "echo \"a b\"") == 0);
+    sub = sub->next;
+    assert(sub->arg == 3 && !sub->quoted);
+    assert(strcmp(sub->command, "ls `pwd`") == 0);
+    assert(sub->next == NULL);
+    free_parsed_command(cmd);
+    
+    // Parentheses inside quotes or nested substitutions do not end it
+    cmd = parse_command("echo $(echo ')' $(echo \"(\")) | wc -c");
+    assert(cmd != NULL);
+    assert(strcmp(cmd->subs->command, "echo ')' $(echo \"(\")") == 0);
+    assert(cmd->pipe_next != NULL);
+    free_parsed_command(cmd);
+    
+    // Single quotes keep it literal
+    cmd = parse_command("echo '$(ls)'");
+    assert(cmd != NULL && cmd->subs == NULL);
+    assert(strcmp(cmd->args[1], "$(ls)") == 0);
+    free_parsed_command(cmd);
+    
+    assert(parse_command("echo $(ls") == NULL);
+    assert(parse_command("echo `ls") == NULL);
+    assert(parse_command("cat >$(echo file)") == NULL);
+    
+    printf("Command substitution parsing test passed!\n");
+}
+
+void test_pipeline() {
+    printf("Testing pipeline parsing...\n");
+    
+    char test_cmd[] = "cat file.txt | grep foo | wc -l > count.txt &";
+    ParsedCommand *cmd = parse_command(test_cmd);
+    
+    assert(cmd != NULL);
+    assert(strcmp(cmd->args[0], "cat") == 0);
+    assert(strcmp(cmd->args[1], "file.txt") == 0);
+    assert(cmd->args[2] == NULL);
+    assert(cmd->background);
+    
+    ParsedCommand *grep = cmd->pipe_next;
+    assert(grep != NULL);
+    assert(strcmp(grep->args[0], "grep") == 0);
+    assert(strcmp(grep->args[1], "foo") == 0);
+    
+    ParsedCommand *wc = grep->pipe_next;
+    assert(wc != NULL);
+    assert(strcmp(wc->args[0], "wc") == 0);
+    assert(wc->redirs != NULL);
+    assert(strcmp(wc->redirs->target, "count.txt") == 0);
+    assert(wc->pipe_next == NULL);
+    
+    free_parsed_command(cmd);
+    
+    // Empty stages are syntax errors
+    char missing_stage[] = "ls |";
+    assert(parse_command(missing_stage) == NULL);
+    char leading_pipe[] = "| ls";
+    assert(parse_command(leading_pipe) == NULL);
+    
+    printf("Pipeline test passed!\n");
+}
+
+void test_command_list() {
+    printf("Testing command list parsing...\n");
+    
+    char test_cmd[] = "cd /tmp && ls | wc -l || echo failed; sleep 1 & echo done;";
+    ParsedCommand *cmd = parse_command(test_cmd);
+    
+    assert(cmd != NULL);
+    assert(strcmp(cmd->args[0], "cd") == 0);
+    assert(cmd->pipe_next == NULL);
+    assert(cmd->connector == CONNECT_AND);
+    
+    ParsedCommand *ls = cmd->next;
+    assert(strcmp(ls->args[0], "ls") == 0);
+    assert(strcmp(ls->pipe_next->args[0], "wc") == 0);
+    assert(ls->connector == CONNECT_OR);
+    
+    ParsedCommand *echo = ls->next;
+    assert(strcmp(echo->args[0], "echo") == 0);
+    assert(strcmp(echo->args[1], "failed") == 0);
+    assert(echo->args[2] == NULL);
+    assert(echo->connector == CONNECT_SEQ);
+    
+    ParsedCommand *background = echo->next;
+    assert(strcmp(background->args[0], "sleep") == 0);
+    assert(background->background);
+    assert(background->connector == CONNECT_SEQ);
+    
+    ParsedCommand *done = background->next;
+    assert(strcmp(done->args[0], "echo") == 0);
+    assert(strcmp(done->args[1], "done") == 0);
+    assert(!done->background);
+    assert(done->next == NULL);
+    
+    free_parsed_command(cmd);
+    
+    char missing_right[] = "ls &&";
+    assert(parse_command(missing_right) == NULL);
+    char missing_left[] = "|| ls";
+    assert(parse_command(missing_left) == NULL);
+    char double_separator[] = "ls ; ; ls";
+    assert(parse_command(double_separator) == NULL);
+    
+    printf("Command list test passed!\n");
+}
+
+void test_quoting() {
+    printf("Testing quotes and escapes...\n");
+    
+    char test_cmd[] = "echo 'a  b' \"c \\\"d\\\" $x\" e\\ f g'h'\"i\" '' \"it's\"";
+    ParsedCommand *cmd = parse_command(test_cmd);
+    assert(cmd != NULL);
+    assert(strcmp(cmd->args[1], "a  b") == 0);
+    assert(strcmp(cmd->args[2], "c \"d\" $x") == 0);
+    assert(strcmp(cmd->args[3], "e f") == 0);
+    assert(strcmp(cmd->args[4], "ghi") == 0);
+    assert(strcmp(cmd->args[5], "") == 0);
+    assert(strcmp(cmd->args[6], "it's") == 0);
+    assert(cmd->args[7] == NULL);
+    free_parsed_command(cmd);
+    
+    // Quoted operators are plain words
+    char quoted_ops[] = "echo '|' \"&&\" \\; '>' out";
+    cmd = parse_command(quoted_ops);
+    assert(cmd != NULL);
+    assert(strcmp(cmd->args[1], "|") == 0);
+    assert(strcmp(cmd->args[2], "&&") == 0);
+    assert(strcmp(cmd->args[3], ";") == 0);
+    assert(strcmp(cmd->args[4], ">") == 0);
+    assert(cmd->redirs == NULL && cmd->pipe_next == NULL && cmd->next == NULL);
+    free_parsed_command(cmd);
+    
+    // Operators do not need spaces around them, and comments are dropped
+    char tight[] = "cat<in|sort>'out file';ls # a comment | ignored";
+    cmd = parse_command(tight);
+    assert(cmd != NULL);
+    assert(cmd->redirs->type == REDIR_INPUT && strcmp(cmd->redirs->target, "in") == 0);
+    assert(strcmp(cmd->pipe_next->args[0], "sort") == 0);
+    assert(strcmp(cmd->pipe_next->redirs->target, "out file") == 0);
+    assert(strcmp(cmd->next->args[0], "ls") == 0);
+    assert(cmd->next->args[1] == NULL);
+    assert(cmd->next->pipe_next == NULL);
+    free_parsed_command(cmd);
+    
+    // The input is left untouched
+    char original[] = "echo \"x\" ; ls";
+    cmd = parse_command(original);
+    assert(strcmp(original, "echo \"x\" ; ls") == 0);
+    free_parsed_command(cmd);
+    
+    char unterminated[] = "echo 'oops";
+    assert(parse_command(unterminated) == NULL);
+    char unterminated_double[] = "echo \"oops";
+    assert(parse_command(unterminated_double) == NULL);
+    char missing_file[] = "ls >";
+    assert(parse_command(missing_file) == NULL);
+    char only_comment[] = "   # nothing";
+    assert(parse_command(only_comment) == NULL);
+    
+    printf("Quoting test passed!\n");
+}
+
+void test_many_arguments() {
+    printf("Testing long argument lists...\n");
+    
+    // Well past the old 64-argument limit
+    size_t count = 5000;
+    char *line = malloc(count * 8 + 8);
+    assert(line != NULL);
+    char *p = line + sprintf(line, "echo");
+    for (size_t i = 1; i < count; i++) {
+        p += sprintf(p, " a%zu", i);
+    }
+    
+    ParsedCommand *cmd = parse_command(line);
+    assert(cmd != NULL);
+    size_t argc = 0;
+    while (cmd->args[argc]) argc++;
+    assert(argc == count);
+    assert(strcmp(cmd->args[count - 1], "a4999") == 0);
+    free_parsed_command(cmd);
+    free(line);
+    
+    printf("Long argument list test passed!\n");
+}
+
+void test_parse_cache() {
+    printf("Testing the parse cache...\n");
+    
+    parse_cache_set_capacity(2);
+    ParseCacheStats before = parse_cache_stats();
+    
+    // The same line comes back as the same resolved command
+    ParsedCommand *first = parse_cache_acquire("echo cached");
+    assert(first != NULL && first->resolved);
+    assert(first->builtin == find_builtin("echo"));
+    parse_cache_release(first);
+    ParsedCommand *again = parse_cache_acquire("echo cached");
+    assert(again == first);
+    parse_cache_release(again);
+    
+    ParseCacheStats stats = parse_cache_stats();
+    assert(stats.hits == before.hits + 1);
+    assert(stats.misses == before.misses + 1);
+    assert(stats.entries == 1);
+    
+    // Syntax errors are not cached
+    assert(parse_cache_acquire("echo |") == NULL);
+    
+    // The least recently used line makes room for new ones
+    parse_cache_release(parse_cache_acquire("pwd"));
+    parse_cache_release(parse_cache_acquire("true"));
+    stats = parse_cache_stats();
+    assert(stats.entries == 2);
+    assert(stats.evictions == before.evictions + 1);
+    
+    // A line still in use survives being dropped from the cache
+    ParsedCommand *held = parse_cache_acquire("true");
+    parse_cache_clear();
+    assert(strcmp(held->args[0], "true") == 0);
+    parse_cache_release(held);
+    
+    // Changing PATH or the registry starts over
+    parse_cache_release(parse_cache_acquire("pwd"));
+    char *path = strdup(getenv("PATH"));
+    setenv("PATH", "/nonexistent", 1);
+    parse_cache_release(parse_cache_acquire("true"));
+    setenv("PATH", path, 1);
+    free(path);
+    stats = parse_cache_stats();
+    assert(stats.invalidations == before.invalidations + 1);
+    assert(stats.entries == 1);
+    
+    register_command("ls", "peek", false);
+    ParsedCommand *peek = parse_cache_acquire("peek -l");
+    assert(peek->mapping != NULL && strcmp(peek->mapping->unix_cmd, "ls") == 0);
+    parse_cache_release(peek);
+    stats = parse_cache_stats();
+    assert(stats.invalidations == before.invalidations + 2);
+    
+    // With no capacity every line is parsed from scratch
+    parse_cache_set_capacity(0);
+    ParsedCommand *uncached = parse_cache_acquire("echo cached");
+    assert(uncached != NULL);
+    parse_cache_release(uncached);
+    assert(parse_cache_stats().entries == 0);
+    
+    parse_cache_free();
+    printf("Parse cache test passed!\n");
+}
+
 void test_null_input() {
     printf("Testing NULL input handling...\n");
     
@@ -67,6 +405,13 @@ int main() {
     // Run the tests
     test_basic_parsing();
     test_redirection();
+    test_here_documents();
+    test_command_substitution();
+    test_pipeline();
+    test_command_list();
+    test_quoting();
+    test_many_arguments();
+    test_parse_cache();
     test_null_input();
     
     // Clean up
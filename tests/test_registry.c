@@ -0,0 +1,404 @@
+#include <nutshell/core.h>
+#include <nutshell/pkg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+void test_lookup_by_either_name() {
+    printf("Testing registry lookups...\n");
+    
+    // Default commands answer to both names
+    const CommandMapping *cmd = find_command("peekaboo");
+    assert(cmd != NULL && strcmp(cmd->unix_cmd, "ls") == 0);
+    assert(find_command("ls") == cmd);
+    assert(find_command("hop") == find_command("cd"));
+    assert(find_command("nutshell_no_such_command") == NULL);
+    
+    printf("Registry lookup test passed!\n");
+}
+
+void test_duplicates_and_shadowing() {
+    printf("Testing duplicate and shadowed registrations...\n");
+    
+    unsigned long generation = registry_generation();
+    assert(register_command("/pkgs/user/tool.sh", "tool", false) == REGISTER_ADDED);
+    assert(registry_generation() != generation);
+    
+    // Registering the same mapping again changes nothing
+    generation = registry_generation();
+    assert(register_command("/pkgs/user/tool.sh", "tool", false) == REGISTER_DUPLICATE);
+    assert(registry_generation() == generation);
+    
+    // The first registration keeps the name; the later one is still
+    // reachable under the name nobody else has
+    assert(register_command("/pkgs/system/tool.sh", "tool", false) == REGISTER_SHADOWED);
+    assert(strcmp(find_command("tool")->unix_cmd, "/pkgs/user/tool.sh") == 0);
+    assert(strcmp(find_command("/pkgs/system/tool.sh")->unix_cmd, "/pkgs/system/tool.sh") == 0);
+    
+    // Packages cannot take over a default command
+    assert(register_command("/pkgs/user/cd.sh", "cd", false) == REGISTER_SHADOWED);
+    assert(find_command("cd")->is_builtin);
+    
+    // A name matching an earlier command's other name still goes to the earlier one
+    assert(register_command("/pkgs/user/hop.sh", "hop-alt", false) == REGISTER_ADDED);
+    assert(register_command("cd", "cd-alias", false) == REGISTER_SHADOWED);
+    assert(strcmp(find_command("cd")->nut_cmd, "hop") == 0);
+    
+    printf("Duplicate and shadowed registration test passed!\n");
+}
+
+void test_many_commands() {
+    printf("Testing a large registry...\n");
+    
+    // Enough to grow the array and indexes many times
+    size_t count = 10000;
+    char unix_cmd[64], nut_cmd[64];
+    for (size_t i = 0; i < count; i++) {
+        snprintf(unix_cmd, sizeof(unix_cmd), "/pkgs/many/cmd%zu.sh", i);
+        snprintf(nut_cmd, sizeof(nut_cmd), "cmd%zu", i);
+        assert(register_command(unix_cmd, nut_cmd, false) == REGISTER_ADDED);
+    }
+    for (size_t i = 0; i < count; i++) {
+        snprintf(unix_cmd, sizeof(unix_cmd), "/pkgs/many/cmd%zu.sh", i);
+        snprintf(nut_cmd, sizeof(nut_cmd), "cmd%zu", i);
+        const CommandMapping *cmd = find_command(nut_cmd);
+        assert(cmd != NULL && strcmp(cmd->unix_cmd, unix_cmd) == 0);
+        assert(find_command(unix_cmd) == cmd);
+    }
+    // Defaults survive the rehashing
+    assert(find_command("peekaboo") != NULL);
+    assert(find_command("cmd10000") == NULL);
+    
+    printf("Large registry test passed!\n");
+}
+
+static void write_package(const char *root, const char *name) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", root, name);
+    assert(mkdir(path, 0755) == 0);
+    snprintf(path, sizeof(path), "%s/%s/%s.sh", root, name, name);
+    FILE *fp = fopen(path, "w");
+    assert(fp != NULL);
+    fprintf(fp, "#!/bin/sh\necho %s\n", name);
+    fclose(fp);
+}
+
+// Pretend a package directory or file last changed a while ago, at `seconds`
+static void age_root(const char *root, time_t seconds) {
+    struct timespec times[2] = { { seconds, 0 }, { seconds, 0 } };
+    assert(utimensat(AT_FDCWD, root, times, 0) == 0);
+}
+
+void test_package_index() {
+    printf("Testing the package index...\n");
+    
+    char home[] = "/tmp/nutshell_pkgindex_XXXXXX";
+    assert(mkdtemp(home) != NULL);
+    char *old_home = strdup(getenv("HOME"));
+    setenv("HOME", home, 1);
+    
+    char root[256], index[256], script[512], pkg_dir[512];
+    snprintf(root, sizeof(root), "%s/.nutshell", home);
+    assert(mkdir(root, 0755) == 0);
+    snprintf(root, sizeof(root), "%s/.nutshell/packages", home);
+    assert(mkdir(root, 0755) == 0);
+    snprintf(index, sizeof(index), "%s/.nutshell/package-index", home);
+    write_package(root, "alpha");
+    snprintf(pkg_dir, sizeof(pkg_dir), "%s/alpha", root);
+    age_root(pkg_dir, 1000000000);
+    // A package with no script yet
+    snprintf(pkg_dir, sizeof(pkg_dir), "%s/gamma", root);
+    assert(mkdir(pkg_dir, 0755) == 0);
+    age_root(pkg_dir, 1000000000);
+    age_root(root, 1000000000);
+    
+    // The first start scans and writes the index
+    free_registry();
+    init_registry();
+    assert(find_command("alpha") != NULL);
+    struct stat st;
+    assert(stat(index, &st) == 0);
+    
+    // While the directories are unchanged the commands come from the index
+    snprintf(script, sizeof(script), "%s/alpha/alpha.sh", root);
+    unlink(script);
+    snprintf(pkg_dir, sizeof(pkg_dir), "%s/alpha", root);
+    age_root(pkg_dir, 1000000000);
+    free_registry();
+    init_registry();
+    assert(find_command("alpha") != NULL);
+    
+    // A script added to an existing package changes only that package's
+    // directory, which is enough to scan the root again
+    snprintf(script, sizeof(script), "%s/gamma/gamma.sh", root);
+    FILE *fp = fopen(script, "w");
+    assert(fp != NULL);
+    fprintf(fp, "#!/bin/sh\necho gamma\n");
+    fclose(fp);
+    snprintf(pkg_dir, sizeof(pkg_dir), "%s/gamma", root);
+    age_root(pkg_dir, 1000000050);
+    free_registry();
+    init_registry();
+    assert(find_command("gamma") != NULL);
+    assert(find_command("alpha") == NULL);
+    
+    // A new package changes the directory and everything is scanned again
+    write_package(root, "beta");
+    age_root(root, 1000000100);
+    free_registry();
+    init_registry();
+    assert(find_command("beta") != NULL);
+    assert(find_command("alpha") == NULL);
+    
+    // A damaged index is ignored
+    assert(truncate(index, 20) == 0);
+    free_registry();
+    init_registry();
+    assert(find_command("beta") != NULL);
+    
+    snprintf(script, sizeof(script), "%s/beta/beta.sh", root);
+    unlink(script);
+    snprintf(script, sizeof(script), "%s/beta", root);
+    rmdir(script);
+    snprintf(script, sizeof(script), "%s/gamma/gamma.sh", root);
+    unlink(script);
+    snprintf(script, sizeof(script), "%s/gamma", root);
+    rmdir(script);
+    snprintf(script, sizeof(script), "%s/alpha", root);
+    rmdir(script);
+    unlink(index);
+    rmdir(root);
+    snprintf(root, sizeof(root), "%s/.nutshell", home);
+    rmdir(root);
+    rmdir(home);
+    setenv("HOME", old_home, 1);
+    free(old_home);
+    
+    printf("Package index test passed!\n");
+}
+
+void test_package_watch() {
+#ifdef __linux__
+    printf("Testing live package reload...\n");
+    
+    char home[] = "/tmp/nutshell_pkgwatch_XXXXXX";
+    assert(mkdtemp(home) != NULL);
+    char *old_home = strdup(getenv("HOME"));
+    setenv("HOME", home, 1);
+    
+    char root[256], script[512];
+    snprintf(root, sizeof(root), "%s/.nutshell", home);
+    assert(mkdir(root, 0755) == 0);
+    snprintf(root, sizeof(root), "%s/.nutshell/packages", home);
+    assert(mkdir(root, 0755) == 0);
+    write_package(root, "early");
+    // A package directory that has nothing in it yet
+    snprintf(script, sizeof(script), "%s/empty", root);
+    assert(mkdir(script, 0755) == 0);
+    
+    free_registry();
+    init_registry();
+    registry_watch_packages();
+    assert(find_command("early") != NULL);
+    
+    // Its script shows up while the shell runs
+    snprintf(script, sizeof(script), "%s/empty/empty.sh", root);
+    FILE *fp = fopen(script, "w");
+    assert(fp != NULL);
+    fclose(fp);
+    registry_poll_packages();
+    assert(find_command("empty") != NULL);
+    
+    // A package installed while the shell runs
+    write_package(root, "late");
+    assert(find_command("late") == NULL);
+    registry_poll_packages();
+    assert(find_command("late") != NULL);
+    
+    // Removing a package's script unregisters just that package, and
+    // putting it back registers it again
+    snprintf(script, sizeof(script), "%s/early/early.sh", root);
+    assert(unlink(script) == 0);
+    unsigned long generation = registry_generation();
+    registry_poll_packages();
+    assert(find_command("early") == NULL);
+    assert(find_command("late") != NULL);
+    assert(registry_generation() != generation);
+    fp = fopen(script, "w");
+    assert(fp != NULL);
+    fclose(fp);
+    registry_poll_packages();
+    assert(find_command("early") != NULL);
+    
+    // Nothing changed, nothing to do
+    generation = registry_generation();
+    registry_poll_packages();
+    assert(registry_generation() == generation);
+    
+    char command[600];
+    snprintf(command, sizeof(command), "rm -rf %s", home);
+    assert(system(command) == 0);
+    registry_poll_packages();
+    assert(find_command("late") == NULL);
+    setenv("HOME", old_home, 1);
+    free(old_home);
+    
+    printf("Live package reload test passed!\n");
+#endif
+}
+
+void test_package_watch_new_root() {
+#ifdef __linux__
+    printf("Testing live reload of a packages directory created later...\n");
+    
+    char home[] = "/tmp/nutshell_pkgroot_XXXXXX";
+    assert(mkdtemp(home) != NULL);
+    char *old_home = strdup(getenv("HOME"));
+    setenv("HOME", home, 1);
+    
+    // Neither ~/.nutshell nor the packages directory exist yet
+    free_registry();
+    init_registry();
+    registry_watch_packages();
+    assert(find_command("first") == NULL);
+    
+    char root[256];
+    snprintf(root, sizeof(root), "%s/.nutshell", home);
+    assert(mkdir(root, 0755) == 0);
+    registry_poll_packages();
+    snprintf(root, sizeof(root), "%s/.nutshell/packages", home);
+    assert(mkdir(root, 0755) == 0);
+    registry_poll_packages();
+    write_package(root, "first");
+    registry_poll_packages();
+    assert(find_command("first") != NULL);
+    
+    char command[600];
+    snprintf(command, sizeof(command), "rm -rf %s", home);
+    assert(system(command) == 0);
+    registry_poll_packages();
+    assert(find_command("first") == NULL);
+    setenv("HOME", old_home, 1);
+    free(old_home);
+    
+    printf("New packages directory test passed!\n");
+#endif
+}
+
+static void write_manifest(const char *dir, const char *commands) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/package.nut", dir);
+    FILE *fp = fopen(path, "w");
+    assert(fp != NULL);
+    fprintf(fp, "{\"name\": \"tools\", \"commands\": {%s}}\n", commands);
+    fclose(fp);
+}
+
+static bool has_args(const char *name, const char **expected) {
+    const CommandMapping *cmd = find_command(name);
+    if (!cmd || !cmd->args) return false;
+    size_t i = 0;
+    for (; expected[i]; i++) {
+        if (!cmd->args[i] || strcmp(cmd->args[i], expected[i]) != 0) return false;
+    }
+    return cmd->args[i] == NULL;
+}
+
+void test_manifest_commands() {
+    printf("Testing manifest commands...\n");
+    
+    char home[] = "/tmp/nutshell_manifest_XXXXXX";
+    assert(mkdtemp(home) != NULL);
+    char *old_home = strdup(getenv("HOME"));
+    setenv("HOME", home, 1);
+    
+    char root[256], dir[512], path[600];
+    snprintf(root, sizeof(root), "%s/.nutshell", home);
+    assert(mkdir(root, 0755) == 0);
+    snprintf(root, sizeof(root), "%s/.nutshell/packages", home);
+    assert(mkdir(root, 0755) == 0);
+    snprintf(dir, sizeof(dir), "%s/tools", root);
+    assert(mkdir(dir, 0755) == 0);
+    
+    // One package, several commands and no script; a template that needs a
+    // shell to run is refused
+    write_manifest(dir, "\"acorn\": \"git commit -m\", "
+                        "\"greet\": \"printf '[%s]' $1\", "
+                        "\"counted\": \"ls | wc -l\"");
+    assert(compile_package_commands(dir) == false);
+    snprintf(path, sizeof(path), "%s/.commands", dir);
+    struct stat st;
+    assert(stat(path, &st) == 0);
+    age_root(root, 1000000000);
+    
+    free_registry();
+    init_registry();
+    assert(has_args("acorn", (const char *[]){ "git", "commit", "-m", NULL }));
+    assert(has_args("greet", (const char *[]){ "printf", "[%s]", "$1", NULL }));
+    assert(find_command("counted") == NULL);
+    assert(find_command("tools") == NULL);
+    
+    // The templates survive the trip through the package index
+    free_registry();
+    init_registry();
+    assert(has_args("acorn", (const char *[]){ "git", "commit", "-m", NULL }));
+    assert(has_args("greet", (const char *[]){ "printf", "[%s]", "$1", NULL }));
+    
+    // Editing the manifest in place leaves every directory's mtime alone, but
+    // the index notices the manifest itself changed
+    age_root(path, 1000000000);
+    snprintf(path, sizeof(path), "%s/package.nut", dir);
+    age_root(path, 999999999);
+    age_root(dir, 1000000000);
+    free_registry();
+    init_registry();
+    write_manifest(dir, "\"acorn\": \"git commit -v\", \"greet\": \"printf '[%s]' $1\"");
+    age_root(path, 1000000100);
+    free_registry();
+    init_registry();
+    assert(has_args("acorn", (const char *[]){ "git", "commit", "-v", NULL }));
+    assert(has_args("greet", (const char *[]){ "printf", "[%s]", "$1", NULL }));
+    
+#ifdef __linux__
+    // Editing the manifest updates and removes commands in a running shell
+    registry_watch_packages();
+    write_manifest(dir, "\"acorn\": \"git commit -am\"");
+    unsigned long generation = registry_generation();
+    registry_poll_packages();
+    assert(has_args("acorn", (const char *[]){ "git", "commit", "-am", NULL }));
+    assert(find_command("greet") == NULL);
+    assert(registry_generation() != generation);
+#endif
+    
+    char command[600];
+    snprintf(command, sizeof(command), "rm -rf %s", home);
+    assert(system(command) == 0);
+    registry_poll_packages();
+    setenv("HOME", old_home, 1);
+    free(old_home);
+    
+    printf("Manifest commands test passed!\n");
+}
+
+int main() {
+    printf("Running registry tests...\n");
+    
+    init_registry();
+    
+    test_lookup_by_either_name();
+    test_duplicates_and_shadowing();
+    test_many_commands();
+    test_package_index();
+    test_package_watch();
+    test_package_watch_new_root();
+    test_manifest_commands();
+    
+    free_registry();
+    
+    printf("All registry tests passed!\n");
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include <nutshell/core.h>
+#include <nutshell/utils.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+
+void test_relay_captures_output() {
+    printf("Testing output relay capture...\n");
+    
+    assert(output_relay_start());
+    printf("relay line one\n");
+    fprintf(stderr, "relay line two\n");
+    char *tail = output_relay_stop();
+    
+    assert(tail != NULL);
+    assert(strstr(tail, "relay line one") != NULL);
+    assert(strstr(tail, "relay line two") != NULL);
+    free(tail);
+    
+    printf("Relay capture test passed!\n");
+}
+
+void test_relay_large_output() {
+    printf("Testing output relay with output larger than the pipe buffer...\n");
+    
+    // Keep the relayed copy off the test log
+    fflush(stdout);
+    int stdout_bak = dup(STDOUT_FILENO);
+    FILE *devnull = fopen("/dev/null", "w");
+    dup2(fileno(devnull), STDOUT_FILENO);
+    
+    // Well beyond both the old 4 KB limit and the kernel pipe buffer
+    assert(output_relay_start());
+    for (int i = 0; i < 20000; i++) {
+        printf("line %d\n", i);
+    }
+    char *tail = output_relay_stop();
+    
+    dup2(stdout_bak, STDOUT_FILENO);
+    close(stdout_bak);
+    fclose(devnull);
+    
+    assert(tail != NULL);
+    assert(strstr(tail, "line 19999\n") != NULL);
+    assert(strlen(tail) <= output_relay_get_tail_size());
+    free(tail);
+    
+    printf("Relay large output test passed!\n");
+}
+
+void test_relay_tail_size() {
+    printf("Testing output relay tail size...\n");
+    
+    output_relay_set_tail_size(16);
+    assert(output_relay_start());
+    printf("0123456789abcdefghijklmnopqrstuvwxyz");
+    char *tail = output_relay_stop();
+    
+    assert(tail != NULL);
+    assert(strcmp(tail, "klmnopqrstuvwxyz") == 0);
+    free(tail);
+    output_relay_set_tail_size(OUTPUT_TAIL_DEFAULT);
+    
+    printf("\nRelay tail size test passed!\n");
+}
+
+int main() {
+    printf("Running output relay tests...\n");
+    
+    test_relay_captures_output();
+    test_relay_large_output();
+    test_relay_tail_size();
+    
+    printf("All output relay tests passed!\n");
+    return 0;
+}
@@ -6,7 +6,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
 #include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 // Helper function to create a simple test theme
 Theme* create_test_theme() {
@@ -336,6 +343,498 @@ int test_segment_commands() {
     return 0;
 }
 
+static double elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Test that segment commands run together and slow ones are picked up later
+int test_async_segments() {
+    printf("Testing concurrent segment commands...\n");
+    
+    Theme *theme = create_test_theme();
+    free(theme->left_prompt->format);
+    theme->left_prompt->format = strdup("{directory} {git_info} {slow}");
+    
+    // Both git_info commands take a while; together they must not take twice as long
+    ThemeSegment *git_segment = theme->segments[1];
+    free(git_segment->commands[0]->command);
+    git_segment->commands[0]->command = strdup("sleep 0.3; echo test_branch");
+    free(git_segment->commands[1]->command);
+    git_segment->commands[1]->command = strdup("sleep 0.3; echo '*'");
+    git_segment->timeout_ms = 5000;
+    
+    // And one that misses its deadline
+    theme->segments = realloc(theme->segments, 4 * sizeof(ThemeSegment*));
+    ThemeSegment *slow = calloc(1, sizeof(ThemeSegment));
+    slow->enabled = true;
+    slow->key = strdup("slow");
+    slow->format = strdup("[{late}]");
+    slow->timeout_ms = 50;
+    slow->command_count = 1;
+    slow->commands = calloc(2, sizeof(ThemeCommand*));
+    slow->commands[0] = calloc(1, sizeof(ThemeCommand));
+    slow->commands[0]->name = strdup("late");
+    slow->commands[0]->command = strdup("sleep 0.6; echo late_value");
+    theme->segments[2] = slow;
+    theme->segments[3] = NULL;
+    theme->segment_count = 3;
+    
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    char *prompt = get_theme_prompt(theme);
+    double took = elapsed_ms(&start);
+    printf("DEBUG: Prompt took %.1f ms: '%s'\n", took, prompt);
+    assert(prompt != NULL);
+    assert(strstr(prompt, "test_dir") != NULL);
+    assert(strstr(prompt, "test_branch") != NULL);
+    assert(strstr(prompt, "*") != NULL);
+    assert(strstr(prompt, "late_value") == NULL);
+    assert(took < 550);
+    free(prompt);
+    
+    // The next prompt leaves it running instead of starting it over
+    pid_t late_pid = slow->commands[0]->pid;
+    assert(late_pid > 0);
+    prompt = get_theme_prompt(theme);
+    assert(slow->commands[0]->pid == late_pid);
+    assert(strstr(prompt, "late_value") == NULL);
+    free(prompt);
+    
+    // The slow command is still running and is collected once it is done
+    int fds[4];
+    assert(segment_commands_fds(fds, 4) == 1);
+    struct pollfd pfd = { .fd = fds[0], .events = POLLIN };
+    while (!segment_commands_collect()) {
+        assert(poll(&pfd, 1, 5000) == 1);
+    }
+    assert(segment_commands_fds(fds, 4) == 0);
+    assert(slow->commands[0]->output != NULL);
+    assert(strcmp(slow->commands[0]->output, "late_value") == 0);
+    prompt = render_theme_prompt(theme);
+    assert(strstr(prompt, "[late_value]") != NULL);
+    free(prompt);
+    
+    // Until it finishes again the prompt shows its last output
+    free(git_segment->commands[0]->command);
+    git_segment->commands[0]->command = strdup("echo test_branch");
+    free(git_segment->commands[1]->command);
+    git_segment->commands[1]->command = strdup("echo '*'");
+    prompt = get_theme_prompt(theme);
+    assert(strstr(prompt, "[late_value]") != NULL);
+    free(prompt);
+    
+    // Freeing the theme stops what is still running
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    free_theme(theme);
+    assert(elapsed_ms(&start) < 300);
+    assert(segment_commands_fds(fds, 4) == 0);
+    
+    // A command that is stopped gets the chance to clean up after itself
+    char stopped[] = "/tmp/nutshell_segment_stop_XXXXXX";
+    int stopped_fd = mkstemp(stopped);
+    assert(stopped_fd >= 0);
+    close(stopped_fd);
+    ThemeCommand *cleanup = calloc(1, sizeof(ThemeCommand));
+    cleanup->name = strdup("cleanup");
+    char script[256];
+    snprintf(script, sizeof(script),
+             "trap 'echo cleaned > %s; exit 0' TERM; while :; do sleep 0.05; done", stopped);
+    cleanup->command = strdup(script);
+    segment_command_start(cleanup, 50);
+    segment_commands_wait();
+    assert(cleanup->pid > 0);
+    segment_command_cancel(cleanup);
+    assert(cleanup->pid == 0);
+    FILE *fp = fopen(stopped, "r");
+    assert(fp != NULL);
+    char line[32] = "";
+    assert(fgets(line, sizeof(line), fp) != NULL);
+    assert(strcmp(line, "cleaned\n") == 0);
+    fclose(fp);
+    unlink(stopped);
+    free(cleanup->name);
+    free(cleanup->command);
+    free(cleanup);
+    
+    // One that closes its output and keeps going does not hold up the prompt,
+    // and is reaped once it exits
+    ThemeCommand *lingering = calloc(1, sizeof(ThemeCommand));
+    lingering->name = strdup("lingering");
+    lingering->command = strdup("trap '' TERM; echo early; exec >/dev/null; sleep 0.4");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    segment_command_start(lingering, 2000);
+    pid_t lingering_pid = lingering->pid;
+    segment_commands_wait();
+    assert(elapsed_ms(&start) < 150);
+    assert(lingering->pid == 0);
+    assert(strcmp(lingering->output, "early") == 0);
+    usleep(600 * 1000);
+    segment_commands_collect();
+    assert(waitpid(lingering_pid, NULL, WNOHANG) < 0 && errno == ECHILD);
+    free(lingering->name);
+    free(lingering->command);
+    free(lingering->output);
+    free(lingering);
+    
+    printf("Concurrent segment command test passed!\n");
+    return 0;
+}
+
+static int count_lines(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return 0;
+    int lines = 0;
+    for (int c; (c = fgetc(fp)) != EOF; ) {
+        if (c == '\n') lines++;
+    }
+    fclose(fp);
+    return lines;
+}
+
+static char **make_keys(const char *first, const char *second, const char *third) {
+    char **keys = calloc(3, sizeof(char *));
+    keys[0] = strdup(first);
+    keys[1] = strdup(second);
+    keys[2] = strdup(third);
+    return keys;
+}
+
+// Test that cached segment outputs are reused until a key or the TTL runs out
+int test_cached_segments() {
+    printf("Testing cached segment outputs...\n");
+    
+    char dir[] = "/tmp/nutshell_theme_XXXXXX";
+    assert(mkdtemp(dir) != NULL);
+    char runs[512], watched[512], sub[512], command[1100];
+    snprintf(runs, sizeof(runs), "%s/runs", dir);
+    snprintf(watched, sizeof(watched), "%s/watched", dir);
+    snprintf(sub, sizeof(sub), "%s/sub", dir);
+    assert(mkdir(sub, 0755) == 0);
+    int fd = open(watched, O_WRONLY | O_CREAT, 0644);
+    assert(fd >= 0);
+    close(fd);
+    char *old_cwd = getcwd(NULL, 0);
+    assert(chdir(sub) == 0);
+    setenv("NUT_TEST_SEGMENT_KEY", "one", 1);
+    
+    Theme *theme = create_test_theme();
+    ThemeCommand *branch = theme->segments[1]->commands[0];
+    free(branch->command);
+    snprintf(command, sizeof(command), "echo run >> %s; echo test_branch", runs);
+    branch->command = strdup(command);
+    // A relative file is found from the working directory up
+    branch->keys = make_keys("cwd", "env:NUT_TEST_SEGMENT_KEY", "file:watched");
+    branch->key_count = 3;
+    theme->segments[1]->timeout_ms = 5000;
+    
+    char *prompt = get_theme_prompt(theme);
+    assert(strstr(prompt, "test_branch") != NULL);
+    free(prompt);
+    assert(count_lines(runs) == 1);
+    
+    // Nothing changed: not run again, and the output is still there
+    prompt = get_theme_prompt(theme);
+    assert(strstr(prompt, "test_branch") != NULL);
+    free(prompt);
+    assert(count_lines(runs) == 1);
+    
+    // Each key invalidates it
+    setenv("NUT_TEST_SEGMENT_KEY", "two", 1);
+    free(get_theme_prompt(theme));
+    assert(count_lines(runs) == 2);
+    
+    struct timespec times[2] = { { .tv_sec = 1000000000 }, { .tv_sec = 1000000000 } };
+    assert(utimensat(AT_FDCWD, watched, times, 0) == 0);
+    free(get_theme_prompt(theme));
+    assert(count_lines(runs) == 3);
+    
+    assert(chdir(dir) == 0);
+    free(get_theme_prompt(theme));
+    assert(count_lines(runs) == 4);
+    free(get_theme_prompt(theme));
+    assert(count_lines(runs) == 4);
+    
+    // A TTL alone expires it
+    branch->ttl_ms = 100;
+    usleep(150000);
+    free(get_theme_prompt(theme));
+    assert(count_lines(runs) == 5);
+    free(get_theme_prompt(theme));
+    assert(count_lines(runs) == 5);
+    usleep(150000);
+    free(get_theme_prompt(theme));
+    assert(count_lines(runs) == 6);
+    
+    // Running a segment's commands by hand always runs them
+    execute_segment_commands(theme->segments[1]);
+    assert(count_lines(runs) == 7);
+    
+    free_theme(theme);
+    assert(chdir(old_cwd) == 0);
+    free(old_cwd);
+    unsetenv("NUT_TEST_SEGMENT_KEY");
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    assert(system(command) == 0);
+    
+    printf("Cached segment output test passed!\n");
+    return 0;
+}
+
+static void write_file(const char *path, const char *text) {
+    FILE *fp = fopen(path, "w");
+    assert(fp != NULL);
+    fputs(text, fp);
+    fclose(fp);
+}
+
+static bool provides(const char *name, const char *expected) {
+    SegmentProvider provider = find_segment_provider(name);
+    assert(provider != NULL);
+    char *output = provider();
+    bool same = expected ? output && strcmp(output, expected) == 0 : output == NULL;
+    if (!same) printf("DEBUG: %s gave '%s'\n", name, output ? output : "NULL");
+    free(output);
+    return same;
+}
+
+// Test the built-in segment providers and that a theme made of them runs nothing
+int test_segment_providers() {
+    printf("Testing segment providers...\n");
+    
+    char dir[] = "/tmp/nutshell_providers_XXXXXX";
+    assert(mkdtemp(dir) != NULL);
+    char path[512], command[600];
+    char *old_cwd = getcwd(NULL, 0);
+    char *old_home = strdup(getenv("HOME"));
+    assert(find_segment_provider("no_such_provider") == NULL);
+    
+    // The directory, with the home directory shortened
+    snprintf(path, sizeof(path), "%s/repo/src", dir);
+    snprintf(command, sizeof(command), "mkdir -p %s", path);
+    assert(system(command) == 0);
+    assert(chdir(path) == 0);
+    setenv("HOME", dir, 1);
+    assert(provides("directory", "~/repo/src"));
+    setenv("HOME", "/nonexistent", 1);
+    assert(provides("directory", path));
+    
+    // The branch, from HEAD found from a subdirectory
+    assert(provides("git_branch", NULL));
+    snprintf(path, sizeof(path), "%s/repo/.git", dir);
+    assert(mkdir(path, 0755) == 0);
+    snprintf(path, sizeof(path), "%s/repo/.git/HEAD", dir);
+    write_file(path, "ref: refs/heads/feature/x\n");
+    assert(provides("git_branch", "feature/x"));
+    write_file(path, "0123456789abcdef0123456789abcdef01234567\n");
+    assert(provides("git_branch", "0123456"));
+    
+    // A worktree's .git file names its git directory
+    snprintf(path, sizeof(path), "%s/worktree", dir);
+    assert(mkdir(path, 0755) == 0);
+    assert(chdir(path) == 0);
+    snprintf(path, sizeof(path), "%s/worktree/.git", dir);
+    write_file(path, "gitdir: ../repo/.git\n");
+    assert(provides("git_branch", "0123456"));
+    
+    // Dirty, from the stat data in a real index
+    snprintf(path, sizeof(path), "%s/clone", dir);
+    snprintf(command, sizeof(command), "cd %s && mkdir clone && cd clone && git init -q && "
+             "echo one > tracked && mkdir sub && echo two > sub/file && git add tracked sub/file", dir);
+    if (system(command) == 0) {
+        assert(chdir(path) == 0);
+        assert(provides("git_branch", NULL) == false);
+        assert(provides("git_dirty", NULL));
+        write_file("sub/file", "changed size\n");
+        assert(provides("git_dirty", "*"));
+        snprintf(command, sizeof(command), "cd %s && git add sub/file && rm tracked", path);
+        assert(system(command) == 0);
+        assert(provides("git_dirty", "*"));
+    } else {
+        printf("DEBUG: git not available, dirty provider not tested\n");
+    }
+    
+    // Environment and the last command
+    setenv("VIRTUAL_ENV", "/home/me/envs/project", 1);
+    assert(provides("venv", "project"));
+    unsetenv("VIRTUAL_ENV");
+    setenv("CONDA_DEFAULT_ENV", "base", 1);
+    assert(provides("venv", "base"));
+    unsetenv("CONDA_DEFAULT_ENV");
+    
+    CommandHistory saved = cmd_history;
+    cmd_history.last_command = "false";
+    cmd_history.exit_status = 0;
+    cmd_history.last_result.wall_ms = 42.5;
+    assert(provides("exit_status", NULL));
+    assert(provides("duration", "42ms"));
+    cmd_history.exit_status = 127;
+    cmd_history.last_result.wall_ms = 2500;
+    assert(provides("exit_status", "127"));
+    assert(provides("duration", "2.5s"));
+    cmd_history.last_result.wall_ms = 125000;
+    assert(provides("duration", "2m05s"));
+    cmd_history = saved;
+    
+    // A theme naming providers starts no process; an unknown provider is
+    // warned about and its command left out
+    setenv("HOME", dir, 1);
+    snprintf(path, sizeof(path), "%s/.nutshell/themes", dir);
+    snprintf(command, sizeof(command), "mkdir -p %s", path);
+    assert(system(command) == 0);
+    snprintf(path, sizeof(path), "%s/.nutshell/themes/providers.json", dir);
+    write_file(path, "{\"name\": \"providers\", \"colors\": {}, \"prompt\": {\"left\": "
+                     "{\"format\": \"{where} {git}\"}}, \"segments\": {"
+                     "\"where\": {\"format\": \"[{dir}]\", \"commands\": {\"dir\": {\"provider\": \"directory\"}}},"
+                     "\"git\": {\"format\": \"({branch}{dirty}{bad})\", \"commands\": {"
+                     "\"branch\": {\"provider\": \"git_branch\"}, \"dirty\": {\"provider\": \"git_dirty\"}, "
+                     "\"bad\": {\"provider\": \"no_such_provider\"}}}}}");
+    snprintf(path, sizeof(path), "%s/repo", dir);
+    assert(chdir(path) == 0);
+    Theme *theme = load_theme("providers");
+    assert(theme != NULL);
+    char *prompt = get_theme_prompt(theme);
+    int fds[4];
+    assert(segment_commands_fds(fds, 4) == 0);
+    printf("DEBUG: Provider prompt: '%s'\n", prompt);
+    assert(strstr(prompt, "[~/repo] (0123456") != NULL);
+    free(prompt);
+    free_theme(theme);
+    
+    assert(chdir(old_cwd) == 0);
+    setenv("HOME", old_home, 1);
+    free(old_cwd);
+    free(old_home);
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    assert(system(command) == 0);
+    
+    printf("Segment provider test passed!\n");
+    return 0;
+}
+
+// Test that formats are compiled once and rendered from the outputs as they are
+int test_compiled_format() {
+    printf("Testing compiled theme formats...\n");
+    
+    Theme *theme = create_test_theme();
+    free(theme->left_prompt->format);
+    theme->left_prompt->format = strdup("{primary}{icon} {directory}{reset} {git_info}{nope} {");
+    assert(compile_theme(theme));
+    
+    // Colors, the icon and segments are resolved; the rest stays text
+    const ThemeProgram *program = &theme->left_prompt->program;
+    assert(program->count == 8);
+    assert(program->ops[0].type == THEME_OP_COLOR);
+    assert(program->ops[1].type == THEME_OP_ICON);
+    assert(program->ops[3].type == THEME_OP_SEGMENT && program->ops[3].index == 0);
+    assert(program->ops[5].type == THEME_OP_TEXT);
+    assert(program->ops[6].type == THEME_OP_SEGMENT && program->ops[6].index == 1);
+    assert(program->ops[7].type == THEME_OP_TEXT && program->ops[7].length == strlen("{nope} {"));
+    assert(theme->appends_symbol);
+    assert(theme->segments[1]->program.count == 6);
+    
+    theme->segments[0]->commands[0]->output = strdup("test_dir");
+    theme->segments[1]->commands[0]->output = strdup("test_branch");
+    char *prompt = render_theme_prompt(theme);
+    printf("DEBUG: Compiled prompt: '%s'\n", prompt);
+    assert(strcmp(prompt, "\001\033[1;32m\002T test_dir\001\033[0m\002 "
+                          "\001\033[1;34m\002git:(test_branch)\001\033[0m\002{nope} {"
+                          "\001\033[1;32m\002$ \001\033[0m\002 ") == 0);
+    free(prompt);
+    
+    // A segment none of whose commands printed anything is left out
+    free(theme->segments[1]->commands[0]->output);
+    theme->segments[1]->commands[0]->output = NULL;
+    prompt = render_theme_prompt(theme);
+    assert(strstr(prompt, "git:") == NULL);
+    assert(strstr(prompt, "test_dir") != NULL);
+    free(prompt);
+    
+    // An ad-hoc format is compiled on its own
+    char *result = expand_theme_format(theme, "{{success}ok{reset}}");
+    assert(strcmp(result, "{\001\033[1;32m\002ok\001\033[0m\002}") == 0);
+    free(result);
+    
+    free_theme(theme);
+    
+    printf("Compiled format test passed!\n");
+    return 0;
+}
+
+// Test the git status helper: counts that follow the work tree, and queries
+// answered from memory while nothing changes
+int test_git_status_helper() {
+    printf("Testing the git status helper...\n");
+    
+    char dir[] = "/tmp/nutshell_gitstatus_XXXXXX";
+    assert(mkdtemp(dir) != NULL);
+    char command[600], git_dir[512];
+    char *old_cwd = getcwd(NULL, 0);
+    snprintf(command, sizeof(command), "cd %s && git init -q && git checkout -q -b main && "
+             "mkdir -p sub ignored/deep && echo ignored/ > .gitignore && touch sub/keep && "
+             "git add .gitignore sub/keep && git -c user.name=t -c user.email=t@t commit -q -m one && "
+             "git branch -q base && git branch -q -u base", dir);
+    if (system(command) != 0) {
+        printf("DEBUG: git not available, helper not tested\n");
+        free(old_cwd);
+        return 0;
+    }
+    assert(chdir(dir) == 0);
+    snprintf(git_dir, sizeof(git_dir), "%s/.git", dir);
+    setenv("NUT_GIT_STATUS_TIMEOUT", "5000", 1);
+    
+    GitStatus status;
+    assert(git_status_query(dir, git_dir, &status));
+    assert(strcmp(status.branch, "main") == 0);
+    assert(status.ahead == 0 && status.staged == 0 && status.unstaged == 0 && status.untracked == 0);
+    assert(provides("git_status", NULL));
+    
+    write_file("new.txt", "one\n");
+    assert(provides("git_untracked", "1"));
+    assert(provides("git_status", "?1"));
+    assert(system("git add new.txt") == 0);
+    assert(provides("git_untracked", NULL));
+    assert(provides("git_staged", "1"));
+    write_file("new.txt", "two\n");
+    assert(provides("git_status", "+1 !1"));
+    assert(system("git add new.txt && git -c user.name=t -c user.email=t@t commit -q -m two") == 0);
+    assert(provides("git_status", "↑1"));
+    
+    // Ignored directories are left out, the rest of the tree is watched,
+    // including directories made after the helper started
+    write_file("ignored/deep/skip.txt", "x\n");
+    write_file("sub/new.txt", "x\n");
+    assert(provides("git_status", "↑1 ?1"));
+    assert(mkdir("later", 0755) == 0 && mkdir("ignored/later", 0755) == 0);
+    write_file("later/new.txt", "x\n");
+    write_file("ignored/later/skip.txt", "x\n");
+    assert(provides("git_status", "↑1 ?2"));
+    assert(system("rm -r sub/new.txt later") == 0);
+    assert(provides("git_status", "↑1"));
+    
+    // Nothing changed, so nothing is run again
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < 100; i++) {
+        assert(git_status_query(dir, git_dir, &status));
+    }
+    double took = elapsed_ms(&start);
+    printf("DEBUG: 100 queries took %.1f ms\n", took);
+    assert(took < 100);
+    assert(status.ahead == 1 && status.staged == 0);
+    
+    git_status_stop();
+    unsetenv("NUT_GIT_STATUS_TIMEOUT");
+    assert(chdir(old_cwd) == 0);
+    free(old_cwd);
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    assert(system(command) == 0);
+    
+    printf("Git status helper test passed!\n");
+    return 0;
+}
+
 int main() {
     printf("Running theme tests...\n");
 
@@ -370,6 +869,26 @@ int main() {
         result = test_segment_commands();
     }
     
+    if (result == 0) {
+        result = test_async_segments();
+    }
+    
+    if (result == 0) {
+        result = test_cached_segments();
+    }
+    
+    if (result == 0) {
+        result = test_segment_providers();
+    }
+    
+    if (result == 0) {
+        result = test_compiled_format();
+    }
+    
+    if (result == 0) {
+        result = test_git_status_helper();
+    }
+    
     // Only continue if previous tests passed
     if (result == 0) {
         result = test_theme_command();